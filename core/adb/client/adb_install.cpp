@@ -27,6 +27,7 @@
 #include <android-base/file.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <ziparchive/zip_archive.h>
 
 #include "adb.h"
 #include "adb_client.h"
@@ -132,6 +133,163 @@ static void read_status_line(int fd, char* buf, size_t count) {
     *buf = '\0';
 }
 
+// Reads a little-endian integer out of |data|, or returns false if it would overrun.
+template <typename T>
+static bool read_le(const std::vector<char>& data, size_t offset, T* value) {
+    if (offset > data.size() || data.size() - offset < sizeof(T)) return false;
+    memcpy(value, &data[offset], sizeof(T));
+    return true;
+}
+
+// Looks up string |index| in the binary XML string pool at |pool|.
+static bool get_pool_string(const std::vector<char>& data, size_t pool, uint32_t index,
+                            std::string* result) {
+    uint16_t header_size;
+    uint32_t count, flags, strings_start, offset;
+    if (!read_le(data, pool + 2, &header_size) || !read_le(data, pool + 8, &count) ||
+        !read_le(data, pool + 16, &flags) || !read_le(data, pool + 20, &strings_start) ||
+        index >= count || !read_le(data, pool + header_size + 4 * index, &offset)) {
+        return false;
+    }
+    size_t p = pool + strings_start + offset;
+    result->clear();
+    if (flags & (1 << 8)) {
+        // UTF-8: the length in UTF-16 units, then in bytes, each one or two bytes long.
+        size_t len = 0;
+        for (int i = 0; i < 2; ++i) {
+            uint8_t high, low;
+            if (!read_le(data, p++, &high)) return false;
+            len = high;
+            if (high & 0x80) {
+                if (!read_le(data, p++, &low)) return false;
+                len = ((high & 0x7f) << 8) | low;
+            }
+        }
+        if (p + len > data.size()) return false;
+        result->assign(&data[p], len);
+    } else {
+        // UTF-16. Package names are ASCII, so don't bother with anything else.
+        uint16_t len, c;
+        if (!read_le(data, p, &len) || (len & 0x8000)) return false;
+        for (p += 2; len-- > 0; p += 2) {
+            if (!read_le(data, p, &c) || c >= 0x80) return false;
+            result->push_back(c);
+        }
+    }
+    return true;
+}
+
+// Finds the package name in an APK's AndroidManifest.xml, which is in Android's binary XML
+// format: a string pool, followed by a chunk per XML node, the first element being <manifest>.
+static std::string get_apk_package_name(const char* apk_path) {
+    ZipArchiveHandle zip;
+    if (OpenArchive(apk_path, &zip) != 0) {
+        CloseArchive(zip);
+        return "";
+    }
+    ZipEntry entry;
+    std::vector<char> data;
+    if (FindEntry(zip, ZipString("AndroidManifest.xml"), &entry) == 0) {
+        data.resize(entry.uncompressed_length);
+        if (ExtractToMemory(zip, &entry, reinterpret_cast<uint8_t*>(data.data()), data.size())) {
+            data.clear();
+        }
+    }
+    CloseArchive(zip);
+
+    static constexpr uint16_t kStringPoolType = 0x0001;
+    static constexpr uint16_t kStartElementType = 0x0102;
+    size_t pool = 0;
+    uint16_t type, header_size;
+    uint32_t size;
+    for (size_t chunk = 8; read_le(data, chunk, &type) && read_le(data, chunk + 2, &header_size) &&
+                           read_le(data, chunk + 4, &size) && size >= 8;
+         chunk += size) {
+        if (type == kStringPoolType) {
+            pool = chunk;
+            continue;
+        } else if (type != kStartElementType || pool == 0) {
+            continue;
+        }
+
+        // This is <manifest>. Find its package attribute.
+        size_t attributes = chunk + header_size;
+        uint16_t attribute_start, attribute_size, attribute_count;
+        if (!read_le(data, attributes + 8, &attribute_start) ||
+            !read_le(data, attributes + 10, &attribute_size) ||
+            !read_le(data, attributes + 12, &attribute_count)) {
+            break;
+        }
+        for (size_t i = 0; i < attribute_count; ++i) {
+            size_t attribute = attributes + attribute_start + i * attribute_size;
+            uint32_t name_index, value_index;
+            std::string name, value;
+            if (read_le(data, attribute + 4, &name_index) &&
+                read_le(data, attribute + 8, &value_index) &&
+                get_pool_string(data, pool, name_index, &name) && name == "package" &&
+                get_pool_string(data, pool, value_index, &value)) {
+                return value;
+            }
+        }
+        break;
+    }
+    return "";
+}
+
+// Installs an APK by sending only what differs from the version that's already installed, which
+// adbd uses to rebuild the new one. Returns false, having done nothing, if that isn't possible.
+static bool install_app_delta(int argc, const char** argv, int* result) {
+    const char* file = argv[argc - 1];
+    if (!android::base::EndsWithIgnoreCase(file, ".apk")) {
+        return false;
+    }
+
+    std::string package = get_apk_package_name(file);
+    if (package.empty()) {
+        fprintf(stderr, "adb: couldn't find the package name in %s\n", file);
+        return false;
+    }
+
+    std::string paths;
+    std::string error_output;
+    DefaultStandardStreamsCallback cb(&paths, &error_output);
+    if (send_shell_command("pm path " + escape_arg(package), false, &cb) != 0) {
+        return false;
+    }
+    // Split APKs list their other parts too, but base.apk is the one an APK can be a delta of.
+    std::string base;
+    for (const std::string& line : android::base::Split(paths, "\n")) {
+        std::string path = android::base::Trim(line);
+        if (android::base::StartsWith(path, "package:") &&
+            (base.empty() || android::base::EndsWith(path, "/base.apk"))) {
+            base = path.substr(strlen("package:"));
+        }
+    }
+    if (base.empty()) {
+        printf("%s isn't installed, performing a full install\n", package.c_str());
+        return false;
+    }
+
+    printf("Performing Delta Install\n");
+    std::string apk_dest = "/data/local/tmp/" + android::base::Basename(file);
+    if (!do_sync_delta_push(file, apk_dest.c_str(), base.c_str())) {
+        delete_device_file(apk_dest);
+        *result = 1;
+        return true;
+    }
+
+    // The new APK replaces the installed one.
+    std::vector<const char*> pm_argv(argv, argv + argc);
+    pm_argv.back() = apk_dest.c_str();
+    if (std::find_if(pm_argv.begin(), pm_argv.end(),
+                     [](const char* arg) { return !strcmp(arg, "-r"); }) == pm_argv.end()) {
+        pm_argv.insert(pm_argv.end() - 1, "-r");
+    }
+    *result = pm_command(pm_argv.size(), pm_argv.data());
+    delete_device_file(apk_dest);
+    return true;
+}
+
 #if defined(ENABLE_FASTDEPLOY)
 static int delete_device_patch_file(const char* apkPath) {
     std::string patchDevicePath = get_patch_path(apkPath);
@@ -368,6 +526,15 @@ int install_app(int argc, const char** argv) {
         error_exit("install requires an apk argument");
     }
 
+    if (use_fastdeploy && can_use_feature(kFeatureSendRecv2Delta)) {
+        // adbd can rebuild the APK itself, without the deployment agent.
+        int result;
+        if (install_app_delta(passthrough_argv.size(), passthrough_argv.data(), &result)) {
+            return result;
+        }
+        use_fastdeploy = false;
+    }
+
     if (use_fastdeploy == true) {
 #if defined(ENABLE_FASTDEPLOY)
         fastdeploy_set_local_agent(use_localagent);
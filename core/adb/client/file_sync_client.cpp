@@ -29,10 +29,12 @@
 #include <utime.h>
 
 #include <chrono>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "sysdeps.h"
@@ -41,6 +43,8 @@
 #include "adb_client.h"
 #include "adb_io.h"
 #include "adb_utils.h"
+#include "compression_utils.h"
+#include "delta_utils.h"
 #include "file_sync_protocol.h"
 #include "line_printer.h"
 #include "sysdeps/errno.h"
@@ -58,6 +62,16 @@ struct syncsendbuf {
     char data[SYNC_DATA_MAX];
 };
 
+// How many requests we let get ahead of the responses we've read. Each is at most a little over
+// 1KiB, so this stays well within what the socket between us and adbd can buffer; otherwise both
+// ends could end up blocked writing to one another.
+static constexpr size_t kMaxPendingRequests = 32;
+
+// How many files we'll have sent without reading adbd's acknowledgement of them.
+// An acknowledgement that carries an error can be a few hundred bytes, this keeps the
+// worst case below what adbd's side of the socket can hold.
+static constexpr size_t kMaxDeferredAcks = 128;
+
 static void ensure_trailing_separators(std::string& local_path, std::string& remote_path) {
     if (!adb_is_separator(local_path.back())) {
         local_path.push_back(OS_PATH_SEPARATOR);
@@ -202,7 +216,7 @@ struct TransferLedger {
 
 class SyncConnection {
   public:
-    SyncConnection() : expect_done_(false) {
+    SyncConnection() {
         max = SYNC_DATA_MAX; // TODO: decide at runtime.
 
         std::string error;
@@ -210,6 +224,15 @@ class SyncConnection {
             Error("failed to get feature set: %s", error.c_str());
         } else {
             have_stat_v2_ = CanUseFeature(features_, kFeatureStat2);
+            have_ls_v2_ = CanUseFeature(features_, kFeatureLs2);
+            have_sendrecv_v2_ = CanUseFeature(features_, kFeatureSendRecv2);
+            have_sendrecv_v2_delta_ =
+                    have_sendrecv_v2_ && CanUseFeature(features_, kFeatureSendRecv2Delta);
+            // $ADB_COMPRESSION=0 turns compression off, for data that's known not to compress.
+            const char* compression = getenv("ADB_COMPRESSION");
+            have_sendrecv_v2_brotli_ = have_sendrecv_v2_ &&
+                                       CanUseFeature(features_, kFeatureSendRecv2Brotli) &&
+                                       !(compression && strcmp(compression, "0") == 0);
             fd.reset(adb_connect("sync:", &error));
             if (fd < 0) {
                 Error("connect failed: %s", error.c_str());
@@ -237,15 +260,9 @@ class SyncConnection {
 
     bool IsValid() { return fd >= 0; }
 
-    bool ReceivedError(const char* from, const char* to) {
-        adb_pollfd pfd = {.fd = fd.get(), .events = POLLIN};
-        int rc = adb_poll(&pfd, 1, 0);
-        if (rc < 0) {
-            Error("failed to poll: %s", strerror(errno));
-            return true;
-        }
-        return rc != 0;
-    }
+    bool HaveStatV2() const { return have_stat_v2_; }
+    bool HaveLsV2() const { return have_ls_v2_; }
+    bool HaveDelta() const { return have_sendrecv_v2_delta_; }
 
     void NewTransfer() {
         current_ledger_.Reset();
@@ -317,6 +334,74 @@ class SyncConnection {
         }
     }
 
+    bool SendList(const char* path) {
+        return SendRequest(have_ls_v2_ ? ID_LIST_V2 : ID_LIST, path);
+    }
+
+    // Asks for a file, the data is read back by sync_finish_recv.
+    bool SendRecv(const char* rpath) {
+        if (!have_sendrecv_v2_) {
+            return SendRequest(ID_RECV, rpath);
+        }
+
+        size_t path_length = strlen(rpath);
+        if (path_length > 1024) {
+            Error("SendRecv failed: path too long: %zu", path_length);
+            errno = ENAMETOOLONG;
+            return false;
+        }
+
+        std::vector<char> buf;
+        AppendRequest(&buf, ID_RECV_V2, rpath, path_length);
+        syncmsg msg;
+        msg.recv_v2_setup.id = ID_RECV_V2;
+        msg.recv_v2_setup.flags = have_sendrecv_v2_brotli_ ? kSyncFlagBrotli : kSyncFlagNone;
+        Append(&buf, &msg.recv_v2_setup, sizeof(msg.recv_v2_setup));
+        return WriteFdExactly(fd, buf.data(), buf.size());
+    }
+
+    // Whether the data sent in response to SendRecv is compressed.
+    bool RecvCompressed() const { return have_sendrecv_v2_brotli_; }
+
+    // Asks adbd to chunk |rpath| for a delta transfer.
+    bool GetChunks(const char* rpath, std::vector<DeltaChunk>* chunks) {
+        if (!ReadAcknowledgements(true) || !SendRequest(ID_CHUNKS, rpath)) {
+            return false;
+        }
+
+        std::vector<char> buffer(SYNC_DATA_MAX);
+        while (true) {
+            syncmsg msg;
+            if (!ReadFdExactly(fd, &msg.data, sizeof(msg.data))) {
+                Error("failed to read chunks of '%s': %s", rpath, strerror(errno));
+                return false;
+            }
+            if (msg.data.id == ID_DONE) {
+                return true;
+            } else if (msg.data.id == ID_FAIL) {
+                buffer.resize(msg.data.size + 1);
+                if (!ReadFdExactly(fd, buffer.data(), msg.data.size)) {
+                    Error("failed to read chunks of '%s'", rpath);
+                    return false;
+                }
+                buffer[msg.data.size] = '\0';
+                Error("failed to read chunks of '%s': remote %s", rpath, buffer.data());
+                return false;
+            } else if (msg.data.id != ID_DATA || msg.data.size > SYNC_DATA_MAX ||
+                       msg.data.size % sizeof(DeltaChunk) != 0) {
+                Error("failed to read chunks of '%s': protocol fault", rpath);
+                return false;
+            }
+
+            if (!ReadFdExactly(fd, buffer.data(), msg.data.size)) {
+                Error("failed to read chunks of '%s': %s", rpath, strerror(errno));
+                return false;
+            }
+            const DeltaChunk* begin = reinterpret_cast<const DeltaChunk*>(buffer.data());
+            chunks->insert(chunks->end(), begin, begin + msg.data.size / sizeof(DeltaChunk));
+        }
+    }
+
     bool FinishStat(struct stat* st) {
         syncmsg msg;
 
@@ -374,55 +459,50 @@ class SyncConnection {
 
     // Sending header, payload, and footer in a single write makes a huge
     // difference to "adb sync" performance.
-    bool SendSmallFile(const char* path_and_mode,
-                       const char* lpath, const char* rpath,
-                       unsigned mtime,
+    bool SendSmallFile(const char* rpath, mode_t mode, const char* lpath, unsigned mtime,
                        const char* data, size_t data_length) {
-        size_t path_length = strlen(path_and_mode);
-        if (path_length > 1024) {
-            Error("SendSmallFile failed: path too long: %zu", path_length);
-            errno = ENAMETOOLONG;
+        // Symlink targets are tiny, and adbd handles them separately. Don't compress them.
+        bool compress = !S_ISLNK(mode) && have_sendrecv_v2_brotli_;
+
+        std::vector<char> buf;
+        if (!AppendSendRequest(&buf, rpath, mode, compress)) {
             return false;
         }
 
-        std::vector<char> buf(sizeof(SyncRequest) + path_length +
-                              sizeof(SyncRequest) + data_length +
-                              sizeof(SyncRequest));
-        char* p = &buf[0];
-
-        SyncRequest* req_send = reinterpret_cast<SyncRequest*>(p);
-        req_send->id = ID_SEND;
-        req_send->path_length = path_length;
-        p += sizeof(SyncRequest);
-        memcpy(p, path_and_mode, path_length);
-        p += path_length;
-
-        SyncRequest* req_data = reinterpret_cast<SyncRequest*>(p);
-        req_data->id = ID_DATA;
-        req_data->path_length = data_length;
-        p += sizeof(SyncRequest);
-        memcpy(p, data, data_length);
-        p += data_length;
+        syncmsg msg;
+        msg.data.id = ID_DATA;
+        auto append_data = [&buf, &msg](const char* data, size_t size) {
+            msg.data.size = size;
+            Append(&buf, &msg.data, sizeof(msg.data));
+            Append(&buf, data, size);
+            return true;
+        };
+        if (compress) {
+            BrotliEncoder encoder(max);
+            if (!encoder.Encode(data, data_length, true, append_data)) {
+                Error("compressing '%s' failed", lpath);
+                return false;
+            }
+        } else {
+            append_data(data, data_length);
+        }
 
-        SyncRequest* req_done = reinterpret_cast<SyncRequest*>(p);
-        req_done->id = ID_DONE;
-        req_done->path_length = mtime;
-        p += sizeof(SyncRequest);
+        msg.data.id = ID_DONE;
+        msg.data.size = mtime;
+        Append(&buf, &msg.data, sizeof(msg.data));
 
-        WriteOrDie(lpath, rpath, &buf[0], (p - &buf[0]));
-        expect_done_ = true;
+        DeferAcknowledgement(lpath, rpath);
+        WriteOrDie(lpath, rpath, buf.data(), buf.size());
 
-        // RecordFilesTransferred gets called in CopyDone.
+        // RecordFilesTransferred gets called when the acknowledgement is read.
         RecordBytesTransferred(data_length);
         ReportProgress(rpath, data_length, data_length);
         return true;
     }
 
-    bool SendLargeFile(const char* path_and_mode,
-                       const char* lpath, const char* rpath,
-                       unsigned mtime) {
-        if (!SendRequest(ID_SEND, path_and_mode)) {
-            Error("failed to send ID_SEND message '%s': %s", path_and_mode, strerror(errno));
+    bool SendLargeFile(const char* rpath, mode_t mode, const char* lpath, unsigned mtime) {
+        std::vector<char> request;
+        if (!AppendSendRequest(&request, rpath, mode, have_sendrecv_v2_brotli_)) {
             return false;
         }
 
@@ -441,61 +521,195 @@ class SyncConnection {
             return false;
         }
 
+        // From here on adbd will reply, whether or not we get to the end of the file.
+        DeferAcknowledgement(lpath, rpath);
+        WriteOrDie(lpath, rpath, request.data(), request.size());
+
         syncsendbuf sbuf;
         sbuf.id = ID_DATA;
+        auto send_data = [this, &sbuf, lpath, rpath](const char* data, size_t size) {
+            if (data != sbuf.data) memcpy(sbuf.data, data, size);
+            sbuf.size = size;
+            return WriteOrDie(lpath, rpath, &sbuf, sizeof(SyncRequest) + size);
+        };
+        std::unique_ptr<BrotliEncoder> encoder;
+        if (have_sendrecv_v2_brotli_) {
+            encoder = std::make_unique<BrotliEncoder>(max - sizeof(SyncRequest));
+        }
+
+        std::vector<char> input;
+        if (encoder) input.resize(max);
         while (true) {
-            int bytes_read = adb_read(lfd, sbuf.data, max - sizeof(SyncRequest));
+            char* read_buf = encoder ? input.data() : sbuf.data;
+            int bytes_read = adb_read(lfd, read_buf, max - sizeof(SyncRequest));
             if (bytes_read == -1) {
                 Error("reading '%s' locally failed: %s", lpath, strerror(errno));
+                AbortSend(lpath, rpath);
                 return false;
             } else if (bytes_read == 0) {
                 break;
             }
 
-            sbuf.size = bytes_read;
-            WriteOrDie(lpath, rpath, &sbuf, sizeof(SyncRequest) + bytes_read);
+            if (encoder) {
+                if (!encoder->Encode(read_buf, bytes_read, false, send_data)) {
+                    Error("compressing '%s' failed", lpath);
+                    AbortSend(lpath, rpath);
+                    return false;
+                }
+            } else {
+                send_data(read_buf, bytes_read);
+            }
 
             RecordBytesTransferred(bytes_read);
             bytes_copied += bytes_read;
 
-            // Check to see if we've received an error from the other side.
-            if (ReceivedError(lpath, rpath)) {
-                break;
+            // Pick up acknowledgements of earlier files, and notice if adbd gave up on this one.
+            if (!ReadAcknowledgements()) {
+                return false;
             }
 
             ReportProgress(rpath, bytes_copied, total_size);
         }
+        if (encoder && !encoder->Encode(nullptr, 0, true, send_data)) {
+            Error("compressing '%s' failed", lpath);
+            AbortSend(lpath, rpath);
+            return false;
+        }
 
         syncmsg msg;
         msg.data.id = ID_DONE;
         msg.data.size = mtime;
-        expect_done_ = true;
 
-        // RecordFilesTransferred gets called in CopyDone.
+        // RecordFilesTransferred gets called when the acknowledgement is read.
         return WriteOrDie(lpath, rpath, &msg.data, sizeof(msg.data));
     }
 
-    bool CopyDone(const char* from, const char* to) {
-        syncmsg msg;
-        if (!ReadFdExactly(fd, &msg.status, sizeof(msg.status))) {
-            Error("failed to copy '%s' to '%s': couldn't read from device", from, to);
+    // Sends |lpath| as the delta |ops| against |base_rpath|, which adbd already has.
+    bool SendDeltaFile(const char* rpath, mode_t mode, const char* lpath, unsigned mtime,
+                       const char* base_rpath, const std::vector<DeltaOp>& ops) {
+        std::vector<char> request;
+        if (!AppendSendRequest(&request, rpath, mode, have_sendrecv_v2_brotli_, base_rpath)) {
             return false;
         }
-        if (msg.status.id == ID_OKAY) {
-            if (expect_done_) {
-                expect_done_ = false;
-                RecordFilesTransferred(1);
-                return true;
-            } else {
-                Error("failed to copy '%s' to '%s': received premature success", from, to);
-                return true;
+
+        uint64_t total_size = 0;
+        for (const DeltaOp& op : ops) {
+            total_size += op.size;
+        }
+        uint64_t bytes_copied = 0;
+
+        unique_fd lfd(adb_open(lpath, O_RDONLY));
+        if (lfd < 0) {
+            Error("opening '%s' locally failed: %s", lpath, strerror(errno));
+            return false;
+        }
+
+        DeferAcknowledgement(lpath, rpath);
+        WriteOrDie(lpath, rpath, request.data(), request.size());
+
+        syncsendbuf sbuf;
+        sbuf.id = ID_DATA;
+        auto send_data = [this, &sbuf, lpath, rpath](const char* data, size_t size) {
+            memcpy(sbuf.data, data, size);
+            sbuf.size = size;
+            return WriteOrDie(lpath, rpath, &sbuf, sizeof(SyncRequest) + size);
+        };
+        std::unique_ptr<BrotliEncoder> encoder;
+        if (have_sendrecv_v2_brotli_) {
+            encoder = std::make_unique<BrotliEncoder>(max - sizeof(SyncRequest));
+        }
+
+        // The ops and the data they carry are gathered into messages of up to |capacity| bytes.
+        const size_t capacity = max - sizeof(SyncRequest);
+        std::vector<char> pending;
+        pending.reserve(capacity);
+        auto flush = [&]() {
+            bool result = true;
+            if (encoder) {
+                result = encoder->Encode(pending.data(), pending.size(), false, send_data);
+            } else if (!pending.empty()) {
+                result = send_data(pending.data(), pending.size());
+            }
+            pending.clear();
+            return result;
+        };
+
+        for (const DeltaOp& op : ops) {
+            if (capacity - pending.size() < sizeof(op) && !flush()) {
+                Error("compressing '%s' failed", lpath);
+                AbortSend(lpath, rpath);
+                return false;
+            }
+            Append(&pending, &op, sizeof(op));
+            if (op.type == kDeltaOpCopy) {
+                bytes_copied += op.size;
+                continue;
+            }
+
+            if (adb_lseek(lfd, op.offset, SEEK_SET) != static_cast<int64_t>(op.offset)) {
+                Error("seeking in '%s' locally failed: %s", lpath, strerror(errno));
+                AbortSend(lpath, rpath);
+                return false;
+            }
+            uint64_t bytes_left = op.size;
+            while (bytes_left > 0) {
+                if (pending.size() == capacity && !flush()) {
+                    Error("compressing '%s' failed", lpath);
+                    AbortSend(lpath, rpath);
+                    return false;
+                }
+                size_t len = std::min<uint64_t>(bytes_left, capacity - pending.size());
+                size_t offset = pending.size();
+                pending.resize(offset + len);
+                if (!ReadFdExactly(lfd, &pending[offset], len)) {
+                    Error("reading '%s' locally failed: %s", lpath, strerror(errno));
+                    AbortSend(lpath, rpath);
+                    return false;
+                }
+
+                bytes_left -= len;
+                bytes_copied += len;
+                RecordBytesTransferred(len);
+                if (!ReadAcknowledgements()) {
+                    return false;
+                }
+                ReportProgress(rpath, bytes_copied, total_size);
             }
         }
-        if (msg.status.id != ID_FAIL) {
-            Error("failed to copy '%s' to '%s': unknown reason %d", from, to, msg.status.id);
+        if (!flush() || (encoder && !encoder->Encode(nullptr, 0, true, send_data))) {
+            Error("sending delta of '%s' failed", lpath);
+            AbortSend(lpath, rpath);
             return false;
         }
-        return ReportCopyFailure(from, to, msg);
+
+        syncmsg msg;
+        msg.data.id = ID_DONE;
+        msg.data.size = mtime;
+        return WriteOrDie(lpath, rpath, &msg.data, sizeof(msg.data));
+    }
+
+    // Reads the acknowledgements of files we've finished sending. Only those that have already
+    // arrived are read, unless |read_all| is set or too many are outstanding, in which case this
+    // blocks. Anything else that expects a reply from adbd must read all of them first.
+    bool ReadAcknowledgements(bool read_all = false) {
+        adb_pollfd pfd = {.fd = fd.get(), .events = POLLIN};
+        while (!deferred_acknowledgements_.empty()) {
+            bool should_block = read_all || deferred_acknowledgements_.size() >= kMaxDeferredAcks;
+            int rc = adb_poll(&pfd, 1, should_block ? -1 : 0);
+            if (rc == 0) {
+                return true;
+            } else if (rc < 0) {
+                Error("failed to poll: %s", strerror(errno));
+                return false;
+            }
+
+            auto [from, to] = std::move(deferred_acknowledgements_.front());
+            deferred_acknowledgements_.pop_front();
+            if (!CopyDone(from.c_str(), to.c_str())) {
+                return false;
+            }
+        }
+        return true;
     }
 
     bool ReportCopyFailure(const char* from, const char* to, const syncmsg& msg) {
@@ -575,9 +789,13 @@ class SyncConnection {
     size_t max;
 
   private:
-    bool expect_done_;
+    std::deque<std::pair<std::string, std::string>> deferred_acknowledgements_;
     FeatureSet features_;
     bool have_stat_v2_;
+    bool have_ls_v2_;
+    bool have_sendrecv_v2_;
+    bool have_sendrecv_v2_brotli_;
+    bool have_sendrecv_v2_delta_;
 
     TransferLedger global_ledger_;
     TransferLedger current_ledger_;
@@ -587,9 +805,116 @@ class SyncConnection {
         return SendRequest(ID_QUIT, ""); // TODO: add a SendResponse?
     }
 
+    static void Append(std::vector<char>* buf, const void* data, size_t length) {
+        const char* p = static_cast<const char*>(data);
+        buf->insert(buf->end(), p, p + length);
+    }
+
+    static void AppendRequest(std::vector<char>* buf, uint32_t id, const char* path,
+                              size_t path_length) {
+        SyncRequest req;
+        req.id = id;
+        req.path_length = path_length;
+        Append(buf, &req, sizeof(req));
+        Append(buf, path, path_length);
+    }
+
+    // Appends an ID_SEND_V2, or an ID_SEND if adbd doesn't support that. A |delta_base| is only
+    // allowed if HaveDelta().
+    bool AppendSendRequest(std::vector<char>* buf, const char* rpath, mode_t mode, bool compress,
+                           const char* delta_base = nullptr) {
+        std::string path_and_mode;
+        const char* path = rpath;
+        if (!have_sendrecv_v2_) {
+            path_and_mode = android::base::StringPrintf("%s,%d", rpath, mode);
+            path = path_and_mode.c_str();
+        }
+
+        size_t path_length = strlen(path);
+        if (path_length > 1024) {
+            Error("failed to send '%s': path too long: %zu", rpath, path_length);
+            errno = ENAMETOOLONG;
+            return false;
+        }
+
+        if (!have_sendrecv_v2_) {
+            AppendRequest(buf, ID_SEND, path, path_length);
+            return true;
+        }
+
+        AppendRequest(buf, ID_SEND_V2, path, path_length);
+        syncmsg msg;
+        msg.send_v2_setup.id = ID_SEND_V2;
+        msg.send_v2_setup.mode = mode;
+        msg.send_v2_setup.flags = compress ? kSyncFlagBrotli : kSyncFlagNone;
+        if (delta_base) {
+            msg.send_v2_setup.flags |= kSyncFlagDelta;
+        }
+        Append(buf, &msg.send_v2_setup, sizeof(msg.send_v2_setup));
+        if (delta_base) {
+            size_t base_length = strlen(delta_base);
+            if (base_length > 1024) {
+                Error("failed to send '%s': path too long: %zu", delta_base, base_length);
+                errno = ENAMETOOLONG;
+                return false;
+            }
+            AppendRequest(buf, ID_BASE, delta_base, base_length);
+        }
+        return true;
+    }
+
+    void DeferAcknowledgement(const char* from, const char* to) {
+        deferred_acknowledgements_.emplace_back(from, to);
+    }
+
+    // Gives up on the file being sent after a local error, once adbd has its send request and
+    // is waiting for the rest of the file (as we would be for its reply). Anything other than
+    // ID_DATA or ID_DONE makes adbd delete the partial file and reply with ID_FAIL. That reply
+    // is read behind the acknowledgements of the files before it, and dropped, since the local
+    // error has already been reported.
+    void AbortSend(const char* from, const char* to) {
+        deferred_acknowledgements_.pop_back();
+        syncmsg msg;
+        msg.data.id = ID_QUIT;
+        msg.data.size = 0;
+        WriteOrDie(from, to, &msg.data, sizeof(msg.data));
+        if (!ReadAcknowledgements(true)) {
+            return;
+        }
+        if (ReadFdExactly(fd, &msg.status, sizeof(msg.status)) && msg.status.id == ID_FAIL) {
+            std::vector<char> reason(msg.status.msglen);
+            ReadFdExactly(fd, reason.data(), reason.size());
+        }
+    }
+
+    // Reads adbd's response to a single file.
+    bool CopyDone(const char* from, const char* to) {
+        syncmsg msg;
+        if (!ReadFdExactly(fd, &msg.status, sizeof(msg.status))) {
+            Error("failed to copy '%s' to '%s': couldn't read from device", from, to);
+            return false;
+        }
+        if (msg.status.id == ID_OKAY) {
+            RecordFilesTransferred(1);
+            return true;
+        }
+        if (msg.status.id != ID_FAIL) {
+            Error("failed to copy '%s' to '%s': unknown reason %d", from, to, msg.status.id);
+            return false;
+        }
+        return ReportCopyFailure(from, to, msg);
+    }
+
     bool WriteOrDie(const char* from, const char* to, const void* data, size_t data_length) {
         if (!WriteFdExactly(fd, data, data_length)) {
-            if (errno == ECONNRESET) {
+            if (!deferred_acknowledgements_.empty()) {
+                // adbd's reason for closing the connection is in its reply to one of the
+                // files we've sent, behind the acknowledgements of those before it.
+                int saved_errno = errno;
+                if (!ReadAcknowledgements(true)) _exit(1);
+                errno = saved_errno;
+                Error("%zu-byte write failed: %s", data_length, strerror(errno));
+            } else if (errno == ECONNRESET) {
                 // Assume adbd told us why it was closing the connection, and
                 // try to read failure reason from adbd.
                 syncmsg msg;
@@ -609,30 +934,45 @@ class SyncConnection {
     }
 };
 
-typedef void (sync_ls_cb)(unsigned mode, unsigned size, unsigned time, const char* name);
-
-static bool sync_ls(SyncConnection& sc, const char* path,
-                    const std::function<sync_ls_cb>& func) {
-    if (!sc.SendRequest(ID_LIST, path)) return false;
+typedef void (sync_ls_cb)(unsigned mode, uint64_t size, int64_t time, const char* name);
 
+// Reads the reply to SendList.
+static bool sync_finish_ls(SyncConnection& sc, const std::function<sync_ls_cb>& func) {
     while (true) {
         syncmsg msg;
-        if (!ReadFdExactly(sc.fd, &msg.dent, sizeof(msg.dent))) return false;
-
-        if (msg.dent.id == ID_DONE) return true;
-        if (msg.dent.id != ID_DENT) return false;
+        size_t len;
+        if (sc.HaveLsV2()) {
+            if (!ReadFdExactly(sc.fd, &msg.dent_v2, sizeof(msg.dent_v2))) return false;
+            if (msg.dent_v2.id == ID_DONE) return true;
+            if (msg.dent_v2.id != ID_DENT_V2) return false;
+            len = msg.dent_v2.namelen;
+        } else {
+            if (!ReadFdExactly(sc.fd, &msg.dent, sizeof(msg.dent))) return false;
+            if (msg.dent.id == ID_DONE) return true;
+            if (msg.dent.id != ID_DENT) return false;
+            len = msg.dent.namelen;
+        }
 
-        size_t len = msg.dent.namelen;
         if (len > 256) return false; // TODO: resize buffer? continue?
 
         char buf[257];
         if (!ReadFdExactly(sc.fd, buf, len)) return false;
         buf[len] = 0;
 
-        func(msg.dent.mode, msg.dent.size, msg.dent.time, buf);
+        if (!sc.HaveLsV2()) {
+            func(msg.dent.mode, msg.dent.size, msg.dent.time, buf);
+        } else if (msg.dent_v2.error == 0) {
+            func(msg.dent_v2.mode, msg.dent_v2.size, msg.dent_v2.mtime, buf);
+        }
+        // Like ID_LIST, leave out anything that adbd couldn't lstat.
     }
 }
 
+static bool sync_ls(SyncConnection& sc, const char* path,
+                    const std::function<sync_ls_cb>& func) {
+    return sc.SendList(path) && sync_finish_ls(sc, func);
+}
+
 static bool sync_stat(SyncConnection& sc, const char* path, struct stat* st) {
     return sc.SendStat(path) && sc.FinishStat(st);
 }
@@ -674,11 +1014,13 @@ static bool sync_stat_fallback(SyncConnection& sc, const char* path, struct stat
     return true;
 }
 
+// Sends a file without waiting for adbd to acknowledge it, see ReadAcknowledgements.
 static bool sync_send(SyncConnection& sc, const char* lpath, const char* rpath, unsigned mtime,
                       mode_t mode, bool sync) {
-    std::string path_and_mode = android::base::StringPrintf("%s,%d", rpath, mode);
-
     if (sync) {
+        if (!sc.ReadAcknowledgements(true)) {
+            return false;
+        }
         struct stat st;
         if (sync_lstat(sc, rpath, &st)) {
             if (st.st_mtime == static_cast<time_t>(mtime)) {
@@ -698,10 +1040,10 @@ static bool sync_send(SyncConnection& sc, const char* lpath, const char* rpath,
         }
         buf[data_length++] = '\0';
 
-        if (!sc.SendSmallFile(path_and_mode.c_str(), lpath, rpath, mtime, buf, data_length)) {
+        if (!sc.SendSmallFile(rpath, mode, lpath, mtime, buf, data_length)) {
             return false;
         }
-        return sc.CopyDone(lpath, rpath);
+        return sc.ReadAcknowledgements();
 #endif
     }
 
@@ -716,22 +1058,20 @@ static bool sync_send(SyncConnection& sc, const char* lpath, const char* rpath,
             sc.Error("failed to read all of '%s': %s", lpath, strerror(errno));
             return false;
         }
-        if (!sc.SendSmallFile(path_and_mode.c_str(), lpath, rpath, mtime,
-                              data.data(), data.size())) {
+        if (!sc.SendSmallFile(rpath, mode, lpath, mtime, data.data(), data.size())) {
             return false;
         }
     } else {
-        if (!sc.SendLargeFile(path_and_mode.c_str(), lpath, rpath, mtime)) {
+        if (!sc.SendLargeFile(rpath, mode, lpath, mtime)) {
             return false;
         }
     }
-    return sc.CopyDone(lpath, rpath);
+    return sc.ReadAcknowledgements();
 }
 
-static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
-                      const char* name, uint64_t expected_size) {
-    if (!sc.SendRequest(ID_RECV, rpath)) return false;
-
+// Reads the reply to SendRecv into |lpath|.
+static bool sync_finish_recv(SyncConnection& sc, const char* rpath, const char* lpath,
+                             const char* name, uint64_t expected_size) {
     adb_unlink(lpath);
     unique_fd lfd(adb_creat(lpath, 0644));
     if (lfd < 0) {
@@ -739,6 +1079,18 @@ static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
         return false;
     }
 
+    std::unique_ptr<BrotliDecoder> decoder;
+    if (sc.RecvCompressed()) {
+        decoder = std::make_unique<BrotliDecoder>(SYNC_DATA_MAX);
+    }
+    auto write_data = [&sc, &lfd, lpath](const char* data, size_t size) {
+        if (!WriteFdExactly(lfd, data, size)) {
+            sc.Error("cannot write '%s': %s", lpath, strerror(errno));
+            return false;
+        }
+        return true;
+    };
+
     uint64_t bytes_copied = 0;
     while (true) {
         syncmsg msg;
@@ -747,7 +1099,14 @@ static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
             return false;
         }
 
-        if (msg.data.id == ID_DONE) break;
+        if (msg.data.id == ID_DONE) {
+            if (decoder && !decoder->Finished()) {
+                sc.Error("failed to copy '%s' to '%s': truncated compressed data", rpath, lpath);
+                adb_unlink(lpath);
+                return false;
+            }
+            break;
+        }
 
         if (msg.data.id != ID_DATA) {
             adb_unlink(lpath);
@@ -767,15 +1126,35 @@ static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
             return false;
         }
 
-        if (!WriteFdExactly(lfd, buffer, msg.data.size)) {
-            sc.Error("cannot write '%s': %s", lpath, strerror(errno));
-            adb_unlink(lpath);
-            return false;
+        // Progress is measured in bytes of the file, compressed or not.
+        size_t bytes_written = 0;
+        if (decoder) {
+            bool write_failed = false;
+            bool decoded = decoder->Decode(buffer, msg.data.size,
+                                           [&](const char* data, size_t size) {
+                                               bytes_written += size;
+                                               write_failed = !write_data(data, size);
+                                               return !write_failed;
+                                           });
+            if (!decoded) {
+                if (!write_failed) {
+                    sc.Error("failed to copy '%s' to '%s': corrupt compressed data", rpath,
+                             lpath);
+                }
+                adb_unlink(lpath);
+                return false;
+            }
+        } else {
+            if (!write_data(buffer, msg.data.size)) {
+                adb_unlink(lpath);
+                return false;
+            }
+            bytes_written = msg.data.size;
         }
 
-        bytes_copied += msg.data.size;
+        bytes_copied += bytes_written;
 
-        sc.RecordBytesTransferred(msg.data.size);
+        sc.RecordBytesTransferred(bytes_written);
         sc.ReportProgress(name != nullptr ? name : rpath, bytes_copied, expected_size);
     }
 
@@ -783,13 +1162,19 @@ static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
     return true;
 }
 
+static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath,
+                      const char* name, uint64_t expected_size) {
+    return sc.SendRecv(rpath) && sync_finish_recv(sc, rpath, lpath, name, expected_size);
+}
+
 bool do_sync_ls(const char* path) {
     SyncConnection sc;
     if (!sc.IsValid()) return false;
 
-    return sync_ls(sc, path, [](unsigned mode, unsigned size, unsigned time,
+    return sync_ls(sc, path, [](unsigned mode, uint64_t size, int64_t time,
                                 const char* name) {
-        printf("%08x %08x %08x %s\n", mode, size, time, name);
+        printf("%08x %08x %08x %s\n", mode, static_cast<unsigned>(size),
+               static_cast<unsigned>(time), name);
     });
 }
 
@@ -910,6 +1295,9 @@ static bool copy_local_dir_remote(SyncConnection& sc, std::string lpath,
     }
 
     if (check_timestamps) {
+        if (!sc.ReadAcknowledgements(true)) {
+            return false;
+        }
         for (const copyinfo& ci : file_list) {
             if (!sc.SendLstat(ci.rpath.c_str())) {
                 sc.Error("failed to send lstat");
@@ -942,6 +1330,10 @@ static bool copy_local_dir_remote(SyncConnection& sc, std::string lpath,
         }
     }
 
+    if (!sc.ReadAcknowledgements(true)) {
+        return false;
+    }
+
     sc.RecordFilesSkipped(skipped);
     sc.ReportTransferRate(lpath, TransferDirection::push);
     return true;
@@ -1034,6 +1426,7 @@ bool do_sync_push(const std::vector<const char*>& srcs, const char* dst, bool sy
         sc.NewTransfer();
         sc.SetExpectedTotalBytes(st.st_size);
         success &= sync_send(sc, src_path, dst_path, st.st_mtime, st.st_mode, sync);
+        success &= sc.ReadAcknowledgements(true);
         sc.ReportTransferRate(src_path, TransferDirection::push);
     }
 
@@ -1041,64 +1434,140 @@ bool do_sync_push(const std::vector<const char*>& srcs, const char* dst, bool sy
     return success;
 }
 
+bool do_sync_delta_push(const char* lpath, const char* rpath, const char* base_rpath) {
+    SyncConnection sc;
+    if (!sc.IsValid()) return false;
+    if (!sc.HaveDelta()) {
+        sc.Error("device doesn't support delta transfers");
+        return false;
+    }
+
+    struct stat st;
+    if (stat(lpath, &st) == -1) {
+        sc.Error("cannot stat '%s': %s", lpath, strerror(errno));
+        return false;
+    }
+    unique_fd lfd(adb_open(lpath, O_RDONLY));
+    if (lfd < 0) {
+        sc.Error("opening '%s' locally failed: %s", lpath, strerror(errno));
+        return false;
+    }
+
+    // Chunking our copy is mostly overlapped with adbd chunking its own.
+    std::vector<DeltaChunk> base_chunks;
+    std::vector<DeltaChunk> chunks;
+    bool chunked_locally = false;
+    std::thread chunker([&lfd, &chunks, &chunked_locally]() {
+        chunked_locally = ChunkFile(lfd.get(), &chunks);
+    });
+    bool chunked_remotely = sc.GetChunks(base_rpath, &base_chunks);
+    chunker.join();
+    if (!chunked_remotely) {
+        return false;
+    }
+    if (!chunked_locally) {
+        sc.Error("reading '%s' locally failed: %s", lpath, strerror(errno));
+        return false;
+    }
+
+    sc.NewTransfer();
+    std::vector<DeltaOp> ops = PlanDelta(base_chunks, chunks);
+    uint64_t delta_size = 0;
+    for (const DeltaOp& op : ops) {
+        if (op.type == kDeltaOpData) delta_size += op.size;
+    }
+    sc.SetExpectedTotalBytes(delta_size);
+
+    bool success = sc.SendDeltaFile(rpath, st.st_mode, lpath, st.st_mtime, base_rpath, ops) &&
+                   sc.ReadAcknowledgements(true);
+    sc.ReportTransferRate(lpath, TransferDirection::push);
+    if (success) {
+        sc.Println("%s: %" PRIu64 " of %" PRIu64 " bytes were already on the device", lpath,
+                   static_cast<uint64_t>(st.st_size) - delta_size,
+                   static_cast<uint64_t>(st.st_size));
+    }
+    return success;
+}
+
 static bool remote_build_list(SyncConnection& sc, std::vector<copyinfo>* file_list,
                               const std::string& rpath, const std::string& lpath) {
+    // Directories are listed a level at a time, with the requests for a level sent ahead of
+    // reading the replies, rather than a round trip per directory.
     std::vector<copyinfo> dirlist;
-    std::vector<copyinfo> linklist;
+    dirlist.emplace_back(lpath, rpath, "", S_IFDIR);
 
-    // Add an entry for the current directory to ensure it gets created before pulling its contents.
-    copyinfo ci(android::base::Dirname(lpath), android::base::Dirname(rpath),
-                android::base::Basename(lpath), S_IFDIR);
-    file_list->push_back(ci);
+    while (!dirlist.empty()) {
+        std::vector<copyinfo> next_dirlist;
+        std::vector<copyinfo> linklist;
+
+        size_t requested = 0;
+        for (size_t i = 0; i < dirlist.size(); ++i) {
+            for (; requested < dirlist.size() && requested - i < kMaxPendingRequests;
+                 ++requested) {
+                if (!sc.SendList(dirlist[requested].rpath.c_str())) return false;
+            }
 
-    // Put the files/dirs in rpath on the lists.
-    auto callback = [&](unsigned mode, unsigned size, unsigned time, const char* name) {
-        if (IsDotOrDotDot(name)) {
-            return;
-        }
+            // Add an entry for the directory to ensure it gets created before pulling its
+            // contents.
+            const copyinfo& dir = dirlist[i];
+            file_list->push_back(dir);
 
-        copyinfo ci(lpath, rpath, name, mode);
-        if (S_ISDIR(mode)) {
-            dirlist.push_back(ci);
-        } else if (S_ISLNK(mode)) {
-            linklist.push_back(ci);
-        } else {
-            if (!should_pull_file(ci.mode)) {
-                sc.Warning("skipping special file '%s' (mode = 0o%o)", ci.rpath.c_str(), ci.mode);
-                ci.skip = true;
-            }
-            ci.time = time;
-            ci.size = size;
-            file_list->push_back(ci);
-        }
-    };
+            // Put the files/dirs in this directory on the lists.
+            auto callback = [&](unsigned mode, uint64_t size, int64_t time, const char* name) {
+                if (IsDotOrDotDot(name)) {
+                    return;
+                }
 
-    if (!sync_ls(sc, rpath.c_str(), callback)) {
-        return false;
-    }
+                copyinfo ci(dir.lpath, dir.rpath, name, mode);
+                if (S_ISDIR(mode)) {
+                    next_dirlist.push_back(ci);
+                } else if (S_ISLNK(mode)) {
+                    linklist.push_back(ci);
+                } else {
+                    if (!should_pull_file(ci.mode)) {
+                        sc.Warning("skipping special file '%s' (mode = 0o%o)", ci.rpath.c_str(),
+                                   ci.mode);
+                        ci.skip = true;
+                    }
+                    ci.time = time;
+                    ci.size = size;
+                    file_list->push_back(ci);
+                }
+            };
 
-    // Check each symlink we found to see whether it's a file or directory.
-    for (copyinfo& link_ci : linklist) {
-        struct stat st;
-        if (!sync_stat_fallback(sc, link_ci.rpath.c_str(), &st)) {
-            sc.Warning("stat failed for path %s: %s", link_ci.rpath.c_str(), strerror(errno));
-            continue;
+            if (!sync_finish_ls(sc, callback)) {
+                return false;
+            }
         }
 
-        if (S_ISDIR(st.st_mode)) {
-            dirlist.emplace_back(std::move(link_ci));
-        } else {
-            file_list->emplace_back(std::move(link_ci));
-        }
-    }
+        // Check each symlink we found to see whether it's a file or directory.
+        // With stat_v2, every stat request is sent before any of the replies are read.
+        for (size_t i = 0, requested = 0; i < linklist.size(); ++i) {
+            copyinfo& link_ci = linklist[i];
+            struct stat st;
+            bool stat_ok;
+            if (sc.HaveStatV2()) {
+                for (; requested < linklist.size() && requested - i < kMaxPendingRequests;
+                     ++requested) {
+                    if (!sc.SendStat(linklist[requested].rpath.c_str())) return false;
+                }
+                stat_ok = sc.FinishStat(&st);
+            } else {
+                stat_ok = sync_stat_fallback(sc, link_ci.rpath.c_str(), &st);
+            }
+            if (!stat_ok) {
+                sc.Warning("stat failed for path %s: %s", link_ci.rpath.c_str(), strerror(errno));
+                continue;
+            }
 
-    // Recurse into each directory we found.
-    while (!dirlist.empty()) {
-        copyinfo current = dirlist.back();
-        dirlist.pop_back();
-        if (!remote_build_list(sc, file_list, current.rpath, current.lpath)) {
-            return false;
+            if (S_ISDIR(st.st_mode)) {
+                next_dirlist.emplace_back(std::move(link_ci));
+            } else {
+                file_list->emplace_back(std::move(link_ci));
+            }
         }
+
+        dirlist = std::move(next_dirlist);
     }
 
     return true;
@@ -1135,6 +1604,7 @@ static bool copy_remote_dir_local(SyncConnection& sc, std::string rpath,
     sc.ComputeExpectedTotalBytes(file_list);
 
     int skipped = 0;
+    std::vector<const copyinfo*> pulls;
     for (const copyinfo &ci : file_list) {
         if (!ci.skip) {
             if (S_ISDIR(ci.mode)) {
@@ -1147,19 +1617,30 @@ static bool copy_remote_dir_local(SyncConnection& sc, std::string rpath,
                 }
                 continue;
             }
-
-            if (!sync_recv(sc, ci.rpath.c_str(), ci.lpath.c_str(), nullptr, ci.size)) {
-                return false;
-            }
-
-            if (copy_attrs && set_time_and_mode(ci.lpath, ci.time, ci.mode)) {
-                return false;
-            }
+            pulls.push_back(&ci);
         } else {
             skipped++;
         }
     }
 
+    // Keep asking for files ahead of the one we're reading, so adbd goes straight from one file
+    // to the next instead of waiting a round trip for each.
+    size_t requested = 0;
+    for (size_t i = 0; i < pulls.size(); ++i) {
+        for (; requested < pulls.size() && requested - i < kMaxPendingRequests; ++requested) {
+            if (!sc.SendRecv(pulls[requested]->rpath.c_str())) return false;
+        }
+
+        const copyinfo& ci = *pulls[i];
+        if (!sync_finish_recv(sc, ci.rpath.c_str(), ci.lpath.c_str(), nullptr, ci.size)) {
+            return false;
+        }
+
+        if (copy_attrs && set_time_and_mode(ci.lpath, ci.time, ci.mode)) {
+            return false;
+        }
+    }
+
     sc.RecordFilesSkipped(skipped);
     sc.ReportTransferRate(rpath, TransferDirection::pull);
     return true;
@@ -21,6 +21,8 @@
 
 bool do_sync_ls(const char* path);
 bool do_sync_push(const std::vector<const char*>& srcs, const char* dst, bool sync);
+// Pushes |lpath| to |rpath| as a delta against |base_rpath|, which must already be on the device.
+bool do_sync_delta_push(const char* lpath, const char* rpath, const char* base_rpath);
 bool do_sync_pull(const std::vector<const char*>& srcs, const char* dst, bool copy_attrs,
                   const char* name = nullptr);
 
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <brotli/decode.h>
+#include <brotli/encode.h>
+
+// Streaming brotli, as used by the sync v2 protocol (see SYNC.TXT).
+//
+// Output is handed to a sink in pieces of at most |output_size| bytes, so a caller can send or
+// write each piece as it's produced without ever holding a whole file. A sink returns false to
+// stop early, which is reported as a failure.
+using CompressionSink = std::function<bool(const char* data, size_t size)>;
+
+class BrotliEncoder {
+  public:
+    explicit BrotliEncoder(size_t output_size)
+        : encoder_(BrotliEncoderCreateInstance(nullptr, nullptr, nullptr),
+                   BrotliEncoderDestroyInstance),
+          output_(output_size) {
+        // Anything above the fastest quality costs more in CPU than it saves on the wire.
+        BrotliEncoderSetParameter(encoder_.get(), BROTLI_PARAM_QUALITY, 1);
+    }
+
+    // Compresses |size| bytes of |data|. Pass |finish| with the last of the input (which may be
+    // empty) to flush everything that's left.
+    bool Encode(const void* data, size_t size, bool finish, const CompressionSink& sink) {
+        const uint8_t* next_in = static_cast<const uint8_t*>(data);
+        size_t avail_in = size;
+        BrotliEncoderOperation op = finish ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS;
+        while (true) {
+            uint8_t* next_out = output_.data();
+            size_t avail_out = output_.size();
+            if (!BrotliEncoderCompressStream(encoder_.get(), op, &avail_in, &next_in, &avail_out,
+                                             &next_out, nullptr)) {
+                return false;
+            }
+            size_t produced = output_.size() - avail_out;
+            if (produced > 0 && !sink(reinterpret_cast<const char*>(output_.data()), produced)) {
+                return false;
+            }
+            if (avail_in == 0 && !BrotliEncoderHasMoreOutput(encoder_.get()) &&
+                (!finish || BrotliEncoderIsFinished(encoder_.get()))) {
+                return true;
+            }
+        }
+    }
+
+  private:
+    std::unique_ptr<BrotliEncoderState, decltype(&BrotliEncoderDestroyInstance)> encoder_;
+    std::vector<uint8_t> output_;
+};
+
+class BrotliDecoder {
+  public:
+    explicit BrotliDecoder(size_t output_size)
+        : decoder_(BrotliDecoderCreateInstance(nullptr, nullptr, nullptr),
+                   BrotliDecoderDestroyInstance),
+          output_(output_size) {}
+
+    // Decompresses the next |size| bytes of the stream.
+    bool Decode(const void* data, size_t size, const CompressionSink& sink) {
+        const uint8_t* next_in = static_cast<const uint8_t*>(data);
+        size_t avail_in = size;
+        while (true) {
+            uint8_t* next_out = output_.data();
+            size_t avail_out = output_.size();
+            BrotliDecoderResult result = BrotliDecoderDecompressStream(
+                    decoder_.get(), &avail_in, &next_in, &avail_out, &next_out, nullptr);
+            if (result == BROTLI_DECODER_RESULT_ERROR) {
+                return false;
+            }
+            size_t produced = output_.size() - avail_out;
+            if (produced > 0 && !sink(reinterpret_cast<const char*>(output_.data()), produced)) {
+                return false;
+            }
+            if (result == BROTLI_DECODER_RESULT_SUCCESS) {
+                // Trailing garbage after the end of the stream is as bad as a corrupt stream.
+                return avail_in == 0;
+            }
+            if (result == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT) {
+                return true;
+            }
+        }
+    }
+
+    // True once the whole stream has been decoded.
+    bool Finished() const { return BrotliDecoderIsFinished(decoder_.get()); }
+
+  private:
+    std::unique_ptr<BrotliDecoderState, decltype(&BrotliDecoderDestroyInstance)> decoder_;
+    std::vector<uint8_t> output_;
+};
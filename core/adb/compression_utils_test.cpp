@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "compression_utils.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+static std::string Compress(const std::string& input, size_t input_chunk, size_t output_size) {
+    BrotliEncoder encoder(output_size);
+    std::string out;
+    auto sink = [&out, output_size](const char* data, size_t size) {
+        EXPECT_LE(size, output_size);
+        out.append(data, size);
+        return true;
+    };
+    for (size_t i = 0; i < input.size(); i += input_chunk) {
+        size_t n = std::min(input_chunk, input.size() - i);
+        EXPECT_TRUE(encoder.Encode(input.data() + i, n, false, sink));
+    }
+    EXPECT_TRUE(encoder.Encode(nullptr, 0, true, sink));
+    return out;
+}
+
+static std::string PseudoRandom(size_t size) {
+    std::string s(size, '\0');
+    uint32_t x = 1;
+    for (char& c : s) {
+        x = x * 1103515245 + 12345;
+        c = x >> 24;
+    }
+    return s;
+}
+
+TEST(compression_utils, round_trip) {
+    std::string input;
+    for (int i = 0; input.size() < 1024 * 1024; ++i) {
+        input += "line " + std::to_string(i % 1000) + " of some fairly repetitive text\n";
+    }
+    input += PseudoRandom(256 * 1024);
+
+    std::string compressed = Compress(input, 64 * 1024, 4096);
+    EXPECT_LT(compressed.size(), input.size());
+
+    // Feed the decoder a byte at a time to begin with, then in large pieces.
+    BrotliDecoder decoder(1000);
+    std::string output;
+    auto sink = [&output](const char* data, size_t size) {
+        EXPECT_LE(size, 1000U);
+        output.append(data, size);
+        return true;
+    };
+    for (size_t i = 0; i < 100; ++i) {
+        ASSERT_TRUE(decoder.Decode(&compressed[i], 1, sink));
+    }
+    ASSERT_TRUE(decoder.Decode(&compressed[100], compressed.size() - 100, sink));
+    EXPECT_TRUE(decoder.Finished());
+    EXPECT_EQ(input, output);
+}
+
+TEST(compression_utils, empty) {
+    std::string compressed = Compress("", 1, 64);
+    EXPECT_FALSE(compressed.empty());
+
+    BrotliDecoder decoder(64);
+    ASSERT_TRUE(decoder.Decode(compressed.data(), compressed.size(),
+                               [](const char*, size_t size) { return size == 0; }));
+    EXPECT_TRUE(decoder.Finished());
+}
+
+TEST(compression_utils, truncated) {
+    std::string input = PseudoRandom(100000);
+    std::string compressed = Compress(input, input.size(), 65536);
+
+    BrotliDecoder decoder(65536);
+    ASSERT_TRUE(decoder.Decode(compressed.data(), compressed.size() - 1,
+                               [](const char*, size_t) { return true; }));
+    EXPECT_FALSE(decoder.Finished());
+}
+
+TEST(compression_utils, corrupt) {
+    std::string compressed = Compress(PseudoRandom(1000), 1000, 65536);
+    compressed += "trailing garbage";
+
+    BrotliDecoder decoder(65536);
+    EXPECT_FALSE(decoder.Decode(compressed.data(), compressed.size(),
+                                [](const char*, size_t) { return true; }));
+}
+
+TEST(compression_utils, sink_failure) {
+    std::string compressed = Compress(std::string(100000, 'x'), 100000, 65536);
+
+    BrotliDecoder decoder(1024);
+    EXPECT_FALSE(decoder.Decode(compressed.data(), compressed.size(),
+                                [](const char*, size_t) { return false; }));
+}
@@ -31,6 +31,7 @@
 #include <unistd.h>
 #include <utime.h>
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <vector>
@@ -52,6 +53,8 @@
 #include "adb_io.h"
 #include "adb_trace.h"
 #include "adb_utils.h"
+#include "compression_utils.h"
+#include "delta_utils.h"
 #include "file_sync_protocol.h"
 #include "security_log_tags.h"
 #include "sysdeps/errno.h"
@@ -210,6 +213,54 @@ done:
     return WriteFdExactly(s, &msg.dent, sizeof(msg.dent));
 }
 
+static bool do_list_v2(int s, const char* path) {
+    syncmsg msg = {};
+    msg.dent_v2.id = ID_DENT_V2;
+
+    std::unique_ptr<DIR, int(*)(DIR*)> d(opendir(path), closedir);
+    if (d) {
+        // Entries are collected and sent together rather than two writes apiece, a directory
+        // of thousands of files is otherwise dominated by the cost of the writes.
+        std::string out;
+        dirent* de;
+        while ((de = readdir(d.get()))) {
+            std::string filename(StringPrintf("%s/%s", path, de->d_name));
+
+            struct stat st;
+            if (lstat(filename.c_str(), &st) == 0) {
+                msg.dent_v2.error = 0;
+                msg.dent_v2.dev = st.st_dev;
+                msg.dent_v2.ino = st.st_ino;
+                msg.dent_v2.mode = st.st_mode;
+                msg.dent_v2.nlink = st.st_nlink;
+                msg.dent_v2.uid = st.st_uid;
+                msg.dent_v2.gid = st.st_gid;
+                msg.dent_v2.size = st.st_size;
+                msg.dent_v2.atime = st.st_atime;
+                msg.dent_v2.mtime = st.st_mtime;
+                msg.dent_v2.ctime = st.st_ctime;
+            } else {
+                msg.dent_v2 = {};
+                msg.dent_v2.id = ID_DENT_V2;
+                msg.dent_v2.error = errno_to_wire(errno);
+            }
+            msg.dent_v2.namelen = strlen(de->d_name);
+
+            out.append(reinterpret_cast<const char*>(&msg.dent_v2), sizeof(msg.dent_v2));
+            out.append(de->d_name, msg.dent_v2.namelen);
+            if (out.size() >= SYNC_DATA_MAX) {
+                if (!WriteFdExactly(s, out)) return false;
+                out.clear();
+            }
+        }
+        if (!out.empty() && !WriteFdExactly(s, out)) return false;
+    }
+
+    msg.dent_v2 = {};
+    msg.dent_v2.id = ID_DONE;
+    return WriteFdExactly(s, &msg.dent_v2, sizeof(msg.dent_v2));
+}
+
 // Make sure that SendFail from adb_io.cpp isn't accidentally used in this file.
 #pragma GCC poison SendFail
 
@@ -227,14 +278,33 @@ static bool SendSyncFailErrno(int fd, const std::string& reason) {
 }
 
 static bool handle_send_file(int s, const char* path, uint32_t* timestamp, uid_t uid, gid_t gid,
-                             uint64_t capabilities, mode_t mode, std::vector<char>& buffer,
-                             bool do_unlink) {
+                             uint64_t capabilities, mode_t mode, bool compressed,
+                             const char* delta_base, std::vector<char>& buffer, bool do_unlink) {
     syncmsg msg;
+    std::unique_ptr<BrotliDecoder> decoder;
+    if (compressed) {
+        decoder = std::make_unique<BrotliDecoder>(SYNC_DATA_MAX);
+    }
+    unique_fd base_fd;
+    std::unique_ptr<DeltaPatcher> patcher;
 
     __android_log_security_bswrite(SEC_TAG_ADB_SEND_FILE, path);
 
     unique_fd fd(adb_open_mode(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode));
 
+    // Where the data ends up: straight into the file, or through the delta patcher.
+    std::string write_error;
+    auto write_data = [&fd, &patcher, &write_error](const char* data, size_t size) {
+        if (patcher) {
+            return patcher->Apply(data, size, &write_error);
+        }
+        if (!WriteFdExactly(fd.get(), data, size)) {
+            write_error = perror_str("write failed");
+            return false;
+        }
+        return true;
+    };
+
     if (posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL | POSIX_FADV_NOREUSE | POSIX_FADV_WILLNEED) <
         0) {
         D("[ Failed to fadvise: %d ]", errno);
@@ -270,12 +340,29 @@ static bool handle_send_file(int s, const char* path, uint32_t* timestamp, uid_t
         fchmod(fd.get(), mode);
     }
 
+    if (delta_base) {
+        base_fd.reset(adb_open(delta_base, O_RDONLY | O_CLOEXEC));
+        if (base_fd < 0) {
+            SendSyncFailErrno(s, "couldn't open delta base");
+            goto fail;
+        }
+        patcher = std::make_unique<DeltaPatcher>(base_fd.get(), fd.get());
+    }
+
     while (true) {
         if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) goto fail;
 
         if (msg.data.id != ID_DATA) {
             if (msg.data.id == ID_DONE) {
                 *timestamp = msg.data.size;
+                if (decoder && !decoder->Finished()) {
+                    SendSyncFail(s, "truncated compressed data");
+                    goto abort;
+                }
+                if (patcher && !patcher->Finished()) {
+                    SendSyncFail(s, "truncated delta");
+                    goto abort;
+                }
                 break;
             }
             SendSyncFail(s, "invalid data message");
@@ -289,8 +376,24 @@ static bool handle_send_file(int s, const char* path, uint32_t* timestamp, uid_t
 
         if (!ReadFdExactly(s, &buffer[0], msg.data.size)) goto abort;
 
-        if (!WriteFdExactly(fd.get(), &buffer[0], msg.data.size)) {
-            SendSyncFailErrno(s, "write failed");
+        if (decoder) {
+            bool write_failed = false;
+            bool decoded = decoder->Decode(&buffer[0], msg.data.size,
+                                           [&write_data, &write_failed](const char* data,
+                                                                        size_t size) {
+                                               write_failed = !write_data(data, size);
+                                               return !write_failed;
+                                           });
+            if (write_failed) {
+                SendSyncFail(s, write_error);
+                goto fail;
+            }
+            if (!decoded) {
+                SendSyncFail(s, "corrupt compressed data");
+                goto fail;
+            }
+        } else if (!write_data(&buffer[0], msg.data.size)) {
+            SendSyncFail(s, write_error);
             goto fail;
         }
     }
@@ -394,23 +497,8 @@ static bool handle_send_link(int s, const std::string& path, uint32_t* timestamp
 }
 #endif
 
-static bool do_send(int s, const std::string& spec, std::vector<char>& buffer) {
-    // 'spec' is of the form "/some/path,0755". Break it up.
-    size_t comma = spec.find_last_of(',');
-    if (comma == std::string::npos) {
-        SendSyncFail(s, "missing , in ID_SEND");
-        return false;
-    }
-
-    std::string path = spec.substr(0, comma);
-
-    errno = 0;
-    mode_t mode = strtoul(spec.substr(comma + 1).c_str(), nullptr, 0);
-    if (errno != 0) {
-        SendSyncFail(s, "bad mode");
-        return false;
-    }
-
+static bool send_impl(int s, const std::string& path, mode_t mode, bool compressed,
+                      const char* delta_base, std::vector<char>& buffer) {
     // Don't delete files before copying if they are not "regular" or symlinks.
     struct stat st;
     bool do_unlink = (lstat(path.c_str(), &st) == -1) || S_ISREG(st.st_mode) ||
@@ -422,6 +510,10 @@ static bool do_send(int s, const std::string& spec, std::vector<char>& buffer) {
     bool result;
     uint32_t timestamp;
     if (S_ISLNK(mode)) {
+        if (compressed || delta_base) {
+            SendSyncFail(s, "compressed or delta symlinks are not supported");
+            return false;
+        }
         result = handle_send_link(s, path, &timestamp, buffer);
     } else {
         // Copy user permission bits to "group" and "other" permissions.
@@ -438,8 +530,8 @@ static bool do_send(int s, const std::string& spec, std::vector<char>& buffer) {
             mode = broken_api_hack;
         }
 
-        result = handle_send_file(s, path.c_str(), &timestamp, uid, gid, capabilities, mode, buffer,
-                                  do_unlink);
+        result = handle_send_file(s, path.c_str(), &timestamp, uid, gid, capabilities, mode,
+                                  compressed, delta_base, buffer, do_unlink);
     }
 
     if (!result) {
@@ -455,7 +547,99 @@ static bool do_send(int s, const std::string& spec, std::vector<char>& buffer) {
     return true;
 }
 
-static bool do_recv(int s, const char* path, std::vector<char>& buffer) {
+static bool do_send(int s, const std::string& spec, std::vector<char>& buffer) {
+    // 'spec' is of the form "/some/path,0755". Break it up.
+    size_t comma = spec.find_last_of(',');
+    if (comma == std::string::npos) {
+        SendSyncFail(s, "missing , in ID_SEND");
+        return false;
+    }
+
+    std::string path = spec.substr(0, comma);
+
+    errno = 0;
+    mode_t mode = strtoul(spec.substr(comma + 1).c_str(), nullptr, 0);
+    if (errno != 0) {
+        SendSyncFail(s, "bad mode");
+        return false;
+    }
+
+    return send_impl(s, path, mode, false, nullptr, buffer);
+}
+
+static bool do_send_v2(int s, const char* path, std::vector<char>& buffer) {
+    // The path is followed by the mode and flags, rather than having the mode tacked onto it.
+    syncmsg msg;
+    if (!ReadFdExactly(s, &msg.send_v2_setup, sizeof(msg.send_v2_setup))) {
+        SendSyncFail(s, "failed to read ID_SEND_V2 setup");
+        return false;
+    }
+    if (msg.send_v2_setup.id != ID_SEND_V2) {
+        SendSyncFail(s, "invalid ID_SEND_V2 setup");
+        return false;
+    }
+    if ((msg.send_v2_setup.flags & ~(kSyncFlagBrotli | kSyncFlagDelta)) != 0) {
+        SendSyncFail(s, StringPrintf("unknown ID_SEND_V2 flags %08x", msg.send_v2_setup.flags));
+        return false;
+    }
+
+    char base[1025];
+    bool delta = (msg.send_v2_setup.flags & kSyncFlagDelta) != 0;
+    if (delta) {
+        SyncRequest request;
+        if (!ReadFdExactly(s, &request, sizeof(request)) || request.id != ID_BASE) {
+            SendSyncFail(s, "failed to read ID_BASE");
+            return false;
+        }
+        if (request.path_length > 1024) {
+            SendSyncFail(s, "path too long");
+            return false;
+        }
+        if (!ReadFdExactly(s, base, request.path_length)) {
+            SendSyncFail(s, "filename read failure");
+            return false;
+        }
+        base[request.path_length] = 0;
+    }
+
+    return send_impl(s, path, msg.send_v2_setup.mode,
+                     (msg.send_v2_setup.flags & kSyncFlagBrotli) != 0, delta ? base : nullptr,
+                     buffer);
+}
+
+static bool do_chunks(int s, const char* path) {
+    __android_log_security_bswrite(SEC_TAG_ADB_RECV_FILE, path);
+
+    unique_fd fd(adb_open(path, O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        SendSyncFailErrno(s, "open failed");
+        return false;
+    }
+
+    std::vector<DeltaChunk> chunks;
+    if (!ChunkFile(fd.get(), &chunks)) {
+        SendSyncFailErrno(s, "read failed");
+        return false;
+    }
+
+    syncmsg msg;
+    msg.data.id = ID_DATA;
+    const size_t chunks_per_message = SYNC_DATA_MAX / sizeof(DeltaChunk);
+    for (size_t i = 0; i < chunks.size(); i += chunks_per_message) {
+        size_t count = std::min(chunks_per_message, chunks.size() - i);
+        msg.data.size = count * sizeof(DeltaChunk);
+        if (!WriteFdExactly(s, &msg.data, sizeof(msg.data)) ||
+            !WriteFdExactly(s, &chunks[i], msg.data.size)) {
+            return false;
+        }
+    }
+
+    msg.data.id = ID_DONE;
+    msg.data.size = 0;
+    return WriteFdExactly(s, &msg.data, sizeof(msg.data));
+}
+
+static bool do_recv(int s, const char* path, bool compressed, std::vector<char>& buffer) {
     __android_log_security_bswrite(SEC_TAG_ADB_RECV_FILE, path);
 
     unique_fd fd(adb_open(path, O_RDONLY | O_CLOEXEC));
@@ -470,6 +654,15 @@ static bool do_recv(int s, const char* path, std::vector<char>& buffer) {
 
     syncmsg msg;
     msg.data.id = ID_DATA;
+    auto send_data = [s, &msg](const char* data, size_t size) {
+        msg.data.size = size;
+        return WriteFdExactly(s, &msg.data, sizeof(msg.data)) && WriteFdExactly(s, data, size);
+    };
+    std::unique_ptr<BrotliEncoder> encoder;
+    if (compressed) {
+        encoder = std::make_unique<BrotliEncoder>(SYNC_DATA_MAX);
+    }
+
     while (true) {
         int r = adb_read(fd.get(), &buffer[0], buffer.size() - sizeof(msg.data));
         if (r <= 0) {
@@ -477,17 +670,39 @@ static bool do_recv(int s, const char* path, std::vector<char>& buffer) {
             SendSyncFailErrno(s, "read failed");
             return false;
         }
-        msg.data.size = r;
-        if (!WriteFdExactly(s, &msg.data, sizeof(msg.data)) || !WriteFdExactly(s, &buffer[0], r)) {
+        if (encoder) {
+            if (!encoder->Encode(&buffer[0], r, false, send_data)) return false;
+        } else if (!send_data(&buffer[0], r)) {
             return false;
         }
     }
+    if (encoder && !encoder->Encode(nullptr, 0, true, send_data)) {
+        return false;
+    }
 
     msg.data.id = ID_DONE;
     msg.data.size = 0;
     return WriteFdExactly(s, &msg.data, sizeof(msg.data));
 }
 
+static bool do_recv_v2(int s, const char* path, std::vector<char>& buffer) {
+    syncmsg msg;
+    if (!ReadFdExactly(s, &msg.recv_v2_setup, sizeof(msg.recv_v2_setup))) {
+        SendSyncFail(s, "failed to read ID_RECV_V2 setup");
+        return false;
+    }
+    if (msg.recv_v2_setup.id != ID_RECV_V2) {
+        SendSyncFail(s, "invalid ID_RECV_V2 setup");
+        return false;
+    }
+    if ((msg.recv_v2_setup.flags & ~kSyncFlagBrotli) != 0) {
+        SendSyncFail(s, StringPrintf("unknown ID_RECV_V2 flags %08x", msg.recv_v2_setup.flags));
+        return false;
+    }
+
+    return do_recv(s, path, (msg.recv_v2_setup.flags & kSyncFlagBrotli) != 0, buffer);
+}
+
 static const char* sync_id_to_name(uint32_t id) {
   switch (id) {
     case ID_LSTAT_V1:
@@ -498,10 +713,18 @@ static const char* sync_id_to_name(uint32_t id) {
       return "stat_v2";
     case ID_LIST:
       return "list";
+    case ID_LIST_V2:
+      return "list_v2";
     case ID_SEND:
       return "send";
+    case ID_SEND_V2:
+      return "send_v2";
     case ID_RECV:
       return "recv";
+    case ID_RECV_V2:
+      return "recv_v2";
+    case ID_CHUNKS:
+      return "chunks";
     case ID_QUIT:
         return "quit";
     default:
@@ -546,11 +769,23 @@ static bool handle_sync_command(int fd, std::vector<char>& buffer) {
         case ID_LIST:
             if (!do_list(fd, name)) return false;
             break;
+        case ID_LIST_V2:
+            if (!do_list_v2(fd, name)) return false;
+            break;
         case ID_SEND:
             if (!do_send(fd, name, buffer)) return false;
             break;
+        case ID_SEND_V2:
+            if (!do_send_v2(fd, name, buffer)) return false;
+            break;
         case ID_RECV:
-            if (!do_recv(fd, name, buffer)) return false;
+            if (!do_recv(fd, name, false, buffer)) return false;
+            break;
+        case ID_RECV_V2:
+            if (!do_recv_v2(fd, name, buffer)) return false;
+            break;
+        case ID_CHUNKS:
+            if (!do_chunks(fd, name)) return false;
             break;
         case ID_QUIT:
             return false;
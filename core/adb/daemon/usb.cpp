@@ -66,6 +66,11 @@ static constexpr size_t kUsbReadSize = 4 * PAGE_SIZE;
 static constexpr size_t kUsbWriteQueueDepth = 8;
 static constexpr size_t kUsbWriteSize = 4 * PAGE_SIZE;
 
+// A payload that arrives in a single read is handed to the transport in the read buffer itself,
+// instead of being copied out, if it fills at least this much of the buffer. Smaller payloads are
+// copied, so that a short packet doesn't pin a whole read buffer while it waits to be consumed.
+static constexpr size_t kUsbReadHandoffSize = kUsbReadSize / 2;
+
 static const char* to_string(enum usb_functionfs_event_type type) {
     switch (type) {
         case FUNCTIONFS_BIND:
@@ -208,11 +213,8 @@ struct UsbFfsConnection : public Connection {
 
     virtual bool Write(std::unique_ptr<apacket> packet) override final {
         LOG(DEBUG) << "USB write: " << dump_header(&packet->msg);
-        Block header(sizeof(packet->msg));
-        memcpy(header.data(), &packet->msg, sizeof(packet->msg));
-
         std::lock_guard<std::mutex> lock(write_mutex_);
-        write_requests_.push_back(CreateWriteBlock(std::move(header), next_write_id_++));
+        write_requests_.push_back(CreateWriteBlock(packet->msg, next_write_id_++));
         if (!packet->payload.empty()) {
             // The kernel attempts to allocate a contiguous block of memory for each write,
             // which can fail if the write is large and the kernel heap is fragmented.
@@ -466,7 +468,8 @@ struct UsbFfsConnection : public Connection {
 
     void PrepareReadBlock(IoBlock* block, uint64_t id) {
         block->pending = false;
-        block->payload = std::make_shared<Block>(kUsbReadSize);
+        // Reuse the buffer from the previous read, unless it was handed off to the transport.
+        block->payload->resize(kUsbReadSize);
         block->control.aio_data = static_cast<uint64_t>(TransferId::read(id));
         block->control.aio_buf = reinterpret_cast<uintptr_t>(block->payload->data());
         block->control.aio_nbytes = block->payload->size();
@@ -474,6 +477,7 @@ struct UsbFfsConnection : public Connection {
 
     IoBlock CreateReadBlock(uint64_t id) {
         IoBlock block;
+        block.payload = std::make_shared<Block>();
         PrepareReadBlock(&block, id);
         block.control.aio_rw_flags = 0;
         block.control.aio_lio_opcode = IOCB_CMD_PREAD;
@@ -535,41 +539,65 @@ struct UsbFfsConnection : public Connection {
             if (current_block->pending) {
                 break;
             }
-            ProcessRead(current_block);
+            if (!ProcessRead(current_block)) {
+                return;
+            }
             ++needed_read_id_;
         }
     }
 
-    void ProcessRead(IoBlock* block) {
+    bool ProcessRead(IoBlock* block) {
         if (!block->payload->empty()) {
             if (!incoming_header_.has_value()) {
-                CHECK_EQ(sizeof(amessage), block->payload->size());
+                if (block->payload->size() != sizeof(amessage)) {
+                    HandleError("received packet of unexpected length while reading header");
+                    return false;
+                }
                 amessage msg;
                 memcpy(&msg, block->payload->data(), sizeof(amessage));
                 LOG(DEBUG) << "USB read:" << dump_header(&msg);
+                // The payload buffer is sized from this up front, so don't trust it blindly.
+                if (msg.data_length > MAX_PAYLOAD) {
+                    HandleError(StringPrintf("received packet with oversized payload (%u > %zu)",
+                                             msg.data_length, MAX_PAYLOAD));
+                    return false;
+                }
                 incoming_header_ = msg;
+                incoming_payload_size_ = 0;
             } else {
-                size_t bytes_left = incoming_header_->data_length - incoming_payload_.size();
-                Block payload = std::move(*block->payload);
-                CHECK_LE(payload.size(), bytes_left);
-                incoming_payload_.append(std::make_unique<Block>(std::move(payload)));
+                size_t size = block->payload->size();
+                size_t bytes_left = incoming_header_->data_length - incoming_payload_size_;
+                if (size > bytes_left) {
+                    HandleError("received too many bytes while waiting for payload");
+                    return false;
+                }
+                if (incoming_payload_size_ == 0 && size == bytes_left &&
+                    size >= kUsbReadHandoffSize) {
+                    // The whole payload is in this read: pass the buffer along without copying.
+                    incoming_payload_ = std::move(*block->payload);
+                } else {
+                    // Otherwise, gather the pieces straight into a payload of the final size.
+                    incoming_payload_.resize(incoming_header_->data_length);
+                    memcpy(incoming_payload_.data() + incoming_payload_size_,
+                           block->payload->data(), size);
+                }
+                incoming_payload_size_ += size;
             }
 
-            if (incoming_header_->data_length == incoming_payload_.size()) {
+            if (incoming_header_->data_length == incoming_payload_size_) {
                 auto packet = std::make_unique<apacket>();
                 packet->msg = *incoming_header_;
-
-                // TODO: Make apacket contain an IOVector so we don't have to coalesce.
-                packet->payload = incoming_payload_.coalesce();
+                packet->payload = std::move(incoming_payload_);
                 read_callback_(this, std::move(packet));
 
                 incoming_header_.reset();
-                incoming_payload_.clear();
+                incoming_payload_size_ = 0;
             }
         }
 
         PrepareReadBlock(block, block->id().id + kUsbReadQueueDepth);
         SubmitRead(block);
+        return true;
     }
 
     bool SubmitRead(IoBlock* block) {
@@ -598,6 +626,7 @@ struct UsbFfsConnection : public Connection {
                 });
         CHECK(it != write_requests_.end());
 
+        ReleaseWriteBlock(std::move(*it));
         write_requests_.erase(it);
         size_t outstanding_writes = --writes_submitted_;
         LOG(DEBUG) << "USB write: reaped, down to " << outstanding_writes;
@@ -606,8 +635,14 @@ struct UsbFfsConnection : public Connection {
     }
 
     std::unique_ptr<IoBlock> CreateWriteBlock(std::shared_ptr<Block> payload, size_t offset,
-                                              size_t len, uint64_t id) {
-        auto block = std::make_unique<IoBlock>();
+                                              size_t len, uint64_t id) REQUIRES(write_mutex_) {
+        std::unique_ptr<IoBlock> block;
+        if (write_block_pool_.empty()) {
+            block = std::make_unique<IoBlock>();
+        } else {
+            block = std::move(write_block_pool_.back());
+            write_block_pool_.pop_back();
+        }
         block->payload = std::move(payload);
         block->control.aio_data = static_cast<uint64_t>(TransferId::write(id));
         block->control.aio_rw_flags = 0;
@@ -622,10 +657,31 @@ struct UsbFfsConnection : public Connection {
         return block;
     }
 
-    std::unique_ptr<IoBlock> CreateWriteBlock(Block payload, uint64_t id) {
-        std::shared_ptr<Block> block = std::make_shared<Block>(std::move(payload));
-        size_t len = block->size();
-        return CreateWriteBlock(std::move(block), 0, len, id);
+    std::unique_ptr<IoBlock> CreateWriteBlock(const amessage& msg, uint64_t id)
+            REQUIRES(write_mutex_) {
+        std::shared_ptr<Block> header;
+        if (header_pool_.empty()) {
+            header = std::make_shared<Block>(sizeof(msg));
+        } else {
+            header = std::move(header_pool_.back());
+            header_pool_.pop_back();
+        }
+        memcpy(header->data(), &msg, sizeof(msg));
+        return CreateWriteBlock(std::move(header), 0, sizeof(msg), id);
+    }
+
+    // Every packet costs a header write and at least one payload write, so hang on to a queue's
+    // worth of completed requests (and header buffers) rather than reallocating them each time.
+    void ReleaseWriteBlock(std::unique_ptr<IoBlock> block) REQUIRES(write_mutex_) {
+        block->pending = false;
+        std::shared_ptr<Block> payload = std::move(block->payload);
+        if (payload && payload.use_count() == 1 && payload->size() == sizeof(amessage) &&
+            header_pool_.size() < kUsbWriteQueueDepth) {
+            header_pool_.push_back(std::move(payload));
+        }
+        if (write_block_pool_.size() < kUsbWriteQueueDepth) {
+            write_block_pool_.push_back(std::move(block));
+        }
     }
 
     void SubmitWrites() REQUIRES(write_mutex_) {
@@ -687,10 +743,10 @@ struct UsbFfsConnection : public Connection {
     unique_fd write_fd_;
 
     std::optional<amessage> incoming_header_;
-    IOVector incoming_payload_;
+    Block incoming_payload_;
+    size_t incoming_payload_size_ = 0;
 
     std::array<IoBlock, kUsbReadQueueDepth> read_requests_;
-    IOVector read_data_;
 
     // ID of the next request that we're going to send out.
     size_t next_read_id_ = 0;
@@ -702,6 +758,8 @@ struct UsbFfsConnection : public Connection {
     std::deque<std::unique_ptr<IoBlock>> write_requests_ GUARDED_BY(write_mutex_);
     size_t next_write_id_ GUARDED_BY(write_mutex_) = 0;
     size_t writes_submitted_ GUARDED_BY(write_mutex_) = 0;
+    std::vector<std::unique_ptr<IoBlock>> write_block_pool_ GUARDED_BY(write_mutex_);
+    std::vector<std::shared_ptr<Block>> header_pool_ GUARDED_BY(write_mutex_);
 
     static constexpr int kInterruptionSignal = SIGUSR1;
 };
@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "delta_utils.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+
+#include <android-base/stringprintf.h>
+#include <openssl/sha.h>
+
+#include "adb_io.h"
+#include "adb_utils.h"
+#include "sysdeps.h"
+
+using android::base::StringPrintf;
+
+static_assert(sizeof(DeltaChunk::sha256) == SHA256_DIGEST_LENGTH);
+
+// The boundary test looks at the top bits of a gear hash, which depend on the last 64 bytes.
+static constexpr uint64_t kBoundaryMask = ((1ULL << 14) - 1) << 50;
+
+// Both ends of a connection have to agree on this table, so it's generated rather than random.
+static constexpr std::array<uint64_t, 256> MakeGearTable() {
+    std::array<uint64_t, 256> table = {};
+    uint64_t x = 0;
+    for (uint64_t& entry : table) {
+        // splitmix64.
+        x += 0x9e3779b97f4a7c15ULL;
+        uint64_t z = x;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        entry = z ^ (z >> 31);
+    }
+    return table;
+}
+
+static constexpr std::array<uint64_t, 256> kGearTable = MakeGearTable();
+
+bool ChunkFile(int fd, std::vector<DeltaChunk>* chunks) {
+    std::vector<uint8_t> buffer(256 * 1024);
+    DeltaChunk chunk = {};
+    size_t chunk_size = 0;
+    uint64_t hash = 0;
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+
+    auto finish_chunk = [&]() {
+        chunk.size = chunk_size;
+        SHA256_Final(chunk.sha256, &ctx);
+        chunks->push_back(chunk);
+        chunk.offset += chunk_size;
+        chunk_size = 0;
+        hash = 0;
+        SHA256_Init(&ctx);
+    };
+
+    while (true) {
+        int rc = adb_read(fd, buffer.data(), buffer.size());
+        if (rc < 0) {
+            return false;
+        } else if (rc == 0) {
+            break;
+        }
+
+        const uint8_t* data = buffer.data();
+        size_t start = 0;
+        for (size_t i = 0; i < static_cast<size_t>(rc); ++i) {
+            hash = (hash << 1) + kGearTable[data[i]];
+            ++chunk_size;
+            if ((chunk_size >= kDeltaMinChunkSize && (hash & kBoundaryMask) == 0) ||
+                chunk_size == kDeltaMaxChunkSize) {
+                SHA256_Update(&ctx, data + start, i + 1 - start);
+                finish_chunk();
+                start = i + 1;
+            }
+        }
+        SHA256_Update(&ctx, data + start, rc - start);
+    }
+
+    if (chunk_size != 0) {
+        finish_chunk();
+    }
+    return true;
+}
+
+std::vector<DeltaOp> PlanDelta(const std::vector<DeltaChunk>& base,
+                               const std::vector<DeltaChunk>& target) {
+    std::unordered_map<std::string, const DeltaChunk*> index;
+    for (const DeltaChunk& chunk : base) {
+        index.emplace(std::string(reinterpret_cast<const char*>(chunk.sha256),
+                                  sizeof(chunk.sha256)),
+                      &chunk);
+    }
+
+    std::vector<DeltaOp> ops;
+    for (const DeltaChunk& chunk : target) {
+        auto it = index.find(
+                std::string(reinterpret_cast<const char*>(chunk.sha256), sizeof(chunk.sha256)));
+        DeltaOp op;
+        if (it != index.end() && it->second->size == chunk.size) {
+            op = {kDeltaOpCopy, it->second->offset, chunk.size};
+        } else {
+            op = {kDeltaOpData, chunk.offset, chunk.size};
+        }
+
+        if (!ops.empty() && ops.back().type == op.type &&
+            ops.back().offset + ops.back().size == op.offset) {
+            ops.back().size += op.size;
+        } else {
+            ops.push_back(op);
+        }
+    }
+    return ops;
+}
+
+bool DeltaPatcher::Apply(const char* data, size_t size, std::string* error) {
+    while (size > 0) {
+        if (data_left_ > 0) {
+            size_t len = std::min<uint64_t>(data_left_, size);
+            if (!WriteFdExactly(output_fd_, data, len)) {
+                *error = perror_str("write failed");
+                return false;
+            }
+            data += len;
+            size -= len;
+            data_left_ -= len;
+            continue;
+        }
+
+        size_t len = std::min(sizeof(op_) - op_bytes_, size);
+        memcpy(reinterpret_cast<char*>(&op_) + op_bytes_, data, len);
+        op_bytes_ += len;
+        data += len;
+        size -= len;
+        if (op_bytes_ < sizeof(op_)) {
+            break;
+        }
+
+        op_bytes_ = 0;
+        switch (op_.type) {
+            case kDeltaOpCopy:
+                if (!Copy(op_.offset, op_.size, error)) return false;
+                break;
+            case kDeltaOpData:
+                data_left_ = op_.size;
+                break;
+            default:
+                *error = StringPrintf("unknown delta op %u", op_.type);
+                return false;
+        }
+    }
+    return true;
+}
+
+bool DeltaPatcher::Copy(uint64_t offset, uint64_t size, std::string* error) {
+#if defined(__linux__)
+    // Let the kernel do the copy, which on filesystems that support it shares the extents instead
+    // of duplicating them. Anything it can't do (an old kernel, or a copy across filesystems)
+    // falls back to reading and writing.
+    loff_t base_offset = offset;
+    while (size > 0) {
+        ssize_t rc = syscall(__NR_copy_file_range, base_fd_, &base_offset, output_fd_, nullptr,
+                             size, 0);
+        if (rc <= 0) {
+            break;
+        }
+        size -= rc;
+    }
+    if (size == 0) {
+        return true;
+    }
+    offset = base_offset;
+#endif
+
+    if (adb_lseek(base_fd_, offset, SEEK_SET) != static_cast<int64_t>(offset)) {
+        *error = perror_str("seek in base file failed");
+        return false;
+    }
+
+    copy_buffer_.resize(64 * 1024);
+    while (size > 0) {
+        int rc = adb_read(base_fd_, copy_buffer_.data(),
+                          std::min<uint64_t>(size, copy_buffer_.size()));
+        if (rc < 0) {
+            *error = perror_str("read of base file failed");
+            return false;
+        } else if (rc == 0) {
+            *error = "delta copies past the end of the base file";
+            return false;
+        }
+        if (!WriteFdExactly(output_fd_, copy_buffer_.data(), rc)) {
+            *error = perror_str("write failed");
+            return false;
+        }
+        size -= rc;
+    }
+    return true;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// Delta transfer of a file against an older version of it on the other side, as used by the
+// sync v2 protocol for `adb install --fastdeploy` (see SYNC.TXT).
+//
+// Both sides split their copy into content-defined chunks, so that inserting or removing bytes
+// only changes the chunks around the edit rather than every chunk after it. The receiver sends
+// its chunk list, and the sender replies with a delta: a sequence of DeltaOps that either copy
+// a range of the receiver's base file, or carry data the receiver doesn't have.
+
+// Chunk sizes. The average is roughly kDeltaMinChunkSize + 16KiB.
+static constexpr size_t kDeltaMinChunkSize = 4 * 1024;
+static constexpr size_t kDeltaMaxChunkSize = 64 * 1024;
+
+struct DeltaChunk {
+    uint64_t offset;
+    uint32_t size;
+    uint8_t sha256[32];
+} __attribute__((packed));
+
+enum DeltaOpType : uint32_t {
+    kDeltaOpCopy = 1,  // Copy `size` bytes at `offset` of the base file.
+    kDeltaOpData = 2,  // `size` bytes of data follow.
+};
+
+struct DeltaOp {
+    uint32_t type;
+    uint64_t offset;
+    uint64_t size;
+} __attribute__((packed));
+
+// Splits the contents of |fd|, which must be positioned at the start of the file, into chunks.
+bool ChunkFile(int fd, std::vector<DeltaChunk>* chunks);
+
+// Works out how to build a file chunked into |target| from a base chunked into |base|. Adjacent
+// ops are merged, so unchanged runs of the file become a single copy. kDeltaOpData ops refer to
+// the target file: their offset is where to find the data to send.
+std::vector<DeltaOp> PlanDelta(const std::vector<DeltaChunk>& base,
+                               const std::vector<DeltaChunk>& target);
+
+// Rebuilds a file from a delta against |base_fd|, writing it to |output_fd|. The delta can be
+// fed in arbitrary pieces, as it arrives.
+class DeltaPatcher {
+  public:
+    DeltaPatcher(int base_fd, int output_fd) : base_fd_(base_fd), output_fd_(output_fd) {}
+
+    // Returns false with |error| set if the delta is malformed or the output couldn't be written.
+    bool Apply(const char* data, size_t size, std::string* error);
+
+    // True if the delta fed so far ends on an op boundary.
+    bool Finished() const { return op_bytes_ == 0 && data_left_ == 0; }
+
+  private:
+    bool Copy(uint64_t offset, uint64_t size, std::string* error);
+
+    int base_fd_;
+    int output_fd_;
+
+    DeltaOp op_;
+    size_t op_bytes_ = 0;
+    uint64_t data_left_ = 0;
+
+    std::vector<char> copy_buffer_;
+};
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "delta_utils.h"
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <string>
+
+#include <android-base/file.h>
+
+// See adb_io_test.cpp for why these tests don't run on Windows.
+#if defined(_WIN32)
+#define POSIX_TEST(x,y) TEST(DISABLED_ ## x,y)
+#else
+#define POSIX_TEST TEST
+#endif
+
+static std::string PseudoRandom(size_t size, uint32_t seed) {
+    std::string s(size, '\0');
+    uint32_t x = seed;
+    for (char& c : s) {
+        x = x * 1103515245 + 12345;
+        c = x >> 24;
+    }
+    return s;
+}
+
+static std::vector<DeltaChunk> Chunk(const std::string& contents) {
+    TemporaryFile tf;
+    EXPECT_TRUE(android::base::WriteStringToFd(contents, tf.fd));
+    EXPECT_EQ(0, lseek(tf.fd, 0, SEEK_SET));
+    std::vector<DeltaChunk> chunks;
+    EXPECT_TRUE(ChunkFile(tf.fd, &chunks));
+    return chunks;
+}
+
+// Serializes the delta the way the sync client sends it.
+static std::string Encode(const std::vector<DeltaOp>& ops, const std::string& target) {
+    std::string delta;
+    for (const DeltaOp& op : ops) {
+        delta.append(reinterpret_cast<const char*>(&op), sizeof(op));
+        if (op.type == kDeltaOpData) {
+            delta.append(target, op.offset, op.size);
+        }
+    }
+    return delta;
+}
+
+static bool Patch(const std::string& base, const std::string& delta, size_t piece_size,
+                  std::string* output, std::string* error) {
+    TemporaryFile base_file;
+    TemporaryFile output_file;
+    EXPECT_TRUE(android::base::WriteStringToFd(base, base_file.fd));
+
+    DeltaPatcher patcher(base_file.fd, output_file.fd);
+    for (size_t i = 0; i < delta.size(); i += piece_size) {
+        if (!patcher.Apply(&delta[i], std::min(piece_size, delta.size() - i), error)) {
+            return false;
+        }
+    }
+    EXPECT_TRUE(patcher.Finished());
+    return android::base::ReadFileToString(output_file.path, output);
+}
+
+POSIX_TEST(delta_utils, chunk_sizes) {
+    std::string contents = PseudoRandom(4 * 1024 * 1024, 1) + std::string(1024 * 1024, 'x');
+    std::vector<DeltaChunk> chunks = Chunk(contents);
+
+    uint64_t offset = 0;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        EXPECT_EQ(offset, chunks[i].offset);
+        EXPECT_LE(chunks[i].size, kDeltaMaxChunkSize);
+        if (i != chunks.size() - 1) {
+            EXPECT_GE(chunks[i].size, kDeltaMinChunkSize);
+        }
+        offset += chunks[i].size;
+    }
+    EXPECT_EQ(contents.size(), offset);
+
+    // Neither too many chunks in the random data, nor too few.
+    EXPECT_GT(chunks.size(), 4 * 1024 * 1024 / (kDeltaMinChunkSize + 64 * 1024));
+    EXPECT_LT(chunks.size(), 4 * 1024 * 1024 / kDeltaMinChunkSize + 16);
+
+    EXPECT_TRUE(Chunk("").empty());
+}
+
+POSIX_TEST(delta_utils, insertion) {
+    std::string base = PseudoRandom(8 * 1024 * 1024, 1);
+    std::string target = base;
+    target.insert(1024 * 1024, PseudoRandom(1000, 2));
+    target.erase(5 * 1024 * 1024, 3000);
+
+    std::vector<DeltaOp> ops = PlanDelta(Chunk(base), Chunk(target));
+    uint64_t copied = 0;
+    uint64_t sent = 0;
+    for (const DeltaOp& op : ops) {
+        (op.type == kDeltaOpCopy ? copied : sent) += op.size;
+    }
+    EXPECT_EQ(target.size(), copied + sent);
+    // Each edit should only cost the chunks around it.
+    EXPECT_LT(sent, 4 * kDeltaMaxChunkSize);
+    EXPECT_LE(ops.size(), 5U);
+
+    std::string output;
+    std::string error;
+    ASSERT_TRUE(Patch(base, Encode(ops, target), 1000, &output, &error)) << error;
+    EXPECT_EQ(target, output);
+}
+
+POSIX_TEST(delta_utils, unrelated) {
+    std::string base = PseudoRandom(1024 * 1024, 1);
+    std::string target = PseudoRandom(1024 * 1024, 2);
+
+    std::vector<DeltaOp> ops = PlanDelta(Chunk(base), Chunk(target));
+    ASSERT_EQ(1U, ops.size());
+    EXPECT_EQ(kDeltaOpData, ops[0].type);
+
+    std::string output;
+    std::string error;
+    ASSERT_TRUE(Patch(base, Encode(ops, target), 65536, &output, &error)) << error;
+    EXPECT_EQ(target, output);
+}
+
+POSIX_TEST(delta_utils, malformed) {
+    std::string output;
+    std::string error;
+
+    DeltaOp copy = {kDeltaOpCopy, 100, 1000};
+    std::string delta(reinterpret_cast<const char*>(&copy), sizeof(copy));
+    EXPECT_FALSE(Patch(std::string(500, 'x'), delta, delta.size(), &output, &error));
+    EXPECT_EQ("delta copies past the end of the base file", error);
+
+    DeltaOp bogus = {42, 0, 0};
+    delta.assign(reinterpret_cast<const char*>(&bogus), sizeof(bogus));
+    EXPECT_FALSE(Patch("", delta, 1, &output, &error));
+    EXPECT_EQ("unknown delta op 42", error);
+}
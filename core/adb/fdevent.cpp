@@ -27,6 +27,10 @@
 #include <string.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
+
 #include <atomic>
 #include <deque>
 #include <functional>
@@ -34,6 +38,7 @@
 #include <mutex>
 #include <optional>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -78,12 +83,30 @@ struct PollNode {
 // That's why we don't need a lock for fdevent.
 static auto& g_poll_node_map = *new std::unordered_map<int, PollNode>();
 static auto& g_pending_list = *new std::list<fdevent*>();
+// Only the fdevents with a timeout set need to be looked at for timeouts.
+static auto& g_timeout_set = *new std::unordered_set<fdevent*>();
 static std::atomic<bool> terminate_loop(false);
 static bool main_thread_valid;
 static uint64_t main_thread_id;
 
 static uint64_t fdevent_id;
 
+#if defined(__linux__)
+// On Linux, registrations are kept by the kernel in an epoll set, which hands
+// back the fdevent itself for each ready fd. Neither waiting nor dispatching
+// costs anything for the fds that are idle.
+static auto& g_epoll_fd = *new unique_fd();
+
+// Fds epoll refuses, with the errno it gave. poll() reports regular files
+// (EPERM) as always ready and invalid fds (EBADF) with POLLNVAL, which we
+// imitate for these.
+static auto& g_unpollable = *new std::unordered_map<fdevent*, int>();
+
+// The most events taken from a single epoll_wait, any more are picked up by
+// the next one.
+static constexpr int kMaxEpollEvents = 256;
+#endif
+
 static bool run_needs_flush = false;
 static auto& run_queue_notify_fd = *new unique_fd();
 static auto& run_queue_mutex = *new std::mutex();
@@ -124,6 +147,39 @@ static std::string dump_fde(const fdevent* fde) {
                                        state.c_str());
 }
 
+#if defined(__linux__)
+static int fdevent_epoll_fd() {
+    if (g_epoll_fd == -1) {
+        g_epoll_fd.reset(epoll_create1(EPOLL_CLOEXEC));
+        if (g_epoll_fd == -1) {
+            PLOG(FATAL) << "failed to create epoll fd";
+        }
+    }
+    return g_epoll_fd.get();
+}
+
+static void fdevent_epoll_ctl(fdevent* fde, int op) {
+    epoll_event ev = {};
+    // Always ask for EPOLLRDHUP, as PollNode does for POLLRDHUP.
+    ev.events = EPOLLRDHUP;
+    if (fde->state & FDE_READ) {
+        ev.events |= EPOLLIN;
+    }
+    if (fde->state & FDE_WRITE) {
+        ev.events |= EPOLLOUT;
+    }
+    ev.data.ptr = fde;
+    if (epoll_ctl(fdevent_epoll_fd(), op, fde->fd.get(), &ev) == 0) {
+        return;
+    }
+    if (op == EPOLL_CTL_ADD && (errno == EPERM || errno == EBADF)) {
+        g_unpollable[fde] = errno;
+        return;
+    }
+    PLOG(FATAL) << "epoll_ctl failed for " << dump_fde(fde);
+}
+#endif
+
 template <typename F>
 static fdevent* fdevent_create_impl(int fd, F func, void* arg) {
     check_main_thread();
@@ -145,6 +201,9 @@ static fdevent* fdevent_create_impl(int fd, F func, void* arg) {
     CHECK(pair.second) << "install existing fd " << fd;
 
     fde->state |= FDE_CREATED;
+#if defined(__linux__)
+    fdevent_epoll_ctl(fde, EPOLL_CTL_ADD);
+#endif
     return fde;
 }
 
@@ -169,6 +228,13 @@ unique_fd fdevent_release(fdevent* fde) {
     unique_fd result = std::move(fde->fd);
     if (fde->state & FDE_ACTIVE) {
         g_poll_node_map.erase(result.get());
+        g_timeout_set.erase(fde);
+#if defined(__linux__)
+        // This fails harmlessly for an fdevent left over from before fdevent_reset().
+        if (g_unpollable.erase(fde) == 0) {
+            epoll_ctl(fdevent_epoll_fd(), EPOLL_CTL_DEL, result.get(), nullptr);
+        }
+#endif
 
         if (fde->state & FDE_PENDING) {
             g_pending_list.remove(fde);
@@ -202,6 +268,11 @@ static void fdevent_update(fdevent* fde, unsigned events) {
         node.pollfd.events &= ~POLLOUT;
     }
     fde->state = (fde->state & FDE_STATEMASK) | events;
+#if defined(__linux__)
+    if (g_unpollable.count(fde) == 0) {
+        fdevent_epoll_ctl(fde, EPOLL_CTL_MOD);
+    }
+#endif
 }
 
 void fdevent_set(fdevent* fde, unsigned events) {
@@ -240,8 +311,14 @@ void fdevent_set_timeout(fdevent* fde, std::optional<std::chrono::milliseconds>
     check_main_thread();
     fde->timeout = timeout;
     fde->last_active = std::chrono::steady_clock::now();
+    if (timeout) {
+        g_timeout_set.insert(fde);
+    } else {
+        g_timeout_set.erase(fde);
+    }
 }
 
+#if !defined(__linux__)
 static std::string dump_pollfds(const std::vector<adb_pollfd>& pollfds) {
     std::string result;
     for (const auto& pollfd : pollfds) {
@@ -256,17 +333,17 @@ static std::string dump_pollfds(const std::vector<adb_pollfd>& pollfds) {
     }
     return result;
 }
+#endif
 
 static std::optional<std::chrono::milliseconds> calculate_timeout() {
     std::optional<std::chrono::milliseconds> result = std::nullopt;
     auto now = std::chrono::steady_clock::now();
     check_main_thread();
 
-    for (const auto& [fd, pollnode] : g_poll_node_map) {
-        UNUSED(fd);
-        auto timeout_opt = pollnode.fde->timeout;
+    for (fdevent* fde : g_timeout_set) {
+        auto timeout_opt = fde->timeout;
         if (timeout_opt) {
-            auto deadline = pollnode.fde->last_active + *timeout_opt;
+            auto deadline = fde->last_active + *timeout_opt;
             auto time_left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
             if (time_left < std::chrono::milliseconds::zero()) {
                 time_left = std::chrono::milliseconds::zero();
@@ -283,7 +360,48 @@ static std::optional<std::chrono::milliseconds> calculate_timeout() {
     return result;
 }
 
-static void fdevent_process() {
+#if defined(__linux__)
+static void fdevent_wait(int timeout_ms, std::vector<std::pair<fdevent*, unsigned>>* ready) {
+    for (const auto& [fde, error] : g_unpollable) {
+        unsigned events = (error == EBADF) ? (FDE_READ | FDE_ERROR)
+                                           : (fde->state & (FDE_READ | FDE_WRITE));
+        if (events != 0) {
+            ready->emplace_back(fde, events);
+            timeout_ms = 0;
+        }
+    }
+
+    epoll_event epoll_events[kMaxEpollEvents];
+    D("epoll_wait(), %zu fds installed", g_poll_node_map.size());
+    int ret = epoll_wait(fdevent_epoll_fd(), epoll_events, kMaxEpollEvents, timeout_ms);
+    if (ret == -1) {
+        if (errno != EINTR) {
+            PLOG(ERROR) << "epoll_wait(), ret = " << ret;
+        }
+        return;
+    }
+
+    for (int i = 0; i < ret; ++i) {
+        fdevent* fde = static_cast<fdevent*>(epoll_events[i].data.ptr);
+        uint32_t revents = epoll_events[i].events;
+        D("for fd %d, revents = %x", fde->fd.get(), revents);
+        unsigned events = 0;
+        if (revents & EPOLLIN) {
+            events |= FDE_READ;
+        }
+        if (revents & EPOLLOUT) {
+            events |= FDE_WRITE;
+        }
+        if (revents & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+            // We fake a read, as the rest of the code assumes that errors will
+            // be detected at that point.
+            events |= FDE_READ | FDE_ERROR;
+        }
+        ready->emplace_back(fde, events);
+    }
+}
+#else
+static void fdevent_wait(int timeout_ms, std::vector<std::pair<fdevent*, unsigned>>* ready) {
     std::vector<adb_pollfd> pollfds;
     for (const auto& pair : g_poll_node_map) {
         pollfds.push_back(pair.second.pollfd);
@@ -291,22 +409,12 @@ static void fdevent_process() {
     CHECK_GT(pollfds.size(), 0u);
     D("poll(), pollfds = %s", dump_pollfds(pollfds).c_str());
 
-    auto timeout = calculate_timeout();
-    int timeout_ms;
-    if (!timeout) {
-        timeout_ms = -1;
-    } else {
-        timeout_ms = timeout->count();
-    }
-
     int ret = adb_poll(&pollfds[0], pollfds.size(), timeout_ms);
     if (ret == -1) {
         PLOG(ERROR) << "poll(), ret = " << ret;
         return;
     }
 
-    auto post_poll = std::chrono::steady_clock::now();
-
     for (const auto& pollfd : pollfds) {
         if (pollfd.revents != 0) {
             D("for fd %d, revents = %x", pollfd.fd, pollfd.revents);
@@ -323,30 +431,50 @@ static void fdevent_process() {
             // be detected at that point.
             events |= FDE_READ | FDE_ERROR;
         }
-#if defined(__linux__)
-        if (pollfd.revents & POLLRDHUP) {
-            events |= FDE_READ | FDE_ERROR;
+        if (events != 0) {
+            auto it = g_poll_node_map.find(pollfd.fd);
+            CHECK(it != g_poll_node_map.end());
+            CHECK_EQ(it->second.fde->fd.get(), pollfd.fd);
+            ready->emplace_back(it->second.fde, events);
         }
+    }
+}
 #endif
-        auto it = g_poll_node_map.find(pollfd.fd);
-        CHECK(it != g_poll_node_map.end());
-        fdevent* fde = it->second.fde;
-
-        if (events == 0) {
-            // Check for timeout.
-            if (fde->timeout) {
-                auto deadline = fde->last_active + *fde->timeout;
-                if (deadline < post_poll) {
-                    events |= FDE_TIMEOUT;
-                }
-            }
+
+static void fdevent_process() {
+    auto timeout = calculate_timeout();
+    int timeout_ms;
+    if (!timeout) {
+        timeout_ms = -1;
+    } else {
+        timeout_ms = timeout->count();
+    }
+
+    static auto& ready = *new std::vector<std::pair<fdevent*, unsigned>>();
+    ready.clear();
+    fdevent_wait(timeout_ms, &ready);
+
+    auto post_poll = std::chrono::steady_clock::now();
+
+    for (const auto& [fde, events] : ready) {
+        fde->events |= events;
+        fde->last_active = post_poll;
+        D("%s got events %x", dump_fde(fde).c_str(), events);
+        if (!(fde->state & FDE_PENDING)) {
+            fde->state |= FDE_PENDING;
+            g_pending_list.push_back(fde);
         }
+    }
 
-        if (events != 0) {
-            CHECK_EQ(fde->fd.get(), pollfd.fd);
-            fde->events |= events;
+    for (fdevent* fde : g_timeout_set) {
+        if (fde->state & FDE_PENDING) {
+            continue;
+        }
+        auto deadline = fde->last_active + *fde->timeout;
+        if (deadline < post_poll) {
+            fde->events |= FDE_TIMEOUT;
             fde->last_active = post_poll;
-            D("%s got events %x", dump_fde(fde).c_str(), events);
+            D("%s got events %x", dump_fde(fde).c_str(), FDE_TIMEOUT);
             fde->state |= FDE_PENDING;
             g_pending_list.push_back(fde);
         }
@@ -543,6 +671,11 @@ size_t fdevent_installed_count() {
 void fdevent_reset() {
     g_poll_node_map.clear();
     g_pending_list.clear();
+    g_timeout_set.clear();
+#if defined(__linux__)
+    g_unpollable.clear();
+    g_epoll_fd.reset();
+#endif
 
     std::lock_guard<std::mutex> lock(run_queue_mutex);
     run_queue_notify_fd.reset();
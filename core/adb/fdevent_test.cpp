@@ -26,6 +26,8 @@
 #include <thread>
 #include <vector>
 
+#include <android-base/file.h>
+
 #include "adb_io.h"
 #include "fdevent_test.h"
 
@@ -357,3 +359,69 @@ TEST_F(FdeventTest, timeout) {
     ASSERT_LT(diff[1], delta.count() * 0.5);
     ASSERT_LT(diff[2], delta.count() * 0.5);
 }
+
+TEST_F(FdeventTest, many_fds) {
+    PrepareThread();
+
+    // Only the fds written to should see any events, however many sit idle.
+    static constexpr size_t kPairCount = 256;
+    std::vector<unique_fd> writers;
+    std::vector<size_t> reads(kPairCount);
+    std::vector<fdevent*> fdes;
+    fdevent_run_on_main_thread([&]() {
+        for (size_t i = 0; i < kPairCount; ++i) {
+            int fds[2];
+            ASSERT_EQ(0, adb_socketpair(fds));
+            writers.emplace_back(fds[1]);
+            fdevent* fde = fdevent_create(fds[0], [](fdevent* fde, unsigned events, void* arg) {
+                ASSERT_EQ(static_cast<unsigned>(FDE_READ), events);
+                char c;
+                ASSERT_EQ(1, adb_read(fde->fd.get(), &c, 1));
+                ++*static_cast<size_t*>(arg);
+            }, &reads[i]);
+            fdevent_add(fde, FDE_READ);
+            fdes.push_back(fde);
+        }
+    });
+    WaitForFdeventLoop();
+    ASSERT_EQ(kPairCount + GetAdditionalLocalSocketCount(), fdevent_installed_count());
+
+    for (size_t i = 0; i < kPairCount; i += 7) {
+        ASSERT_TRUE(WriteFdExactly(writers[i], "x", 1));
+    }
+    WaitForFdeventLoop();
+
+    fdevent_run_on_main_thread([&fdes]() {
+        for (fdevent* fde : fdes) {
+            fdevent_destroy(fde);
+        }
+    });
+    WaitForFdeventLoop();
+    TerminateThread();
+
+    for (size_t i = 0; i < kPairCount; ++i) {
+        EXPECT_EQ(i % 7 == 0 ? 1u : 0u, reads[i]) << "fd pair " << i;
+    }
+}
+
+#if !defined(_WIN32)
+TEST_F(FdeventTest, regular_file) {
+    // A regular file can't be added to an epoll set, it must still be reported
+    // as always ready the way poll() does.
+    TemporaryFile tf;
+    PrepareThread();
+
+    unsigned events = 0;
+    fdevent_run_on_main_thread([&]() {
+        fdevent* fde = fdevent_create(dup(tf.fd), [](fdevent* fde, unsigned events, void* arg) {
+            *static_cast<unsigned*>(arg) |= events;
+            fdevent_destroy(fde);
+        }, &events);
+        fdevent_add(fde, FDE_READ | FDE_WRITE);
+    });
+    WaitForFdeventLoop();
+    TerminateThread();
+
+    ASSERT_EQ(static_cast<unsigned>(FDE_READ | FDE_WRITE), events);
+}
+#endif
@@ -22,15 +22,29 @@
 #define ID_STAT_V2 MKID('S', 'T', 'A', '2')
 #define ID_LSTAT_V2 MKID('L', 'S', 'T', '2')
 #define ID_LIST MKID('L', 'I', 'S', 'T')
+#define ID_LIST_V2 MKID('L', 'I', 'S', '2')
 #define ID_SEND MKID('S', 'E', 'N', 'D')
+#define ID_SEND_V2 MKID('S', 'N', 'D', '2')
 #define ID_RECV MKID('R', 'E', 'C', 'V')
+#define ID_RECV_V2 MKID('R', 'C', 'V', '2')
 #define ID_DENT MKID('D', 'E', 'N', 'T')
+#define ID_DENT_V2 MKID('D', 'N', 'T', '2')
+#define ID_CHUNKS MKID('C', 'H', 'N', 'K')
+#define ID_BASE MKID('B', 'A', 'S', 'E')
 #define ID_DONE MKID('D', 'O', 'N', 'E')
 #define ID_DATA MKID('D', 'A', 'T', 'A')
 #define ID_OKAY MKID('O', 'K', 'A', 'Y')
 #define ID_FAIL MKID('F', 'A', 'I', 'L')
 #define ID_QUIT MKID('Q', 'U', 'I', 'T')
 
+// Flags for ID_SEND_V2 and ID_RECV_V2.
+enum SyncFlag : uint32_t {
+    kSyncFlagNone = 0,
+    kSyncFlagBrotli = 1,  // ID_DATA payloads are one brotli stream.
+    kSyncFlagDelta = 2,   // ID_SEND_V2 only: the (decompressed) data is a delta (see delta_utils.h)
+                          // against the file named by an ID_BASE request following the setup.
+};
+
 struct SyncRequest {
     uint32_t id;           // ID_STAT, et cetera.
     uint32_t path_length;  // <= 1024
@@ -65,6 +79,30 @@ union syncmsg {
         uint32_t time;
         uint32_t namelen;
     } dent;
+    struct __attribute__((packed)) {
+        uint32_t id;
+        uint32_t error;
+        uint64_t dev;
+        uint64_t ino;
+        uint32_t mode;
+        uint32_t nlink;
+        uint32_t uid;
+        uint32_t gid;
+        uint64_t size;
+        int64_t atime;
+        int64_t mtime;
+        int64_t ctime;
+        uint32_t namelen;
+    } dent_v2;  // followed by `namelen` bytes of the name.
+    struct __attribute__((packed)) {
+        uint32_t id;
+        uint32_t mode;
+        uint32_t flags;
+    } send_v2_setup;
+    struct __attribute__((packed)) {
+        uint32_t id;
+        uint32_t flags;
+    } recv_v2_setup;
     struct __attribute__((packed)) {
         uint32_t id;
         uint32_t size;
@@ -73,6 +73,10 @@ const char* const kFeatureFixedPushMkdir = "fixed_push_mkdir";
 const char* const kFeatureAbb = "abb";
 const char* const kFeatureFixedPushSymlinkTimestamp = "fixed_push_symlink_timestamp";
 const char* const kFeatureAbbExec = "abb_exec";
+const char* const kFeatureSendRecv2 = "sendrecv_v2";
+const char* const kFeatureSendRecv2Brotli = "sendrecv_v2_brotli";
+const char* const kFeatureLs2 = "ls_v2";
+const char* const kFeatureSendRecv2Delta = "sendrecv_v2_delta";
 
 namespace {
 
@@ -1053,6 +1057,10 @@ const FeatureSet& supported_features() {
             kFeatureAbb,
             kFeatureFixedPushSymlinkTimestamp,
             kFeatureAbbExec,
+            kFeatureSendRecv2,
+            kFeatureSendRecv2Brotli,
+            kFeatureLs2,
+            kFeatureSendRecv2Delta,
             // Increment ADB_SERVER_VERSION when adding a feature that adbd needs
             // to know about. Otherwise, the client can be stuck running an old
             // version of the server even after upgrading their copy of adb.
@@ -69,6 +69,14 @@ extern const char* const kFeatureFixedPushMkdir;
 extern const char* const kFeatureAbb;
 // adbd properly updates symlink timestamps on push.
 extern const char* const kFeatureFixedPushSymlinkTimestamp;
+// adbd supports ID_SEND_V2/ID_RECV_V2, with pipelined transfers (see SYNC.TXT).
+extern const char* const kFeatureSendRecv2;
+// adbd supports brotli compression for ID_SEND_V2/ID_RECV_V2.
+extern const char* const kFeatureSendRecv2Brotli;
+// adbd supports ID_LIST_V2.
+extern const char* const kFeatureLs2;
+// adbd supports ID_CHUNKS and delta transfers with ID_SEND_V2.
+extern const char* const kFeatureSendRecv2Delta;
 
 TransportId NextTransportId();
 
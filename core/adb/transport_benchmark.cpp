@@ -16,11 +16,17 @@
 
 #include <malloc.h>
 #include <stdio.h>
+#include <sys/resource.h>
+
+#include <future>
+#include <vector>
 
 #include <android-base/logging.h>
 #include <benchmark/benchmark.h>
 
+#include "adb_io.h"
 #include "adb_trace.h"
+#include "fdevent.h"
 #include "sysdeps.h"
 #include "transport.h"
 
@@ -182,6 +188,79 @@ void BM_Connection_Echo(benchmark::State& state) {
 ADB_CONNECTION_BENCHMARK(BM_Connection_Echo, ThreadPolicy::SameThread);
 ADB_CONNECTION_BENCHMARK(BM_Connection_Echo, ThreadPolicy::MainThread);
 
+static std::chrono::nanoseconds ProcessCpuTime() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    auto to_ns = [](const timeval& tv) {
+        return std::chrono::seconds(tv.tv_sec) + std::chrono::microseconds(tv.tv_usec);
+    };
+    return to_ns(usage.ru_utime) + to_ns(usage.ru_stime);
+}
+
+// Round trip of a byte through an fdevent that echoes it back, with range(0)
+// other fds installed and idle. Reports the CPU time of the whole process,
+// fdevent thread included, per round trip.
+void BM_fdevent_idle_fds(benchmark::State& state) {
+    fdevent_reset();
+    std::thread fdevent_thread([]() { fdevent_loop(); });
+
+    int echo_fds[2];
+    if (adb_socketpair(echo_fds) != 0) {
+        LOG(FATAL) << "failed to create socketpair";
+    }
+    unique_fd echo(echo_fds[0]);
+
+    std::vector<unique_fd> idle;
+    std::vector<fdevent*> fdes;
+    std::promise<void> installed;
+    fdevent_run_on_main_thread([&]() {
+        fdevent* fde = fdevent_create(echo_fds[1], [](int fd, unsigned, void*) {
+            char c;
+            if (adb_read(fd, &c, 1) == 1) {
+                adb_write(fd, &c, 1);
+            }
+        }, nullptr);
+        fdevent_add(fde, FDE_READ);
+        fdes.push_back(fde);
+
+        for (int i = 0; i < state.range(0); ++i) {
+            int fds[2];
+            if (adb_socketpair(fds) != 0) {
+                LOG(FATAL) << "failed to create socketpair";
+            }
+            idle.emplace_back(fds[0]);
+            fde = fdevent_create(fds[1], [](int, unsigned, void*) {}, nullptr);
+            fdevent_add(fde, FDE_READ);
+            fdes.push_back(fde);
+        }
+        installed.set_value();
+    });
+    installed.get_future().wait();
+
+    auto cpu_start = ProcessCpuTime();
+    for (auto _ : state) {
+        char c = 'x';
+        if (!WriteFdExactly(echo.get(), &c, 1) || !ReadFdExactly(echo.get(), &c, 1)) {
+            state.SkipWithError("echo failed");
+            break;
+        }
+    }
+    auto cpu_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(ProcessCpuTime() - cpu_start);
+    state.counters["cpu_ns"] =
+            benchmark::Counter(cpu_ns.count(), benchmark::Counter::kAvgIterations);
+
+    fdevent_run_on_main_thread([&fdes]() {
+        for (fdevent* fde : fdes) {
+            fdevent_destroy(fde);
+        }
+    });
+    fdevent_terminate_loop();
+    fdevent_run_on_main_thread([]() {});
+    fdevent_thread.join();
+}
+
+BENCHMARK(BM_fdevent_idle_fds)->Arg(0)->Arg(16)->Arg(64)->Arg(256)->UseRealTime();
+
 int main(int argc, char** argv) {
     // Set M_DECAY_TIME so that our allocations aren't immediately purged on free.
     mallopt(M_DECAY_TIME, 1);
@@ -110,12 +110,10 @@ static Result<Success> do_class_start(const BuiltinArguments& args) {
         return Success();
     // Starting a class does not start services which are explicitly disabled.
     // They must  be started individually.
-    for (const auto& service : ServiceList::GetInstance()) {
-        if (service->classnames().count(args[1])) {
-            if (auto result = service->StartIfNotDisabled(); !result) {
-                LOG(ERROR) << "Could not start service '" << service->name()
-                           << "' as part of class '" << args[1] << "': " << result.error();
-            }
+    for (const auto& service : ServiceList::GetInstance().services_in_start_order(args[1])) {
+        if (auto result = service->StartIfNotDisabled(); !result) {
+            LOG(ERROR) << "Could not start service '" << service->name()
+                       << "' as part of class '" << args[1] << "': " << result.error();
         }
     }
     return Success();
@@ -125,12 +123,10 @@ static Result<Success> do_class_start_post_data(const BuiltinArguments& args) {
     if (args.context != kInitContext) {
         return Error() << "command 'class_start_post_data' only available in init context";
     }
-    for (const auto& service : ServiceList::GetInstance()) {
-        if (service->classnames().count(args[1])) {
-            if (auto result = service->StartIfPostData(); !result) {
-                LOG(ERROR) << "Could not start service '" << service->name()
-                           << "' as part of class '" << args[1] << "': " << result.error();
-            }
+    for (const auto& service : ServiceList::GetInstance().services_in_start_order(args[1])) {
+        if (auto result = service->StartIfPostData(); !result) {
+            LOG(ERROR) << "Could not start service '" << service->name()
+                       << "' as part of class '" << args[1] << "': " << result.error();
         }
     }
     return Success();
@@ -168,8 +168,8 @@ bool Permissions::Match(const std::string& path) const {
 
 bool SysfsPermissions::MatchWithSubsystem(const std::string& path,
                                           const std::string& subsystem) const {
-    std::string path_basename = Basename(path);
     if (name().find(subsystem) != std::string::npos) {
+        std::string path_basename = Basename(path);
         if (Match("/sys/class/" + subsystem + "/" + path_basename)) return true;
         if (Match("/sys/bus/" + subsystem + "/devices/" + path_basename)) return true;
     }
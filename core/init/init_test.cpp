@@ -134,6 +134,46 @@ service A something
     EXPECT_TRUE(service->is_override());
 }
 
+TEST(init, ServiceStartOrder) {
+    std::string init_script = R"init(
+service A something
+    class main
+    after B
+
+service B something
+    class main
+    requires C
+
+service C something
+    class main
+
+service D something
+    class main
+    after E
+
+service E something
+    class core
+
+service F something
+    class main
+    after G
+
+service G something
+    class main
+    after F
+
+)init";
+
+    ServiceList service_list;
+    TestInitText(init_script, TestFunctionMap(), {}, &service_list);
+
+    std::vector<std::string> names;
+    for (const auto& service : service_list.services_in_start_order("main")) {
+        names.emplace_back(service->name());
+    }
+    EXPECT_EQ(std::vector<std::string>({"C", "B", "A", "D", "G", "F"}), names);
+}
+
 TEST(init, EventTriggerOrderMultipleFiles) {
     // 6 total files, which should have their triggers executed in the following order:
     // 1: start - original script parsed
@@ -18,6 +18,7 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/system_properties.h>
 #include <sys/types.h>
@@ -31,6 +32,7 @@
 
 #include "util.h"
 
+using android::base::Dirname;
 using android::base::ReadFdToString;
 using android::base::StartsWith;
 using android::base::WriteStringToFd;
@@ -45,6 +47,34 @@ namespace {
 
 constexpr const char kLegacyPersistentPropertyDir[] = "/data/property";
 
+// Once the log of updates grows past this size, it is folded back into the persistent property
+// file by the next write.
+constexpr off_t kMaxPersistentPropertyLogSize = 16 * 1024;
+
+// Each record in the log is this header followed by a serialized PersistentPropertyRecord.
+struct PersistentPropertyLogHeader {
+    uint32_t size;
+    uint32_t crc;
+};
+
+int sync_group_depth = 0;
+bool sync_pending = false;
+
+std::string PersistentPropertyLogFilename() {
+    return persistent_property_filename + ".log";
+}
+
+uint32_t Crc32(const std::string& data) {
+    uint32_t crc = 0xffffffff;
+    for (unsigned char c : data) {
+        crc ^= c;
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
 void AddPersistentProperty(const std::string& name, const std::string& value,
                            PersistentProperties* persistent_properties) {
     auto persistent_property_record = persistent_properties->add_properties();
@@ -52,6 +82,18 @@ void AddPersistentProperty(const std::string& name, const std::string& value,
     persistent_property_record->set_value(value);
 }
 
+void SetPersistentProperty(const std::string& name, const std::string& value,
+                           PersistentProperties* persistent_properties) {
+    auto it = std::find_if(persistent_properties->mutable_properties()->begin(),
+                           persistent_properties->mutable_properties()->end(),
+                           [&name](const auto& record) { return record.name() == name; });
+    if (it != persistent_properties->mutable_properties()->end()) {
+        it->set_value(value);
+    } else {
+        AddPersistentProperty(name, value, persistent_properties);
+    }
+}
+
 Result<PersistentProperties> LoadLegacyPersistentProperties() {
     std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(kLegacyPersistentPropertyDir), closedir);
     if (!dir) {
@@ -154,18 +196,123 @@ Result<std::string> ReadPersistentPropertyFile() {
     return *file_contents;
 }
 
+// Applies the updates in the log on top of |persistent_properties|.  A record that is incomplete or
+// fails its checksum can only come from an append that was interrupted, so it and anything after
+// it are dropped from the log.
+Result<Success> ReplayPersistentPropertyLog(PersistentProperties* persistent_properties) {
+    const std::string log_filename = PersistentPropertyLogFilename();
+    unique_fd fd(TEMP_FAILURE_RETRY(open(log_filename.c_str(), O_RDWR | O_NOFOLLOW | O_CLOEXEC)));
+    if (fd == -1) {
+        if (errno == ENOENT) return Success();
+        return ErrnoError() << "Unable to open persistent property log";
+    }
+    std::string contents;
+    if (!ReadFdToString(fd, &contents)) {
+        return ErrnoError() << "Unable to read persistent property log";
+    }
+
+    size_t offset = 0;
+    while (contents.size() - offset >= sizeof(PersistentPropertyLogHeader)) {
+        PersistentPropertyLogHeader header;
+        memcpy(&header, &contents[offset], sizeof(header));
+        size_t remaining = contents.size() - offset - sizeof(header);
+        if (header.size == 0 || header.size > remaining) break;
+
+        std::string data = contents.substr(offset + sizeof(header), header.size);
+        PersistentProperties::PersistentPropertyRecord record;
+        if (Crc32(data) != header.crc || !record.ParseFromString(data)) break;
+
+        SetPersistentProperty(record.name(), record.value(), persistent_properties);
+        offset += sizeof(header) + header.size;
+    }
+
+    if (offset != contents.size()) {
+        LOG(WARNING) << "Discarding " << contents.size() - offset
+                     << " bytes of incomplete persistent property log";
+        if (ftruncate(fd, offset) == -1) {
+            return ErrnoError() << "Unable to truncate persistent property log";
+        }
+    }
+    return Success();
+}
+
+// Returns false if there is no log to append to, in which case the persistent property file has
+// to be rewritten.
+Result<bool> AppendPersistentPropertyLog(const std::string& name, const std::string& value) {
+    const std::string log_filename = PersistentPropertyLogFilename();
+    unique_fd fd(TEMP_FAILURE_RETRY(
+        open(log_filename.c_str(), O_WRONLY | O_APPEND | O_NOFOLLOW | O_CLOEXEC)));
+    if (fd == -1) {
+        if (errno == ENOENT) return false;
+        return ErrnoError() << "Unable to open persistent property log";
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) == -1) {
+        return ErrnoError() << "fstat on persistent property log failed";
+    }
+    if (sb.st_size >= kMaxPersistentPropertyLogSize) return false;
+
+    PersistentProperties::PersistentPropertyRecord record;
+    record.set_name(name);
+    record.set_value(value);
+    std::string data;
+    if (!record.SerializeToString(&data)) {
+        return Error() << "Unable to serialize property";
+    }
+
+    // Write the header and record together, so that a torn write is at the end of the log.
+    PersistentPropertyLogHeader header = {static_cast<uint32_t>(data.size()), Crc32(data)};
+    data.insert(0, reinterpret_cast<const char*>(&header), sizeof(header));
+    if (!WriteStringToFd(data, fd)) {
+        int saved_errno = errno;
+        // Don't leave a partial record for later appends to follow.
+        ftruncate(fd, sb.st_size);
+        return Error(saved_errno) << "Unable to append to persistent property log";
+    }
+
+    if (sync_group_depth > 0) {
+        sync_pending = true;
+    } else {
+        fdatasync(fd);
+    }
+    return true;
+}
+
 }  // namespace
 
+PersistentPropertySyncGroup::PersistentPropertySyncGroup() {
+    ++sync_group_depth;
+}
+
+PersistentPropertySyncGroup::~PersistentPropertySyncGroup() {
+    if (--sync_group_depth > 0 || !sync_pending) return;
+
+    sync_pending = false;
+    unique_fd fd(TEMP_FAILURE_RETRY(
+        open(PersistentPropertyLogFilename().c_str(), O_WRONLY | O_NOFOLLOW | O_CLOEXEC)));
+    if (fd == -1 || fdatasync(fd) == -1) {
+        PLOG(ERROR) << "Unable to sync persistent property log";
+    }
+}
+
 Result<PersistentProperties> LoadPersistentPropertyFile() {
     auto file_contents = ReadPersistentPropertyFile();
     if (!file_contents) return file_contents.error();
 
     PersistentProperties persistent_properties;
-    if (persistent_properties.ParseFromString(*file_contents)) return persistent_properties;
+    if (persistent_properties.ParseFromString(*file_contents)) {
+        if (auto result = ReplayPersistentPropertyLog(&persistent_properties); !result) {
+            return result.error();
+        }
+        return persistent_properties;
+    }
 
     // If the file cannot be parsed in either format, then we don't have any recovery
     // mechanisms, so we delete it to allow for future writes to take place successfully.
+    // The log only makes sense on top of the file, so it goes too.
     unlink(persistent_property_filename.c_str());
+    unlink(PersistentPropertyLogFilename().c_str());
     return Error() << "Unable to parse persistent property file: Could not parse protobuf";
 }
 
@@ -191,12 +338,40 @@ Result<Success> WritePersistentPropertyFile(const PersistentProperties& persiste
         unlink(temp_filename.c_str());
         return Error(saved_errno) << "Unable to rename persistent property file";
     }
+
+    // The rename has to reach the disk before the log is emptied, or a crash in between could
+    // leave the old file next to an empty log.
+    const std::string dir = Dirname(persistent_property_filename);
+    unique_fd dir_fd(TEMP_FAILURE_RETRY(open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)));
+    if (dir_fd == -1) {
+        return ErrnoError() << "Unable to open persistent property directory";
+    }
+    if (fsync(dir_fd) == -1) {
+        return ErrnoError() << "Unable to fsync persistent property directory";
+    }
+
+    // The new file includes everything in the log, so start a new, empty one.  If we crash before
+    // this, replaying the old log on top of the new file is harmless.
+    const std::string log_filename = PersistentPropertyLogFilename();
+    unique_fd log_fd(TEMP_FAILURE_RETRY(open(
+        log_filename.c_str(), O_WRONLY | O_CREAT | O_NOFOLLOW | O_TRUNC | O_CLOEXEC, 0600)));
+    if (log_fd == -1) {
+        return ErrnoError() << "Could not create persistent property log";
+    }
+    fsync(log_fd);
     return Success();
 }
 
-// Persistent properties are not written often, so we rather not keep any data in memory and read
-// then rewrite the persistent property file for each update.
+// Persistent properties are not written often, so we rather not keep any data in memory.  Updates
+// are appended to a log next to the persistent property file, which is only rewritten once the
+// log grows too large.
 void WritePersistentProperty(const std::string& name, const std::string& value) {
+    auto appended = AppendPersistentPropertyLog(name, value);
+    if (appended && *appended) return;
+    if (!appended) {
+        LOG(ERROR) << "Rewriting persistent property file: " << appended.error();
+    }
+
     auto persistent_properties = LoadPersistentPropertyFile();
 
     if (!persistent_properties) {
@@ -204,15 +379,7 @@ void WritePersistentProperty(const std::string& name, const std::string& value)
                    << persistent_properties.error();
         persistent_properties = LoadPersistentPropertiesFromMemory();
     }
-    auto it = std::find_if(persistent_properties->mutable_properties()->begin(),
-                           persistent_properties->mutable_properties()->end(),
-                           [&name](const auto& record) { return record.name() == name; });
-    if (it != persistent_properties->mutable_properties()->end()) {
-        it->set_name(name);
-        it->set_value(value);
-    } else {
-        AddPersistentProperty(name, value, &persistent_properties.value());
-    }
+    SetPersistentProperty(name, value, &persistent_properties.value());
 
     if (auto result = WritePersistentPropertyFile(*persistent_properties); !result) {
         LOG(ERROR) << "Could not store persistent property: " << result.error();
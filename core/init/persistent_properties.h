@@ -19,6 +19,8 @@
 
 #include <string>
 
+#include <android-base/macros.h>
+
 #include "result.h"
 #include "system/core/init/persistent_properties.pb.h"
 
@@ -28,6 +30,17 @@ namespace init {
 PersistentProperties LoadPersistentProperties();
 void WritePersistentProperty(const std::string& name, const std::string& value);
 
+// Persistent property writes made while a PersistentPropertySyncGroup exists are synced to disk
+// together when the outermost group is destroyed, rather than one at a time.
+class PersistentPropertySyncGroup {
+  public:
+    PersistentPropertySyncGroup();
+    ~PersistentPropertySyncGroup();
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(PersistentPropertySyncGroup);
+};
+
 // Exposed only for testing
 Result<PersistentProperties> LoadPersistentPropertyFile();
 Result<Success> WritePersistentPropertyFile(const PersistentProperties& persistent_properties);
@@ -17,6 +17,7 @@
 #include "persistent_properties.h"
 
 #include <errno.h>
+#include <sys/stat.h>
 
 #include <vector>
 
@@ -152,5 +153,95 @@ TEST(persistent_properties, UpdatePropertyBadParse) {
     EXPECT_FALSE(it == read_back_properties.properties().end());
 }
 
+TEST(persistent_properties, UpdatesAreAppendedToLog) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    persistent_property_filename = tf.path;
+
+    std::vector<std::pair<std::string, std::string>> persistent_properties = {
+        {"persist.sys.locale", "en-US"},
+        {"persist.sys.timezone", "America/Los_Angeles"},
+    };
+    ASSERT_TRUE(WritePersistentPropertyFile(VectorToPersistentProperties(persistent_properties)));
+    std::string file_contents;
+    ASSERT_TRUE(android::base::ReadFileToString(tf.path, &file_contents));
+
+    WritePersistentProperty("persist.sys.locale", "pt-BR");
+    WritePersistentProperty("persist.test.new", "1");
+    WritePersistentProperty("persist.sys.locale", "fr-FR");
+
+    // The file itself is untouched until the log is compacted.
+    std::string new_file_contents;
+    ASSERT_TRUE(android::base::ReadFileToString(tf.path, &new_file_contents));
+    EXPECT_EQ(file_contents, new_file_contents);
+
+    std::vector<std::pair<std::string, std::string>> persistent_properties_expected = {
+        {"persist.sys.locale", "fr-FR"},
+        {"persist.sys.timezone", "America/Los_Angeles"},
+        {"persist.test.new", "1"},
+    };
+    CheckPropertiesEqual(persistent_properties_expected, LoadPersistentProperties());
+    unlink((tf.path + ".log"s).c_str());
+}
+
+TEST(persistent_properties, TornLogRecord) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    persistent_property_filename = tf.path;
+    std::string log_filename = tf.path + ".log"s;
+
+    ASSERT_TRUE(WritePersistentPropertyFile(
+        VectorToPersistentProperties({{"persist.sys.timezone", "America/Los_Angeles"}})));
+    WritePersistentProperty("persist.sys.locale", "pt-BR");
+    std::string log_contents;
+    ASSERT_TRUE(android::base::ReadFileToString(log_filename, &log_contents));
+
+    // Simulate a crash part way through appending the next record.
+    WritePersistentProperty("persist.test.torn", "value");
+    struct stat sb;
+    ASSERT_EQ(0, stat(log_filename.c_str(), &sb));
+    ASSERT_EQ(0, truncate(log_filename.c_str(), sb.st_size - 1));
+
+    std::vector<std::pair<std::string, std::string>> persistent_properties_expected = {
+        {"persist.sys.timezone", "America/Los_Angeles"},
+        {"persist.sys.locale", "pt-BR"},
+    };
+    CheckPropertiesEqual(persistent_properties_expected, LoadPersistentProperties());
+
+    // Loading drops the partial record, so later appends aren't lost behind it.
+    std::string new_log_contents;
+    ASSERT_TRUE(android::base::ReadFileToString(log_filename, &new_log_contents));
+    EXPECT_EQ(log_contents, new_log_contents);
+
+    WritePersistentProperty("persist.test.torn", "value");
+    persistent_properties_expected.emplace_back("persist.test.torn", "value");
+    CheckPropertiesEqual(persistent_properties_expected, LoadPersistentProperties());
+    unlink(log_filename.c_str());
+}
+
+TEST(persistent_properties, LogCompaction) {
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    persistent_property_filename = tf.path;
+    std::string log_filename = tf.path + ".log"s;
+
+    ASSERT_TRUE(WritePersistentPropertyFile(PersistentProperties()));
+
+    std::vector<std::pair<std::string, std::string>> persistent_properties_expected;
+    for (int i = 0; i < 1000; ++i) {
+        auto name = "persist.test.compaction" + std::to_string(i % 100);
+        auto value = std::to_string(i);
+        WritePersistentProperty(name, value);
+        if (i >= 900) persistent_properties_expected.emplace_back(name, value);
+    }
+
+    struct stat sb;
+    ASSERT_EQ(0, stat(log_filename.c_str(), &sb));
+    EXPECT_LT(sb.st_size, 32 * 1024);
+
+    CheckPropertiesEqual(persistent_properties_expected, LoadPersistentProperties());
+    unlink(log_filename.c_str());
+}
+
 }  // namespace init
 }  // namespace android
@@ -50,6 +50,7 @@
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <cutils/properties.h>
 #include <property_info_parser/property_info_parser.h>
 #include <property_info_serializer/property_info_serializer.h>
 #include <selinux/android.h>
@@ -329,6 +330,12 @@ class SocketConnection {
         return result == sizeof(value);
     }
 
+    bool SendUint32s(const std::vector<uint32_t>& values) {
+        size_t size = values.size() * sizeof(values[0]);
+        int result = TEMP_FAILURE_RETRY(send(socket_, values.data(), size, 0));
+        return result == static_cast<int>(size);
+    }
+
     int socket() { return socket_; }
 
     const ucred& cred() { return cred_; }
@@ -588,6 +595,50 @@ static void handle_property_set_fd() {
         break;
       }
 
+    case PROPERTY_MSG_SETPROP_BATCH: {
+        uint32_t count = 0;
+        if (!socket.RecvUint32(&count, &timeout_ms) || count > PROPERTY_BATCH_MAX) {
+            PLOG(ERROR) << "sys_prop(PROPERTY_MSG_SETPROP_BATCH): invalid batch size " << count;
+            socket.SendUint32(PROP_ERROR_READ_DATA);
+            return;
+        }
+
+        // Read the whole batch before applying any of it, so a truncated request has no effect.
+        std::vector<std::pair<std::string, std::string>> properties(count);
+        for (auto& [name, value] : properties) {
+            if (!socket.RecvString(&name, &timeout_ms) ||
+                !socket.RecvString(&value, &timeout_ms)) {
+                PLOG(ERROR) << "sys_prop(PROPERTY_MSG_SETPROP_BATCH): error while reading "
+                               "name/value from the socket";
+                socket.SendUint32(PROP_ERROR_READ_DATA);
+                return;
+            }
+        }
+
+        // The peer's credentials and security context are the same for every property in the
+        // batch, so only look them up once.
+        const auto& cr = socket.cred();
+        std::string source_context = socket.source_context();
+        std::vector<uint32_t> results;
+        results.reserve(count);
+        {
+            // Ends before the reply, so persistent properties are on disk once the peer hears back.
+            PersistentPropertySyncGroup sync_group;
+            for (const auto& [name, value] : properties) {
+                std::string error;
+                uint32_t result = HandlePropertySet(name, value, source_context, cr, &error);
+                if (result != PROP_SUCCESS) {
+                    LOG(ERROR) << "Unable to set property '" << name << "' to '" << value
+                               << "' from uid:" << cr.uid << " gid:" << cr.gid
+                               << " pid:" << cr.pid << ": " << error;
+                }
+                results.emplace_back(result);
+            }
+        }
+        socket.SendUint32s(results);
+        break;
+      }
+
     default:
         LOG(ERROR) << "sys_prop: invalid command " << cmd;
         socket.SendUint32(PROP_ERROR_INVALID_CMD);
@@ -22,8 +22,10 @@
 #include <sys/_system_properties.h>
 
 #include <android-base/properties.h>
+#include <cutils/properties.h>
 #include <gtest/gtest.h>
 
+using android::base::GetProperty;
 using android::base::SetProperty;
 
 namespace android {
@@ -69,5 +71,33 @@ TEST(property_service, non_utf8_value) {
     EXPECT_TRUE(SetProperty("property_service_utf8_test", "\xF0\x90\x80\x80"));
 }
 
+TEST(property_service, set_batch) {
+    const char* keys[] = {"property_service_batch_test.a", "property_service_batch..test",
+                          "property_service_batch_test.b"};
+    const char* values[] = {"1", "2", "3"};
+    uint32_t results[3] = {};
+
+    EXPECT_EQ(-1, property_set_batch(keys, values, 3, results));
+    EXPECT_EQ(static_cast<uint32_t>(PROP_SUCCESS), results[0]);
+    EXPECT_EQ(static_cast<uint32_t>(PROP_ERROR_INVALID_NAME), results[1]);
+    EXPECT_EQ(static_cast<uint32_t>(PROP_SUCCESS), results[2]);
+    EXPECT_EQ("1", GetProperty("property_service_batch_test.a", ""));
+    EXPECT_EQ("3", GetProperty("property_service_batch_test.b", ""));
+
+    // Batches larger than the service accepts are split up by the client.
+    std::vector<std::string> names;
+    std::vector<const char*> many_keys;
+    std::vector<const char*> many_values;
+    for (int i = 0; i < PROPERTY_BATCH_MAX + 10; ++i) {
+        names.emplace_back("property_service_batch_test.n" + std::to_string(i));
+    }
+    for (const auto& name : names) {
+        many_keys.emplace_back(name.c_str());
+        many_values.emplace_back("x");
+    }
+    EXPECT_EQ(0, property_set_batch(many_keys.data(), many_values.data(), names.size(), nullptr));
+    EXPECT_EQ("x", GetProperty(names.back(), ""));
+}
+
 }  // namespace init
 }  // namespace android
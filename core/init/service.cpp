@@ -34,6 +34,7 @@
 #include <android-base/logging.h>
 #include <android-base/parseint.h>
 #include <android-base/properties.h>
+#include <android-base/scopeguard.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
@@ -60,6 +61,7 @@
 using android::base::boot_clock;
 using android::base::GetProperty;
 using android::base::Join;
+using android::base::make_scope_guard;
 using android::base::ParseInt;
 using android::base::Split;
 using android::base::StartsWith;
@@ -360,6 +362,14 @@ void Service::Reap(const siginfo_t& siginfo) {
     flags_ &= (~SVC_RUNNING);
     start_order_ = 0;
 
+    // Services that were waiting for this one to finish can go ahead now.
+    if (flags_ & SVC_ONESHOT) {
+        completed_ = siginfo.si_code == CLD_EXITED && siginfo.si_status == 0;
+        for (const auto& service : ServiceList::GetInstance()) {
+            service->StartIfWaitingFor(*this);
+        }
+    }
+
     // Oneshot processes go into the disabled state on exit,
     // except when manually restarted.
     if ((flags_ & SVC_ONESHOT) && !(flags_ & SVC_RESTART) && !(flags_ & SVC_RESET)) {
@@ -415,6 +425,16 @@ void Service::DumpState() const {
                   [] (const auto& info) { LOG(INFO) << *info; });
 }
 
+Result<Success> Service::ParseAfter(std::vector<std::string>&& args) {
+    for (size_t i = 1; i < args.size(); i++) {
+        if (args[i] == name_) {
+            return Error() << "service cannot be started after itself";
+        }
+        after_services_.emplace_back(std::move(args[i]));
+    }
+    return Success();
+}
+
 Result<Success> Service::ParseCapabilities(std::vector<std::string>&& args) {
     capabilities_ = 0;
 
@@ -671,6 +691,16 @@ Result<Success> Service::ParseProcessRlimit(std::vector<std::string>&& args) {
     return Success();
 }
 
+Result<Success> Service::ParseRequires(std::vector<std::string>&& args) {
+    for (size_t i = 1; i < args.size(); i++) {
+        if (args[i] == name_) {
+            return Error() << "service cannot require itself";
+        }
+        required_services_.emplace_back(std::move(args[i]));
+    }
+    return Success();
+}
+
 Result<Success> Service::ParseRestartPeriod(std::vector<std::string>&& args) {
     int period;
     if (!ParseInt(args[1], &period, 5)) {
@@ -804,6 +834,7 @@ const Service::OptionParserMap::Map& Service::OptionParserMap::map() const {
     constexpr std::size_t kMax = std::numeric_limits<std::size_t>::max();
     // clang-format off
     static const Map option_parsers = {
+        {"after",       {1,     kMax, &Service::ParseAfter}},
         {"capabilities",
                         {0,     kMax, &Service::ParseCapabilities}},
         {"class",       {1,     kMax, &Service::ParseClass}},
@@ -834,6 +865,7 @@ const Service::OptionParserMap::Map& Service::OptionParserMap::map() const {
                         {1,     1,    &Service::ParseOomScoreAdjust}},
         {"override",    {0,     0,    &Service::ParseOverride}},
         {"priority",    {1,     1,    &Service::ParsePriority}},
+        {"requires",    {1,     kMax, &Service::ParseRequires}},
         {"restart_period",
                         {1,     1,    &Service::ParseRestartPeriod}},
         {"rlimit",      {3,     3,    &Service::ParseProcessRlimit}},
@@ -911,6 +943,17 @@ Result<Success> Service::Start() {
         return Success();
     }
 
+    if (auto result = StartRequiredServices(); !result) {
+        return result;
+    }
+
+    if (const Service* dependency = RunningOneshotDependency()) {
+        LOG(INFO) << "Service '" << name_ << "' will be started once '" << dependency->name()
+                  << "' has exited";
+        start_deferred_ = true;
+        return Success();
+    }
+
     bool needs_console = (flags_ & SVC_CONSOLE);
     if (needs_console) {
         if (console_.empty()) {
@@ -1079,6 +1122,7 @@ Result<Success> Service::Start() {
     pid_ = pid;
     flags_ |= SVC_RUNNING;
     start_order_ = next_start_order_++;
+    completed_ = false;
     process_cgroup_empty_ = false;
 
     bool use_memcg = swappiness_ != -1 || soft_limit_in_bytes_ != -1 || limit_in_bytes_ != -1 ||
@@ -1132,6 +1176,63 @@ Result<Success> Service::Start() {
     return Success();
 }
 
+Result<Success> Service::StartRequiredServices() {
+    // Services that require each other are started in the order they were asked for.
+    if (starting_required_services_) return Success();
+    starting_required_services_ = true;
+    auto guard = make_scope_guard([this] { starting_required_services_ = false; });
+
+    for (const auto& name : required_services_) {
+        Service* svc = ServiceList::GetInstance().FindService(name);
+        if (!svc) {
+            return Error() << "required service '" << name << "' not found";
+        }
+        if (svc->starting_required_services_) continue;
+        // A oneshot service only has to have run once.
+        if (svc->completed_) continue;
+        if (auto result = svc->Start(); !result) {
+            return Error() << "could not start required service '" << name
+                           << "': " << result.error();
+        }
+    }
+    return Success();
+}
+
+// Returns a oneshot service named by 'after' or 'requires' that is still running, if there is one.
+// Such a service is setting something up, so this one has to wait until it has exited.
+const Service* Service::RunningOneshotDependency() const {
+    for (const auto* names : {&required_services_, &after_services_}) {
+        for (const auto& name : *names) {
+            const Service* svc = ServiceList::GetInstance().FindService(name);
+            if (svc && (svc->flags_ & SVC_ONESHOT) && (svc->flags_ & SVC_RUNNING)) return svc;
+        }
+    }
+    return nullptr;
+}
+
+void Service::StartIfWaitingFor(const Service& dependency) {
+    if (!start_deferred_ || !DependsOn(dependency.name())) return;
+    start_deferred_ = false;
+
+    if (!dependency.completed_ && std::find(required_services_.begin(), required_services_.end(),
+                                            dependency.name()) != required_services_.end()) {
+        LOG(ERROR) << "Not starting service '" << name_ << "': required service '"
+                   << dependency.name() << "' failed";
+        return;
+    }
+    if (auto result = Start(); !result) {
+        LOG(ERROR) << "Could not start service '" << name_ << "' after '" << dependency.name()
+                   << "': " << result.error();
+    }
+}
+
+bool Service::DependsOn(const std::string& name) const {
+    for (const auto* names : {&required_services_, &after_services_}) {
+        if (std::find(names->begin(), names->end(), name) != names->end()) return true;
+    }
+    return false;
+}
+
 Result<Success> Service::StartIfNotDisabled() {
     if (!(flags_ & SVC_DISABLED)) {
         return Start();
@@ -1214,6 +1315,7 @@ void Service::StopOrReset(int how) {
     // The service is still SVC_RUNNING until its process exits, but if it has
     // already exited it shoudn't attempt a restart yet.
     flags_ &= ~(SVC_RESTARTING | SVC_DISABLED_START);
+    start_deferred_ = false;
 
     if ((how != SVC_DISABLED) && (how != SVC_RESET) && (how != SVC_RESTART)) {
         // An illegal flag: default to SVC_DISABLED.
@@ -1347,6 +1449,33 @@ const std::vector<Service*> ServiceList::services_in_shutdown_order() const {
     return shutdown_services;
 }
 
+// Orders the services in |classname| so that each comes after the services it is declared to
+// start 'after' or that it 'requires', and otherwise keeps the order in which they were parsed.
+// Dependencies outside the class don't affect the order, and a cycle is broken where it is found.
+// A service whose dependency is a oneshot that is still running is not forked in this order but
+// once that oneshot has exited; see Service::Start().
+const std::vector<Service*> ServiceList::services_in_start_order(
+        const std::string& classname) const {
+    std::vector<Service*> start_services;
+    std::set<const Service*> visited;
+
+    std::function<void(Service*)> visit = [&](Service* service) {
+        if (!visited.emplace(service).second) return;
+        for (const auto* names : {&service->required_services(), &service->after_services()}) {
+            for (const auto& name : *names) {
+                Service* dependency = FindService(name);
+                if (dependency && dependency->classnames().count(classname)) visit(dependency);
+            }
+        }
+        start_services.emplace_back(service);
+    };
+
+    for (const auto& service : services_) {
+        if (service->classnames().count(classname)) visit(service.get());
+    }
+    return start_services;
+}
+
 void ServiceList::RemoveService(const Service& svc) {
     auto svc_it = std::find_if(services_.begin(), services_.end(),
                                [&svc] (const std::unique_ptr<Service>& s) {
@@ -79,6 +79,7 @@ class Service {
     Result<Success> ExecStart();
     Result<Success> Start();
     Result<Success> StartIfNotDisabled();
+    void StartIfWaitingFor(const Service& dependency);
     Result<Success> StartIfPostData();
     Result<Success> Enable();
     void Reset();
@@ -127,6 +128,8 @@ class Service {
     const std::vector<std::string>& args() const { return args_; }
     bool is_updatable() const { return updatable_; }
     bool is_post_data() const { return post_data_; }
+    const std::vector<std::string>& after_services() const { return after_services_; }
+    const std::vector<std::string>& required_services() const { return required_services_; }
 
   private:
     using OptionParser = Result<Success> (Service::*)(std::vector<std::string>&& args);
@@ -141,7 +144,11 @@ class Service {
     void OpenConsole() const;
     void KillProcessGroup(int signal);
     void SetProcessAttributes();
+    Result<Success> StartRequiredServices();
+    const Service* RunningOneshotDependency() const;
+    bool DependsOn(const std::string& name) const;
 
+    Result<Success> ParseAfter(std::vector<std::string>&& args);
     Result<Success> ParseCapabilities(std::vector<std::string>&& args);
     Result<Success> ParseClass(std::vector<std::string>&& args);
     Result<Success> ParseConsole(std::vector<std::string>&& args);
@@ -164,6 +171,7 @@ class Service {
     Result<Success> ParseMemcgSwappiness(std::vector<std::string>&& args);
     Result<Success> ParseNamespace(std::vector<std::string>&& args);
     Result<Success> ParseProcessRlimit(std::vector<std::string>&& args);
+    Result<Success> ParseRequires(std::vector<std::string>&& args);
     Result<Success> ParseRestartPeriod(std::vector<std::string>&& args);
     Result<Success> ParseSeclabel(std::vector<std::string>&& args);
     Result<Success> ParseSetenv(std::vector<std::string>&& args);
@@ -251,6 +259,12 @@ class Service {
     bool post_data_ = false;
 
     bool running_at_post_data_reset_ = false;
+
+    std::vector<std::string> after_services_;     // started before this one by class_start
+    std::vector<std::string> required_services_;  // started before this one by any start
+    bool starting_required_services_ = false;
+    bool start_deferred_ = false;  // waiting for a oneshot dependency to exit
+    bool completed_ = false;       // oneshot that last exited successfully
 };
 
 class ServiceList {
@@ -291,6 +305,7 @@ class ServiceList {
     auto end() const { return services_.end(); }
     const std::vector<std::unique_ptr<Service>>& services() const { return services_; }
     const std::vector<Service*> services_in_shutdown_order() const;
+    const std::vector<Service*> services_in_start_order(const std::string& classname) const;
 
     void MarkPostData();
     bool IsPostData();
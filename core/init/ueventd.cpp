@@ -17,13 +17,18 @@
 #include "ueventd.h"
 
 #include <ctype.h>
+#include <dirent.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/wait.h>
 
+#include <atomic>
+#include <memory>
+#include <new>
 #include <set>
 #include <thread>
 
@@ -78,20 +83,27 @@
 // given file.  It is more efficient to simply do restorecon recursively on /sys during cold boot,
 // than to do restorecon on each device as its uevent is handled.  This only applies to cold boot;
 // once that has completed, restorecon is done for each device as its uevent is handled.
+// Labeling /sys is as much work as handling the uevents, so it is split into jobs (see
+// SplitRestoreCon()) that every process works through once it has nothing else to do.
 
 // With all of the above considered, the cold boot process has the below steps:
 // 1) ueventd regenerates uevents by doing the /sys traversal and listens to the netlink socket for
 //    the generated uevents.  It writes these uevents into a queue represented by a vector.
 //
-// 2) ueventd forks 'n' separate uevent handler subprocesses and has each of them to handle the
+// 2) ueventd splits the restorecon of /sys into jobs, and labels /sys itself.  This also loads the
+//    file contexts, so that the subprocesses inherit them rather than each loading their own.
+//
+// 3) ueventd forks 'n' separate uevent handler subprocesses and has each of them to handle the
 //    uevents in the queue based on a starting offset (their process number) and a stride (the total
 //    number of processes).  Note that no IPC happens at this point and only const functions from
 //    DeviceHandler should be called from this context.
 //
-// 3) In parallel to the subprocesses handling the uevents, the main thread of ueventd calls
-//    selinux_android_restorecon() recursively on /sys/class, /sys/block, and /sys/devices.
+// 4) In parallel to the subprocesses handling the uevents, the main thread of ueventd calls
+//    selinux_android_restorecon() for the restorecon jobs.  Each subprocess joins in once it has
+//    handled its uevents.  The only state they share is the index of the next job to run, which
+//    lives in a shared anonymous mapping.
 //
-// 4) Once the restorecon operation finishes, the main thread calls waitpid() to wait for all
+// 5) Once there are no restorecon jobs left, the main thread calls waitpid() to wait for all
 //    subprocess handlers to complete and exit.  Once this happens, it marks coldboot as having
 //    completed.
 //
@@ -106,6 +118,39 @@
 namespace android {
 namespace init {
 
+std::vector<RestoreConJob> SplitRestoreCon(const std::string& dir,
+                                           const std::set<std::string>& split_dirs) {
+    std::vector<RestoreConJob> jobs;
+    std::unique_ptr<DIR, decltype(&closedir)> d(opendir(dir.c_str()), closedir);
+    if (!d) {
+        jobs.push_back({dir, SELINUX_ANDROID_RESTORECON_RECURSE});
+        return jobs;
+    }
+
+    jobs.push_back({dir, 0});
+    dirent* de;
+    while ((de = readdir(d.get())) != nullptr) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+
+        std::string path = dir + "/" + de->d_name;
+        if (de->d_type == DT_DIR && split_dirs.count(path)) {
+            auto dir_jobs = SplitRestoreCon(path, split_dirs);
+            std::move(dir_jobs.begin(), dir_jobs.end(), std::back_inserter(jobs));
+        } else {
+            jobs.push_back({std::move(path), SELINUX_ANDROID_RESTORECON_RECURSE});
+        }
+    }
+    return jobs;
+}
+
+// The bulk of /sys lives under these directories, so restorecon their entries separately for an
+// even split of the work.
+static const std::set<std::string> kRestoreConSplitDirs = {
+        "/sys/devices",
+        "/sys/devices/platform",
+        "/sys/devices/virtual",
+};
+
 class ColdBoot {
   public:
     ColdBoot(UeventListener& uevent_listener,
@@ -113,14 +158,16 @@ class ColdBoot {
         : uevent_listener_(uevent_listener),
           uevent_handlers_(uevent_handlers),
           num_handler_subprocesses_(std::thread::hardware_concurrency() ?: 4) {}
+    ~ColdBoot();
 
     void Run();
 
   private:
     void UeventHandlerMain(unsigned int process_num, unsigned int total_processes);
     void RegenerateUevents();
+    void GenerateRestoreConJobs();
     void ForkSubProcesses();
-    void DoRestoreCon();
+    void DoRestoreCon(size_t max_jobs = SIZE_MAX);
     void WaitForSubProcesses();
 
     UeventListener& uevent_listener_;
@@ -129,9 +176,16 @@ class ColdBoot {
     unsigned int num_handler_subprocesses_;
     std::vector<Uevent> uevent_queue_;
 
+    std::vector<RestoreConJob> restorecon_jobs_;
+    std::atomic<size_t>* next_restorecon_job_ = nullptr;  // Shared with the subprocesses.
+
     std::set<pid_t> subprocess_pids_;
 };
 
+ColdBoot::~ColdBoot() {
+    if (next_restorecon_job_) munmap(next_restorecon_job_, sizeof(*next_restorecon_job_));
+}
+
 void ColdBoot::UeventHandlerMain(unsigned int process_num, unsigned int total_processes) {
     for (unsigned int i = process_num; i < uevent_queue_.size(); i += total_processes) {
         auto& uevent = uevent_queue_[i];
@@ -140,6 +194,7 @@ void ColdBoot::UeventHandlerMain(unsigned int process_num, unsigned int total_pr
             uevent_handler->HandleUevent(uevent);
         }
     }
+    DoRestoreCon();
     _exit(EXIT_SUCCESS);
 }
 
@@ -150,6 +205,22 @@ void ColdBoot::RegenerateUevents() {
     });
 }
 
+void ColdBoot::GenerateRestoreConJobs() {
+    restorecon_jobs_ = SplitRestoreCon("/sys", kRestoreConSplitDirs);
+
+    void* shared = mmap(nullptr, sizeof(*next_restorecon_job_), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        PLOG(FATAL) << "mmap() failed!";
+    }
+    // Only lock free atomics work between processes.
+    static_assert(std::atomic<size_t>::is_always_lock_free);
+    next_restorecon_job_ = new (shared) std::atomic<size_t>(0);
+
+    // Label /sys itself before forking, so that the file contexts are only loaded once.
+    DoRestoreCon(1);
+}
+
 void ColdBoot::ForkSubProcesses() {
     for (unsigned int i = 0; i < num_handler_subprocesses_; ++i) {
         auto pid = fork();
@@ -165,8 +236,14 @@ void ColdBoot::ForkSubProcesses() {
     }
 }
 
-void ColdBoot::DoRestoreCon() {
-    selinux_android_restorecon("/sys", SELINUX_ANDROID_RESTORECON_RECURSE);
+void ColdBoot::DoRestoreCon(size_t max_jobs) {
+    for (size_t n = 0; n < max_jobs; ++n) {
+        size_t i = next_restorecon_job_->fetch_add(1);
+        if (i >= restorecon_jobs_.size()) return;
+
+        const auto& job = restorecon_jobs_[i];
+        selinux_android_restorecon(job.path.c_str(), job.flags);
+    }
 }
 
 void ColdBoot::WaitForSubProcesses() {
@@ -207,6 +284,8 @@ void ColdBoot::Run() {
 
     RegenerateUevents();
 
+    GenerateRestoreConJobs();
+
     ForkSubProcesses();
 
     DoRestoreCon();
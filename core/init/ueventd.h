@@ -17,11 +17,26 @@
 #ifndef _INIT_UEVENTD_H_
 #define _INIT_UEVENTD_H_
 
+#include <set>
+#include <string>
+#include <vector>
+
 namespace android {
 namespace init {
 
 int ueventd_main(int argc, char** argv);
 
+struct RestoreConJob {
+    std::string path;
+    unsigned int flags;
+};
+
+// Splits a recursive restorecon of |dir| into jobs that can be run in any order, or by different
+// processes. |dir| and the directories under it in |split_dirs| are labeled on their own, and
+// each of their other entries is labeled recursively as a separate job.
+std::vector<RestoreConJob> SplitRestoreCon(const std::string& dir,
+                                           const std::set<std::string>& split_dirs);
+
 }  // namespace init
 }  // namespace android
 
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <dirent.h>
 #include <linux/futex.h>
 #include <pthread.h>
 #include <sys/stat.h>
@@ -21,17 +22,21 @@
 
 #include <atomic>
 #include <chrono>
+#include <map>
 #include <string>
 #include <thread>
 #include <vector>
 
 #include <android-base/file.h>
 #include <android-base/scopeguard.h>
+#include <android-base/strings.h>
 #include <gtest/gtest.h>
 #include <selinux/android.h>
 #include <selinux/label.h>
 #include <selinux/selinux.h>
 
+#include "ueventd.h"
+
 using namespace std::chrono_literals;
 using namespace std::string_literals;
 
@@ -201,3 +206,72 @@ TEST(ueventd, selabel_lookup_MultiThreaded) {
     EXPECT_EQ(0U, num_context_check_failures);
     EXPECT_GT(num_successes, 0U);
 }
+
+// Collects every path under |dir|, not following symlinks.
+static void ListTree(const std::string& dir, std::vector<std::string>* paths) {
+    paths->emplace_back(dir);
+    std::unique_ptr<DIR, decltype(&closedir)> d(opendir(dir.c_str()), closedir);
+    ASSERT_TRUE(d);
+    dirent* de;
+    while ((de = readdir(d.get())) != nullptr) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+        auto path = dir + "/" + de->d_name;
+        if (de->d_type == DT_DIR) {
+            ListTree(path, paths);
+        } else {
+            paths->emplace_back(path);
+        }
+    }
+}
+
+TEST(ueventd, SplitRestoreCon) {
+    // A small synthetic /sys.
+    TemporaryDir sys;
+    auto root = std::string(sys.path);
+    for (const auto& dir : {"/class", "/class/input", "/devices", "/devices/platform",
+                            "/devices/platform/soc", "/devices/platform/soc/a600000.dwc3",
+                            "/devices/platform/gpio", "/devices/virtual", "/devices/virtual/input",
+                            "/devices/virtual/input/input0", "/devices/system", "/devices/system/cpu",
+                            "/module", "/module/loop", "/module/loop/parameters"}) {
+        ASSERT_EQ(0, mkdir((root + dir).c_str(), 0755)) << dir;
+    }
+    for (const auto& file : {"/devices/platform/uevent", "/devices/platform/soc/uevent",
+                             "/devices/platform/soc/a600000.dwc3/uevent",
+                             "/devices/virtual/input/input0/uevent", "/devices/system/cpu/online",
+                             "/module/loop/parameters/max_part", "/.hidden"}) {
+        ASSERT_TRUE(android::base::WriteStringToFile("", root + file)) << file;
+    }
+    ASSERT_EQ(0, symlink("../../devices/virtual/input/input0",
+                         (root + "/class/input/input0").c_str()));
+    ASSERT_EQ(0, symlink("devices/platform", (root + "/platform").c_str()));
+
+    auto split_dirs = std::set<std::string>{root + "/devices", root + "/devices/platform",
+                                            root + "/devices/virtual", root + "/no/such/dir"};
+    auto jobs = android::init::SplitRestoreCon(root, split_dirs);
+
+    std::map<std::string, unsigned int> job_flags;
+    for (const auto& job : jobs) {
+        EXPECT_TRUE(job_flags.emplace(job.path, job.flags).second) << "duplicate job " << job.path;
+    }
+    EXPECT_EQ(0U, job_flags[root]);
+    EXPECT_EQ(0U, job_flags[root + "/devices"]);
+    EXPECT_EQ(0U, job_flags[root + "/devices/platform"]);
+    EXPECT_EQ(0U, job_flags[root + "/devices/virtual"]);
+    EXPECT_EQ(SELINUX_ANDROID_RESTORECON_RECURSE, job_flags[root + "/devices/platform/soc"]);
+    EXPECT_EQ(SELINUX_ANDROID_RESTORECON_RECURSE, job_flags[root + "/platform"]);
+    EXPECT_EQ(13U, jobs.size());
+
+    // Every path is labeled by exactly one job.
+    std::vector<std::string> paths;
+    ListTree(root, &paths);
+    for (const auto& path : paths) {
+        int labeled_by = 0;
+        for (const auto& job : jobs) {
+            if (path == job.path || ((job.flags & SELINUX_ANDROID_RESTORECON_RECURSE) &&
+                                     android::base::StartsWith(path, job.path + "/"))) {
+                ++labeled_by;
+            }
+        }
+        EXPECT_EQ(1, labeled_by) << path;
+    }
+}
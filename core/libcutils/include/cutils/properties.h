@@ -107,6 +107,22 @@ int32_t property_get_int32(const char *key, int32_t default_value);
 */
 int property_set(const char *key, const char *value);
 
+/* property_set_batch: sets count properties with a single request to the
+** property service, rather than one connection per property. Each
+** property is still subject to the same permission checks as property_set.
+**
+** results, if nonnull, receives one PROP_SUCCESS or PROP_ERROR_* code per
+** property. Returns 0 if every property was set, < 0 otherwise.
+*/
+int property_set_batch(const char* const* keys, const char* const* values, size_t count,
+                       uint32_t* results);
+
+/* The property service command used by property_set_batch, followed by a
+** uint32_t count and count (name, value) pairs of length-prefixed strings.
+** The service replies with one uint32_t result per property. */
+#define PROPERTY_MSG_SETPROP_BATCH 0x00030001
+#define PROPERTY_BATCH_MAX 64
+
 int property_list(void (*propfn)(const char *key, const char *value, void *cookie), void *cookie);
 
 #if defined(__BIONIC_FORTIFY)
@@ -25,8 +25,13 @@
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 #include <cutils/sockets.h>
 #include <log/log.h>
 
@@ -111,6 +116,95 @@ int property_set(const char *key, const char *value) {
     return __system_property_set(key, value);
 }
 
+static bool append_string(std::string* msg, const char* s) {
+    size_t len = strlen(s);
+    if (len > 0xffff) {
+        return false;
+    }
+    uint32_t len32 = len;
+    msg->append(reinterpret_cast<const char*>(&len32), sizeof(len32));
+    msg->append(s, len);
+    return true;
+}
+
+static int property_set_batch_chunk(const char* const* keys, const char* const* values,
+                                    size_t count, uint32_t* results) {
+    std::string msg;
+    uint32_t header[2] = {PROPERTY_MSG_SETPROP_BATCH, static_cast<uint32_t>(count)};
+    msg.append(reinterpret_cast<const char*>(header), sizeof(header));
+    for (size_t i = 0; i < count; ++i) {
+        if (!keys[i] || !append_string(&msg, keys[i]) ||
+            !append_string(&msg, values[i] ? values[i] : "")) {
+            return -1;
+        }
+    }
+
+    int fd = socket_local_client(PROP_SERVICE_NAME, ANDROID_SOCKET_NAMESPACE_RESERVED,
+                                 SOCK_STREAM | SOCK_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    // An older property service replies to the unknown command before it has read the rest of
+    // the batch, so a failed send doesn't mean there is no reply to read.
+    for (size_t sent = 0; sent < msg.size();) {
+        ssize_t written =
+                TEMP_FAILURE_RETRY(send(fd, &msg[sent], msg.size() - sent, MSG_NOSIGNAL));
+        if (written <= 0) {
+            break;
+        }
+        sent += written;
+    }
+
+    ssize_t expected = count * sizeof(*results);
+    ssize_t n = TEMP_FAILURE_RETRY(recv(fd, results, expected, MSG_WAITALL));
+    close(fd);
+
+    if (n >= static_cast<ssize_t>(sizeof(*results)) && results[0] == PROP_ERROR_INVALID_CMD) {
+        ALOGV("%s - property service doesn't support batches, falling back", __FUNCTION__);
+        int rc = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (property_set(keys[i], values[i]) == 0) {
+                results[i] = PROP_SUCCESS;
+            } else {
+                results[i] = PROP_ERROR_SET_FAILED;
+                rc = -1;
+            }
+        }
+        return rc;
+    }
+    if (n != expected) {
+        for (size_t i = n > 0 ? n / sizeof(*results) : 0; i < count; ++i) {
+            results[i] = PROP_ERROR_READ_DATA;
+        }
+        return -1;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (results[i] != PROP_SUCCESS) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int property_set_batch(const char* const* keys, const char* const* values, size_t count,
+                       uint32_t* results) {
+    std::vector<uint32_t> local_results;
+    if (results == nullptr) {
+        local_results.resize(count);
+        results = local_results.data();
+    }
+
+    int rc = 0;
+    for (size_t i = 0; i < count; i += PROPERTY_BATCH_MAX) {
+        size_t n = std::min(count - i, static_cast<size_t>(PROPERTY_BATCH_MAX));
+        if (property_set_batch_chunk(keys + i, values + i, n, results + i) != 0) {
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
 int property_get(const char *key, char *value, const char *default_value) {
     int len = __system_property_get(key, value);
     if (len > 0) {
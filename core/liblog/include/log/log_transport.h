@@ -23,6 +23,7 @@ extern "C" {
 #define LOGGER_NULL    0x04 /* Does not release resources of other selections */
 #define LOGGER_RESERVED 0x08 /* Reserved, previously for logging to local memory */
 #define LOGGER_STDERR  0x10 /* logs sent to stderr */
+#define LOGGER_LOGD_BATCH 0x20 /* logd, entries sent in per-thread batches */
 /* clang-format on */
 
 /* Both return the selected transport flag mask, or negative errno */
@@ -52,6 +52,70 @@ typedef struct __attribute__((__packed__)) {
   log_time realtime;
 } android_log_header_t;
 
+/*
+ * Batched entries to logd (LOGGER_LOGD_BATCH), a single datagram holding
+ * android_log_batch_header_t followed by count records. Each record is an
+ * android_log_header_t, a uint16_t payload length, then the payload. The
+ * magic sits where android_log_header_t keeps its id, and is out of range
+ * for a log id, so a logd without batch support drops the datagram.
+ */
+#define LOGGER_BATCH_MAGIC 'B'
+#define LOGGER_BATCH_MAX_LEN (4 * LOGGER_ENTRY_MAX_LEN)
+
+typedef struct __attribute__((__packed__)) {
+  uint8_t magic;
+  uint16_t count;
+} android_log_batch_header_t;
+
+/*
+ * Log chunks persisted by logd (logd.buffer.persist) to
+ * ANDROID_LOG_PERSIST_DIR, one file per chunk, so that they can be read
+ * post-mortem, including by a host logcat (--persisted=<dir>). All fields
+ * are little endian. A file is laid out as:
+ *
+ *   android_log_persist_header_t
+ *   uint32_t pids[pid_count]                   sorted
+ *   { uint8_t len; char tag[len]; }[tag_count] sorted, text buffers only
+ *   data_len bytes, zstd compressed if flags & ANDROID_LOG_PERSIST_ZSTD,
+ *     of back to back android_log_persist_entry_t each followed by
+ *     msg_len bytes of payload.
+ *
+ * The header and the pid and tag tables let a reader skip a file for a
+ * time range, pid or tag filter without decompressing the entries. A
+ * tag_count of zero means the tags were not indexed.
+ */
+#define ANDROID_LOG_PERSIST_DIR "/data/misc/logd/buffers"
+#define ANDROID_LOG_PERSIST_SUFFIX ".chunk"
+#define ANDROID_LOG_PERSIST_MAGIC 0x504c474c /* "LGLP" */
+#define ANDROID_LOG_PERSIST_VERSION 1
+#define ANDROID_LOG_PERSIST_ZSTD 0x1
+/* A chunk holds at most a quarter of the largest buffer, uncompressed */
+#define ANDROID_LOG_PERSIST_MAX_CHUNK (LOG_BUFFER_MAX_SIZE / 4)
+
+typedef struct __attribute__((__packed__)) {
+  uint32_t magic;
+  uint16_t version;
+  uint8_t log_id;
+  uint8_t flags;
+  uint32_t entry_count;
+  uint32_t pid_count;
+  uint32_t tag_count;
+  uint32_t tag_len; /* bytes used by the tag table */
+  uint32_t data_len;
+  uint32_t uncompressed_len;
+  log_time oldest;
+  log_time newest;
+} android_log_persist_header_t;
+
+typedef struct __attribute__((__packed__)) {
+  uint32_t uid;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t sequence;
+  log_time realtime;
+  uint16_t msg_len;
+} android_log_persist_entry_t;
+
 /* Event Header Structure to logd */
 typedef struct __attribute__((__packed__)) {
   int32_t tag;  // Little Endian Order
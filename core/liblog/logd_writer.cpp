@@ -19,6 +19,7 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <poll.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdatomic.h>
 #include <stdio.h>
@@ -31,7 +32,9 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <cutils/list.h>
 #include <cutils/sockets.h>
+#include <log/log_transport.h>
 #include <private/android_filesystem_config.h>
 #include <private/android_logger.h>
 
@@ -47,6 +50,7 @@ static int logdAvailable(log_id_t LogId);
 static int logdOpen();
 static void logdClose();
 static int logdWrite(log_id_t logId, struct timespec* ts, struct iovec* vec, size_t nr);
+static void logdFlushBatches();
 
 struct android_log_transport_write logdLoggerWrite = {
     .node = {&logdLoggerWrite.node, &logdLoggerWrite.node},
@@ -107,6 +111,7 @@ static void __logdClose(int negative_errno) {
 }
 
 static void logdClose() {
+  logdFlushBatches();
   __logdClose(-EBADF);
 }
 
@@ -123,6 +128,294 @@ static int logdAvailable(log_id_t logId) {
   return 1;
 }
 
+static atomic_int dropped;
+static atomic_int droppedSecurity;
+
+/*
+ * The write below could be lost, but will never block.
+ *
+ * ENOTCONN occurs if logd has died.
+ * ENOENT occurs if logd is not running and socket is missing.
+ * ECONNREFUSED occurs if we can not reconnect to logd.
+ * EAGAIN occurs if logd is overloaded.
+ */
+static ssize_t logdSend(struct iovec* vec, size_t nr) {
+  ssize_t ret;
+  int sock = atomic_load(&logdLoggerWrite.context.sock);
+
+  if (sock < 0) {
+    ret = sock;
+  } else {
+    ret = TEMP_FAILURE_RETRY(writev(sock, vec, nr));
+    if (ret < 0) {
+      ret = -errno;
+    }
+  }
+  switch (ret) {
+    case -ENOTCONN:
+    case -ECONNREFUSED:
+    case -ENOENT:
+      if (__android_log_trylock()) {
+        return ret; /* in a signal handler? try again when less stressed */
+      }
+      __logdClose(ret);
+      ret = logdOpen();
+      __android_log_unlock();
+
+      if (ret < 0) {
+        return ret;
+      }
+
+      ret = TEMP_FAILURE_RETRY(writev(atomic_load(&logdLoggerWrite.context.sock), vec, nr));
+      if (ret < 0) {
+        ret = -errno;
+      }
+      [[fallthrough]];
+    default:
+      break;
+  }
+
+  return ret;
+}
+
+/*
+ * LOGGER_LOGD_BATCH: rather than a syscall per entry, entries are staged in
+ * a buffer owned by the logging thread and sent to logd several at a time
+ * as one datagram (android_log_batch_header_t). A batch is sent when the
+ * next entry does not fit, once it is LOGD_BATCH_MAX_AGE_MS old (by the
+ * flusher thread), when its thread exits and when logging is closed. Fatal
+ * and security entries are never staged; a fatal entry first sends every
+ * batch that is pending so that they reach logd ahead of the abort.
+ */
+#define LOGD_BATCH_MAX_AGE_MS 50
+
+struct logd_batch {
+  struct listnode node;      /* on logd_batches, logd_batches_lock held */
+  pthread_mutex_t lock;      /* owning thread vs flusher thread */
+  struct timespec oldest;    /* CLOCK_MONOTONIC of the first entry */
+  size_t len;                /* bytes used in data, batch header included */
+  uint16_t count;
+  char data[LOGGER_BATCH_MAX_LEN];
+};
+
+static pthread_mutex_t logd_batches_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t logd_batches_cond = PTHREAD_COND_INITIALIZER;
+static struct listnode logd_batches = {&logd_batches, &logd_batches};
+static bool logd_batches_pending; /* logd_batches_lock held */
+static bool logd_batches_flusher; /* logd_batches_lock held */
+static pthread_once_t logd_batch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t logd_batch_key;
+static bool logd_batch_key_valid;
+
+/* batch->lock held */
+static void logdFlushBatch(struct logd_batch* batch) {
+  if (!batch->count) {
+    return;
+  }
+
+  android_log_batch_header_t* header = reinterpret_cast<android_log_batch_header_t*>(batch->data);
+  header->magic = LOGGER_BATCH_MAGIC;
+  header->count = batch->count;
+
+  struct iovec vec = {batch->data, batch->len};
+  if (logdSend(&vec, 1) == -EAGAIN) {
+    atomic_fetch_add_explicit(&dropped, batch->count, memory_order_relaxed);
+  }
+
+  batch->count = 0;
+  batch->len = sizeof(android_log_batch_header_t);
+}
+
+/* Send every pending batch, skipping those busy in another thread. */
+static void logdFlushBatches() {
+  struct listnode* node;
+
+  if (pthread_mutex_trylock(&logd_batches_lock)) {
+    return;
+  }
+  list_for_each(node, &logd_batches) {
+    struct logd_batch* batch = node_to_item(node, struct logd_batch, node);
+    if (!pthread_mutex_trylock(&batch->lock)) {
+      logdFlushBatch(batch);
+      pthread_mutex_unlock(&batch->lock);
+    }
+  }
+  pthread_mutex_unlock(&logd_batches_lock);
+}
+
+static void* logdBatchFlusher(void*) {
+  static const struct timespec maxAge = {0, LOGD_BATCH_MAX_AGE_MS * 1000000L};
+
+  pthread_mutex_lock(&logd_batches_lock);
+  for (;;) {
+    while (!logd_batches_pending) {
+      pthread_cond_wait(&logd_batches_cond, &logd_batches_lock);
+    }
+    logd_batches_pending = false;
+
+    /* Give the batches a chance to fill up, or to be sent when full */
+    pthread_mutex_unlock(&logd_batches_lock);
+    nanosleep(&maxAge, nullptr);
+    pthread_mutex_lock(&logd_batches_lock);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct listnode* node;
+    list_for_each(node, &logd_batches) {
+      struct logd_batch* batch = node_to_item(node, struct logd_batch, node);
+      if (pthread_mutex_trylock(&batch->lock)) {
+        logd_batches_pending = true;
+        continue;
+      }
+      if (batch->count) {
+        int64_t age = (now.tv_sec - batch->oldest.tv_sec) * 1000 +
+                      (now.tv_nsec - batch->oldest.tv_nsec) / 1000000;
+        if (age >= LOGD_BATCH_MAX_AGE_MS) {
+          logdFlushBatch(batch);
+        } else {
+          logd_batches_pending = true;
+        }
+      }
+      pthread_mutex_unlock(&batch->lock);
+    }
+  }
+  return nullptr;
+}
+
+static void logdBatchThreadExit(void* obj) {
+  struct logd_batch* batch = reinterpret_cast<struct logd_batch*>(obj);
+
+  pthread_mutex_lock(&logd_batches_lock);
+  list_remove(&batch->node);
+  pthread_mutex_unlock(&logd_batches_lock);
+
+  pthread_mutex_lock(&batch->lock);
+  logdFlushBatch(batch);
+  pthread_mutex_unlock(&batch->lock);
+  pthread_mutex_destroy(&batch->lock);
+  free(batch);
+}
+
+static void logdBatchAtforkPrepare() {
+  pthread_mutex_lock(&logd_batches_lock);
+}
+
+static void logdBatchAtforkParent() {
+  pthread_mutex_unlock(&logd_batches_lock);
+}
+
+/*
+ * Only the forking thread survives, and what it had staged is the parent's
+ * to send. The flusher thread is restarted on demand.
+ */
+static void logdBatchAtforkChild() {
+  list_init(&logd_batches);
+  logd_batches_pending = false;
+  logd_batches_flusher = false;
+
+  struct logd_batch* batch =
+      reinterpret_cast<struct logd_batch*>(pthread_getspecific(logd_batch_key));
+  if (batch) {
+    pthread_mutex_init(&batch->lock, nullptr);
+    batch->count = 0;
+    batch->len = sizeof(android_log_batch_header_t);
+    list_add_tail(&logd_batches, &batch->node);
+  }
+  pthread_mutex_unlock(&logd_batches_lock);
+}
+
+static void logdBatchInit() {
+  logd_batch_key_valid = !pthread_key_create(&logd_batch_key, logdBatchThreadExit);
+  if (logd_batch_key_valid) {
+    pthread_atfork(logdBatchAtforkPrepare, logdBatchAtforkParent, logdBatchAtforkChild);
+  }
+}
+
+static struct logd_batch* logdGetBatch() {
+  pthread_once(&logd_batch_once, logdBatchInit);
+  if (!logd_batch_key_valid) {
+    return nullptr;
+  }
+
+  struct logd_batch* batch =
+      reinterpret_cast<struct logd_batch*>(pthread_getspecific(logd_batch_key));
+  if (batch) {
+    return batch;
+  }
+
+  batch = reinterpret_cast<struct logd_batch*>(malloc(sizeof(*batch)));
+  if (!batch) {
+    return nullptr;
+  }
+  pthread_mutex_init(&batch->lock, nullptr);
+  batch->count = 0;
+  batch->len = sizeof(android_log_batch_header_t);
+  if (pthread_setspecific(logd_batch_key, batch)) {
+    pthread_mutex_destroy(&batch->lock);
+    free(batch);
+    return nullptr;
+  }
+
+  pthread_mutex_lock(&logd_batches_lock);
+  list_add_tail(&logd_batches, &batch->node);
+  pthread_mutex_unlock(&logd_batches_lock);
+  return batch;
+}
+
+/* Stage an entry, returns the payload size accepted. */
+static int logdBatchWrite(struct logd_batch* batch, android_log_header_t* header,
+                          struct iovec* vec, size_t nr) {
+  size_t i;
+  uint16_t payloadSize = 0;
+
+  for (i = 0; i < nr; i++) {
+    payloadSize += vec[i].iov_len;
+  }
+  size_t len = sizeof(*header) + sizeof(payloadSize) + payloadSize;
+
+  pthread_mutex_lock(&batch->lock);
+  if ((batch->len + len) > sizeof(batch->data)) {
+    logdFlushBatch(batch);
+  }
+  bool wasEmpty = !batch->count;
+  if (wasEmpty) {
+    clock_gettime(CLOCK_MONOTONIC, &batch->oldest);
+  }
+  char* cp = batch->data + batch->len;
+  memcpy(cp, header, sizeof(*header));
+  cp += sizeof(*header);
+  memcpy(cp, &payloadSize, sizeof(payloadSize));
+  cp += sizeof(payloadSize);
+  for (i = 0; i < nr; i++) {
+    memcpy(cp, vec[i].iov_base, vec[i].iov_len);
+    cp += vec[i].iov_len;
+  }
+  batch->len += len;
+  batch->count++;
+  pthread_mutex_unlock(&batch->lock);
+
+  /* Once per batch, have the flusher keep an eye on its age */
+  if (wasEmpty) {
+    pthread_mutex_lock(&logd_batches_lock);
+    if (!logd_batches_flusher) {
+      pthread_t thread;
+      pthread_attr_t attr;
+      if (!pthread_attr_init(&attr)) {
+        if (!pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) &&
+            !pthread_create(&thread, &attr, logdBatchFlusher, nullptr)) {
+          logd_batches_flusher = true;
+        }
+        pthread_attr_destroy(&attr);
+      }
+    }
+    logd_batches_pending = true;
+    pthread_cond_signal(&logd_batches_cond);
+    pthread_mutex_unlock(&logd_batches_lock);
+  }
+
+  return payloadSize;
+}
+
 static int logdWrite(log_id_t logId, struct timespec* ts, struct iovec* vec, size_t nr) {
   ssize_t ret;
   int sock;
@@ -130,8 +423,6 @@ static int logdWrite(log_id_t logId, struct timespec* ts, struct iovec* vec, siz
   struct iovec newVec[nr + headerLength];
   android_log_header_t header;
   size_t i, payloadSize;
-  static atomic_int dropped;
-  static atomic_int droppedSecurity;
 
   sock = atomic_load(&logdLoggerWrite.context.sock);
   if (sock < 0) switch (sock) {
@@ -231,45 +522,21 @@ static int logdWrite(log_id_t logId, struct timespec* ts, struct iovec* vec, siz
     }
   }
 
-  /*
-   * The write below could be lost, but will never block.
-   *
-   * ENOTCONN occurs if logd has died.
-   * ENOENT occurs if logd is not running and socket is missing.
-   * ECONNREFUSED occurs if we can not reconnect to logd.
-   * EAGAIN occurs if logd is overloaded.
-   */
-  if (sock < 0) {
-    ret = sock;
-  } else {
-    ret = TEMP_FAILURE_RETRY(writev(sock, newVec, i));
-    if (ret < 0) {
-      ret = -errno;
+  if (__android_log_transport & LOGGER_LOGD_BATCH) {
+    bool fatal = (logId != LOG_ID_EVENTS) && (logId != LOG_ID_STATS) &&
+                 (logId != LOG_ID_SECURITY) && vec[0].iov_len &&
+                 (*reinterpret_cast<const char*>(vec[0].iov_base) >= ANDROID_LOG_FATAL);
+    if (fatal) {
+      logdFlushBatches();
+    } else if (logId != LOG_ID_SECURITY) {
+      struct logd_batch* batch = logdGetBatch();
+      if (batch) {
+        return logdBatchWrite(batch, &header, newVec + headerLength, i - headerLength);
+      }
     }
   }
-  switch (ret) {
-    case -ENOTCONN:
-    case -ECONNREFUSED:
-    case -ENOENT:
-      if (__android_log_trylock()) {
-        return ret; /* in a signal handler? try again when less stressed */
-      }
-      __logdClose(ret);
-      ret = logdOpen();
-      __android_log_unlock();
-
-      if (ret < 0) {
-        return ret;
-      }
 
-      ret = TEMP_FAILURE_RETRY(writev(atomic_load(&logdLoggerWrite.context.sock), newVec, i));
-      if (ret < 0) {
-        ret = -errno;
-      }
-      [[fallthrough]];
-    default:
-      break;
-  }
+  ret = logdSend(newVec, i);
 
   if (ret > (ssize_t)sizeof(header)) {
     ret -= sizeof(header);
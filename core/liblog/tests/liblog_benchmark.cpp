@@ -90,6 +90,36 @@ static void BM_log_maximum_null(benchmark::State& state) {
 }
 BENCHMARK(BM_log_maximum_null);
 
+/*
+ *	Measure the rate at which each core can stuff print messages into the
+ * log, one writev() per message (default) against messages staged per
+ * thread and sent to logd in batches (LOGGER_LOGD_BATCH). Run with a thread
+ * per cpu, items_per_second is per core.
+ */
+static void BM_log_maximum_per_cpu(benchmark::State& state) {
+  while (state.KeepRunning()) {
+    __android_log_print(ANDROID_LOG_INFO, "BM_log_maximum_per_cpu", "%zu",
+                        state.iterations());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_log_maximum_per_cpu)->ThreadPerCpu();
+
+static void BM_log_maximum_batch(benchmark::State& state) {
+  if (state.thread_index == 0) {
+    android_set_log_transport(LOGGER_LOGD_BATCH);
+  }
+  while (state.KeepRunning()) {
+    __android_log_print(ANDROID_LOG_INFO, "BM_log_maximum_batch", "%zu",
+                        state.iterations());
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index == 0) {
+    set_log_default();
+  }
+}
+BENCHMARK(BM_log_maximum_batch)->ThreadPerCpu();
+
 /*
  *	Measure the time it takes to collect the time using
  * discrete acquisition (state.PauseTiming() to state.ResumeTiming())
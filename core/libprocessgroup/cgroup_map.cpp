@@ -28,8 +28,6 @@
 #include <time.h>
 #include <unistd.h>
 
-#include <regex>
-
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
@@ -86,12 +84,19 @@ std::string CgroupController::GetTasksFilePath(const std::string& rel_path) cons
     return (version() == 1) ? tasks_path + CGROUP_TASKS_FILE : tasks_path + CGROUP_TASKS_FILE_V2;
 }
 
+static void ReplaceAll(std::string* str, const std::string& from, const std::string& to) {
+    for (size_t pos = str->find(from); pos != std::string::npos; pos = str->find(from, pos)) {
+        str->replace(pos, from.length(), to);
+        pos += to.length();
+    }
+}
+
 std::string CgroupController::GetProcsFilePath(const std::string& rel_path, uid_t uid,
                                                pid_t pid) const {
     std::string proc_path(path());
     proc_path.append("/").append(rel_path);
-    proc_path = regex_replace(proc_path, std::regex("<uid>"), std::to_string(uid));
-    proc_path = regex_replace(proc_path, std::regex("<pid>"), std::to_string(pid));
+    ReplaceAll(&proc_path, "<uid>", std::to_string(uid));
+    ReplaceAll(&proc_path, "<pid>", std::to_string(pid));
 
     return proc_path.append(CGROUP_PROCS_FILE);
 }
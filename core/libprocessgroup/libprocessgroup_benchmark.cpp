@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <processgroup/processgroup.h>
+
+// Each iteration is one foreground/background transition, as done by ActivityManager.
+// The first argument selects whether cgroup file descriptors are cached.
+
+static void BM_SetTaskProfiles(benchmark::State& state) {
+    bool use_fd_cache = state.range(0);
+    for (auto _ : state) {
+        SetTaskProfiles(0, {"ProcessCapacityHigh", "HighPerformance"}, use_fd_cache);
+        SetTaskProfiles(0, {"ProcessCapacityLow", "HighEnergySaving"}, use_fd_cache);
+    }
+    SetTaskProfiles(0, {"ProcessCapacityNormal", "NormalPerformance"}, use_fd_cache);
+}
+BENCHMARK(BM_SetTaskProfiles)->Arg(false)->Arg(true);
+
+static void BM_SetAttribute(benchmark::State& state) {
+    bool use_fd_cache = state.range(0);
+    for (auto _ : state) {
+        SetTaskProfiles(0, {"CpuPolicySpread"}, use_fd_cache);
+        SetTaskProfiles(0, {"CpuPolicyPack"}, use_fd_cache);
+    }
+}
+BENCHMARK(BM_SetAttribute)->Arg(false)->Arg(true);
+
+// The second argument is the number of threads in the process being moved.
+static void BM_SetProcessProfiles(benchmark::State& state) {
+    bool use_fd_cache = state.range(0);
+    bool done = false;
+    std::vector<std::thread> threads;
+    for (int i = 1; i < state.range(1); ++i) {
+        threads.emplace_back([&done] {
+            while (!__atomic_load_n(&done, __ATOMIC_RELAXED)) usleep(100 * 1000);
+        });
+    }
+
+    for (auto _ : state) {
+        SetProcessProfiles(getuid(), getpid(), {"ProcessCapacityHigh"}, use_fd_cache);
+        SetProcessProfiles(getuid(), getpid(), {"ProcessCapacityLow"}, use_fd_cache);
+    }
+    SetProcessProfiles(getuid(), getpid(), {"ProcessCapacityNormal"}, use_fd_cache);
+
+    __atomic_store_n(&done, true, __ATOMIC_RELAXED);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+BENCHMARK(BM_SetProcessProfiles)
+        ->ArgPair(false, 1)
+        ->ArgPair(true, 1)
+        ->ArgPair(false, 32)
+        ->ArgPair(true, 32);
+
+BENCHMARK_MAIN();
@@ -116,6 +116,17 @@ bool SetAttributeAction::ExecuteForProcess(uid_t, pid_t pid) const {
     return ExecuteForTask(pid);
 }
 
+bool SetAttributeAction::IsCacheablePath(const std::string& path) {
+    // Per-application cgroups are removed when the application dies, and an open fd would keep
+    // a removed cgroup around
+    return path.find("/uid_") == std::string::npos;
+}
+
+void SetAttributeAction::EnableResourceCaching() {
+    std::lock_guard<std::mutex> lock(fd_mutex_);
+    cache_fds_ = true;
+}
+
 bool SetAttributeAction::ExecuteForTask(int tid) const {
     std::string path;
 
@@ -124,6 +135,27 @@ bool SetAttributeAction::ExecuteForTask(int tid) const {
         return false;
     }
 
+    std::lock_guard<std::mutex> lock(fd_mutex_);
+    if (cache_fds_ && IsCacheablePath(path)) {
+        auto iter = fds_.find(path);
+        if (iter == fds_.end() && fds_.size() < kMaxCachedFds) {
+            unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_WRONLY | O_CLOEXEC)));
+            if (fd >= 0) {
+                iter = fds_.emplace(path, std::move(fd)).first;
+            }
+        }
+
+        if (iter != fds_.end()) {
+            // cgroup files ignore the file offset, so the fd can be written to repeatedly
+            if (TEMP_FAILURE_RETRY(write(iter->second, value_.c_str(), value_.length())) < 0) {
+                PLOG(ERROR) << "Failed to write '" << value_ << "' to " << path;
+                fds_.erase(iter);
+                return false;
+            }
+            return true;
+        }
+    }
+
     if (!WriteStringToFile(value_, path)) {
         PLOG(ERROR) << "Failed to write '" << value_ << "' to " << path;
         return false;
@@ -142,35 +174,38 @@ SetCgroupAction::SetCgroupAction(const CgroupController& c, const std::string& p
     if (IsAppDependentPath(path_)) {
         // file descriptor is not cached
         fd_.reset(FDS_APP_DEPENDENT);
+        procs_fd_.reset(FDS_APP_DEPENDENT);
         return;
     }
 
     // file descriptor can be cached later on request
     fd_.reset(FDS_NOT_CACHED);
+    procs_fd_.reset(FDS_NOT_CACHED);
 }
 
-void SetCgroupAction::EnableResourceCaching() {
-    std::lock_guard<std::mutex> lock(fd_mutex_);
-    if (fd_ != FDS_NOT_CACHED) {
-        return;
-    }
-
-    std::string tasks_path = controller_.GetTasksFilePath(path_);
-
-    if (access(tasks_path.c_str(), W_OK) != 0) {
+int SetCgroupAction::OpenCacheableFd(const std::string& path) {
+    if (access(path.c_str(), W_OK) != 0) {
         // file is not accessible
-        fd_.reset(FDS_INACCESSIBLE);
-        return;
+        return FDS_INACCESSIBLE;
     }
 
-    unique_fd fd(TEMP_FAILURE_RETRY(open(tasks_path.c_str(), O_WRONLY | O_CLOEXEC)));
+    int fd = TEMP_FAILURE_RETRY(open(path.c_str(), O_WRONLY | O_CLOEXEC));
     if (fd < 0) {
-        PLOG(ERROR) << "Failed to cache fd '" << tasks_path << "'";
-        fd_.reset(FDS_INACCESSIBLE);
+        PLOG(ERROR) << "Failed to cache fd '" << path << "'";
+        return FDS_INACCESSIBLE;
+    }
+
+    return fd;
+}
+
+void SetCgroupAction::EnableResourceCaching() {
+    std::lock_guard<std::mutex> lock(fd_mutex_);
+    if (fd_ != FDS_NOT_CACHED) {
         return;
     }
 
-    fd_ = std::move(fd);
+    fd_.reset(OpenCacheableFd(controller_.GetTasksFilePath(path_)));
+    procs_fd_.reset(OpenCacheableFd(controller_.GetProcsFilePath(path_, 0, 0)));
 }
 
 bool SetCgroupAction::AddTidToCgroup(int tid, int fd) {
@@ -193,16 +228,16 @@ bool SetCgroupAction::AddTidToCgroup(int tid, int fd) {
 
 bool SetCgroupAction::ExecuteForProcess(uid_t uid, pid_t pid) const {
     std::lock_guard<std::mutex> lock(fd_mutex_);
-    if (IsFdValid()) {
-        // fd is cached, reuse it
-        if (!AddTidToCgroup(pid, fd_)) {
+    if (IsFdValid(procs_fd_)) {
+        // fd is cached, reuse it; one write moves every thread of the process
+        if (!AddTidToCgroup(pid, procs_fd_)) {
             LOG(ERROR) << "Failed to add task into cgroup";
             return false;
         }
         return true;
     }
 
-    if (fd_ == FDS_INACCESSIBLE) {
+    if (procs_fd_ == FDS_INACCESSIBLE) {
         // no permissions to access the file, ignore
         return true;
     }
@@ -224,7 +259,7 @@ bool SetCgroupAction::ExecuteForProcess(uid_t uid, pid_t pid) const {
 
 bool SetCgroupAction::ExecuteForTask(int tid) const {
     std::lock_guard<std::mutex> lock(fd_mutex_);
-    if (IsFdValid()) {
+    if (IsFdValid(fd_)) {
         // fd is cached, reuse it
         if (!AddTidToCgroup(tid, fd_)) {
             LOG(ERROR) << "Failed to add task into cgroup";
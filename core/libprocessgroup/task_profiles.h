@@ -100,10 +100,19 @@ class SetAttributeAction : public ProfileAction {
 
     virtual bool ExecuteForProcess(uid_t uid, pid_t pid) const;
     virtual bool ExecuteForTask(int tid) const;
+    virtual void EnableResourceCaching();
 
   private:
+    // The attribute file depends on the cgroup the task is in, so cache one fd per path
+    static constexpr size_t kMaxCachedFds = 8;
+
     const ProfileAttribute* attribute_;
     std::string value_;
+    bool cache_fds_ = false;
+    mutable std::map<std::string, android::base::unique_fd> fds_;
+    mutable std::mutex fd_mutex_;
+
+    static bool IsCacheablePath(const std::string& path);
 };
 
 // Set cgroup profile element
@@ -127,13 +136,17 @@ class SetCgroupAction : public ProfileAction {
 
     CgroupController controller_;
     std::string path_;
+    // fd_ is the cgroup's tasks file, which moves a single thread; procs_fd_ is its
+    // cgroup.procs file, which moves all threads of a process with one write
     android::base::unique_fd fd_;
+    android::base::unique_fd procs_fd_;
     mutable std::mutex fd_mutex_;
 
     static bool IsAppDependentPath(const std::string& path);
     static bool AddTidToCgroup(int tid, int fd);
+    static int OpenCacheableFd(const std::string& path);
 
-    bool IsFdValid() const { return fd_ > FDS_INACCESSIBLE; }
+    static bool IsFdValid(int fd) { return fd > FDS_INACCESSIBLE; }
 };
 
 class TaskProfile {
@@ -53,6 +53,7 @@ void SocketListener::init(const char *socketName, int socketFd, bool listen, boo
     mSocketName = socketName;
     mSock = socketFd;
     mUseCmdNum = useCmdNum;
+    mCtrlPipe[0] = mCtrlPipe[1] = -1;  // until startListener()
     pthread_mutex_init(&mClientsLock, nullptr);
 }
 
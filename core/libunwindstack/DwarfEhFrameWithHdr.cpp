@@ -16,6 +16,8 @@
 
 #include <stdint.h>
 
+#include <algorithm>
+
 #include <unwindstack/DwarfError.h>
 #include <unwindstack/DwarfStructs.h>
 #include <unwindstack/Memory.h>
@@ -26,6 +28,11 @@
 
 namespace unwindstack {
 
+// Searches done through the encoded table before it is decoded in full. A
+// one off unwind never gets here, anything that keeps unwinding through the
+// same elf does soon enough.
+static constexpr size_t kSearchesBeforeFdeTable = 32;
+
 static inline bool IsEncodingRelative(uint8_t encoding) {
   encoding >>= 4;
   return encoding > 0 && encoding <= DW_EH_PE_funcrel;
@@ -144,12 +151,105 @@ DwarfEhFrameWithHdr<AddressType>::GetFdeInfoFromIndex(size_t index) {
   return info;
 }
 
+template <typename AddressType>
+bool DwarfEhFrameWithHdr<AddressType>::BuildFdeTable() {
+  if (fde_count_ == 0 || entries_end_ < entries_offset_ ||
+      fde_count_ > (entries_end_ - entries_offset_) / (2 * table_entry_size_)) {
+    return false;
+  }
+
+  std::vector<FdeInfo> table(fde_count_);
+  if (table_encoding_ == (DW_EH_PE_datarel | DW_EH_PE_sdata4)) {
+    // What linkers write, so read it all in one go rather than a value at a time.
+    std::vector<int32_t> values(2 * fde_count_);
+    memory_.set_cur_offset(entries_offset_);
+    if (!memory_.ReadBytes(values.data(), values.size() * sizeof(int32_t))) {
+      last_error_.code = DWARF_ERROR_MEMORY_INVALID;
+      last_error_.address = entries_offset_;
+      return false;
+    }
+    for (size_t i = 0; i < fde_count_; i++) {
+      table[i].pc = static_cast<uint64_t>(values[2 * i]) + entries_data_offset_ + load_bias_;
+      table[i].offset = static_cast<uint64_t>(values[2 * i + 1]) + entries_data_offset_;
+    }
+  } else {
+    for (size_t i = 0; i < fde_count_; i++) {
+      const FdeInfo* info = GetFdeInfoFromIndex(i);
+      if (info == nullptr) {
+        return false;
+      }
+      table[i] = *info;
+    }
+  }
+
+  // The binary search depends on this too, but a table that will be used
+  // for every lookup from now on is worth checking.
+  if (!std::is_sorted(table.begin(), table.end(),
+                      [](const FdeInfo& a, const FdeInfo& b) { return a.pc < b.pc; })) {
+    last_error_.code = DWARF_ERROR_ILLEGAL_VALUE;
+    return false;
+  }
+
+  fde_table_ = std::move(table);
+  fde_info_.clear();
+  return true;
+}
+
+template <typename AddressType>
+bool DwarfEhFrameWithHdr<AddressType>::GetFdeTable(
+    std::vector<std::pair<uint64_t, uint64_t>>* table) {
+  if (fde_table_.empty() && !BuildFdeTable()) {
+    return false;
+  }
+  table->clear();
+  table->reserve(fde_table_.size());
+  for (const FdeInfo& info : fde_table_) {
+    table->emplace_back(info.pc, info.offset);
+  }
+  return true;
+}
+
+template <typename AddressType>
+bool DwarfEhFrameWithHdr<AddressType>::SetFdeTable(
+    const std::vector<std::pair<uint64_t, uint64_t>>& table) {
+  if (fde_count_ == 0 || table.size() != fde_count_) {
+    return false;
+  }
+  std::vector<FdeInfo> fde_table(table.size());
+  for (size_t i = 0; i < table.size(); i++) {
+    if (i != 0 && table[i].first < table[i - 1].first) {
+      return false;
+    }
+    fde_table[i].pc = table[i].first;
+    fde_table[i].offset = table[i].second;
+  }
+  fde_table_ = std::move(fde_table);
+  fde_info_.clear();
+  return true;
+}
+
 template <typename AddressType>
 bool DwarfEhFrameWithHdr<AddressType>::GetFdeOffsetFromPc(uint64_t pc, uint64_t* fde_offset) {
   if (fde_count_ == 0) {
     return false;
   }
 
+  if (fde_table_.empty() && !fde_table_failed_ && ++searches_ > kSearchesBeforeFdeTable) {
+    // If the table can't be decoded, keep searching it the old way.
+    DwarfErrorData last_error = last_error_;
+    fde_table_failed_ = !BuildFdeTable();
+    last_error_ = last_error;
+  }
+  if (!fde_table_.empty()) {
+    auto entry = std::upper_bound(fde_table_.begin(), fde_table_.end(), pc,
+                                  [](uint64_t pc, const FdeInfo& info) { return pc < info.pc; });
+    if (entry == fde_table_.begin()) {
+      return false;
+    }
+    *fde_offset = (entry - 1)->offset;
+    return true;
+  }
+
   size_t first = 0;
   size_t last = fde_count_;
   while (first < last) {
@@ -20,6 +20,8 @@
 #include <stdint.h>
 
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <unwindstack/DwarfSection.h>
 
@@ -71,6 +73,14 @@ class DwarfEhFrameWithHdr : public DwarfSectionImpl<AddressType> {
 
   void GetFdes(std::vector<const DwarfFde*>* fdes) override;
 
+  // Decodes the whole search table at once, so that later lookups are a
+  // binary search over memory we already have.
+  bool BuildFdeTable();
+
+  bool GetFdeTable(std::vector<std::pair<uint64_t, uint64_t>>* table) override;
+
+  bool SetFdeTable(const std::vector<std::pair<uint64_t, uint64_t>>& table) override;
+
  protected:
   uint8_t version_;
   uint8_t ptr_encoding_;
@@ -84,6 +94,11 @@ class DwarfEhFrameWithHdr : public DwarfSectionImpl<AddressType> {
 
   uint64_t fde_count_;
   std::unordered_map<uint64_t, FdeInfo> fde_info_;
+
+  // Built once enough searches have been done to pay for it.
+  std::vector<FdeInfo> fde_table_;
+  size_t searches_ = 0;
+  bool fde_table_failed_ = false;
 };
 
 }  // namespace unwindstack
@@ -15,12 +15,18 @@
  */
 
 #include <elf.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <memory>
 #include <mutex>
 #include <string>
 #include <utility>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
 
 #define LOG_TAG "unwind"
 #include <log/log.h>
@@ -38,7 +44,21 @@ namespace unwindstack {
 
 bool Elf::cache_enabled_;
 std::unordered_map<std::string, std::pair<std::shared_ptr<Elf>, bool>>* Elf::cache_;
+std::unordered_map<std::string, std::shared_ptr<Elf>>* Elf::build_id_cache_;
 std::mutex* Elf::cache_lock_;
+std::string* Elf::cache_dir_;
+
+// A file in the cache directory is this header followed by count pairs of
+// uint64_t pc and fde offset, as the eh_frame_hdr of the elf decodes to.
+struct FdeTableHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t load_bias;
+  uint64_t eh_frame_hdr_offset;
+  uint64_t count;
+};
+static constexpr uint32_t kFdeTableMagic = 0x54454446;  // "FDET"
+static constexpr uint32_t kFdeTableVersion = 1;
 
 bool Elf::Init() {
   load_bias_ = 0;
@@ -321,14 +341,34 @@ void Elf::SetCachingEnabled(bool enable) {
   if (!cache_enabled_ && enable) {
     cache_enabled_ = true;
     cache_ = new std::unordered_map<std::string, std::pair<std::shared_ptr<Elf>, bool>>;
+    build_id_cache_ = new std::unordered_map<std::string, std::shared_ptr<Elf>>;
     cache_lock_ = new std::mutex;
   } else if (cache_enabled_ && !enable) {
     cache_enabled_ = false;
     delete cache_;
+    delete build_id_cache_;
     delete cache_lock_;
   }
 }
 
+void Elf::SetCacheDirectory(const std::string& dir) {
+  if (cache_dir_ == nullptr) {
+    cache_dir_ = new std::string;
+  }
+  *cache_dir_ = dir;
+}
+
+// The build id alone would match a stripped elf to its unstripped original,
+// which has more to offer, so the size is part of the key.
+static std::string BuildIDCacheKey(Memory* memory) {
+  std::string build_id = Elf::GetBuildID(memory);
+  uint64_t size;
+  if (build_id.empty() || !Elf::GetInfo(memory, &size)) {
+    return "";
+  }
+  return build_id + ':' + std::to_string(size);
+}
+
 void Elf::CacheLock() {
   cache_lock_->lock();
 }
@@ -337,7 +377,7 @@ void Elf::CacheUnlock() {
   cache_lock_->unlock();
 }
 
-void Elf::CacheAdd(MapInfo* info) {
+bool Elf::CacheAdd(MapInfo* info) {
   // If elf_offset != 0, then cache both name:offset and name.
   // The cached name is used to do lookups if multiple maps for the same
   // named elf file exist.
@@ -355,6 +395,99 @@ void Elf::CacheAdd(MapInfo* info) {
     (*cache_)[info->name + ':' + std::to_string(info->offset)] =
         std::make_pair(info->elf, info->elf_offset != 0);
   }
+
+  // An elf read out of process memory is only good for that process.
+  if (info->memory_backed_elf || !info->elf->valid()) {
+    return false;
+  }
+  std::string key = BuildIDCacheKey(info->elf->memory());
+  return !key.empty() && build_id_cache_->emplace(key, info->elf).second &&
+         cache_dir_ != nullptr && !cache_dir_->empty();
+}
+
+bool Elf::CacheGetByBuildID(MapInfo* info, Memory* memory) {
+  if (memory == nullptr || info->memory_backed_elf) {
+    return false;
+  }
+  std::string key = BuildIDCacheKey(memory);
+  if (key.empty()) {
+    return false;
+  }
+  auto entry = build_id_cache_->find(key);
+  if (entry == build_id_cache_->end()) {
+    return false;
+  }
+
+  // Cache it by this name too, so the next lookup doesn't read the build id.
+  info->elf = entry->second;
+  CacheAdd(info);
+  return true;
+}
+
+void Elf::CacheFdeTable(Elf* elf) {
+  ElfInterface* interface = elf->interface();
+  DwarfSection* eh_frame = interface->eh_frame();
+  std::string build_id = elf->GetBuildID();
+  if (eh_frame == nullptr || build_id.empty()) {
+    return;
+  }
+
+  std::string path = *cache_dir_ + '/';
+  for (char c : build_id) {
+    path += android::base::StringPrintf("%02hhx", c);
+  }
+  path += ".fdes";
+
+  FdeTableHeader header = {};
+  header.magic = kFdeTableMagic;
+  header.version = kFdeTableVersion;
+  header.load_bias = elf->GetLoadBias();
+  header.eh_frame_hdr_offset = interface->eh_frame_hdr_offset();
+
+  std::vector<std::pair<uint64_t, uint64_t>> table;
+  std::string contents;
+  if (android::base::ReadFileToString(path, &contents) && contents.size() >= sizeof(header)) {
+    FdeTableHeader saved;
+    memcpy(&saved, contents.data(), sizeof(saved));
+    size_t entries_size = contents.size() - sizeof(saved);
+    if (saved.magic == header.magic && saved.version == header.version &&
+        saved.load_bias == header.load_bias &&
+        saved.eh_frame_hdr_offset == header.eh_frame_hdr_offset &&
+        entries_size % (2 * sizeof(uint64_t)) == 0 &&
+        saved.count == entries_size / (2 * sizeof(uint64_t))) {
+      const char* data = contents.data() + sizeof(saved);
+      table.resize(saved.count);
+      for (auto& entry : table) {
+        memcpy(&entry.first, data, sizeof(uint64_t));
+        memcpy(&entry.second, data + sizeof(uint64_t), sizeof(uint64_t));
+        data += 2 * sizeof(uint64_t);
+      }
+      // The elf is already in the cache, so other threads may be using it.
+      std::lock_guard<std::mutex> guard(elf->lock_);
+      if (eh_frame->SetFdeTable(table)) {
+        return;
+      }
+    }
+  }
+
+  // Missing or out of date, build it and write it for next time.
+  {
+    std::lock_guard<std::mutex> guard(elf->lock_);
+    if (!eh_frame->GetFdeTable(&table)) {
+      return;
+    }
+  }
+  header.count = table.size();
+  contents.assign(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (const auto& entry : table) {
+    contents.append(reinterpret_cast<const char*>(&entry.first), sizeof(uint64_t));
+    contents.append(reinterpret_cast<const char*>(&entry.second), sizeof(uint64_t));
+  }
+  // Written aside and renamed into place, as other processes may read it at any time.
+  std::string tmp = path + '.' + std::to_string(getpid());
+  if (!android::base::WriteStringToFile(contents, tmp) || rename(tmp.c_str(), path.c_str()) != 0) {
+    unlink(tmp.c_str());
+  }
 }
 
 bool Elf::CacheAfterCreateMemory(MapInfo* info) {
@@ -210,7 +210,7 @@ Elf* MapInfo::GetElf(const std::shared_ptr<Memory>& process_memory, ArchEnum exp
 
     Memory* memory = CreateMemory(process_memory);
     if (locked) {
-      if (Elf::CacheAfterCreateMemory(this)) {
+      if (Elf::CacheAfterCreateMemory(this) || Elf::CacheGetByBuildID(this, memory)) {
         delete memory;
         Elf::CacheUnlock();
         return elf.get();
@@ -226,8 +226,11 @@ Elf* MapInfo::GetElf(const std::shared_ptr<Memory>& process_memory, ArchEnum exp
     }
 
     if (locked) {
-      Elf::CacheAdd(this);
+      bool cache_fde_table = Elf::CacheAdd(this);
       Elf::CacheUnlock();
+      if (cache_fde_table) {
+        Elf::CacheFdeTable(elf.get());
+      }
     }
   }
 
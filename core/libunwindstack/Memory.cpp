@@ -26,6 +26,7 @@
 
 #include <algorithm>
 #include <memory>
+#include <vector>
 
 #include <android-base/unique_fd.h>
 
@@ -452,4 +453,44 @@ size_t MemoryCache::Read(uint64_t addr, void* dst, size_t size) {
   return size;
 }
 
+void MemoryCache::Prefetch(uint64_t addr, size_t size) {
+  uint64_t first_page = addr >> kCacheBits;
+  if (size == 0 || cache_.count(first_page) != 0) {
+    return;
+  }
+  uint64_t end;
+  if (__builtin_add_overflow(addr, size - 1, &end)) {
+    end = UINT64_MAX;
+  }
+  uint64_t last_page = end >> kCacheBits;
+
+  std::vector<uint8_t> buffer;
+  uint64_t page = first_page;
+  while (page <= last_page) {
+    if (cache_.count(page) != 0) {
+      page++;
+      continue;
+    }
+    uint64_t run_end = page;
+    while (run_end < last_page && cache_.count(run_end + 1) == 0) {
+      run_end++;
+    }
+
+    // One read for the whole run, process_vm_readv stops at the first page
+    // that cannot be read and everything before it is still usable. Nothing
+    // past that page is tried: it is usually the end of the mapping, and
+    // further reads would only fail the same way.
+    buffer.resize((run_end - page + 1) << kCacheBits);
+    size_t bytes = impl_->Read(page << kCacheBits, buffer.data(), buffer.size());
+    size_t pages = bytes >> kCacheBits;
+    for (size_t i = 0; i < pages; i++) {
+      memcpy(cache_[page + i], &buffer[i << kCacheBits], kCacheSize);
+    }
+    if (pages != run_end - page + 1) {
+      break;
+    }
+    page = run_end + 1;
+  }
+}
+
 }  // namespace unwindstack
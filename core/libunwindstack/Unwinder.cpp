@@ -42,6 +42,12 @@
 
 namespace unwindstack {
 
+// How much of the stack, from the current sp up, to ask the process memory
+// to fetch in one go whenever the sp reaches a page it doesn't have. Frames
+// are rarely large, so this covers a good many of them. The window never
+// extends past the end of the map holding the sp.
+static constexpr size_t kStackPrefetchSize = 64 * 1024;
+
 // Inject extra 'virtual' frame that represents the dex pc data.
 // The dex pc is a magic register defined in the Mterp interpreter,
 // and thus it will be restored/observed in the frame after it.
@@ -151,6 +157,11 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
   for (; frames_.size() < max_frames_;) {
     uint64_t cur_pc = regs_->pc();
     uint64_t cur_sp = regs_->sp();
+    MapInfo* sp_map_info = maps_->Find(cur_sp);
+    if (sp_map_info != nullptr) {
+      process_memory_->Prefetch(cur_sp, std::min<uint64_t>(kStackPrefetchSize,
+                                                           sp_map_info->end - cur_sp));
+    }
 
     MapInfo* map_info = maps_->Find(regs_->pc());
     uint64_t pc_adjustment = 0;
@@ -20,6 +20,7 @@
 
 #include <benchmark/benchmark.h>
 
+#include <android-base/file.h>
 #include <android-base/strings.h>
 
 #include <unwindstack/Elf.h>
@@ -83,6 +84,65 @@ static void BM_cached_unwind(benchmark::State& state) {
 }
 BENCHMARK(BM_cached_unwind);
 
+// A first unwind in a new process: every elf is opened and its CFI parsed.
+static void BM_cold_unwind(benchmark::State& state) {
+  auto process_memory = unwindstack::Memory::CreateProcessMemoryCached(getpid());
+  unwindstack::Elf::SetCachingEnabled(false);
+
+  for (auto _ : state) {
+    unwindstack::LocalMaps maps;
+    if (!maps.Parse()) {
+      state.SkipWithError("Failed to parse local maps.");
+      break;
+    }
+    benchmark::DoNotOptimize(Call1(process_memory, &maps));
+  }
+}
+BENCHMARK(BM_cold_unwind);
+
+// New maps each time, as for a new process, but the elfs and their FDE tables
+// come from the elf cache.
+static void BM_warm_unwind(benchmark::State& state) {
+  auto process_memory = unwindstack::Memory::CreateProcessMemoryCached(getpid());
+  unwindstack::Elf::SetCachingEnabled(true);
+
+  for (auto _ : state) {
+    unwindstack::LocalMaps maps;
+    if (!maps.Parse()) {
+      state.SkipWithError("Failed to parse local maps.");
+      break;
+    }
+    benchmark::DoNotOptimize(Call1(process_memory, &maps));
+  }
+  unwindstack::Elf::SetCachingEnabled(false);
+}
+BENCHMARK(BM_warm_unwind);
+
+// The elf cache is emptied each time, but the FDE tables are read back from
+// the cache directory rather than rebuilt.
+static void BM_warm_unwind_from_disk(benchmark::State& state) {
+  auto process_memory = unwindstack::Memory::CreateProcessMemoryCached(getpid());
+  TemporaryDir dir;
+  unwindstack::Elf::SetCacheDirectory(dir.path);
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    unwindstack::Elf::SetCachingEnabled(false);
+    unwindstack::Elf::SetCachingEnabled(true);
+    state.ResumeTiming();
+
+    unwindstack::LocalMaps maps;
+    if (!maps.Parse()) {
+      state.SkipWithError("Failed to parse local maps.");
+      break;
+    }
+    benchmark::DoNotOptimize(Call1(process_memory, &maps));
+  }
+  unwindstack::Elf::SetCachingEnabled(false);
+  unwindstack::Elf::SetCacheDirectory("");
+}
+BENCHMARK(BM_warm_unwind_from_disk);
+
 static void Initialize(benchmark::State& state, unwindstack::Maps& maps,
                        unwindstack::MapInfo** build_id_map_info) {
   if (!maps.Parse()) {
@@ -22,6 +22,8 @@
 #include <iterator>
 #include <map>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <unwindstack/DwarfError.h>
 #include <unwindstack/DwarfLocation.h>
@@ -104,6 +106,12 @@ class DwarfSection {
 
   virtual uint64_t AdjustPcFromFde(uint64_t pc) = 0;
 
+  // Sections that look pcs up in a sorted table of (pc, fde offset) pairs
+  // can hand the table out, building it if necessary, and can be given a
+  // previously built one instead of building their own.
+  virtual bool GetFdeTable(std::vector<std::pair<uint64_t, uint64_t>>*) { return false; }
+  virtual bool SetFdeTable(const std::vector<std::pair<uint64_t, uint64_t>>&) { return false; }
+
   bool Step(uint64_t pc, Regs* regs, Memory* process_memory, bool* finished);
 
  protected:
@@ -108,11 +108,23 @@ class Elf {
   static void SetCachingEnabled(bool enable);
   static bool CachingEnabled() { return cache_enabled_; }
 
+  // When caching, also keep the pc to fde table of each elf in this
+  // directory, by build id, and load it from there rather than build it
+  // the next time any process caches the same elf.
+  static void SetCacheDirectory(const std::string& dir);
+
   static void CacheLock();
   static void CacheUnlock();
-  static void CacheAdd(MapInfo* info);
+  // Returns true if the elf is new to the cache and its fde table is to be
+  // kept in the cache directory, which the caller then does by calling
+  // CacheFdeTable() after CacheUnlock().
+  static bool CacheAdd(MapInfo* info);
   static bool CacheGet(MapInfo* info);
   static bool CacheAfterCreateMemory(MapInfo* info);
+  static bool CacheGetByBuildID(MapInfo* info, Memory* memory);
+  // Loads the fde table of the elf from the cache directory, or builds it and
+  // writes it there. Does file I/O, so call it without the cache lock held.
+  static void CacheFdeTable(Elf* elf);
 
  protected:
   bool valid_ = false;
@@ -130,7 +142,10 @@ class Elf {
 
   static bool cache_enabled_;
   static std::unordered_map<std::string, std::pair<std::shared_ptr<Elf>, bool>>* cache_;
+  // The same elfs as cache_, by build id, for the same file under another name.
+  static std::unordered_map<std::string, std::shared_ptr<Elf>>* build_id_cache_;
   static std::mutex* cache_lock_;
+  static std::string* cache_dir_;
 };
 
 }  // namespace unwindstack
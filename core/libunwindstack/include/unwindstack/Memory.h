@@ -42,6 +42,10 @@ class Memory {
 
   virtual void Clear() {}
 
+  // A hint that [addr, addr + size) is likely to be read soon. Memory that
+  // caches can use it to fetch the range with one read instead of many.
+  virtual void Prefetch(uint64_t, size_t) {}
+
   virtual size_t Read(uint64_t addr, void* dst, size_t size) = 0;
 
   bool ReadFully(uint64_t addr, void* dst, size_t size);
@@ -64,6 +68,11 @@ class MemoryCache : public Memory {
 
   void Clear() override { cache_.clear(); }
 
+  // Does nothing if the page containing addr is already cached, otherwise
+  // reads every uncached page up to addr + size, a run of adjacent pages
+  // at a time. Pages that cannot be read are skipped.
+  void Prefetch(uint64_t addr, size_t size) override;
+
  private:
   constexpr static size_t kCacheBits = 12;
   constexpr static size_t kCacheMask = (1 << kCacheBits) - 1;
@@ -15,12 +15,19 @@
  */
 
 #include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <string>
+#include <utility>
+#include <vector>
+
 #include <android-base/file.h>
 
 #include <gtest/gtest.h>
 
+#include <unwindstack/DwarfSection.h>
 #include <unwindstack/Elf.h>
 #include <unwindstack/MapInfo.h>
 
@@ -260,4 +267,67 @@ TEST_F(ElfCacheTest, caching_valid_elf_offset_non_zero_never_read_at_zero) {
   VerifyWithinSameMapNeverReadAtZero(true);
 }
 
+static void CopyLibc(TemporaryFile* tf) {
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(
+      TestGetFileDirectory() + "offline/shared_lib_in_apk_arm64/libc.so", &contents));
+  ASSERT_TRUE(android::base::WriteStringToFd(contents, tf->fd));
+}
+
+TEST_F(ElfCacheTest, caching_same_build_id_different_name) {
+  TemporaryFile tf1;
+  TemporaryFile tf2;
+  CopyLibc(&tf1);
+  CopyLibc(&tf2);
+
+  MapInfo info1(nullptr, 0x1000, 0x80000, 0, PROT_READ | PROT_EXEC, tf1.path);
+  MapInfo info2(nullptr, 0x1000, 0x80000, 0, PROT_READ | PROT_EXEC, tf2.path);
+  Elf* elf1 = info1.GetElf(memory_, ARCH_ARM64);
+  ASSERT_TRUE(elf1->valid());
+  Elf* elf2 = info2.GetElf(memory_, ARCH_ARM64);
+  EXPECT_EQ(elf1, elf2);
+}
+
+TEST_F(ElfCacheTest, caching_fde_table_in_directory) {
+  TemporaryDir dir;
+  Elf::SetCacheDirectory(dir.path);
+
+  TemporaryFile tf;
+  CopyLibc(&tf);
+  std::vector<std::pair<uint64_t, uint64_t>> built;
+  {
+    MapInfo info(nullptr, 0x1000, 0x80000, 0, PROT_READ | PROT_EXEC, tf.path);
+    Elf* elf = info.GetElf(memory_, ARCH_ARM64);
+    ASSERT_TRUE(elf->valid());
+    ASSERT_TRUE(elf->interface()->eh_frame()->GetFdeTable(&built));
+    ASSERT_FALSE(built.empty());
+  }
+
+  std::string path = std::string(dir.path) + "/46375e4efdec674f3de15db61fae2eac.fdes";
+  struct stat st;
+  ASSERT_EQ(0, stat(path.c_str(), &st));
+  EXPECT_EQ(static_cast<off_t>(32 + built.size() * 16), st.st_size);
+
+  // Change an entry, so that it is clear the table came from the file.
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(path, &contents));
+  uint64_t offset = 0x1234;
+  contents.replace(32 + 8, sizeof(offset), reinterpret_cast<const char*>(&offset), sizeof(offset));
+  ASSERT_TRUE(android::base::WriteStringToFile(contents, path));
+  built[0].second = offset;
+
+  // As a new process would, start with an empty cache and load the table.
+  Elf::SetCachingEnabled(false);
+  Elf::SetCachingEnabled(true);
+  MapInfo info(nullptr, 0x1000, 0x80000, 0, PROT_READ | PROT_EXEC, tf.path);
+  Elf* elf = info.GetElf(memory_, ARCH_ARM64);
+  ASSERT_TRUE(elf->valid());
+  std::vector<std::pair<uint64_t, uint64_t>> loaded;
+  ASSERT_TRUE(elf->interface()->eh_frame()->GetFdeTable(&loaded));
+  EXPECT_EQ(built, loaded);
+
+  unlink(path.c_str());
+  Elf::SetCacheDirectory("");
+}
+
 }  // namespace unwindstack
@@ -140,4 +140,49 @@ TEST_F(MemoryCacheTest, read_for_cache_fail_cross) {
   ASSERT_EQ(expect, buffer);
 }
 
+TEST_F(MemoryCacheTest, prefetch) {
+  memory_cache_->Prefetch(0x8010, 0x2000);
+
+  // Verify the full pages are cached, and the partial one is not.
+  memory_->SetMemoryBlock(0x8000, 4096, 0xff);
+  memory_->SetMemoryBlock(0x9000, 4096, 0xff);
+  memory_->SetMemoryBlock(0xa000, 3000, 0xff);
+  std::vector<uint8_t> buffer(kMaxCachedSize);
+  ASSERT_TRUE(memory_cache_->ReadFully(0x8010, buffer.data(), kMaxCachedSize));
+  ASSERT_EQ(std::vector<uint8_t>(kMaxCachedSize, 0xab), buffer);
+  ASSERT_TRUE(memory_cache_->ReadFully(0x9010, buffer.data(), kMaxCachedSize));
+  ASSERT_EQ(std::vector<uint8_t>(kMaxCachedSize, 0xde), buffer);
+  ASSERT_TRUE(memory_cache_->ReadFully(0xa010, buffer.data(), kMaxCachedSize));
+  ASSERT_EQ(std::vector<uint8_t>(kMaxCachedSize, 0xff), buffer);
+}
+
+TEST_F(MemoryCacheTest, prefetch_first_page_cached) {
+  std::vector<uint8_t> buffer(kMaxCachedSize);
+  ASSERT_TRUE(memory_cache_->ReadFully(0x8010, buffer.data(), kMaxCachedSize));
+
+  // Nothing is read if the first page is already there.
+  memory_cache_->Prefetch(0x8010, 0x2000);
+  memory_->SetMemoryBlock(0x9000, 4096, 0xff);
+  ASSERT_TRUE(memory_cache_->ReadFully(0x9010, buffer.data(), kMaxCachedSize));
+  ASSERT_EQ(std::vector<uint8_t>(kMaxCachedSize, 0xff), buffer);
+}
+
+TEST_F(MemoryCacheTest, prefetch_stops_at_unreadable_page) {
+  memory_->SetMemoryBlock(0xc000, 4096, 0x11);
+  memory_->SetMemoryBlock(0xe000, 4096, 0x22);
+  memory_cache_->Prefetch(0xc000, 0x3000);
+
+  memory_->SetMemoryBlock(0xc000, 4096, 0xff);
+  memory_->SetMemoryBlock(0xd000, 4096, 0xff);
+  memory_->SetMemoryBlock(0xe000, 4096, 0xff);
+  std::vector<uint8_t> buffer(kMaxCachedSize);
+  ASSERT_TRUE(memory_cache_->ReadFully(0xc010, buffer.data(), kMaxCachedSize));
+  ASSERT_EQ(std::vector<uint8_t>(kMaxCachedSize, 0x11), buffer);
+  ASSERT_TRUE(memory_cache_->ReadFully(0xd010, buffer.data(), kMaxCachedSize));
+  ASSERT_EQ(std::vector<uint8_t>(kMaxCachedSize, 0xff), buffer);
+  // Nothing past the unreadable page was fetched.
+  ASSERT_TRUE(memory_cache_->ReadFully(0xe010, buffer.data(), kMaxCachedSize));
+  ASSERT_EQ(std::vector<uint8_t>(kMaxCachedSize, 0xff), buffer);
+}
+
 }  // namespace unwindstack
@@ -139,6 +139,31 @@ int32_t OpenArchiveFd(const int fd, const char* debugFileName, ZipArchiveHandle*
 
 int32_t OpenArchiveFromMemory(void* address, size_t length, const char* debugFileName,
                               ZipArchiveHandle* handle);
+
+/*
+ * Like OpenArchive, but first tries the index at |indexFileName|, as
+ * written by WriteArchiveIndex. If the index is present and was written
+ * for this archive, the central directory is mapped but not scanned, and
+ * FindEntry takes a single probe. Each entry is then checked as it is
+ * looked up rather than all of them up front. Otherwise this behaves
+ * exactly like OpenArchive.
+ *
+ * Returns 0 on success, and negative values on failure.
+ */
+int32_t OpenArchiveWithIndex(const char* fileName, const char* indexFileName,
+                             ZipArchiveHandle* handle);
+
+/*
+ * Writes an index of the entry names of |archive| to |fd|, for later use
+ * by OpenArchiveWithIndex. The index holds a minimal perfect hash of the
+ * names and is tied to the archive's size, modification time and central
+ * directory, so it is meant to be written once, for example at install
+ * time, and kept next to the archive. The archive must have been opened
+ * from a file.
+ *
+ * Returns 0 on success, and negative values on failure.
+ */
+int32_t WriteArchiveIndex(const ZipArchiveHandle archive, int fd);
 /*
  * Close archive, releasing resources associated with it. This will
  * unmap the central directory of the zipfile and free all internal
@@ -230,6 +255,18 @@ typedef bool (*ProcessZipEntryFunction)(const uint8_t* buf, size_t buf_size, voi
  */
 int32_t ProcessZipEntryContents(ZipArchiveHandle archive, ZipEntry* entry,
                                 ProcessZipEntryFunction func, void* cookie);
+
+/*
+ * Extracts |count| entries, each as ExtractEntryToFile would extract
+ * |entries[i]| to |fds[i]|, on up to |num_threads| threads at once. A
+ * |num_threads| of 0 means one per CPU. Every entry is attempted even if
+ * some of them fail.
+ *
+ * Returns 0 if all entries were extracted, and otherwise the result of
+ * the first entry, in the order given, that failed.
+ */
+int32_t ExtractEntriesToFiles(ZipArchiveHandle archive, ZipEntry* entries, const int* fds,
+                              size_t count, size_t num_threads = 0);
 #endif
 
 namespace zip_archive {
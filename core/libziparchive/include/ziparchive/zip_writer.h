@@ -19,6 +19,7 @@
 #include <cstdio>
 #include <ctime>
 
+#include <deque>
 #include <memory>
 #include <string>
 #include <vector>
@@ -89,6 +90,17 @@ class ZipWriter {
    */
   explicit ZipWriter(FILE* f);
 
+  /**
+   * Same as ZipWriter(FILE*), but deflates on |num_threads| threads. Entries are compressed
+   * concurrently with each other, and each entry in 128K blocks that carry the previous block's
+   * window, so large entries compress concurrently too (in the manner of pigz). Deflated output
+   * is held in memory until it can be written in order, so the compressed data differs from, but
+   * is as valid as, that of a single threaded ZipWriter.
+   */
+  ZipWriter(FILE* f, size_t num_threads);
+
+  ~ZipWriter();
+
   // Move constructor.
   ZipWriter(ZipWriter&& zipWriter) noexcept;
 
@@ -129,6 +141,15 @@ class ZipWriter {
    */
   int32_t WriteBytes(const void* data, size_t len);
 
+  /**
+   * Writes |len| bytes of |fd|, starting at |offset|, to the zip file for the previously started
+   * zip entry. For a stored entry the data is copied from file to file with copy_file_range(2)
+   * where the kernel supports it, so a large stored entry, aligned for mmap or not, is added
+   * without passing its contents through a user space buffer.
+   * Returns 0 on success, and an error value < 0 on failure.
+   */
+  int32_t WriteBytesFromFd(int fd, off64_t offset, size_t len);
+
   /**
    * Finish a zip entry started with StartEntry(const char*, size_t) or
    * StartEntryWithTime(const char*, size_t, time_t). This must be called before
@@ -159,11 +180,18 @@ class ZipWriter {
  private:
   DISALLOW_COPY_AND_ASSIGN(ZipWriter);
 
+  struct PendingWrite;
+  class ThreadPool;
+
   int32_t HandleError(int32_t error_code);
   int32_t PrepareDeflate();
   int32_t StoreBytes(FileEntry* file, const void* data, size_t len);
   int32_t CompressBytes(FileEntry* file, const void* data, size_t len);
   int32_t FlushCompressedBytes(FileEntry* file);
+  int32_t QueueBlock(bool last);
+  int32_t QueueWrite(std::unique_ptr<PendingWrite> write);
+  int32_t WritePending(size_t max_remaining);
+  void DiscardPending();
 
   enum class State {
     kWritingZip,
@@ -181,4 +209,12 @@ class ZipWriter {
 
   std::unique_ptr<z_stream, void (*)(z_stream*)> z_stream_;
   std::vector<uint8_t> buffer_;
+
+  // Only used when deflating on a ThreadPool. Output waiting to be written in order, the input
+  // and window of the block being filled, and the pool. The pool must be destroyed first.
+  std::deque<std::unique_ptr<PendingWrite>> pending_;
+  std::vector<uint8_t> block_;
+  std::vector<uint8_t> window_;
+  size_t max_pending_;
+  std::unique_ptr<ThreadPool> pool_;
 };
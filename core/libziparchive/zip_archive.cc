@@ -28,12 +28,19 @@
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 
+#if !defined(_WIN32)
+#include <atomic>
+#include <thread>
+#endif
+
 #if defined(__APPLE__)
 #define lseek64 lseek
 #endif
@@ -47,6 +54,7 @@
 #include <android-base/macros.h>  // TEMP_FAILURE_RETRY may or may not be in unistd
 #include <android-base/mapped_file.h>
 #include <android-base/memory.h>
+#include <android-base/unique_fd.h>
 #include <android-base/utf8.h>
 #include <log/log.h>
 #include "zlib.h"
@@ -64,6 +72,14 @@ static const bool kCrcChecksEnabled = false;
 // The maximum number of bytes to scan backwards for the EOCD start.
 static const uint32_t kMaxEOCDSearch = kMaxCommentLen + sizeof(EocdRecord);
 
+// Buffers used to extract an entry grow with the size of the entry.
+static const size_t kMinExtractBufSize = 32 * 1024;
+static const size_t kMaxExtractBufSize = 1024 * 1024;
+
+// Stored entries of at least this size are written out straight from a
+// mapping of the archive instead of being read into a buffer first.
+static const uint32_t kMinMappedCopySize = 256 * 1024;
+
 /*
  * A Read-only Zip archive.
  *
@@ -135,6 +151,57 @@ static inline uint32_t GetOffset(const uint8_t* name, const uint8_t* start) {
   return static_cast<uint32_t>(name - start);
 }
 
+/*
+ * Hash used by archive indexes. Unlike ComputeHash this must not change
+ * between builds or platforms, as indexes are kept on disk.
+ */
+__attribute__((no_sanitize("unsigned-integer-overflow")))
+static uint32_t ComputeIndexHash(const ZipString& name, uint32_t seed) {
+  // FNV-1a, then the murmur3 finalizer to spread the bits.
+  uint32_t hash = 2166136261u ^ seed;
+  for (uint16_t i = 0; i < name.name_length; ++i) {
+    hash = (hash ^ name.name[i]) * 16777619u;
+  }
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+/*
+ * The nanoseconds of a file's modification time, where we have them. An
+ * index is only used if these and the size still match the archive.
+ */
+static uint32_t GetMtimeNsec(const struct stat& st) {
+#if defined(__APPLE__)
+  return static_cast<uint32_t>(st.st_mtimespec.tv_nsec);
+#elif defined(_WIN32)
+  return 0;
+#else
+  return static_cast<uint32_t>(st.st_mtim.tv_nsec);
+#endif
+}
+
+/*
+ * Convert a ZipEntry to a slot of an archive index, see ZipIndexHeader.
+ */
+static int64_t EntryToIndexSlot(const ZipArchive* archive, const ZipString& name) {
+  const uint32_t seed =
+      archive->index_seeds[ComputeIndexHash(name, 0) % archive->index_bucket_count];
+  const uint32_t ent = (seed & ZipIndexHeader::kDirectSlot)
+                           ? (seed & ~ZipIndexHeader::kDirectSlot)
+                           : (ComputeIndexHash(name, seed) % archive->hash_table_size);
+  if (ent < archive->hash_table_size &&
+      isZipStringEqual(archive->central_directory.GetBasePtr(), name, archive->hash_table[ent])) {
+    return ent;
+  }
+
+  ALOGV("Zip: Unable to find entry %.*s", name.name_length, name.name);
+  return kEntryNotFound;
+}
+
 /*
  * Convert a ZipEntry to a hash table index, verifying that it's in a
  * valid range.
@@ -196,7 +263,11 @@ ZipArchive::ZipArchive(const int fd, bool assume_ownership)
       directory_map(),
       num_entries(0),
       hash_table_size(0),
-      hash_table(nullptr) {
+      hash_table(nullptr),
+      eocd_crc(0),
+      index_map(),
+      index_seeds(nullptr),
+      index_bucket_count(0) {
 #if defined(__BIONIC__)
   if (assume_ownership) {
     android_fdsan_exchange_owner_tag(fd, 0, GetOwnerTag(this));
@@ -212,7 +283,11 @@ ZipArchive::ZipArchive(void* address, size_t length)
       directory_map(),
       num_entries(0),
       hash_table_size(0),
-      hash_table(nullptr) {}
+      hash_table(nullptr),
+      eocd_crc(0),
+      index_map(),
+      index_seeds(nullptr),
+      index_bucket_count(0) {}
 
 ZipArchive::~ZipArchive() {
   if (close_file && mapped_zip.GetFileDescriptor() >= 0) {
@@ -223,7 +298,9 @@ ZipArchive::~ZipArchive() {
 #endif
   }
 
-  free(hash_table);
+  if (!index_map) {
+    free(hash_table);
+  }
 }
 
 static int32_t MapCentralDirectory0(const char* debug_file_name, ZipArchive* archive,
@@ -303,6 +380,8 @@ static int32_t MapCentralDirectory0(const char* debug_file_name, ZipArchive* arc
 
   archive->num_entries = eocd->num_records;
   archive->directory_offset = eocd->cd_start_offset;
+  archive->eocd_crc =
+      crc32(0, scan_buffer + i, static_cast<uInt>(sizeof(EocdRecord) + eocd->comment_length));
 
   return 0;
 }
@@ -505,6 +584,206 @@ int32_t OpenArchiveFromMemory(void* address, size_t length, const char* debug_fi
   return OpenArchiveInternal(archive, debug_file_name);
 }
 
+/*
+ * Maps the index at index_file_name in place of the hash table, if it was
+ * written for this archive. Only the index is read, not the central
+ * directory.
+ */
+static bool MapArchiveIndex(ZipArchive* archive, const char* index_file_name) {
+  android::base::unique_fd fd(
+      android::base::utf8::open(index_file_name, O_RDONLY | O_BINARY | O_CLOEXEC, 0));
+  if (fd == -1) {
+    return false;
+  }
+
+  ZipIndexHeader header;
+  if (!android::base::ReadFullyAtOffset(fd, &header, sizeof(header), 0)) {
+    return false;
+  }
+  struct stat archive_st, index_st;
+  if (fstat(archive->mapped_zip.GetFileDescriptor(), &archive_st) || fstat(fd, &index_st)) {
+    return false;
+  }
+  if (header.magic != ZipIndexHeader::kMagic || header.version != ZipIndexHeader::kVersion ||
+      header.file_length != static_cast<uint64_t>(archive_st.st_size) ||
+      header.file_mtime != static_cast<int64_t>(archive_st.st_mtime) ||
+      header.file_mtime_nsec != GetMtimeNsec(archive_st) ||
+      header.cd_start_offset != archive->directory_offset ||
+      header.cd_size != archive->central_directory.GetMapLength() ||
+      header.eocd_crc != archive->eocd_crc || header.num_entries != archive->num_entries ||
+      header.bucket_count == 0 || header.bucket_count > header.num_entries) {
+    ALOGW("Zip: index %s does not match the archive", index_file_name);
+    return false;
+  }
+
+  const size_t length = sizeof(header) + header.bucket_count * sizeof(uint32_t) +
+                        header.num_entries * sizeof(ZipStringOffset);
+  if (static_cast<uint64_t>(index_st.st_size) < length) {
+    ALOGW("Zip: index %s is truncated", index_file_name);
+    return false;
+  }
+  std::unique_ptr<android::base::MappedFile> map =
+      android::base::MappedFile::FromFd(fd, 0, length, PROT_READ);
+  if (!map) {
+    return false;
+  }
+
+  const uint32_t* seeds = reinterpret_cast<const uint32_t*>(map->data() + sizeof(header));
+  const ZipStringOffset* slots =
+      reinterpret_cast<const ZipStringOffset*>(seeds + header.bucket_count);
+  // FindEntry trusts these to lie within the central directory.
+  for (uint32_t i = 0; i < header.num_entries; ++i) {
+    if (slots[i].name_offset < sizeof(CentralDirectoryRecord) ||
+        static_cast<uint64_t>(slots[i].name_offset) + slots[i].name_length > header.cd_size) {
+      ALOGW("Zip: index %s has a bad entry", index_file_name);
+      return false;
+    }
+  }
+
+  // As ParseZipArchive does, only accept an archive with an entry at offset 0.
+  uint32_t lfh_start_bytes;
+  if (!archive->mapped_zip.ReadAtOffset(reinterpret_cast<uint8_t*>(&lfh_start_bytes),
+                                        sizeof(uint32_t), 0) ||
+      lfh_start_bytes != LocalFileHeader::kSignature) {
+    ALOGW("Zip: Entry at offset zero has invalid LFH signature");
+    return false;
+  }
+
+  archive->index_map = std::move(map);
+  archive->index_seeds = seeds;
+  archive->index_bucket_count = header.bucket_count;
+  archive->hash_table = const_cast<ZipStringOffset*>(slots);
+  archive->hash_table_size = header.num_entries;
+  return true;
+}
+
+int32_t OpenArchiveWithIndex(const char* fileName, const char* indexFileName,
+                             ZipArchiveHandle* handle) {
+  const int fd = ::android::base::utf8::open(fileName, O_RDONLY | O_BINARY | O_CLOEXEC, 0);
+  ZipArchive* archive = new ZipArchive(fd, true);
+  *handle = archive;
+
+  if (fd < 0) {
+    ALOGW("Unable to open '%s': %s", fileName, strerror(errno));
+    return kIoError;
+  }
+
+  int32_t result = MapCentralDirectory(fileName, archive);
+  if (result != 0) {
+    return result;
+  }
+  if (MapArchiveIndex(archive, indexFileName)) {
+    return 0;
+  }
+  return ParseZipArchive(archive);
+}
+
+int32_t WriteArchiveIndex(const ZipArchiveHandle archive, int fd) {
+  if (archive == nullptr || archive->hash_table == nullptr || !archive->mapped_zip.HasFd()) {
+    ALOGW("Zip: Invalid ZipArchiveHandle");
+    return kInvalidHandle;
+  }
+
+  const uint8_t* start = archive->central_directory.GetBasePtr();
+  std::vector<ZipStringOffset> names;
+  for (uint32_t i = 0; i < archive->hash_table_size; ++i) {
+    if (archive->hash_table[i].name_offset != 0) {
+      names.push_back(archive->hash_table[i]);
+    }
+  }
+
+  const uint32_t num_entries = names.size();
+  if (num_entries == 0) {
+    return kEmptyArchive;
+  }
+
+  // Largest buckets first, while most slots are still free.
+  const uint32_t bucket_count = (num_entries + 3) / 4;
+  std::vector<std::vector<uint32_t>> buckets(bucket_count);
+  for (uint32_t i = 0; i < num_entries; ++i) {
+    buckets[ComputeIndexHash(names[i].GetZipString(start), 0) % bucket_count].push_back(i);
+  }
+  std::vector<uint32_t> order(bucket_count);
+  for (uint32_t i = 0; i < bucket_count; ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&buckets](uint32_t lhs, uint32_t rhs) {
+    return buckets[lhs].size() > buckets[rhs].size();
+  });
+
+  // Value initialized, so that the padding written out is zero.
+  std::vector<ZipStringOffset> slots(num_entries);
+  std::vector<bool> taken(num_entries);
+  std::vector<uint32_t> seeds(bucket_count);
+  std::vector<uint32_t> placed;
+  uint32_t next_free = 0;
+  for (uint32_t b : order) {
+    const std::vector<uint32_t>& bucket = buckets[b];
+    if (bucket.empty()) {
+      break;
+    }
+    if (bucket.size() == 1) {
+      while (taken[next_free]) {
+        ++next_free;
+      }
+      seeds[b] = ZipIndexHeader::kDirectSlot | next_free;
+      taken[next_free] = true;
+      slots[next_free] = names[bucket[0]];
+      continue;
+    }
+
+    static const uint32_t kMaxSeed = 1 << 20;
+    uint32_t seed;
+    for (seed = 1; seed < kMaxSeed; ++seed) {
+      placed.clear();
+      for (uint32_t i : bucket) {
+        const uint32_t slot = ComputeIndexHash(names[i].GetZipString(start), seed) % num_entries;
+        if (taken[slot] || std::find(placed.begin(), placed.end(), slot) != placed.end()) {
+          break;
+        }
+        placed.push_back(slot);
+      }
+      if (placed.size() == bucket.size()) {
+        break;
+      }
+    }
+    if (seed == kMaxSeed) {
+      ALOGW("Zip: unable to build an index for %u entries", num_entries);
+      return kInconsistentInformation;
+    }
+    seeds[b] = seed;
+    for (size_t i = 0; i < bucket.size(); ++i) {
+      taken[placed[i]] = true;
+      slots[placed[i]] = names[bucket[i]];
+    }
+  }
+
+  struct stat st;
+  if (fstat(archive->mapped_zip.GetFileDescriptor(), &st)) {
+    ALOGW("Zip: fstat failed: %s", strerror(errno));
+    return kIoError;
+  }
+  ZipIndexHeader header = {};
+  header.magic = ZipIndexHeader::kMagic;
+  header.version = ZipIndexHeader::kVersion;
+  header.file_length = st.st_size;
+  header.file_mtime = st.st_mtime;
+  header.file_mtime_nsec = GetMtimeNsec(st);
+  header.cd_start_offset = static_cast<uint32_t>(archive->directory_offset);
+  header.cd_size = static_cast<uint32_t>(archive->central_directory.GetMapLength());
+  header.eocd_crc = archive->eocd_crc;
+  header.num_entries = num_entries;
+  header.bucket_count = bucket_count;
+
+  if (!android::base::WriteFully(fd, &header, sizeof(header)) ||
+      !android::base::WriteFully(fd, seeds.data(), seeds.size() * sizeof(seeds[0])) ||
+      !android::base::WriteFully(fd, slots.data(), slots.size() * sizeof(slots[0]))) {
+    ALOGW("Zip: failed to write index: %s", strerror(errno));
+    return kIoError;
+  }
+  return 0;
+}
+
 /*
  * Close a ZipArchive, closing the file and freeing the contents.
  */
@@ -567,6 +846,16 @@ static int32_t FindEntry(const ZipArchive* archive, const int ent, ZipEntry* dat
 
   const CentralDirectoryRecord* cdr = reinterpret_cast<const CentralDirectoryRecord*>(ptr);
 
+  // The slots of an index weren't checked when the archive was opened, so
+  // check here what ParseZipArchive would have: that this is a central
+  // directory record, for this name, and that the name is valid.
+  if (archive->index_seeds != nullptr &&
+      (cdr->record_signature != CentralDirectoryRecord::kSignature ||
+       cdr->file_name_length != nameLen || !IsValidEntryName(from_offset.name, nameLen))) {
+    ALOGW("Zip: index entry does not match the central directory");
+    return kInvalidOffset;
+  }
+
   // The offset of the start of the central directory in the zipfile.
   // We keep this lying around so that we can sanity check all our lengths
   // and our per-file structures.
@@ -760,8 +1049,10 @@ int32_t FindEntry(const ZipArchiveHandle archive, const ZipString& entryName, Zi
     return kInvalidEntryName;
   }
 
-  const int64_t ent = EntryToIndex(archive->hash_table, archive->hash_table_size, entryName,
-                                   archive->central_directory.GetBasePtr());
+  const int64_t ent = archive->index_seeds
+                          ? EntryToIndexSlot(archive, entryName)
+                          : EntryToIndex(archive->hash_table, archive->hash_table_size, entryName,
+                                         archive->central_directory.GetBasePtr());
   if (ent < 0) {
     ALOGV("Zip: Could not find entry %.*s", entryName.name_length, entryName.name);
     return ent;
@@ -949,6 +1240,10 @@ static inline int zlib_inflateInit2(z_stream* stream, int window_bits) {
 }
 #pragma GCC diagnostic pop
 
+static size_t ExtractBufSize(uint32_t length) {
+  return std::min(kMaxExtractBufSize, std::max(kMinExtractBufSize, static_cast<size_t>(length)));
+}
+
 namespace zip_archive {
 
 // Moved out of line to avoid -Wweak-vtables.
@@ -957,9 +1252,10 @@ Writer::~Writer() {}
 
 int32_t Inflate(const Reader& reader, const uint32_t compressed_length,
                 const uint32_t uncompressed_length, Writer* writer, uint64_t* crc_out) {
-  const size_t kBufSize = 32768;
-  std::vector<uint8_t> read_buf(kBufSize);
-  std::vector<uint8_t> write_buf(kBufSize);
+  const size_t read_buf_size = ExtractBufSize(compressed_length);
+  const size_t write_buf_size = ExtractBufSize(uncompressed_length);
+  std::vector<uint8_t> read_buf(read_buf_size);
+  std::vector<uint8_t> write_buf(write_buf_size);
   z_stream zstream;
   int zerr;
 
@@ -973,7 +1269,7 @@ int32_t Inflate(const Reader& reader, const uint32_t compressed_length,
   zstream.next_in = NULL;
   zstream.avail_in = 0;
   zstream.next_out = &write_buf[0];
-  zstream.avail_out = kBufSize;
+  zstream.avail_out = write_buf_size;
   zstream.data_type = Z_UNKNOWN;
 
   /*
@@ -1003,7 +1299,7 @@ int32_t Inflate(const Reader& reader, const uint32_t compressed_length,
   do {
     /* read as much as we can */
     if (zstream.avail_in == 0) {
-      const size_t read_size = (remaining_bytes > kBufSize) ? kBufSize : remaining_bytes;
+      const size_t read_size = (remaining_bytes > read_buf_size) ? read_buf_size : remaining_bytes;
       const uint32_t offset = (compressed_length - remaining_bytes);
       // Make sure to read at offset to ensure concurrent access to the fd.
       if (!reader.ReadAtOffset(read_buf.data(), read_size, offset)) {
@@ -1026,7 +1322,7 @@ int32_t Inflate(const Reader& reader, const uint32_t compressed_length,
     }
 
     /* write when we're full or when we're done */
-    if (zstream.avail_out == 0 || (zerr == Z_STREAM_END && zstream.avail_out != kBufSize)) {
+    if (zstream.avail_out == 0 || (zerr == Z_STREAM_END && zstream.avail_out != write_buf_size)) {
       const size_t write_size = zstream.next_out - &write_buf[0];
       if (!writer->Append(&write_buf[0], write_size)) {
         return kIoError;
@@ -1035,7 +1331,7 @@ int32_t Inflate(const Reader& reader, const uint32_t compressed_length,
       }
 
       zstream.next_out = &write_buf[0];
-      zstream.avail_out = kBufSize;
+      zstream.avail_out = write_buf_size;
     }
   } while (zerr == Z_OK);
 
@@ -1071,34 +1367,67 @@ static int32_t InflateEntryToWriter(MappedZipFile& mapped_zip, const ZipEntry* e
 
 static int32_t CopyEntryToWriter(MappedZipFile& mapped_zip, const ZipEntry* entry,
                                  zip_archive::Writer* writer, uint64_t* crc_out) {
-  static const uint32_t kBufSize = 32768;
-  std::vector<uint8_t> buf(kBufSize);
-
   const uint32_t length = entry->uncompressed_length;
+
+  // Write straight out of the archive if it is in memory, or out of a
+  // mapping of the entry if the entry is large enough to be worth mapping.
+  // Only map what the file actually contains: touching a mapping past the end
+  // of the file raises SIGBUS, where a short read returns kIoError below.
+  // The file can shrink while open, so its length is asked for each time,
+  // but only for entries large enough to map, where the lseek is lost in the
+  // copy.
+  std::unique_ptr<android::base::MappedFile> entry_map;
+  const uint8_t* mapped = nullptr;
+  const off64_t end = entry->offset + static_cast<off64_t>(length);
+  if (!mapped_zip.HasFd()) {
+    if (end <= mapped_zip.GetFileLength()) {
+      mapped = static_cast<const uint8_t*>(mapped_zip.GetBasePtr()) + entry->offset;
+    }
+  } else if (length >= kMinMappedCopySize && end <= mapped_zip.GetFileLength()) {
+    entry_map = android::base::MappedFile::FromFd(mapped_zip.GetFileDescriptor(), entry->offset,
+                                                  length, PROT_READ);
+    if (entry_map) {
+      mapped = reinterpret_cast<const uint8_t*>(entry_map->data());
+    }
+  }
+
+  const size_t buf_size = ExtractBufSize(length);
+  std::vector<uint8_t> buf(mapped ? 0 : buf_size);
   uint32_t count = 0;
   uint64_t crc = 0;
   while (count < length) {
     uint32_t remaining = length - count;
     off64_t offset = entry->offset + count;
 
-    // Safe conversion because kBufSize is narrow enough for a 32 bit signed value.
-    const size_t block_size = (remaining > kBufSize) ? kBufSize : remaining;
+    // Safe conversion because buf_size is narrow enough for a 32 bit signed value.
+    const size_t block_size = (remaining > buf_size) ? buf_size : remaining;
 
-    // Make sure to read at offset to ensure concurrent access to the fd.
-    if (!mapped_zip.ReadAtOffset(buf.data(), block_size, offset)) {
-      ALOGW("CopyFileToFile: copy read failed, block_size = %zu, offset = %" PRId64 ": %s",
-            block_size, static_cast<int64_t>(offset), strerror(errno));
-      return kIoError;
+    uint8_t* block;
+    if (mapped) {
+      // Writers only ever read from the buffer they are given.
+      block = const_cast<uint8_t*>(mapped + count);
+    } else {
+      // Make sure to read at offset to ensure concurrent access to the fd.
+      if (!mapped_zip.ReadAtOffset(buf.data(), block_size, offset)) {
+        ALOGW("CopyFileToFile: copy read failed, block_size = %zu, offset = %" PRId64 ": %s",
+              block_size, static_cast<int64_t>(offset), strerror(errno));
+        return kIoError;
+      }
+      block = buf.data();
     }
 
-    if (!writer->Append(&buf[0], block_size)) {
+    if (!writer->Append(block, block_size)) {
       return kIoError;
     }
-    crc = crc32(crc, &buf[0], block_size);
+    if (crc_out != nullptr) {
+      crc = crc32(crc, block, block_size);
+    }
     count += block_size;
   }
 
-  *crc_out = crc;
+  if (crc_out != nullptr) {
+    *crc_out = crc;
+  }
 
   return 0;
 }
@@ -1109,10 +1438,12 @@ int32_t ExtractToWriter(ZipArchiveHandle archive, ZipEntry* entry, zip_archive::
   // this should default to kUnknownCompressionMethod.
   int32_t return_value = -1;
   uint64_t crc = 0;
+  // Only pay for the crc if it is going to be checked.
+  uint64_t* crc_out = kCrcChecksEnabled ? &crc : nullptr;
   if (method == kCompressStored) {
-    return_value = CopyEntryToWriter(archive->mapped_zip, entry, writer, &crc);
+    return_value = CopyEntryToWriter(archive->mapped_zip, entry, writer, crc_out);
   } else if (method == kCompressDeflated) {
-    return_value = InflateEntryToWriter(archive->mapped_zip, entry, writer, &crc);
+    return_value = InflateEntryToWriter(archive->mapped_zip, entry, writer, crc_out);
   }
 
   if (!return_value && entry->has_data_descriptor) {
@@ -1190,6 +1521,49 @@ int32_t ProcessZipEntryContents(ZipArchiveHandle archive, ZipEntry* entry,
   return ExtractToWriter(archive, entry, &writer);
 }
 
+int32_t ExtractEntriesToFiles(ZipArchiveHandle archive, ZipEntry* entries, const int* fds,
+                              size_t count, size_t num_threads) {
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  num_threads = std::min(num_threads, count);
+
+  // Largest first, so that one big entry doesn't start last and hold up the rest.
+  std::vector<size_t> order(count);
+  for (size_t i = 0; i < count; ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [entries](size_t lhs, size_t rhs) {
+    return entries[lhs].uncompressed_length > entries[rhs].uncompressed_length;
+  });
+
+  // Every reader of the archive uses pread, so the only shared state is the next index.
+  std::vector<int32_t> results(count);
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+      const size_t index = order[i];
+      results[index] = ExtractEntryToFile(archive, &entries[index], fds[index]);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (int32_t result : results) {
+    if (result != 0) {
+      return result;
+    }
+  }
+  return 0;
+}
+
 #endif  //! defined(_WIN32)
 
 int MappedZipFile::GetFileDescriptor() const {
@@ -14,14 +14,20 @@
  * limitations under the License.
  */
 
+#include <unistd.h>
+
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <string>
 #include <tuple>
 #include <vector>
 
+#include <android-base/file.h>
 #include <android-base/test_utils.h>
 #include <benchmark/benchmark.h>
 #include <ziparchive/zip_archive.h>
@@ -84,4 +90,253 @@ static void Iterate_all_files(benchmark::State& state) {
 }
 BENCHMARK(Iterate_all_files);
 
+static std::string LargeZipEntryName(size_t i) {
+  return "res/drawable-xxhdpi-v4/image_" + std::to_string(i) + ".png";
+}
+
+// An APK shaped archive with num_entries small stored entries, and an index
+// of it written by WriteArchiveIndex. Shared by the benchmarks below, as
+// writing the larger ones takes a while.
+struct LargeZip {
+  TemporaryFile zip;
+  TemporaryFile index;
+};
+
+static const LargeZip& GetLargeZip(size_t num_entries) {
+  static std::map<size_t, std::unique_ptr<LargeZip>> zips;
+  std::unique_ptr<LargeZip>& large_zip = zips[num_entries];
+  if (large_zip) return *large_zip;
+
+  large_zip.reset(new LargeZip);
+  FILE* fp = fdopen(large_zip->zip.fd, "w");
+  ZipWriter writer(fp);
+  for (size_t i = 0; i < num_entries; i++) {
+    writer.StartEntry(LargeZipEntryName(i).c_str(), 0);
+    writer.WriteBytes("helo", 4);
+    writer.FinishEntry();
+  }
+  writer.Finish();
+  fclose(fp);
+  large_zip->zip.fd = -1;
+
+  ZipArchiveHandle handle;
+  OpenArchive(large_zip->zip.path, &handle);
+  WriteArchiveIndex(handle, large_zip->index.fd);
+  CloseArchive(handle);
+  return *large_zip;
+}
+
+static void OpenArchive_entries(benchmark::State& state) {
+  const LargeZip& large_zip = GetLargeZip(state.range(0));
+  ZipArchiveHandle handle;
+
+  while (state.KeepRunning()) {
+    OpenArchive(large_zip.zip.path, &handle);
+    CloseArchive(handle);
+  }
+}
+
+static void OpenArchiveWithIndex_entries(benchmark::State& state) {
+  const LargeZip& large_zip = GetLargeZip(state.range(0));
+  ZipArchiveHandle handle;
+
+  while (state.KeepRunning()) {
+    OpenArchiveWithIndex(large_zip.zip.path, large_zip.index.path, &handle);
+    CloseArchive(handle);
+  }
+}
+
+static void FindEntry_entries(benchmark::State& state, bool indexed) {
+  const LargeZip& large_zip = GetLargeZip(state.range(0));
+  ZipArchiveHandle handle;
+  if (indexed) {
+    OpenArchiveWithIndex(large_zip.zip.path, large_zip.index.path, &handle);
+  } else {
+    OpenArchive(large_zip.zip.path, &handle);
+  }
+
+  std::vector<std::string> names;
+  for (size_t i = 0; i < 1024; i++) {
+    names.push_back(LargeZipEntryName((i * 7919) % state.range(0)));
+  }
+  ZipEntry data;
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    FindEntry(handle, ZipString(names[i++ % names.size()].c_str()), &data);
+  }
+  state.SetItemsProcessed(state.iterations());
+  CloseArchive(handle);
+}
+
+static void FindEntry_hash_table(benchmark::State& state) {
+  FindEntry_entries(state, false);
+}
+
+static void FindEntry_index(benchmark::State& state) {
+  FindEntry_entries(state, true);
+}
+
+// 65535 is as many entries as an archive without zip64 extensions can hold.
+static void LargeZipSizes(benchmark::internal::Benchmark* b) {
+  for (int entries : {10000, 50000, 65535}) {
+    b->Arg(entries);
+  }
+}
+BENCHMARK(OpenArchive_entries)->Apply(LargeZipSizes);
+BENCHMARK(OpenArchiveWithIndex_entries)->Apply(LargeZipSizes);
+BENCHMARK(FindEntry_hash_table)->Apply(LargeZipSizes);
+BENCHMARK(FindEntry_index)->Apply(LargeZipSizes);
+
+// Extracts 32 entries of 1MiB, stored if range(1) is 0 and deflated
+// otherwise, to files on range(0) threads.
+static void ExtractEntriesToFiles_threads(benchmark::State& state) {
+  const size_t kEntries = 32;
+  std::vector<uint8_t> contents(1024 * 1024);
+  for (size_t i = 0; i < contents.size(); i++) {
+    contents[i] = static_cast<uint8_t>((i * 7) ^ (i >> 9));
+  }
+
+  TemporaryFile zip;
+  FILE* fp = fdopen(zip.fd, "w");
+  ZipWriter writer(fp);
+  for (size_t i = 0; i < kEntries; i++) {
+    writer.StartEntry(("entry" + std::to_string(i)).c_str(),
+                      state.range(1) ? ZipWriter::kCompress : 0);
+    writer.WriteBytes(contents.data(), contents.size());
+    writer.FinishEntry();
+  }
+  writer.Finish();
+  fclose(fp);
+  zip.fd = -1;
+
+  ZipArchiveHandle handle;
+  OpenArchive(zip.path, &handle);
+  std::vector<ZipEntry> entries(kEntries);
+  std::vector<std::unique_ptr<TemporaryFile>> files;
+  std::vector<int> fds;
+  for (size_t i = 0; i < kEntries; i++) {
+    FindEntry(handle, ZipString(("entry" + std::to_string(i)).c_str()), &entries[i]);
+    files.emplace_back(new TemporaryFile);
+    fds.push_back(files.back()->fd);
+  }
+
+  while (state.KeepRunning()) {
+    for (int fd : fds) {
+      ftruncate(fd, 0);
+      lseek(fd, 0, SEEK_SET);
+    }
+    ExtractEntriesToFiles(handle, entries.data(), fds.data(), kEntries, state.range(0));
+  }
+  state.SetBytesProcessed(state.iterations() * kEntries * contents.size());
+  CloseArchive(handle);
+}
+static void ExtractThreads(benchmark::internal::Benchmark* b) {
+  for (int compressed : {0, 1}) {
+    for (int threads : {1, 2, 4, 8}) {
+      b->Args({threads, compressed});
+    }
+  }
+}
+BENCHMARK(ExtractEntriesToFiles_threads)->Apply(ExtractThreads)->UseRealTime();
+
+// Data for the ZipWriter benchmarks that compresses, about 3:1, but not to nothing.
+static const std::vector<uint8_t>& WriterContents() {
+  static std::vector<uint8_t> contents;
+  if (contents.empty()) {
+    contents.resize(1024 * 1024);
+    for (size_t i = 0; i < contents.size(); i++) {
+      contents[i] = "abcdefghijklmnop"[static_cast<uint32_t>(i * 2654435761u) >> 28] + (i % 7 == 0);
+    }
+  }
+  return contents;
+}
+
+// Writes a range(0) MiB archive of deflated entries of range(1) KiB each, on range(2) threads,
+// 0 being the single threaded ZipWriter.
+static void ZipWriter_deflate(benchmark::State& state) {
+  const std::vector<uint8_t>& contents = WriterContents();
+  const size_t total = static_cast<size_t>(state.range(0)) * 1024 * 1024;
+  const size_t entry_size = static_cast<size_t>(state.range(1)) * 1024;
+
+  while (state.KeepRunning()) {
+    TemporaryFile zip;
+    FILE* fp = fdopen(zip.fd, "w");
+    ZipWriter writer(fp, state.range(2));
+    for (size_t written = 0, i = 0; written < total; written += entry_size, i++) {
+      writer.StartEntry(("entry" + std::to_string(i)).c_str(), ZipWriter::kCompress);
+      for (size_t offset = 0; offset < entry_size; offset += contents.size()) {
+        writer.WriteBytes(contents.data(), std::min(contents.size(), entry_size - offset));
+      }
+      writer.FinishEntry();
+    }
+    writer.Finish();
+    fclose(fp);
+    zip.fd = -1;
+  }
+  state.SetBytesProcessed(state.iterations() * total);
+}
+
+// Writes a range(0) MiB archive of page aligned stored entries of 64MiB each, from a file with
+// WriteBytesFromFd if range(1) is 1, and otherwise by reading it and calling WriteBytes.
+static void ZipWriter_store(benchmark::State& state) {
+  const size_t kEntrySize = 64 * 1024 * 1024;
+  const size_t total = static_cast<size_t>(state.range(0)) * 1024 * 1024;
+
+  TemporaryFile source;
+  for (size_t offset = 0; offset < kEntrySize; offset += WriterContents().size()) {
+    android::base::WriteFully(source.fd, WriterContents().data(), WriterContents().size());
+  }
+  std::vector<uint8_t> buffer(1024 * 1024);
+
+  while (state.KeepRunning()) {
+    TemporaryFile zip;
+    FILE* fp = fdopen(zip.fd, "w");
+    ZipWriter writer(fp);
+    for (size_t written = 0, i = 0; written < total; written += kEntrySize, i++) {
+      writer.StartAlignedEntry(("lib" + std::to_string(i) + ".so").c_str(), 0, 4096);
+      if (state.range(1)) {
+        writer.WriteBytesFromFd(source.fd, 0, kEntrySize);
+      } else {
+        for (size_t offset = 0; offset < kEntrySize; offset += buffer.size()) {
+          android::base::ReadFullyAtOffset(source.fd, buffer.data(), buffer.size(), offset);
+          writer.WriteBytes(buffer.data(), buffer.size());
+        }
+      }
+      writer.FinishEntry();
+    }
+    writer.Finish();
+    fclose(fp);
+    zip.fd = -1;
+  }
+  state.SetBytesProcessed(state.iterations() * total);
+}
+
+// Archives in the GiB range, up to what an archive without zip64 extensions can hold.
+static void WriterDeflateArgs(benchmark::internal::Benchmark* b) {
+  for (int megabytes : {1024, 3072}) {
+    for (int entry_kilobytes : {64, 64 * 1024}) {
+      for (int threads : {0, 1, 4, 8}) {
+        b->Args({megabytes, entry_kilobytes, threads});
+      }
+    }
+  }
+}
+static void WriterStoreArgs(benchmark::internal::Benchmark* b) {
+  for (int megabytes : {1024, 3072}) {
+    for (int from_fd : {0, 1}) {
+      b->Args({megabytes, from_fd});
+    }
+  }
+}
+BENCHMARK(ZipWriter_deflate)
+    ->Apply(WriterDeflateArgs)
+    ->Iterations(1)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(ZipWriter_store)
+    ->Apply(WriterStoreArgs)
+    ->Iterations(1)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
 BENCHMARK_MAIN();
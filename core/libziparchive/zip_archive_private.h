@@ -156,6 +156,38 @@ struct ZipStringOffset {
   }
 };
 
+static_assert(sizeof(ZipStringOffset) == 8, "ZipStringOffset is written to archive indexes");
+
+/**
+ * Header of an archive index written by WriteArchiveIndex. It is followed by
+ * uint32_t seeds[bucket_count] and ZipStringOffset slots[num_entries].
+ *
+ * The index is a minimal perfect hash built with hash and displace: a name
+ * hashes to a bucket, and the bucket's seed says where in slots the names of
+ * that bucket went. A seed with kDirectSlot set is that slot, used for
+ * buckets of one name. Anything else is fed back into the hash along with
+ * the name. Slots hold the same offsets into the central directory as the
+ * hash table built by OpenArchive, so it can be mapped in its place.
+ */
+struct ZipIndexHeader {
+  static const uint32_t kMagic = 0x5844495a;  // ZIDX
+  static const uint32_t kVersion = 2;
+  static const uint32_t kDirectSlot = 0x80000000;
+
+  uint32_t magic;
+  uint32_t version;
+  // Which archive this index was written for.
+  uint64_t file_length;
+  int64_t file_mtime;
+  uint32_t file_mtime_nsec;
+  uint32_t cd_start_offset;
+  uint32_t cd_size;
+  uint32_t eocd_crc;
+
+  uint32_t num_entries;
+  uint32_t bucket_count;
+} __attribute__((packed));
+
 struct ZipArchive {
   // open Zip archive
   mutable MappedZipFile mapped_zip;
@@ -176,6 +208,15 @@ struct ZipArchive {
   uint32_t hash_table_size;
   ZipStringOffset* hash_table;
 
+  // crc32 of the end of central directory record and comment.
+  uint32_t eocd_crc;
+
+  // If opened with an index, hash_table points at its slots in index_map and
+  // index_seeds at its seeds.
+  std::unique_ptr<android::base::MappedFile> index_map;
+  const uint32_t* index_seeds;
+  uint32_t index_bucket_count;
+
   ZipArchive(const int fd, bool assume_ownership);
   ZipArchive(void* address, size_t length);
   ~ZipArchive();
@@ -15,12 +15,14 @@
  */
 
 #include "zip_archive_private.h"
+#include "zip_archive_common.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <memory>
@@ -32,6 +34,7 @@
 #include <gtest/gtest.h>
 #include <ziparchive/zip_archive.h>
 #include <ziparchive/zip_archive_stream_entry.h>
+#include <ziparchive/zip_writer.h>
 
 static std::string test_data_dir = android::base::GetExecutableDirectory() + "/testdata";
 
@@ -210,6 +213,103 @@ TEST(ziparchive, FindEntry) {
   CloseArchive(handle);
 }
 
+TEST(ziparchive, OpenWithIndex) {
+  const std::string zip_path = test_data_dir + "/" + kValidZip;
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchive(zip_path.c_str(), &handle));
+  TemporaryFile index;
+  ASSERT_EQ(0, WriteArchiveIndex(handle, index.fd));
+  CloseArchive(handle);
+
+  ASSERT_EQ(0, OpenArchiveWithIndex(zip_path.c_str(), index.path, &handle));
+  ZipEntry data;
+  ZipString name;
+  SetZipString(&name, kATxtName);
+  ASSERT_EQ(0, FindEntry(handle, name, &data));
+  ASSERT_EQ(63, data.offset);
+  ASSERT_EQ(0x950821c5, data.crc32);
+
+  ZipString absent_name;
+  SetZipString(&absent_name, kNonexistentTxtName);
+  ASSERT_LT(FindEntry(handle, absent_name, &data), 0);
+
+  void* iteration_cookie;
+  ASSERT_EQ(0, StartIteration(handle, &iteration_cookie, nullptr, nullptr));
+  size_t entries = 0;
+  while (Next(iteration_cookie, &data, &name) == 0) {
+    ++entries;
+  }
+  EndIteration(iteration_cookie);
+  ASSERT_EQ(5u, entries);
+  CloseArchive(handle);
+}
+
+TEST(ziparchive, OpenWithMismatchedIndex) {
+  // An index for another archive must be ignored, not trusted.
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kLargeZip, &handle));
+  TemporaryFile index;
+  ASSERT_EQ(0, WriteArchiveIndex(handle, index.fd));
+  CloseArchive(handle);
+
+  const std::string zip_path = test_data_dir + "/" + kValidZip;
+  ASSERT_EQ(0, OpenArchiveWithIndex(zip_path.c_str(), index.path, &handle));
+  ZipEntry data;
+  ZipString name;
+  SetZipString(&name, kATxtName);
+  ASSERT_EQ(0, FindEntry(handle, name, &data));
+  ASSERT_EQ(63, data.offset);
+  CloseArchive(handle);
+
+  ASSERT_EQ(0, OpenArchiveWithIndex(zip_path.c_str(), "/nonexistent.zidx", &handle));
+  ASSERT_EQ(0, FindEntry(handle, name, &data));
+  CloseArchive(handle);
+}
+
+TEST(ziparchive, OpenWithIndexOfModifiedArchive) {
+  // A copy of the archive, indexed, then with its central directory record
+  // for a.txt broken but its size and modification time restored, as if
+  // someone had tried to pass off the old index.
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(test_data_dir + "/" + kValidZip, &contents));
+  TemporaryFile zip;
+  ASSERT_TRUE(android::base::WriteStringToFd(contents, zip.fd));
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchive(zip.path, &handle));
+  TemporaryFile index;
+  ASSERT_EQ(0, WriteArchiveIndex(handle, index.fd));
+  CloseArchive(handle);
+
+  struct stat st;
+  ASSERT_EQ(0, fstat(zip.fd, &st));
+  const std::string cdr_a_txt = std::string("PK\x01\x02", 4);
+  size_t offset = contents.find(cdr_a_txt);
+  while (offset != std::string::npos &&
+         contents.compare(offset + sizeof(CentralDirectoryRecord), kATxtName.size(), kATxtName)) {
+    offset = contents.find(cdr_a_txt, offset + 1);
+  }
+  ASSERT_NE(std::string::npos, offset);
+  contents[offset] = 'X';
+  ASSERT_TRUE(android::base::WriteStringToFile(contents, zip.path));
+  const struct timespec times[2] = {st.st_atim, st.st_mtim};
+  ASSERT_EQ(0, utimensat(AT_FDCWD, zip.path, times, 0));
+
+  ZipEntry data;
+  ZipString name;
+  SetZipString(&name, kATxtName);
+  ASSERT_EQ(0, OpenArchiveWithIndex(zip.path, index.path, &handle));
+  ASSERT_EQ(kInvalidOffset, FindEntry(handle, name, &data));
+  CloseArchive(handle);
+
+  // With any other modification time the index isn't used, and a full scan
+  // rejects the archive.
+  struct timespec later[2] = {st.st_atim, st.st_mtim};
+  later[1].tv_nsec = (later[1].tv_nsec + 1) % 1000000000;
+  ASSERT_EQ(0, utimensat(AT_FDCWD, zip.path, later, 0));
+  ASSERT_NE(0, OpenArchiveWithIndex(zip.path, index.path, &handle));
+  CloseArchive(handle);
+}
+
 TEST(ziparchive, TestInvalidDeclaredLength) {
   ZipArchiveHandle handle;
   ASSERT_EQ(0, OpenArchiveWrapper("declaredlength.zip", &handle));
@@ -429,6 +529,93 @@ TEST(ziparchive, OpenFromMemory) {
   ASSERT_NE(-1, tmp_binary.fd);
   ASSERT_EQ(0, ExtractEntryToFile(handle, &binary_entry, tmp_binary.fd));
 }
+
+TEST(ziparchive, ExtractEntriesToFiles) {
+  // A stored entry large enough to be copied out of a mapping, a deflated
+  // one and a small one of each.
+  std::vector<uint8_t> large(1024 * 1024);
+  for (size_t i = 0; i < large.size(); ++i) {
+    large[i] = static_cast<uint8_t>(i * 7 + i / 251);
+  }
+  const std::vector<std::pair<const char*, size_t>> kEntries = {
+      {"large_stored", 0}, {"large_deflated", ZipWriter::kCompress}, {"a.txt", 0},
+      {"b.txt", ZipWriter::kCompress}};
+
+  TemporaryFile zip_file;
+  ASSERT_NE(-1, zip_file.fd);
+  {
+    FILE* fp = fdopen(dup(zip_file.fd), "w");
+    ASSERT_NE(nullptr, fp);
+    ZipWriter writer(fp);
+    for (const auto& entry : kEntries) {
+      ASSERT_EQ(0, writer.StartEntry(entry.first, entry.second));
+      if (entry.first[0] == 'l') {
+        ASSERT_EQ(0, writer.WriteBytes(large.data(), large.size()));
+      } else {
+        ASSERT_EQ(0, writer.WriteBytes(kATxtContents.data(), kATxtContents.size()));
+      }
+      ASSERT_EQ(0, writer.FinishEntry());
+    }
+    ASSERT_EQ(0, writer.Finish());
+    ASSERT_EQ(0, fclose(fp));
+  }
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchive(zip_file.path, &handle));
+
+  std::vector<ZipEntry> entries(kEntries.size());
+  std::vector<std::unique_ptr<TemporaryFile>> files;
+  std::vector<int> fds;
+  for (size_t i = 0; i < kEntries.size(); ++i) {
+    ZipString name(kEntries[i].first);
+    ASSERT_EQ(0, FindEntry(handle, name, &entries[i]));
+    files.emplace_back(new TemporaryFile);
+    fds.push_back(files.back()->fd);
+  }
+  ASSERT_EQ(0, ExtractEntriesToFiles(handle, entries.data(), fds.data(), entries.size(), 3));
+
+  for (size_t i = 0; i < kEntries.size(); ++i) {
+    const std::vector<uint8_t>& expected = (kEntries[i].first[0] == 'l') ? large : kATxtContents;
+    std::vector<uint8_t> contents(expected.size());
+    ASSERT_EQ(static_cast<off_t>(expected.size()), lseek(fds[i], 0, SEEK_END));
+    ASSERT_EQ(0, lseek(fds[i], 0, SEEK_SET));
+    ASSERT_TRUE(android::base::ReadFully(fds[i], contents.data(), contents.size()));
+    ASSERT_EQ(expected, contents) << kEntries[i].first;
+  }
+
+  CloseArchive(handle);
+}
+
+TEST(ziparchive, ExtractTruncatedStoredEntry) {
+  // A stored entry large enough to be copied out of a mapping, in an archive
+  // that is cut short after it has been opened.
+  std::vector<uint8_t> large(1024 * 1024, 'x');
+  TemporaryFile zip_file;
+  ASSERT_NE(-1, zip_file.fd);
+  {
+    FILE* fp = fdopen(dup(zip_file.fd), "w");
+    ASSERT_NE(nullptr, fp);
+    ZipWriter writer(fp);
+    ASSERT_EQ(0, writer.StartEntry("large_stored", 0));
+    ASSERT_EQ(0, writer.WriteBytes(large.data(), large.size()));
+    ASSERT_EQ(0, writer.FinishEntry());
+    ASSERT_EQ(0, writer.Finish());
+    ASSERT_EQ(0, fclose(fp));
+  }
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchive(zip_file.path, &handle));
+  ZipEntry entry;
+  ZipString name("large_stored");
+  ASSERT_EQ(0, FindEntry(handle, name, &entry));
+  ASSERT_EQ(0, ftruncate(zip_file.fd, entry.offset + large.size() / 2));
+
+  TemporaryFile out;
+  ASSERT_NE(-1, out.fd);
+  ASSERT_EQ(kIoError, ExtractEntryToFile(handle, &entry, out.fd));
+
+  CloseArchive(handle);
+}
 #endif
 
 static void ZipArchiveStreamTest(ZipArchiveHandle& handle, const std::string& entry_name, bool raw,
@@ -18,14 +18,26 @@
 
 #include <sys/param.h>
 #include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#include <unistd.h>
 #include <zlib.h>
 #include <cstdio>
+#include <cstring>
 #define DEF_MEM_LEVEL 8  // normally in zutil.h?
 
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "android-base/logging.h"
+#include "android-base/mapped_file.h"
 
 #include "entry_name_utils-inl.h"
 #include "zip_archive_common.h"
@@ -47,6 +59,11 @@ enum {
 // Size of the output buffer used for compression.
 static const size_t kBufSize = 32768u;
 
+// When deflating on a ThreadPool, entries are cut into blocks of this size, and each block is
+// primed with this much of the end of the block before it.
+static const size_t kParallelBlockSize = 128 * 1024;
+static const size_t kWindowSize = 32 * 1024;
+
 // No error, operation completed successfully.
 static const int32_t kNoError = 0;
 
@@ -84,13 +101,169 @@ static void DeleteZStream(z_stream* stream) {
   delete stream;
 }
 
+// Copies up to |len| bytes from one file to another without reading them into user space.
+// Returns the number of bytes copied, which is less than |len| if the kernel or the file system
+// can't do any more.
+static size_t CopyFileRange(int in_fd, off64_t in_offset, int out_fd, off64_t out_offset,
+                            size_t len) {
+  size_t copied = 0;
+#if defined(__linux__) && defined(__NR_copy_file_range)
+  while (copied < len) {
+    off64_t in_off = in_offset + copied;
+    off64_t out_off = out_offset + copied;
+    ssize_t result = syscall(__NR_copy_file_range, in_fd, &in_off, out_fd, &out_off, len - copied,
+                             0);
+    if (result <= 0) {
+      break;
+    }
+    copied += result;
+  }
+#else
+  UNUSED(in_fd, in_offset, out_fd, out_offset, len);
+#endif
+  return copied;
+}
+
+// A piece of the zip file when deflating on a ThreadPool. Pieces are written in the order they
+// were queued, each once the deflating it waits on, if any, is done. The local file header
+// offset, compressed size and crc of deflated entries are only known at that point.
+struct ZipWriter::PendingWrite {
+  enum Type {
+    kHeader,
+    kData,
+    kDataDescriptor,
+  };
+
+  PendingWrite(Type type, size_t file_index) : type(type), file_index(file_index) {}
+
+  void Deflate();
+
+  const Type type;
+  // The entry in files_ this belongs to, or the current entry if there isn't one yet.
+  const size_t file_index;
+  // What is written to the file.
+  std::vector<uint8_t> bytes;
+
+  // kData only.
+  std::vector<uint8_t> input;
+  std::vector<uint8_t> window;
+  bool last = false;
+  uint32_t crc = 0;
+  size_t input_size = 0;
+  int32_t result = kNoError;
+  std::future<void> done;
+};
+
+// Deflates |input| into |bytes| with a stream of its own. Every block but the last ends with a
+// sync flush, so that it ends on a byte boundary and the blocks can be concatenated into one
+// deflate stream.
+void ZipWriter::PendingWrite::Deflate() {
+  crc = crc32(0, input.data(), input.size());
+  input_size = input.size();
+
+  z_stream stream = {};
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+  int zerr = deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, DEF_MEM_LEVEL,
+                          Z_DEFAULT_STRATEGY);
+#pragma GCC diagnostic pop
+  if (zerr != Z_OK) {
+    LOG(ERROR) << "deflateInit2 failed (zerr=" << zerr << ")";
+    result = kZlibError;
+    return;
+  }
+  if (!window.empty()) {
+    deflateSetDictionary(&stream, window.data(), window.size());
+  }
+
+  stream.next_in = input.data();
+  stream.avail_in = input.size();
+  bytes.resize(deflateBound(&stream, input.size()) + 8);
+  const int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+  size_t produced = 0;
+  do {
+    if (produced == bytes.size()) {
+      bytes.resize(bytes.size() * 2);
+    }
+    stream.next_out = bytes.data() + produced;
+    stream.avail_out = bytes.size() - produced;
+    zerr = deflate(&stream, flush);
+    produced = bytes.size() - stream.avail_out;
+  } while (zerr == Z_OK && (last || stream.avail_out == 0));
+  deflateEnd(&stream);
+
+  if (zerr != (last ? Z_STREAM_END : Z_OK)) {
+    LOG(ERROR) << "deflate failed (zerr=" << zerr << ")";
+    result = kZlibError;
+  }
+  bytes.resize(produced);
+  std::vector<uint8_t>().swap(input);
+  std::vector<uint8_t>().swap(window);
+}
+
+// Runs tasks on a fixed set of threads. Tasks already queued are run before the pool is
+// destroyed.
+class ZipWriter::ThreadPool {
+ public:
+  explicit ThreadPool(size_t num_threads) {
+    for (size_t i = 0; i < num_threads; i++) {
+      threads_.emplace_back([this]() { Work(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  std::future<void> Run(std::function<void()> fn) {
+    std::packaged_task<void()> task(std::move(fn));
+    std::future<void> result = task.get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+    return result;
+  }
+
+ private:
+  void Work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cv_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        return;
+      }
+      std::packaged_task<void()> task = std::move(tasks_.front());
+      tasks_.pop_front();
+      lock.unlock();
+      task();
+      lock.lock();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::packaged_task<void()>> tasks_;
+  bool stop_ = false;
+  std::vector<std::thread> threads_;
+};
+
 ZipWriter::ZipWriter(FILE* f)
     : file_(f),
       seekable_(false),
       current_offset_(0),
       state_(State::kWritingZip),
       z_stream_(nullptr, DeleteZStream),
-      buffer_(kBufSize) {
+      buffer_(kBufSize),
+      max_pending_(0) {
   // Check if the file is seekable (regular file). If fstat fails, that's fine, subsequent calls
   // will fail as well.
   struct stat file_stats;
@@ -99,6 +272,16 @@ ZipWriter::ZipWriter(FILE* f)
   }
 }
 
+ZipWriter::ZipWriter(FILE* f, size_t num_threads) : ZipWriter(f) {
+  if (num_threads > 0) {
+    pool_.reset(new ThreadPool(num_threads));
+    // Enough to keep every thread busy while the oldest block is written.
+    max_pending_ = 4 * num_threads;
+  }
+}
+
+ZipWriter::~ZipWriter() = default;
+
 ZipWriter::ZipWriter(ZipWriter&& writer) noexcept
     : file_(writer.file_),
       seekable_(writer.seekable_),
@@ -106,12 +289,19 @@ ZipWriter::ZipWriter(ZipWriter&& writer) noexcept
       state_(writer.state_),
       files_(std::move(writer.files_)),
       z_stream_(std::move(writer.z_stream_)),
-      buffer_(std::move(writer.buffer_)) {
+      buffer_(std::move(writer.buffer_)),
+      pending_(std::move(writer.pending_)),
+      block_(std::move(writer.block_)),
+      window_(std::move(writer.window_)),
+      max_pending_(writer.max_pending_),
+      pool_(std::move(writer.pool_)) {
   writer.file_ = nullptr;
   writer.state_ = State::kError;
 }
 
 ZipWriter& ZipWriter::operator=(ZipWriter&& writer) noexcept {
+  // Our own pool has to finish before the pending writes it works on are replaced.
+  pool_ = std::move(writer.pool_);
   file_ = writer.file_;
   seekable_ = writer.seekable_;
   current_offset_ = writer.current_offset_;
@@ -119,6 +309,10 @@ ZipWriter& ZipWriter::operator=(ZipWriter&& writer) noexcept {
   files_ = std::move(writer.files_);
   z_stream_ = std::move(writer.z_stream_);
   buffer_ = std::move(writer.buffer_);
+  pending_ = std::move(writer.pending_);
+  block_ = std::move(writer.block_);
+  window_ = std::move(writer.window_);
+  max_pending_ = writer.max_pending_;
   writer.file_ = nullptr;
   writer.state_ = State::kError;
   return *this;
@@ -127,6 +321,7 @@ ZipWriter& ZipWriter::operator=(ZipWriter&& writer) noexcept {
 int32_t ZipWriter::HandleError(int32_t error_code) {
   state_ = State::kError;
   z_stream_.reset();
+  DiscardPending();
   return error_code;
 }
 
@@ -220,12 +415,28 @@ int32_t ZipWriter::StartAlignedEntryWithTime(const char* path, size_t flags, tim
     return kInvalidEntryName;
   }
 
+  // On a ThreadPool, the header of a deflated entry can be queued behind the entries still being
+  // deflated. Anything else needs to know where it starts.
+  const bool queue_header = pool_ && (flags & ZipWriter::kCompress) && alignment == 0;
+  if (pool_ && !queue_header) {
+    int32_t result = WritePending(0);
+    if (result != kNoError) {
+      return result;
+    }
+    file_entry.local_file_header_offset = current_offset_;
+  }
+
   if (flags & ZipWriter::kCompress) {
     file_entry.compression_method = kCompressDeflated;
 
-    int32_t result = PrepareDeflate();
-    if (result != kNoError) {
-      return result;
+    if (pool_) {
+      block_.clear();
+      window_.clear();
+    } else {
+      int32_t result = PrepareDeflate();
+      if (result != kNoError) {
+        return result;
+      }
     }
   } else {
     file_entry.compression_method = kCompressStored;
@@ -248,6 +459,16 @@ int32_t ZipWriter::StartAlignedEntryWithTime(const char* path, size_t flags, tim
   // if it is possible to seek back, the GPB flag will reset and the sizes written.
   CopyFromFileEntry(file_entry, true /*use_data_descriptor*/, &header);
 
+  if (queue_header) {
+    std::unique_ptr<PendingWrite> write(new PendingWrite(PendingWrite::kHeader, files_.size()));
+    write->bytes.resize(sizeof(header) + file_entry.path.size());
+    memcpy(&write->bytes[0], &header, sizeof(header));
+    memcpy(&write->bytes[sizeof(header)], file_entry.path.data(), file_entry.path.size());
+    current_file_entry_ = std::move(file_entry);
+    state_ = State::kWritingEntry;
+    return QueueWrite(std::move(write));
+  }
+
   if (fwrite(&header, sizeof(header), 1, file_) != 1) {
     return HandleError(kIoError);
   }
@@ -272,6 +493,11 @@ int32_t ZipWriter::DiscardLastEntry() {
     return kInvalidState;
   }
 
+  int32_t result = WritePending(0);
+  if (result != kNoError) {
+    return result;
+  }
+
   FileEntry& last_entry = files_.back();
   current_offset_ = last_entry.local_file_header_offset;
   if (fseeko(file_, current_offset_, SEEK_SET) != 0) {
@@ -287,6 +513,11 @@ int32_t ZipWriter::GetLastEntry(FileEntry* out_entry) {
   if (files_.empty()) {
     return kInvalidState;
   }
+
+  int32_t result = WritePending(0);
+  if (result != kNoError) {
+    return result;
+  }
   *out_entry = files_.back();
   return kNoError;
 }
@@ -323,6 +554,25 @@ int32_t ZipWriter::WriteBytes(const void* data, size_t len) {
     return HandleError(kInvalidState);
   }
 
+  if (pool_ && (current_file_entry_.compression_method & kCompressDeflated)) {
+    // The crc is computed along with the deflating, and combined as each block is written.
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    while (len > 0) {
+      const size_t block_len = std::min(len, kParallelBlockSize - block_.size());
+      block_.insert(block_.end(), bytes, bytes + block_len);
+      bytes += block_len;
+      len -= block_len;
+      current_file_entry_.uncompressed_size += block_len;
+      if (block_.size() == kParallelBlockSize) {
+        int32_t result = QueueBlock(false /*last*/);
+        if (result != kNoError) {
+          return result;
+        }
+      }
+    }
+    return kNoError;
+  }
+
   int32_t result = kNoError;
   if (current_file_entry_.compression_method & kCompressDeflated) {
     result = CompressBytes(&current_file_entry_, data, len);
@@ -340,6 +590,43 @@ int32_t ZipWriter::WriteBytes(const void* data, size_t len) {
   return kNoError;
 }
 
+int32_t ZipWriter::WriteBytesFromFd(int fd, off64_t offset, size_t len) {
+  if (state_ != State::kWritingEntry) {
+    return HandleError(kInvalidState);
+  }
+  if (len == 0) {
+    return kNoError;
+  }
+
+  auto map = android::base::MappedFile::FromFd(fd, offset, len, PROT_READ);
+  if (!map) {
+    PLOG(ERROR) << "failed to map " << len << " bytes at " << offset;
+    return HandleError(kIoError);
+  }
+  if (current_file_entry_.compression_method & kCompressDeflated) {
+    return WriteBytes(map->data(), len);
+  }
+
+  // The crc still reads every byte, but from the page cache rather than a copy of it.
+  size_t copied = 0;
+  if (seekable_ && fflush(file_) == 0) {
+    copied = CopyFileRange(fd, offset, fileno(file_), current_offset_, len);
+    if (copied != 0 && fseeko(file_, current_offset_ + copied, SEEK_SET) != 0) {
+      return HandleError(kIoError);
+    }
+  }
+  if (fwrite(map->data() + copied, 1, len - copied, file_) != len - copied) {
+    return HandleError(kIoError);
+  }
+
+  current_file_entry_.crc32 =
+      crc32(current_file_entry_.crc32, reinterpret_cast<const Bytef*>(map->data()), len);
+  current_file_entry_.uncompressed_size += len;
+  current_file_entry_.compressed_size += len;
+  current_offset_ += len;
+  return kNoError;
+}
+
 int32_t ZipWriter::StoreBytes(FileEntry* file, const void* data, size_t len) {
   CHECK(state_ == State::kWritingEntry);
 
@@ -422,11 +709,92 @@ int32_t ZipWriter::FlushCompressedBytes(FileEntry* file) {
   return kNoError;
 }
 
+int32_t ZipWriter::QueueBlock(bool last) {
+  std::unique_ptr<PendingWrite> write(new PendingWrite(PendingWrite::kData, files_.size()));
+  write->window = window_;
+  const size_t window_len = std::min(block_.size(), kWindowSize);
+  window_.assign(block_.end() - window_len, block_.end());
+  write->input = std::move(block_);
+  block_.clear();
+  write->last = last;
+
+  PendingWrite* pending = write.get();
+  write->done = pool_->Run([pending]() { pending->Deflate(); });
+  return QueueWrite(std::move(write));
+}
+
+int32_t ZipWriter::QueueWrite(std::unique_ptr<PendingWrite> write) {
+  pending_.push_back(std::move(write));
+  return WritePending(max_pending_);
+}
+
+int32_t ZipWriter::WritePending(size_t max_remaining) {
+  while (pending_.size() > max_remaining) {
+    PendingWrite* write = pending_.front().get();
+    FileEntry* file = (write->file_index < files_.size()) ? &files_[write->file_index]
+                                                           : &current_file_entry_;
+    switch (write->type) {
+      case PendingWrite::kHeader:
+        file->local_file_header_offset = current_offset_;
+        break;
+
+      case PendingWrite::kData:
+        write->done.get();
+        if (write->result != kNoError) {
+          return HandleError(write->result);
+        }
+        file->compressed_size += write->bytes.size();
+        file->crc32 = crc32_combine(file->crc32, write->crc, write->input_size);
+        break;
+
+      case PendingWrite::kDataDescriptor: {
+        const uint32_t sig = DataDescriptor::kOptSignature;
+        DataDescriptor dd = {};
+        dd.crc32 = file->crc32;
+        dd.compressed_size = file->compressed_size;
+        dd.uncompressed_size = file->uncompressed_size;
+        write->bytes.resize(sizeof(sig) + sizeof(dd));
+        memcpy(&write->bytes[0], &sig, sizeof(sig));
+        memcpy(&write->bytes[sizeof(sig)], &dd, sizeof(dd));
+        break;
+      }
+    }
+
+    if (fwrite(write->bytes.data(), 1, write->bytes.size(), file_) != write->bytes.size()) {
+      return HandleError(kIoError);
+    }
+    current_offset_ += write->bytes.size();
+    pending_.pop_front();
+  }
+  return kNoError;
+}
+
+void ZipWriter::DiscardPending() {
+  // A block may still be deflating into the PendingWrite that owns it.
+  for (auto& write : pending_) {
+    if (write->done.valid()) {
+      write->done.wait();
+    }
+  }
+  pending_.clear();
+}
+
 int32_t ZipWriter::FinishEntry() {
   if (state_ != State::kWritingEntry) {
     return kInvalidState;
   }
 
+  if (pool_ && (current_file_entry_.compression_method & kCompressDeflated)) {
+    int32_t result = QueueBlock(true /*last*/);
+    if (result != kNoError) {
+      return result;
+    }
+    files_.emplace_back(std::move(current_file_entry_));
+    state_ = State::kWritingZip;
+    return QueueWrite(std::unique_ptr<PendingWrite>(
+        new PendingWrite(PendingWrite::kDataDescriptor, files_.size() - 1)));
+  }
+
   if (current_file_entry_.compression_method & kCompressDeflated) {
     int32_t result = FlushCompressedBytes(&current_file_entry_);
     if (result != kNoError) {
@@ -478,6 +846,11 @@ int32_t ZipWriter::Finish() {
     return kInvalidState;
   }
 
+  int32_t result = WritePending(0);
+  if (result != kNoError) {
+    return result;
+  }
+
   off_t startOfCdr = current_offset_;
   for (FileEntry& file : files_) {
     CentralDirectoryRecord cdr = {};
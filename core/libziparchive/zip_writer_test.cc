@@ -17,10 +17,13 @@
 #include "ziparchive/zip_writer.h"
 #include "ziparchive/zip_archive.h"
 
+#include <android-base/file.h>
 #include <android-base/test_utils.h>
 #include <gtest/gtest.h>
 #include <time.h>
+#include <zlib.h>
 #include <memory>
+#include <string>
 #include <vector>
 
 static ::testing::AssertionResult AssertFileEntryContentsEq(const std::string& expected,
@@ -286,6 +289,113 @@ TEST_F(zipwriter, WriteCompressedZipFlushFull) {
   CloseArchive(handle);
 }
 
+TEST_F(zipwriter, WriteCompressedZipOnThreads) {
+  // Several blocks' worth of data that compresses, but not to nothing.
+  std::string large(5 * 128 * 1024 + 1000, '\0');
+  for (size_t i = 0; i < large.size(); i++) {
+    large[i] = "abcdefgh"[static_cast<uint32_t>(i * 2654435761u) >> 29] + (i % 7 == 0);
+  }
+
+  ZipWriter writer(file_, 4);
+  ASSERT_EQ(0, writer.StartEntry("large.txt", ZipWriter::kCompress));
+  ASSERT_EQ(0, writer.WriteBytes(large.data(), 1000));
+  ASSERT_EQ(0, writer.WriteBytes(large.data() + 1000, large.size() - 1000));
+  ASSERT_EQ(0, writer.FinishEntry());
+  for (int i = 0; i < 32; i++) {
+    std::string name = "small" + std::to_string(i) + ".txt";
+    std::string contents = "small file " + std::to_string(i);
+    ASSERT_EQ(0, writer.StartEntry(name.c_str(), ZipWriter::kCompress));
+    ASSERT_EQ(0, writer.WriteBytes(contents.data(), contents.size()));
+    ASSERT_EQ(0, writer.FinishEntry());
+  }
+  ASSERT_EQ(0, writer.StartEntry("empty.txt", ZipWriter::kCompress));
+  ASSERT_EQ(0, writer.FinishEntry());
+  ASSERT_EQ(0, writer.StartAlignedEntry("align.txt", 0, 4096));
+  ASSERT_EQ(0, writer.WriteBytes("he", 2));
+  ASSERT_EQ(0, writer.FinishEntry());
+  ASSERT_EQ(0, writer.StartEntry("last.txt", ZipWriter::kCompress));
+  ASSERT_EQ(0, writer.WriteBytes(large.data(), 300000));
+  ASSERT_EQ(0, writer.FinishEntry());
+
+  ZipWriter::FileEntry last;
+  ASSERT_EQ(0, writer.GetLastEntry(&last));
+  EXPECT_EQ(300000u, last.uncompressed_size);
+  EXPECT_NE(0u, last.compressed_size);
+  ASSERT_EQ(0, writer.Finish());
+
+  ASSERT_GE(0, lseek(fd_, 0, SEEK_SET));
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFd(fd_, "temp", &handle, false));
+
+  ZipEntry data;
+  ASSERT_EQ(0, FindEntry(handle, ZipString("large.txt"), &data));
+  EXPECT_EQ(kCompressDeflated, data.method);
+  EXPECT_EQ(crc32(0, reinterpret_cast<const Bytef*>(large.data()), large.size()), data.crc32);
+  ASSERT_TRUE(AssertFileEntryContentsEq(large, handle, &data));
+
+  for (int i = 0; i < 32; i++) {
+    std::string name = "small" + std::to_string(i) + ".txt";
+    ASSERT_EQ(0, FindEntry(handle, ZipString(name.c_str()), &data));
+    ASSERT_TRUE(AssertFileEntryContentsEq("small file " + std::to_string(i), handle, &data));
+  }
+
+  ASSERT_EQ(0, FindEntry(handle, ZipString("empty.txt"), &data));
+  ASSERT_TRUE(AssertFileEntryContentsEq("", handle, &data));
+
+  ASSERT_EQ(0, FindEntry(handle, ZipString("align.txt"), &data));
+  EXPECT_EQ(0, data.offset & 0xfff);
+  ASSERT_TRUE(AssertFileEntryContentsEq("he", handle, &data));
+
+  ASSERT_EQ(0, FindEntry(handle, ZipString("last.txt"), &data));
+  EXPECT_EQ(last.compressed_size, data.compressed_length);
+  ASSERT_TRUE(AssertFileEntryContentsEq(large.substr(0, 300000), handle, &data));
+
+  CloseArchive(handle);
+}
+
+TEST_F(zipwriter, WriteBytesFromFd) {
+  std::string contents(1024 * 1024 + 3, '\0');
+  for (size_t i = 0; i < contents.size(); i++) {
+    contents[i] = static_cast<char>(i * 31 + i / 4096);
+  }
+  TemporaryFile source;
+  ASSERT_NE(-1, source.fd);
+  ASSERT_TRUE(android::base::WriteStringToFd("prefix", source.fd));
+  ASSERT_TRUE(android::base::WriteStringToFd(contents, source.fd));
+
+  ZipWriter writer(file_);
+  ASSERT_EQ(0, writer.StartEntry("small.txt", 0));
+  ASSERT_EQ(0, writer.WriteBytes("small", 5));
+  ASSERT_EQ(0, writer.FinishEntry());
+  ASSERT_EQ(0, writer.StartAlignedEntry("lib.so", 0, 4096));
+  ASSERT_EQ(0, writer.WriteBytesFromFd(source.fd, 6, contents.size()));
+  ASSERT_EQ(0, writer.FinishEntry());
+  ASSERT_EQ(0, writer.StartEntry("lib.so.z", ZipWriter::kCompress));
+  ASSERT_EQ(0, writer.WriteBytesFromFd(source.fd, 6, contents.size()));
+  ASSERT_EQ(0, writer.FinishEntry());
+  ASSERT_EQ(0, writer.Finish());
+
+  ASSERT_GE(0, lseek(fd_, 0, SEEK_SET));
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFd(fd_, "temp", &handle, false));
+
+  ZipEntry data;
+  ASSERT_EQ(0, FindEntry(handle, ZipString("lib.so"), &data));
+  EXPECT_EQ(kCompressStored, data.method);
+  EXPECT_EQ(0, data.offset & 0xfff);
+  EXPECT_EQ(crc32(0, reinterpret_cast<const Bytef*>(contents.data()), contents.size()),
+            data.crc32);
+  ASSERT_TRUE(AssertFileEntryContentsEq(contents, handle, &data));
+
+  ASSERT_EQ(0, FindEntry(handle, ZipString("lib.so.z"), &data));
+  EXPECT_EQ(kCompressDeflated, data.method);
+  ASSERT_TRUE(AssertFileEntryContentsEq(contents, handle, &data));
+
+  CloseArchive(handle);
+}
+
 TEST_F(zipwriter, CheckStartEntryErrors) {
   ZipWriter writer(file_);
 
@@ -39,6 +39,7 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <memory>
 #include <string>
@@ -53,10 +54,13 @@
 #include <log/event_tag_map.h>
 #include <log/logprint.h>
 #include <private/android_logger.h>
+#ifdef __ANDROID__
 #include <processgroup/sched_policy.h>
+#endif
 #include <system/thread_defs.h>
 
 #include <pcrecpp.h>
+#include <zstd.h>
 
 #define DEFAULT_MAX_ROTATED_LOGS 4
 
@@ -375,6 +379,146 @@ static void maybePrintStart(android_logcat_context_internal* context,
     }
 }
 
+// Print the chunks logd persisted to dir (logd.buffer.persist), oldest file
+// first. Files are skipped without decompressing them if their header, pid
+// table or tag table shows nothing in them can pass the filters.
+static void printPersisted(android_logcat_context_internal* context,
+                           const char* dir, log_time tail_time, size_t pid,
+                           bool printDividers) {
+    std::unique_ptr<DIR, int (*)(DIR*)> d(opendir(dir), closedir);
+    if (!d) {
+        logcat_panic(context, HELP_FALSE, "%s: %s\n", dir, strerror(errno));
+        return;
+    }
+    std::vector<std::string> files;
+    struct dirent* dp;
+    while (!!(dp = readdir(d.get()))) {
+        // Skips . and .. along with files logd is still writing
+        if (dp->d_name[0] == '.') continue;
+        if (!android::base::EndsWith(dp->d_name, ANDROID_LOG_PERSIST_SUFFIX)) {
+            continue;
+        }
+        files.emplace_back(dp->d_name);
+    }
+    // zero padded sequence number first, so this is oldest first
+    std::sort(files.begin(), files.end());
+
+    log_device_t* dev = nullptr;
+    for (const auto& name : files) {
+        if (context->stop ||
+            (context->maxCount && (context->printCount >= context->maxCount))) {
+            break;
+        }
+
+        std::string file;
+        if (!android::base::ReadFileToString(std::string(dir) + "/" + name,
+                                             &file)) {
+            continue;
+        }
+        android_log_persist_header_t header;
+        if (file.size() < sizeof(header)) continue;
+        memcpy(&header, file.data(), sizeof(header));
+        if ((header.magic != ANDROID_LOG_PERSIST_MAGIC) ||
+            (header.version != ANDROID_LOG_PERSIST_VERSION)) {
+            continue;
+        }
+        size_t pids = sizeof(header);
+        if (header.pid_count > ((file.size() - pids) / sizeof(uint32_t))) {
+            continue;
+        }
+        size_t tags = pids + header.pid_count * sizeof(uint32_t);
+        if (header.tag_len > (file.size() - tags)) continue;
+        size_t data = tags + header.tag_len;
+        if (header.data_len > (file.size() - data)) continue;
+
+        log_device_t* d;
+        for (d = context->devices; d; d = d->next) {
+            if (android_name_to_log_id(d->device) == header.log_id) break;
+        }
+        if (!d) continue;
+
+        if ((tail_time != log_time::EPOCH) && (header.newest < tail_time)) {
+            continue;
+        }
+
+        if (pid) {
+            std::vector<uint32_t> table(header.pid_count);
+            memcpy(table.data(), &file[pids], header.pid_count * sizeof(uint32_t));
+            if (!std::binary_search(table.begin(), table.end(), pid)) continue;
+        }
+
+        if (header.tag_count && !d->binary) {
+            bool any = false;
+            for (size_t offset = tags; !any && (offset < data);) {
+                size_t len = static_cast<uint8_t>(file[offset++]);
+                if (len > (data - offset)) break;
+                std::string tag(&file[offset], len);
+                offset += len;
+                any = android_log_shouldPrintLine(context->logformat,
+                                                  tag.c_str(),
+                                                  ANDROID_LOG_FATAL);
+            }
+            if (!any) continue;
+        }
+
+        std::string contents;
+        if (header.flags & ANDROID_LOG_PERSIST_ZSTD) {
+            if (header.uncompressed_len > ANDROID_LOG_PERSIST_MAX_CHUNK) {
+                continue;
+            }
+            contents.resize(header.uncompressed_len);
+            size_t ret = ZSTD_decompress(&contents[0], contents.size(),
+                                         &file[data], header.data_len);
+            if (ZSTD_isError(ret) || (ret != contents.size())) continue;
+        } else {
+            contents.assign(&file[data], header.data_len);
+        }
+
+        android_log_persist_entry_t entry;
+        for (size_t offset = 0;
+             (offset + sizeof(entry)) <= contents.size();) {
+            memcpy(&entry, &contents[offset], sizeof(entry));
+            offset += sizeof(entry);
+            if (entry.msg_len > (contents.size() - offset)) break;
+            const char* msg = &contents[offset];
+            offset += entry.msg_len;
+
+            if (pid && (entry.pid != pid)) continue;
+            if (entry.realtime < tail_time) continue;
+
+            struct log_msg log_msg;
+            size_t len =
+                std::min<size_t>(entry.msg_len, LOGGER_ENTRY_MAX_PAYLOAD);
+            log_msg.entry_v4.len = len;
+            log_msg.entry_v4.hdr_size = sizeof(log_msg.entry_v4);
+            log_msg.entry_v4.pid = entry.pid;
+            log_msg.entry_v4.tid = entry.tid;
+            log_msg.entry_v4.sec = entry.realtime.tv_sec;
+            log_msg.entry_v4.nsec = entry.realtime.tv_nsec;
+            log_msg.entry_v4.lid = header.log_id;
+            log_msg.entry_v4.uid = entry.uid;
+            memcpy(log_msg.entry_v4.msg, msg, len);
+            log_msg.entry_v4.msg[len] = '\0';
+
+            if (dev != d) {
+                dev = d;
+                maybePrintStart(context, dev, printDividers);
+                if (context->stop) return;
+            }
+            if (context->printBinary) {
+                printBinary(context, &log_msg);
+            } else {
+                processBuffer(context, dev, &log_msg);
+            }
+            if (context->stop ||
+                (context->maxCount &&
+                 (context->printCount >= context->maxCount))) {
+                return;
+            }
+        }
+    }
+}
+
 static void setupOutputAndSchedulingPolicy(
     android_logcat_context_internal* context, bool blocking) {
     if (!context->outputFileName) return;
@@ -382,10 +526,12 @@ static void setupOutputAndSchedulingPolicy(
     if (blocking) {
         // Lower priority and set to batch scheduling if we are saving
         // the logs into files and taking continuous content.
+#ifdef __ANDROID__
         if ((set_sched_policy(0, SP_BACKGROUND) < 0) && context->error) {
             fprintf(context->error,
                     "failed to set background scheduling policy\n");
         }
+#endif
 
         struct sched_param param;
         memset(&param, 0, sizeof(param));
@@ -496,6 +642,9 @@ static void show_help(android_logcat_context_internal* context) {
                     "                  Set prune white and ~black list, using same format as\n"
                     "                  listed above. Must be quoted.\n"
                     "  --pid=<pid>     Only prints logs from the given pid.\n"
+                    "  --persisted=<dir>\n"
+                    "                  Dump the log chunks logd persisted to <dir> and exit,\n"
+                    "                  for example a copy of /data/misc/logd/buffers.\n"
                     // Check ANDROID_LOG_WRAP_DEFAULT_TIMEOUT value for match to 2 hours
                     "  --wrap          Sleep for 2 hours or when buffer about to wrap whichever\n"
                     "                  comes first. Improves efficiency of polling by providing\n"
@@ -739,6 +888,7 @@ static int __logcat(android_logcat_context_internal* context) {
     size_t tail_lines = 0;
     log_time tail_time(log_time::EPOCH);
     size_t pid = 0;
+    const char* persisted = nullptr;
     bool got_t = false;
 
     // object instantiations before goto's can happen
@@ -853,6 +1003,7 @@ static int __logcat(android_logcat_context_internal* context) {
         int option_index = 0;
         // list of long-argument only strings for later comparison
         static const char pid_str[] = "pid";
+        static const char persisted_str[] = "persisted";
         static const char debug_str[] = "debug";
         static const char id_str[] = "id";
         static const char wrap_str[] = "wrap";
@@ -875,6 +1026,7 @@ static int __logcat(android_logcat_context_internal* context) {
           { id_str,          required_argument, nullptr, 0 },
           { "last",          no_argument,       nullptr, 'L' },
           { "max-count",     required_argument, nullptr, 'm' },
+          { persisted_str,   required_argument, nullptr, 0 },
           { pid_str,         required_argument, nullptr, 0 },
           { print_str,       no_argument,       nullptr, 0 },
           { "prune",         optional_argument, nullptr, 'p' },
@@ -906,6 +1058,10 @@ static int __logcat(android_logcat_context_internal* context) {
                     }
                     break;
                 }
+                if (long_options[option_index].name == persisted_str) {
+                    persisted = optarg;
+                    break;
+                }
                 if (long_options[option_index].name == wrap_str) {
                     mode |= ANDROID_LOG_WRAP | ANDROID_LOG_RDONLY |
                             ANDROID_LOG_NONBLOCK;
@@ -1398,6 +1554,22 @@ static int __logcat(android_logcat_context_internal* context) {
         }
     }
 
+    if (persisted) {
+        logger_list = nullptr;
+        if (clearLog || setId || getLogSize || setLogSize || getPruneList ||
+            setPruneList || printStatistics) {
+            logcat_panic(context, HELP_TRUE,
+                         "--persisted only dumps the log\n");
+            goto close;
+        }
+        context->retval = EXIT_SUCCESS;
+        setupOutputAndSchedulingPolicy(context, false);
+        if (!context->stop) {
+            printPersisted(context, persisted, tail_time, pid, printDividers);
+        }
+        goto close;
+    }
+
     dev = context->devices;
     if (tail_time != log_time::EPOCH) {
         logger_list = android_logger_list_alloc_time(mode, tail_time, pid);
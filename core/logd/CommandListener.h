@@ -18,7 +18,7 @@
 #define _COMMANDLISTENER_H__
 
 #include <sysutils/FrameworkListener.h>
-#include "LogBuffer.h"
+#include "LogBufferInterface.h"
 #include "LogCommand.h"
 #include "LogListener.h"
 #include "LogReader.h"
@@ -28,7 +28,8 @@ void reinit_signal_handler(int /*signal*/);
 
 class CommandListener : public FrameworkListener {
    public:
-    CommandListener(LogBuffer* buf, LogReader* reader, LogListener* swl);
+    CommandListener(LogBufferInterface* buf, LogReader* reader,
+                    LogListener* swl);
     virtual ~CommandListener() {
     }
 
@@ -48,10 +49,10 @@ class CommandListener : public FrameworkListener {
 
 #define LogBufferCmd(name)                                      \
     class name##Cmd : public LogCommand {                       \
-        LogBuffer& mBuf;                                        \
+        LogBufferInterface& mBuf;                               \
                                                                 \
        public:                                                  \
-        explicit name##Cmd(LogBuffer* buf);                     \
+        explicit name##Cmd(LogBufferInterface* buf);            \
         virtual ~name##Cmd() {                                  \
         }                                                       \
         int runCommand(SocketClient* c, int argc, char** argv); \
@@ -17,25 +17,12 @@
 #define _FLUSH_COMMAND_H
 
 #include <private/android_logger.h>
-#include <sysutils/SocketClientCommand.h>
-
-class LogBufferElement;
-
-#include "LogTimes.h"
-
-class LogReader;
-
-class FlushCommand : public SocketClientCommand {
-    LogReader& mReader;
-    log_mask_t mLogMask;
+#include <sysutils/SocketClient.h>
 
+// Reader credential checks. Waking up readers on new entries is done by
+// LogReader::notifyNewLog() directly against LastLogTimes.
+class FlushCommand {
    public:
-    explicit FlushCommand(LogReader& reader, log_mask_t logMask)
-        : mReader(reader), mLogMask(logMask) {
-    }
-
-    virtual void runSocketCommand(SocketClient* client);
-
     static bool hasReadLogs(SocketClient* client);
     static bool hasSecurityLogs(SocketClient* client);
 };
@@ -26,7 +26,10 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <memory>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <cutils/properties.h>
 #include <private/android_logger.h>
@@ -114,7 +117,10 @@ void LogBuffer::init() {
 }
 
 LogBuffer::LogBuffer(LastLogTimes* times)
-    : monotonic(android_log_clockid() == CLOCK_MONOTONIC), mTimes(*times) {
+    : LogBufferInterface(times),
+      mReadSequence(0),
+      mErased(0),
+      monotonic(android_log_clockid() == CLOCK_MONOTONIC) {
     pthread_rwlock_init(&mLogElementsLock, nullptr);
 
     log_id_for_each(i) {
@@ -386,56 +392,48 @@ int LogBuffer::log(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid,
 void LogBuffer::log(LogBufferElement* elem) {
     // cap on how far back we will sort in-place, otherwise append
     static uint32_t too_far_back = 5;  // five seconds
-    // Insert elements in time sorted order if possible
-    //  NB: if end is region locked, place element at end of list
+    static const size_t maxSortBack = 300;  // entries
+    // Insert elements in time sorted order if possible. Readers resume by
+    // sequence number, so sequence numbers follow list order: an element
+    // sorted in ahead of others takes the sequence number of the first one
+    // it passes and those move up by one. Entries some reader has already
+    // gone past are never passed, which keeps every resume point valid.
     LogBufferElementCollection::iterator it = mLogElements.end();
     LogBufferElementCollection::iterator last = it;
     if (__predict_true(it != mLogElements.begin())) --it;
-    if (__predict_false(it == mLogElements.begin()) ||
+    bool append =
+        __predict_false(it == mLogElements.begin()) ||
         __predict_true((*it)->getRealTime() <= elem->getRealTime()) ||
         __predict_false((((*it)->getRealTime().tv_sec - too_far_back) >
                          elem->getRealTime().tv_sec) &&
                         (elem->getLogId() != LOG_ID_KERNEL) &&
-                        ((*it)->getLogId() != LOG_ID_KERNEL))) {
-        mLogElements.push_back(elem);
-    } else {
-        log_time end(log_time::EPOCH);
-        bool end_set = false;
-        bool end_always = false;
-
-        LogTimeEntry::rdlock();
-
-        LastLogTimes::iterator times = mTimes.begin();
-        while (times != mTimes.end()) {
-            LogTimeEntry* entry = times->get();
-            if (!entry->mNonBlock) {
-                end_always = true;
+                        ((*it)->getLogId() != LOG_ID_KERNEL));
+    if (!append) {
+        uint64_t read = mReadSequence.load(std::memory_order_relaxed);
+        size_t count = maxSortBack;
+        // should be short as timestamps are localized near end()
+        while (((*it)->getSequence() >= read) && count--) {
+            last = it;
+            if (__predict_false(it == mLogElements.begin())) {
                 break;
             }
-            // it passing mEnd is blocked by the following checks.
-            if (!end_set || (end <= entry->mEnd)) {
-                end = entry->mEnd;
-                end_set = true;
+            --it;
+            if ((*it)->getRealTime() <= elem->getRealTime()) {
+                break;
             }
-            times++;
         }
+    }
 
-        if (end_always || (end_set && (end > (*it)->getRealTime()))) {
-            mLogElements.push_back(elem);
-        } else {
-            // should be short as timestamps are localized near end()
-            do {
-                last = it;
-                if (__predict_false(it == mLogElements.begin())) {
-                    break;
-                }
-                --it;
-            } while (((*it)->getRealTime() > elem->getRealTime()) &&
-                     (!end_set || (end <= (*it)->getRealTime())));
-            mLogElements.insert(last, elem);
+    uint64_t sequence = atomic_fetch_add_explicit(&LogBufferElement::sequence,
+                                                  1, memory_order_relaxed);
+    if (last != mLogElements.end()) {
+        sequence = (*last)->mSequence;
+        for (it = last; it != mLogElements.end(); ++it) {
+            ++(*it)->mSequence;
         }
-        LogTimeEntry::unlock();
     }
+    elem->mSequence = sequence;
+    mLogElements.insert(last, elem);
 
     stats.add(elem);
     maybePrune(elem->getLogId());
@@ -507,6 +505,7 @@ LogBufferElementCollection::iterator LogBuffer::erase(
                   : element->getUid();
 #endif
     it = mLogElements.erase(it);
+    ++mErased;
     if (doSetLast) {
         log_id_for_each(i) {
             if (setLast[i]) {
@@ -708,15 +707,15 @@ bool LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
     while (times != mTimes.end()) {
         LogTimeEntry* entry = times->get();
         if (entry->isWatching(id) &&
-            (!oldest || (oldest->mStart > entry->mStart) ||
-             ((oldest->mStart == entry->mStart) &&
+            (!oldest || (oldest->start() > entry->start()) ||
+             ((oldest->start() == entry->start()) &&
               (entry->mTimeout.tv_sec || entry->mTimeout.tv_nsec)))) {
             oldest = entry;
         }
         times++;
     }
     log_time watermark(log_time::tv_sec_max, log_time::tv_nsec_max);
-    if (oldest) watermark = oldest->mStart - pruneMargin;
+    if (oldest) watermark = oldest->start() - pruneMargin;
 
     LogBufferElementCollection::iterator it;
 
@@ -1097,104 +1096,137 @@ unsigned long LogBuffer::getSize(log_id_t id) {
     return retval;
 }
 
-log_time LogBuffer::flushTo(SocketClient* reader, const log_time& start,
+// assumes rdlock() held. Sequence numbers follow list order, and readers
+// are usually close to the end, so search back from there.
+LogBufferElementCollection::iterator LogBuffer::seek(uint64_t start) {
+    if (start <= 1) {
+        // client wants to start from the beginning
+        return mLogElements.begin();
+    }
+    LogBufferElementCollection::iterator it = mLogElements.end();
+    while (it != mLogElements.begin()) {
+        --it;
+        if ((*it)->getSequence() < start) {
+            return ++it;
+        }
+    }
+    return it;
+}
+
+uint64_t LogBuffer::flushTo(SocketClient* reader, uint64_t start,
                             pid_t* lastTid, bool privileged, bool security,
                             int (*filter)(const LogBufferElement* element,
                                           void* arg),
-                            void* arg) {
-    LogBufferElementCollection::iterator it;
+                            void* arg, FlushToState* /*state*/) {
     uid_t uid = reader->getUid();
+    uint64_t curr = start;
 
-    rdlock();
+    // Entries are copied out a batch at a time under the read lock and sent
+    // once it is dropped, so a reader blocked on its socket never holds up
+    // log() or pruning. Between batches the reader keeps its place in the
+    // list unless something was erased, stepping back over any entries
+    // log() sorted in ahead of it.
+    static const size_t maxBatch = 64;
+    std::vector<std::pair<std::unique_ptr<LogBufferElement>, bool>> batch;
+    batch.reserve(maxBatch);
 
-    if (start == log_time::EPOCH) {
-        // client wants to start from the beginning
-        it = mLogElements.begin();
-    } else {
-        // Cap to 300 iterations we look back for out-of-order entries.
-        size_t count = 300;
-
-        // Client wants to start from some specified time. Chances are
-        // we are better off starting from the end of the time sorted list.
-        LogBufferElementCollection::iterator last;
-        for (last = it = mLogElements.end(); it != mLogElements.begin();
-             /* do nothing */) {
-            --it;
-            LogBufferElement* element = *it;
-            if (element->getRealTime() > start) {
-                last = it;
-            } else if (element->getRealTime() == start) {
-                last = ++it;
-                break;
-            } else if (!--count) {
-                break;
-            }
-        }
-        it = last;
-    }
-
-    log_time curr = start;
+    LogBufferElementCollection::iterator it;
+    bool positioned = false;
+    uint64_t erased = 0;
 
     LogBufferElement* lastElement = nullptr;  // iterator corruption paranoia
     static const size_t maxSkip = 4194304;    // maximum entries to skip
     size_t skip = maxSkip;
-    for (; it != mLogElements.end(); ++it) {
-        LogBufferElement* element = *it;
+    for (bool done = false; !done;) {
+        rdlock();
 
-        if (!--skip) {
-            android::prdebug("reader.per: too many elements skipped");
-            break;
-        }
-        if (element == lastElement) {
-            android::prdebug("reader.per: identical elements");
-            break;
+        if (!positioned || (erased != mErased)) {
+            it = seek(curr);
+            positioned = true;
+            erased = mErased;
+        } else {
+            while ((it != mLogElements.begin()) &&
+                   ((*std::prev(it))->getSequence() >= curr)) {
+                --it;
+            }
         }
-        lastElement = element;
 
-        if (!privileged && (element->getUid() != uid)) {
-            continue;
-        }
+        done = true;
+        for (; it != mLogElements.end(); ++it) {
+            if (batch.size() >= maxBatch) {
+                done = false;
+                break;
+            }
 
-        if (!security && (element->getLogId() == LOG_ID_SECURITY)) {
-            continue;
-        }
+            LogBufferElement* element = *it;
 
-        // NB: calling out to another object with wrlock() held (safe)
-        if (filter) {
-            int ret = (*filter)(element, arg);
-            if (ret == false) {
-                continue;
+            if (!--skip) {
+                android::prdebug("reader.per: too many elements skipped");
+                break;
             }
-            if (ret != true) {
+            if (element == lastElement) {
+                android::prdebug("reader.per: identical elements");
                 break;
             }
+            lastElement = element;
+
+            if (!privileged && (element->getUid() != uid)) {
+                curr = element->getSequence() + 1;
+                continue;
+            }
+
+            if (!security && (element->getLogId() == LOG_ID_SECURITY)) {
+                curr = element->getSequence() + 1;
+                continue;
+            }
+
+            // NB: calling out to another object with rdlock() held (safe)
+            if (filter) {
+                int ret = (*filter)(element, arg);
+                if ((ret != false) && (ret != true)) {
+                    break;  // element stays unread, we resume from it next time
+                }
+                curr = element->getSequence() + 1;
+                if (ret == false) {
+                    continue;
+                }
+            } else {
+                curr = element->getSequence() + 1;
+            }
+
+            bool sameTid = false;
+            if (lastTid) {
+                sameTid = lastTid[element->getLogId()] == element->getTid();
+                // Dropped (chatty) immediately following a valid log from the
+                // same source in the same log buffer indicates we have a
+                // multiple identical squash.  chatty that differs source
+                // is due to spam filter.  chatty to chatty of different
+                // source is also due to spam filter.
+                lastTid[element->getLogId()] =
+                    (element->getDropped() && !sameTid) ? 0 : element->getTid();
+            }
+
+            batch.emplace_back(new LogBufferElement(*element), sameTid);
+            skip = maxSkip;
         }
 
-        bool sameTid = false;
-        if (lastTid) {
-            sameTid = lastTid[element->getLogId()] == element->getTid();
-            // Dropped (chatty) immediately following a valid log from the
-            // same source in the same log buffer indicates we have a
-            // multiple identical squash.  chatty that differs source
-            // is due to spam filter.  chatty to chatty of different
-            // source is also due to spam filter.
-            lastTid[element->getLogId()] =
-                (element->getDropped() && !sameTid) ? 0 : element->getTid();
+        uint64_t read = mReadSequence.load(std::memory_order_relaxed);
+        while ((read < curr) &&
+               !mReadSequence.compare_exchange_weak(
+                   read, curr, std::memory_order_relaxed)) {
         }
 
         unlock();
 
-        // range locking in LastLogTimes looks after us
-        curr = element->flushTo(reader, this, privileged, sameTid);
-
-        if (curr == element->FLUSH_ERROR) {
-            return curr;
+        for (auto& pending : batch) {
+            if (pending.first->flushTo(reader, this, privileged,
+                                       pending.second) ==
+                LogBufferElement::FLUSH_ERROR) {
+                return LogBufferElement::FLUSH_ERROR;
+            }
         }
-
-        skip = maxSkip;
-        rdlock();
+        batch.clear();
     }
-    unlock();
 
     return curr;
 }
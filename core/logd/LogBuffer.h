@@ -19,6 +19,7 @@
 
 #include <sys/types.h>
 
+#include <atomic>
 #include <list>
 #include <string>
 
@@ -96,6 +97,13 @@ class LogBuffer : public LogBufferInterface {
 
     unsigned long mMaxSize[LOG_ID_MAX];
 
+    // Every entry with a lower sequence number has been looked at by some
+    // reader, log() does not sort anything in ahead of those.
+    std::atomic<uint64_t> mReadSequence;
+    // Bumped by erase(), a reader between batches only trusts its position
+    // in the list while this is unchanged.
+    uint64_t mErased;
+
     bool monotonic;
 
     LogTags tags;
@@ -105,76 +113,72 @@ class LogBuffer : public LogBufferInterface {
     void log(LogBufferElement* elem);
 
    public:
-    LastLogTimes& mTimes;
-
     explicit LogBuffer(LastLogTimes* times);
     ~LogBuffer() override;
-    void init();
-    bool isMonotonic() {
+    void init() override;
+    bool isMonotonic() override {
         return monotonic;
     }
 
     int log(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid, pid_t tid,
             const char* msg, uint16_t len) override;
-    // lastTid is an optional context to help detect if the last previous
-    // valid message was from the same source so we can differentiate chatty
-    // filter types (identical or expired)
-    log_time flushTo(SocketClient* writer, const log_time& start,
-                     pid_t* lastTid,  // &lastTid[LOG_ID_MAX] or nullptr
+    uint64_t flushTo(SocketClient* writer, uint64_t start, pid_t* lastTid,
                      bool privileged, bool security,
                      int (*filter)(const LogBufferElement* element,
                                    void* arg) = nullptr,
-                     void* arg = nullptr);
+                     void* arg = nullptr,
+                     FlushToState* state = nullptr) override;
 
-    bool clear(log_id_t id, uid_t uid = AID_ROOT);
-    unsigned long getSize(log_id_t id);
-    int setSize(log_id_t id, unsigned long size);
-    unsigned long getSizeUsed(log_id_t id);
+    bool clear(log_id_t id, uid_t uid = AID_ROOT) override;
+    unsigned long getSize(log_id_t id) override;
+    int setSize(log_id_t id, unsigned long size) override;
+    unsigned long getSizeUsed(log_id_t id) override;
 
-    std::string formatStatistics(uid_t uid, pid_t pid, unsigned int logMask);
+    std::string formatStatistics(uid_t uid, pid_t pid,
+                                 unsigned int logMask) override;
 
-    void enableStatistics() {
+    void enableStatistics() override {
         stats.enableStatistics();
     }
 
-    int initPrune(const char* cp) {
+    int initPrune(const char* cp) override {
         return mPrune.init(cp);
     }
-    std::string formatPrune() {
+    std::string formatPrune() override {
         return mPrune.format();
     }
 
     std::string formatGetEventTag(uid_t uid, const char* name,
-                                  const char* format) {
+                                  const char* format) override {
         return tags.formatGetEventTag(uid, name, format);
     }
-    std::string formatEntry(uint32_t tag, uid_t uid) {
+    std::string formatEntry(uint32_t tag, uid_t uid) override {
         return tags.formatEntry(tag, uid);
     }
-    const char* tagToName(uint32_t tag) {
+    const char* tagToName(uint32_t tag) override {
         return tags.tagToName(tag);
     }
 
     // helper must be protected directly or implicitly by wrlock()/unlock()
-    const char* pidToName(pid_t pid) {
+    const char* pidToName(pid_t pid) override {
         return stats.pidToName(pid);
     }
-    virtual uid_t pidToUid(pid_t pid) override {
+    uid_t pidToUid(pid_t pid) override {
         return stats.pidToUid(pid);
     }
-    virtual pid_t tidToPid(pid_t tid) override {
+    pid_t tidToPid(pid_t tid) override {
         return stats.tidToPid(tid);
     }
-    const char* uidToName(uid_t uid) {
+    const char* uidToName(uid_t uid) override {
         return stats.uidToName(uid);
     }
-    void wrlock() {
+    void wrlock() override {
         pthread_rwlock_wrlock(&mLogElementsLock);
     }
-    void rdlock() {
+    void rdlock() override {
         pthread_rwlock_rdlock(&mLogElementsLock);
     }
-    void unlock() {
+    void unlock() override {
         pthread_rwlock_unlock(&mLogElementsLock);
     }
 
@@ -190,6 +194,7 @@ class LogBuffer : public LogBufferInterface {
     bool prune(log_id_t id, unsigned long pruneRows, uid_t uid = AID_ROOT);
     LogBufferElementCollection::iterator erase(
         LogBufferElementCollection::iterator it, bool coalesce = false);
+    LogBufferElementCollection::iterator seek(uint64_t start);
 };
 
 #endif  // _LOGD_LOG_BUFFER_H__
@@ -30,7 +30,7 @@
 #include "LogReader.h"
 #include "LogUtils.h"
 
-const log_time LogBufferElement::FLUSH_ERROR((uint32_t)-1, (uint32_t)-1);
+const uint64_t LogBufferElement::FLUSH_ERROR(UINT64_MAX);
 atomic_int_fast64_t LogBufferElement::sequence(1);
 
 LogBufferElement::LogBufferElement(log_id_t log_id, log_time realtime,
@@ -40,6 +40,7 @@ LogBufferElement::LogBufferElement(log_id_t log_id, log_time realtime,
       mPid(pid),
       mTid(tid),
       mRealTime(realtime),
+      mSequence(0),
       mMsgLen(len),
       mLogId(log_id),
       mDropped(false) {
@@ -47,11 +48,26 @@ LogBufferElement::LogBufferElement(log_id_t log_id, log_time realtime,
     memcpy(mMsg, msg, len);
 }
 
+LogBufferElement::LogBufferElement(Borrowed, log_id_t log_id, log_time realtime,
+                                   uid_t uid, pid_t pid, pid_t tid,
+                                   const char* msg, uint16_t len)
+    : mUid(uid),
+      mPid(pid),
+      mTid(tid),
+      mRealTime(realtime),
+      mSequence(0),
+      mMsg(const_cast<char*>(msg)),
+      mMsgLen(len),
+      mLogId(log_id),
+      mDropped(false) {
+}
+
 LogBufferElement::LogBufferElement(const LogBufferElement& elem)
     : mUid(elem.mUid),
       mPid(elem.mPid),
       mTid(elem.mTid),
       mRealTime(elem.mRealTime),
+      mSequence(elem.mSequence),
       mMsgLen(elem.mMsgLen),
       mLogId(elem.mLogId),
       mDropped(elem.mDropped) {
@@ -146,7 +162,8 @@ char* android::tidToName(pid_t tid) {
 }
 
 // assumption: mMsg == NULL
-size_t LogBufferElement::populateDroppedMessage(char*& buffer, LogBuffer* parent,
+size_t LogBufferElement::populateDroppedMessage(char*& buffer,
+                                                LogBufferInterface* parent,
                                                 bool lastSame) {
     static const char tag[] = "chatty";
 
@@ -239,7 +256,8 @@ size_t LogBufferElement::populateDroppedMessage(char*& buffer, LogBuffer* parent
     return retval;
 }
 
-log_time LogBufferElement::flushTo(SocketClient* reader, LogBuffer* parent,
+uint64_t LogBufferElement::flushTo(SocketClient* reader,
+                                   LogBufferInterface* parent,
                                    bool privileged, bool lastSame) {
     struct logger_entry_v4 entry;
 
@@ -262,7 +280,7 @@ log_time LogBufferElement::flushTo(SocketClient* reader, LogBuffer* parent,
 
     if (mDropped) {
         entry.len = populateDroppedMessage(buffer, parent, lastSame);
-        if (!entry.len) return mRealTime;
+        if (!entry.len) return mSequence;
         iovec[1].iov_base = buffer;
     } else {
         entry.len = mMsgLen;
@@ -270,9 +288,9 @@ log_time LogBufferElement::flushTo(SocketClient* reader, LogBuffer* parent,
     }
     iovec[1].iov_len = entry.len;
 
-    log_time retval = reader->sendDatav(iovec, 1 + (entry.len != 0))
+    uint64_t retval = reader->sendDatav(iovec, 1 + (entry.len != 0))
                           ? FLUSH_ERROR
-                          : mRealTime;
+                          : mSequence;
 
     if (buffer) free(buffer);
 
@@ -26,6 +26,8 @@
 #include <sysutils/SocketClient.h>
 
 class LogBuffer;
+class LogBufferInterface;
+class SerializedLogBuffer;
 
 #define EXPIRE_HOUR_THRESHOLD 24  // Only expire chatty UID logs to preserve
                                   // non-chatty UIDs less than this age in hours
@@ -35,12 +37,14 @@ class LogBuffer;
 
 class __attribute__((packed)) LogBufferElement {
     friend LogBuffer;
+    friend SerializedLogBuffer;
 
     // sized to match reality of incoming log packets
     const uint32_t mUid;
     const uint32_t mPid;
     const uint32_t mTid;
     log_time mRealTime;
+    uint64_t mSequence;  // follows list order, readers resume by it
     char* mMsg;
     union {
         const uint16_t mMsgLen;  // mDropped == false
@@ -52,9 +56,16 @@ class __attribute__((packed)) LogBufferElement {
     static atomic_int_fast64_t sequence;
 
     // assumption: mDropped == true
-    size_t populateDroppedMessage(char*& buffer, LogBuffer* parent,
+    size_t populateDroppedMessage(char*& buffer, LogBufferInterface* parent,
                                   bool lastSame);
 
+    // Refers to msg in place instead of copying it. For SerializedLogBuffer,
+    // which keeps its entries elsewhere and must set mMsg back to nullptr
+    // before the element is destroyed.
+    struct Borrowed {};
+    LogBufferElement(Borrowed, log_id_t log_id, log_time realtime, uid_t uid,
+                     pid_t pid, pid_t tid, const char* msg, uint16_t len);
+
    public:
     LogBufferElement(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid,
                      pid_t tid, const char* msg, uint16_t len);
@@ -91,10 +102,13 @@ class __attribute__((packed)) LogBufferElement {
     log_time getRealTime(void) const {
         return mRealTime;
     }
+    uint64_t getSequence(void) const {
+        return mSequence;
+    }
 
-    static const log_time FLUSH_ERROR;
-    log_time flushTo(SocketClient* writer, LogBuffer* parent, bool privileged,
-                     bool lastSame);
+    static const uint64_t FLUSH_ERROR;
+    uint64_t flushTo(SocketClient* writer, LogBufferInterface* parent,
+                     bool privileged, bool lastSame);
 };
 
 #endif
@@ -17,7 +17,7 @@
 #include "LogBufferInterface.h"
 #include "LogUtils.h"
 
-LogBufferInterface::LogBufferInterface() {
+LogBufferInterface::LogBufferInterface(LastLogTimes* times) : mTimes(*times) {
 }
 LogBufferInterface::~LogBufferInterface() {
 }
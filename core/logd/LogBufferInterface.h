@@ -19,23 +19,98 @@
 
 #include <sys/types.h>
 
+#include <memory>
+#include <string>
+
 #include <android-base/macros.h>
 #include <log/log_id.h>
 #include <log/log_time.h>
+#include <private/android_filesystem_config.h>
+#include <sysutils/SocketClient.h>
+
+#include "LogTimes.h"
+
+class LogBufferElement;
 
 // Abstract interface that handles log when log available.
+//
+// Implemented by LogBuffer (the std::list backed store with chatty
+// de-duplication) and SerializedLogBuffer (per log id chunks, compressed
+// once sealed). The reader, listener and command sockets only talk to
+// the store through this interface, the backend is picked at startup.
 class LogBufferInterface {
    public:
-    LogBufferInterface();
+    explicit LogBufferInterface(LastLogTimes* times);
     virtual ~LogBufferInterface();
     // Handles a log entry when available in LogListener.
     // Returns the size of the handled log message.
     virtual int log(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid,
                     pid_t tid, const char* msg, uint16_t len) = 0;
 
+    // (Re)read persistent properties, and release any sleeping readers.
+    virtual void init() = 0;
+    virtual bool isMonotonic() = 0;
+
+    // Whatever a backend wants to carry from one flushTo() of a reader to
+    // the next, owned by the reader thread.
+    class FlushToState {
+       public:
+        virtual ~FlushToState() {
+        }
+    };
+    // Returns nullptr if the backend keeps nothing between flushes.
+    virtual std::unique_ptr<FlushToState> createFlushToState() {
+        return nullptr;
+    }
+
+    // Sends entries with a sequence number of start or later, in the order
+    // they were logged, and returns the sequence number to resume from or
+    // LogBufferElement::FLUSH_ERROR. A filter returning other than true or
+    // false stops the flush in front of that entry.
+    //
+    // lastTid is an optional context to help detect if the last previous
+    // valid message was from the same source so we can differentiate chatty
+    // filter types (identical or expired)
+    //
+    // state, if not nullptr, comes from createFlushToState() and is passed
+    // again on the reader's next flush.
+    virtual uint64_t flushTo(SocketClient* writer, uint64_t start,
+                             pid_t* lastTid,  // &lastTid[LOG_ID_MAX] or nullptr
+                             bool privileged, bool security,
+                             int (*filter)(const LogBufferElement* element,
+                                           void* arg) = nullptr,
+                             void* arg = nullptr,
+                             FlushToState* state = nullptr) = 0;
+
+    virtual bool clear(log_id_t id, uid_t uid = AID_ROOT) = 0;
+    virtual unsigned long getSize(log_id_t id) = 0;
+    virtual int setSize(log_id_t id, unsigned long size) = 0;
+    virtual unsigned long getSizeUsed(log_id_t id) = 0;
+
+    virtual std::string formatStatistics(uid_t uid, pid_t pid,
+                                         unsigned int logMask) = 0;
+    virtual void enableStatistics() = 0;
+
+    virtual int initPrune(const char* cp) = 0;
+    virtual std::string formatPrune() = 0;
+
+    virtual std::string formatGetEventTag(uid_t uid, const char* name,
+                                          const char* format) = 0;
+    virtual std::string formatEntry(uint32_t tag, uid_t uid) = 0;
+    virtual const char* tagToName(uint32_t tag) = 0;
+
+    // helpers must be protected directly or implicitly by wrlock()/unlock()
+    virtual const char* pidToName(pid_t pid) = 0;
+    virtual const char* uidToName(uid_t uid) = 0;
     virtual uid_t pidToUid(pid_t pid);
     virtual pid_t tidToPid(pid_t tid);
 
+    virtual void wrlock() = 0;
+    virtual void rdlock() = 0;
+    virtual void unlock() = 0;
+
+    LastLogTimes& mTimes;
+
    private:
     DISALLOW_COPY_AND_ASSIGN(LogBufferInterface);
 };
@@ -201,8 +201,8 @@ log_time LogKlog::correction = (log_time(CLOCK_REALTIME) < log_time(CLOCK_MONOTO
                                        ? log_time(log_time::EPOCH)
                                        : (log_time(CLOCK_REALTIME) - log_time(CLOCK_MONOTONIC));
 
-LogKlog::LogKlog(LogBuffer* buf, LogReader* reader, int fdWrite, int fdRead,
-                 bool auditd)
+LogKlog::LogKlog(LogBufferInterface* buf, LogReader* reader, int fdWrite,
+                 int fdRead, bool auditd)
     : SocketListener(fdRead, false),
       logbuf(buf),
       reader(reader),
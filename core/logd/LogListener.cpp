@@ -24,6 +24,8 @@
 #include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <cutils/sockets.h>
 #include <private/android_filesystem_config.h>
 #include <private/android_logger.h>
@@ -44,8 +46,11 @@ bool LogListener::onDataAvailable(SocketClient* cli) {
     }
 
     // + 1 to ensure null terminator if MAX_PAYLOAD buffer is received
-    char buffer[sizeof_log_id_t + sizeof(uint16_t) + sizeof(log_time) +
-                LOGGER_ENTRY_MAX_PAYLOAD + 1];
+    char buffer[std::max<size_t>(sizeof_log_id_t + sizeof(uint16_t) +
+                                     sizeof(log_time) +
+                                     LOGGER_ENTRY_MAX_PAYLOAD,
+                                 LOGGER_BATCH_MAX_LEN) +
+                1];
     struct iovec iov = { buffer, sizeof(buffer) - 1 };
 
     alignas(4) char control[CMSG_SPACE(sizeof(struct ucred))];
@@ -92,57 +97,95 @@ bool LogListener::onDataAvailable(SocketClient* cli) {
         return false;
     }
 
-    android_log_header_t* header =
-        reinterpret_cast<android_log_header_t*>(buffer);
+    // NB: hdr.msg_flags & MSG_TRUNC is not tested, silently passing a
+    // truncated message to the logs.
+
+    if (static_cast<uint8_t>(buffer[0]) != LOGGER_BATCH_MAGIC) {
+        size_t len = std::min<size_t>(n - sizeof(android_log_header_t),
+                                      LOGGER_ENTRY_MAX_PAYLOAD);
+        char* msg = buffer + sizeof(android_log_header_t);
+        msg[len] = 0;
+        logEntry(*cred, reinterpret_cast<android_log_header_t*>(buffer), msg,
+                 len);
+        return true;
+    }
+
+    // A batch of entries from one thread, see android_log_batch_header_t.
+    android_log_batch_header_t* batch =
+        reinterpret_cast<android_log_batch_header_t*>(buffer);
+    char* cp = buffer + sizeof(*batch);
+    char* end = buffer + n;
+    for (uint16_t count = batch->count; count; --count) {
+        if ((end - cp) <
+            (ssize_t)(sizeof(android_log_header_t) + sizeof(uint16_t))) {
+            break;
+        }
+        android_log_header_t* header =
+            reinterpret_cast<android_log_header_t*>(cp);
+        cp += sizeof(*header);
+        uint16_t len;
+        memcpy(&len, cp, sizeof(len));
+        cp += sizeof(len);
+        if (!len || (len > LOGGER_ENTRY_MAX_PAYLOAD) || (len > (end - cp))) {
+            break;
+        }
+        // Null terminate the payload in place, which borrows the first byte
+        // of the next record's header until we are done with this one.
+        char save = cp[len];
+        cp[len] = 0;
+        logEntry(*cred, header, cp, len);
+        cp[len] = save;
+        cp += len;
+    }
+
+    return true;
+}
+
+// Validate a single entry and hand it to the log buffer. cred is a copy as
+// missing details are filled in per entry.
+void LogListener::logEntry(struct ucred cred, android_log_header_t* header,
+                           char* msg, size_t len) {
     log_id_t logId = static_cast<log_id_t>(header->id);
     if (/* logId < LOG_ID_MIN || */ logId >= LOG_ID_MAX ||
         logId == LOG_ID_KERNEL) {
-        return false;
+        return;
     }
 
     if ((logId == LOG_ID_SECURITY) &&
         (!__android_log_security() ||
-         !clientHasLogCredentials(cred->uid, cred->gid, cred->pid))) {
-        return false;
+         !clientHasLogCredentials(cred.uid, cred.gid, cred.pid))) {
+        return;
     }
 
     // Check credential validity, acquire corrected details if not supplied.
-    if (cred->pid == 0) {
-        cred->pid = logbuf ? logbuf->tidToPid(header->tid)
-                           : android::tidToPid(header->tid);
-        if (cred->pid == getpid()) {
+    if (cred.pid == 0) {
+        cred.pid = logbuf ? logbuf->tidToPid(header->tid)
+                          : android::tidToPid(header->tid);
+        if (cred.pid == getpid()) {
             // We expect that /proc/<tid>/ is accessible to self even without
             // readproc group, so that we will always drop messages that come
             // from any of our logd threads and their library calls.
-            return false;  // ignore self
+            return;  // ignore self
         }
     }
-    if (cred->uid == DEFAULT_OVERFLOWUID) {
+    if (cred.uid == DEFAULT_OVERFLOWUID) {
         uid_t uid =
-            logbuf ? logbuf->pidToUid(cred->pid) : android::pidToUid(cred->pid);
+            logbuf ? logbuf->pidToUid(cred.pid) : android::pidToUid(cred.pid);
         if (uid == AID_LOGD) {
             uid = logbuf ? logbuf->pidToUid(header->tid)
-                         : android::pidToUid(cred->pid);
+                         : android::pidToUid(cred.pid);
         }
-        if (uid != AID_LOGD) cred->uid = uid;
+        if (uid != AID_LOGD) cred.uid = uid;
     }
 
-    char* msg = ((char*)buffer) + sizeof(android_log_header_t);
-    n -= sizeof(android_log_header_t);
-
-    // NB: hdr.msg_flags & MSG_TRUNC is not tested, silently passing a
-    // truncated message to the logs.
-
     if (logbuf != nullptr) {
         int res = logbuf->log(
-            logId, header->realtime, cred->uid, cred->pid, header->tid, msg,
-            ((size_t)n <= UINT16_MAX) ? (uint16_t)n : UINT16_MAX);
+            logId, header->realtime, cred.uid, cred.pid, header->tid, msg,
+            (len <= UINT16_MAX) ? (uint16_t)len : UINT16_MAX);
         if (res > 0 && reader != nullptr) {
             reader->notifyNewLog(static_cast<log_mask_t>(1 << logId));
         }
     }
-
-    return true;
 }
 
 int LogListener::getLogSocket() {
@@ -30,15 +30,41 @@
 #include "LogReader.h"
 #include "LogUtils.h"
 
-LogReader::LogReader(LogBuffer* logbuf)
-    : SocketListener(getLogSocket(), true), mLogbuf(*logbuf) {
+LogReader::LogReader(LogBufferInterface* logbuf)
+    : LogReader(logbuf, getLogSocket()) {
+}
+
+LogReader::LogReader(LogBufferInterface* logbuf, int sock)
+    : SocketListener(sock, true), mLogbuf(*logbuf) {
 }
 
 // When we are notified a new log entry is available, inform
 // listening sockets who are watching this entry's log id.
+//
+// This runs on the writer path for every entry, so it is a single pass
+// over the reader list that only wakes up readers that are asleep; readers
+// busy in flushTo() pick the entry up by sequence number on their own.
 void LogReader::notifyNewLog(log_mask_t logMask) {
-    FlushCommand command(*this, logMask);
-    runOnEachSocket(&command);
+    LogTimeEntry::wrlock();
+    for (const auto& entry : mLogbuf.mTimes) {
+        if (!entry->isWatchingMultiple(logMask)) {
+            continue;
+        }
+        if (entry->mTimeout.tv_sec || entry->mTimeout.tv_nsec) {
+            if (mLogbuf.isMonotonic()) {
+                continue;
+            }
+            // If the user changes the time in a gross manner that
+            // invalidates the timeout, fall through and trigger.
+            log_time now(CLOCK_REALTIME);
+            if (((entry->mEnd + entry->mTimeout) > now) &&
+                (now > entry->mEnd)) {
+                continue;
+            }
+        }
+        entry->triggerReader_Locked();
+    }
+    LogTimeEntry::unlock();
 }
 
 // Note returning false will release the SocketClient instance.
@@ -196,7 +222,7 @@ bool LogReader::onDataAvailable(SocketClient* cli) {
         } logFindStart(pid, logMask, sequence,
                        logbuf().isMonotonic() && android::isMonotonic(start));
 
-        logbuf().flushTo(cli, sequence, nullptr, FlushCommand::hasReadLogs(cli),
+        logbuf().flushTo(cli, 0, nullptr, FlushCommand::hasReadLogs(cli),
                          FlushCommand::hasSecurityLogs(cli),
                          logFindStart.callback, &logFindStart);
 
@@ -212,13 +238,34 @@ bool LogReader::onDataAvailable(SocketClient* cli) {
         cli->getUid(), cli->getGid(), cli->getPid(), nonBlock ? 'n' : 'b', tail,
         logMask, (int)pid, sequence.nsec(), timeout);
 
+    uint64_t startSequence = 0;
     if (sequence == log_time::EPOCH) {
         timeout = 0;
+    } else {
+        // Readers resume by sequence number, translate the start time into
+        // the sequence number of the first entry logged after it. flushTo()
+        // stops in front of that entry and hands back its sequence number,
+        // or the next one to be assigned if there is none yet.
+        struct LogFindStartSequence {
+            const log_time mStart;
+
+            static int callback(const LogBufferElement* element, void* obj) {
+                LogFindStartSequence* me =
+                    reinterpret_cast<LogFindStartSequence*>(obj);
+                return (element->getRealTime() > me->mStart) ? -1 : false;
+            }
+        } logFindStartSequence = { sequence };
+
+        startSequence = logbuf().flushTo(
+            cli, 0, nullptr, FlushCommand::hasReadLogs(cli),
+            FlushCommand::hasSecurityLogs(cli), logFindStartSequence.callback,
+            &logFindStartSequence);
     }
 
     LogTimeEntry::wrlock();
-    auto entry = std::make_unique<LogTimeEntry>(
-        *this, cli, nonBlock, tail, logMask, pid, sequence, timeout);
+    auto entry = std::make_unique<LogTimeEntry>(*this, cli, nonBlock, tail,
+                                                logMask, pid, sequence,
+                                                startSequence, timeout);
     if (!entry->startReader_Locked()) {
         LogTimeEntry::unlock();
         return false;
@@ -23,16 +23,17 @@
 
 #define LOGD_SNDTIMEO 32
 
-class LogBuffer;
+class LogBufferInterface;
 
 class LogReader : public SocketListener {
-    LogBuffer& mLogbuf;
+    LogBufferInterface& mLogbuf;
 
    public:
-    explicit LogReader(LogBuffer* logbuf);
+    explicit LogReader(LogBufferInterface* logbuf);
+    LogReader(LogBufferInterface* logbuf, int sock);
     void notifyNewLog(log_mask_t logMask);
 
-    LogBuffer& logbuf(void) const {
+    LogBufferInterface& logbuf(void) const {
         return mLogbuf;
     }
 
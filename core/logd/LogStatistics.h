@@ -25,10 +25,15 @@
 #include <sys/types.h>
 
 #include <algorithm>  // std::max
+#include <functional>
 #include <memory>
+#include <new>
 #include <string>
 #include <string_view>
-#include <unordered_map>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include <android-base/stringprintf.h>
 #include <android/log.h>
@@ -44,41 +49,278 @@
 
 class LogStatistics;
 
+// Open addressing hash table of TEntry by TKey. Entries live in fixed size
+// slabs and never move once added, the index only holds slot numbers. The
+// kTopEntries largest entries by getSizes() are kept in order as entries
+// change, so sort() need not walk the table for the common queries.
 template <typename TKey, typename TEntry>
 class LogHashtable {
-    std::unordered_map<TKey, TEntry> map;
+   public:
+    typedef std::pair<const TKey, TEntry> value_type;
+
+   private:
+    static constexpr size_t kSlabEntries = 32;
+    static constexpr size_t kInitialIndex = 64;  // power of two
+    static constexpr size_t kTopEntries = 32;
+    static constexpr uint32_t kEmpty = UINT32_MAX;
+
+    struct Slot {
+        typename std::aligned_storage<sizeof(value_type),
+                                      alignof(value_type)>::type storage;
+        mutable int8_t rank;  // position in mTop, or -1
+        bool used;
+
+        Slot() : rank(-1), used(false) {
+        }
+
+        value_type& value() {
+            return *reinterpret_cast<value_type*>(&storage);
+        }
+        const value_type& value() const {
+            return *reinterpret_cast<const value_type*>(&storage);
+        }
+    };
+    struct Slab {
+        Slot slots[kSlabEntries];
+    };
+
+    std::vector<std::unique_ptr<Slab>> mSlabs;
+    std::vector<uint32_t> mFree;   // unused slots, lowest last
+    std::vector<uint32_t> mIndex;  // slot numbers, linear probing
+    size_t mSize;
+
+    // Largest getSizes() first. Anything not in mTop is no larger than
+    // mTopBound, and nothing in mTop is smaller. Rebuilt if that is lost.
+    mutable uint32_t mTop[kTopEntries];
+    mutable size_t mTopCount;
+    mutable size_t mTopBound;
+    mutable bool mTopValid;
+
+    Slot& slot(uint32_t s) {
+        return mSlabs[s / kSlabEntries]->slots[s % kSlabEntries];
+    }
+    const Slot& slot(uint32_t s) const {
+        return mSlabs[s / kSlabEntries]->slots[s % kSlabEntries];
+    }
+    size_t capacity() const {
+        return mSlabs.size() * kSlabEntries;
+    }
+    size_t sizesOf(uint32_t s) const {
+        return slot(s).value().second.getSizes();
+    }
+
+    static size_t hash(const TKey& key) {
+        // std::hash of an integer is the integer, spread it over the index
+        uint64_t h = std::hash<TKey>()(key);
+        return (h * UINT64_C(0x9e3779b97f4a7c15)) >> 32;
+    }
+
+    // Position in mIndex of key, or of the empty entry ending its probe.
+    size_t probe(const TKey& key) const {
+        size_t mask = mIndex.size() - 1;
+        for (size_t pos = hash(key) & mask;; pos = (pos + 1) & mask) {
+            uint32_t s = mIndex[pos];
+            if ((s == kEmpty) || (slot(s).value().first == key)) {
+                return pos;
+            }
+        }
+    }
+
+    void rehash(size_t size) {
+        mIndex.assign(size, kEmpty);
+        size_t mask = size - 1;
+        for (uint32_t s = 0; s < capacity(); ++s) {
+            if (!slot(s).used) continue;
+            size_t pos = hash(slot(s).value().first) & mask;
+            while (mIndex[pos] != kEmpty) pos = (pos + 1) & mask;
+            mIndex[pos] = s;
+        }
+    }
+
+    template <typename TArg>
+    uint32_t emplace(size_t pos, const TKey& key, TArg arg) {
+        if (((mSize + 1) * 2) > mIndex.size()) {
+            rehash(mIndex.size() * 2);
+            pos = probe(key);
+        }
+        if (mFree.empty()) {
+            uint32_t base = capacity();
+            mSlabs.emplace_back(new Slab);
+            for (uint32_t s = base + kSlabEntries; s > base; --s) {
+                mFree.push_back(s - 1);
+            }
+        }
+        uint32_t s = mFree.back();
+        mFree.pop_back();
+        Slot& sl = slot(s);
+        new (&sl.storage) value_type(std::piecewise_construct,
+                                     std::forward_as_tuple(key),
+                                     std::forward_as_tuple(arg));
+        sl.used = true;
+        mIndex[pos] = s;
+        ++mSize;
+        changed(s, 0);
+        return s;
+    }
+
+    void erase(size_t pos) {
+        uint32_t s = mIndex[pos];
+        Slot& sl = slot(s);
+        if (sl.rank >= 0) {
+            for (size_t i = sl.rank + 1; i < mTopCount; ++i) {
+                mTop[i - 1] = mTop[i];
+                slot(mTop[i - 1]).rank = i - 1;
+            }
+            --mTopCount;
+            sl.rank = -1;
+            // Whatever should take the freed place is not known.
+            if ((mSize - 1) > mTopCount) invalidateTop();
+        }
+        sl.value().~value_type();
+        sl.used = false;
+        mFree.push_back(s);
+        --mSize;
+
+        // Backward shift, so that no tombstones are needed.
+        size_t mask = mIndex.size() - 1;
+        size_t hole = pos;
+        for (size_t next = (pos + 1) & mask; mIndex[next] != kEmpty;
+             next = (next + 1) & mask) {
+            size_t home = hash(slot(mIndex[next]).value().first) & mask;
+            if (((next - home) & mask) >= ((next - hole) & mask)) {
+                mIndex[hole] = mIndex[next];
+                hole = next;
+            }
+        }
+        mIndex[hole] = kEmpty;
+    }
+
+    void swapTop(size_t i, size_t j) const {
+        std::swap(mTop[i], mTop[j]);
+        slot(mTop[i]).rank = i;
+        slot(mTop[j]).rank = j;
+    }
+
+    void invalidateTop() const {
+        for (size_t i = 0; i < mTopCount; ++i) slot(mTop[i]).rank = -1;
+        mTopCount = 0;
+        mTopValid = false;
+    }
+
+    void rebuildTop() const {
+        mTopValid = true;
+        mTopBound = 0;
+        for (uint32_t s = 0; s < capacity(); ++s) {
+            if (slot(s).used) changed(s, 0);
+        }
+    }
 
-    size_t bucket_size() const {
-        size_t count = 0;
-        for (size_t idx = 0; idx < map.bucket_count(); ++idx) {
-            size_t bucket_size = map.bucket_size(idx);
-            if (bucket_size == 0) bucket_size = 1;
-            count += bucket_size;
+    // Keeps mTop in order after slot s went from oldSizes to its current
+    // getSizes(). Costs a compare unless s is, or becomes, one of the top.
+    void changed(uint32_t s, size_t oldSizes) const {
+        if (!mTopValid) return;
+        const Slot& sl = slot(s);
+        size_t sizes = sl.value().second.getSizes();
+        if (sl.rank < 0) {
+            if (mTopCount == kTopEntries) {
+                if (sizes <= sizesOf(mTop[kTopEntries - 1])) {
+                    mTopBound = std::max(mTopBound, sizes);
+                    return;
+                }
+                uint32_t last = mTop[--mTopCount];
+                slot(last).rank = -1;
+                mTopBound = std::max(mTopBound, sizesOf(last));
+            }
+            mTop[mTopCount] = s;
+            sl.rank = mTopCount++;
+        }
+        size_t i = sl.rank;
+        if (sizes >= oldSizes) {
+            for (; (i > 0) && (sizesOf(mTop[i - 1]) < sizes); --i) {
+                swapTop(i - 1, i);
+            }
+            return;
+        }
+        for (; ((i + 1) < mTopCount) && (sizesOf(mTop[i + 1]) > sizes); ++i) {
+            swapTop(i, i + 1);
         }
-        float load_factor = map.max_load_factor();
-        if (load_factor < 1.0) return count;
-        return count * load_factor;
+        if (sizes < mTopBound) invalidateTop();
     }
 
-    static const size_t unordered_map_per_entry_overhead = sizeof(void*);
-    static const size_t unordered_map_bucket_overhead = sizeof(void*);
+    static bool matches(const TEntry& entry, uid_t uid, pid_t pid) {
+        if ((uid != AID_ROOT) && (uid != entry.getUid())) {
+            return false;
+        }
+        if (pid && entry.getPid() && (pid != entry.getPid())) {
+            return false;
+        }
+        return true;
+    }
 
    public:
+    template <typename Table, typename Value>
+    class Iterator {
+        Table* mTable;
+        uint32_t mSlot;
+
+        void skip() {
+            while ((mSlot < mTable->capacity()) && !mTable->slot(mSlot).used) {
+                ++mSlot;
+            }
+        }
+
+       public:
+        Iterator(Table* table, uint32_t s) : mTable(table), mSlot(s) {
+            skip();
+        }
+
+        Value& operator*() const {
+            return mTable->slot(mSlot).value();
+        }
+        Value* operator->() const {
+            return &mTable->slot(mSlot).value();
+        }
+        Iterator& operator++() {
+            ++mSlot;
+            skip();
+            return *this;
+        }
+        bool operator==(const Iterator& rhs) const {
+            return mSlot == rhs.mSlot;
+        }
+        bool operator!=(const Iterator& rhs) const {
+            return mSlot != rhs.mSlot;
+        }
+    };
+    typedef Iterator<LogHashtable, value_type> iterator;
+    typedef Iterator<const LogHashtable, const value_type> const_iterator;
+
+    LogHashtable()
+        : mIndex(kInitialIndex, kEmpty),
+          mSize(0),
+          mTopCount(0),
+          mTopBound(0),
+          mTopValid(true) {
+    }
+    ~LogHashtable() {
+        for (uint32_t s = 0; s < capacity(); ++s) {
+            if (slot(s).used) slot(s).value().~value_type();
+        }
+    }
+    LogHashtable(const LogHashtable&) = delete;
+    LogHashtable& operator=(const LogHashtable&) = delete;
+
     size_t size() const {
-        return map.size();
+        return mSize;
     }
 
-    // Estimate unordered_map memory usage.
     size_t sizeOf() const {
         return sizeof(*this) +
-               (size() * (sizeof(TEntry) + unordered_map_per_entry_overhead)) +
-               (bucket_size() * sizeof(size_t) + unordered_map_bucket_overhead);
+               (mSlabs.size() * (sizeof(Slab) + sizeof(mSlabs[0]))) +
+               (mFree.capacity() * sizeof(mFree[0])) +
+               (mIndex.capacity() * sizeof(mIndex[0]));
     }
 
-    typedef typename std::unordered_map<TKey, TEntry>::iterator iterator;
-    typedef
-        typename std::unordered_map<TKey, TEntry>::const_iterator const_iterator;
-
     std::unique_ptr<const TEntry* []> sort(uid_t uid, pid_t pid,
                                            size_t len) const {
         if (!len) {
@@ -88,14 +330,26 @@ class LogHashtable {
 
         const TEntry** retval = new const TEntry*[len];
         memset(retval, 0, sizeof(*retval) * len);
+        std::unique_ptr<const TEntry* []> sorted(retval);
+
+        if (len <= kTopEntries) {
+            if (!mTopValid) rebuildTop();
+            size_t found = 0;
+            for (size_t i = 0; (i < mTopCount) && (found < len); ++i) {
+                const TEntry& entry = slot(mTop[i]).value().second;
+                if (matches(entry, uid, pid)) retval[found++] = &entry;
+            }
+            // Everything outside of mTop is no larger than what is in it.
+            if ((found == len) || (mTopCount == mSize)) {
+                return sorted;
+            }
+            memset(retval, 0, sizeof(*retval) * len);
+        }
 
-        for (const_iterator it = map.begin(); it != map.end(); ++it) {
+        for (const_iterator it = begin(); it != end(); ++it) {
             const TEntry& entry = it->second;
 
-            if ((uid != AID_ROOT) && (uid != entry.getUid())) {
-                continue;
-            }
-            if (pid && entry.getPid() && (pid != entry.getPid())) {
+            if (!matches(entry, uid, pid)) {
                 continue;
             }
 
@@ -113,62 +367,74 @@ class LogHashtable {
                 retval[index] = &entry;
             }
         }
-        std::unique_ptr<const TEntry* []> sorted(retval);
         return sorted;
     }
 
     inline iterator add(const TKey& key, const LogBufferElement* element) {
-        iterator it = map.find(key);
-        if (it == map.end()) {
-            it = map.insert(std::make_pair(key, TEntry(element))).first;
+        size_t pos = probe(key);
+        uint32_t s = mIndex[pos];
+        if (s == kEmpty) {
+            s = emplace(pos, key, element);
         } else {
-            it->second.add(element);
+            TEntry& entry = slot(s).value().second;
+            size_t sizes = entry.getSizes();
+            entry.add(element);
+            changed(s, sizes);
         }
-        return it;
+        return iterator(this, s);
     }
 
     inline iterator add(TKey key) {
-        iterator it = map.find(key);
-        if (it == map.end()) {
-            it = map.insert(std::make_pair(key, TEntry(key))).first;
+        size_t pos = probe(key);
+        uint32_t s = mIndex[pos];
+        if (s == kEmpty) {
+            s = emplace(pos, key, key);
         } else {
-            it->second.add(key);
+            slot(s).value().second.add(key);
         }
-        return it;
+        return iterator(this, s);
     }
 
     void subtract(TKey&& key, const LogBufferElement* element) {
-        iterator it = map.find(std::move(key));
-        if ((it != map.end()) && it->second.subtract(element)) {
-            map.erase(it);
-        }
+        subtract(static_cast<const TKey&>(key), element);
     }
 
     void subtract(const TKey& key, const LogBufferElement* element) {
-        iterator it = map.find(key);
-        if ((it != map.end()) && it->second.subtract(element)) {
-            map.erase(it);
+        size_t pos = probe(key);
+        uint32_t s = mIndex[pos];
+        if (s == kEmpty) {
+            return;
+        }
+        TEntry& entry = slot(s).value().second;
+        size_t sizes = entry.getSizes();
+        if (entry.subtract(element)) {
+            erase(pos);
+        } else {
+            changed(s, sizes);
         }
     }
 
     inline void drop(TKey key, const LogBufferElement* element) {
-        iterator it = map.find(key);
-        if (it != map.end()) {
-            it->second.drop(element);
+        uint32_t s = mIndex[probe(key)];
+        if (s != kEmpty) {
+            TEntry& entry = slot(s).value().second;
+            size_t sizes = entry.getSizes();
+            entry.drop(element);
+            changed(s, sizes);
         }
     }
 
     inline iterator begin() {
-        return map.begin();
+        return iterator(this, 0);
     }
     inline const_iterator begin() const {
-        return map.begin();
+        return const_iterator(this, 0);
     }
     inline iterator end() {
-        return map.end();
+        return iterator(this, capacity());
     }
     inline const_iterator end() const {
-        return map.end();
+        return const_iterator(this, capacity());
     }
 
     std::string format(const LogStatistics& stat, uid_t uid, pid_t pid,
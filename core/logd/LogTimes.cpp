@@ -29,18 +29,22 @@ pthread_mutex_t LogTimeEntry::timesLock = PTHREAD_MUTEX_INITIALIZER;
 
 LogTimeEntry::LogTimeEntry(LogReader& reader, SocketClient* client,
                            bool nonBlock, unsigned long tail, log_mask_t logMask,
-                           pid_t pid, log_time start, uint64_t timeout)
-    : leadingDropped(false),
+                           pid_t pid, log_time start, uint64_t startSequence,
+                           uint64_t timeout)
+    : mPending(false),
+      mWaiting(false),
+      leadingDropped(false),
       mReader(reader),
       mLogMask(logMask),
       mPid(pid),
       mCount(0),
       mTail(tail),
       mIndex(0),
+      mStartSequence(startSequence),
       mClient(client),
-      mStart(start),
       mNonBlock(nonBlock),
       mEnd(log_time(android_log_clockid())) {
+    setStart(start);
     mTimeout.tv_sec = timeout / NS_PER_SEC;
     mTimeout.tv_nsec = timeout % NS_PER_SEC;
     memset(mLastTid, 0, sizeof(mLastTid));
@@ -48,6 +52,25 @@ LogTimeEntry::LogTimeEntry(LogReader& reader, SocketClient* client,
     cleanSkip_Locked();
 }
 
+// Sleep until triggered, or until timeout if not nullptr. Returns 0 straight
+// away if we were triggered while busy flushing, so no new entry is missed
+// even though the writer only signals readers that are asleep.
+int LogTimeEntry::waitForTrigger_Locked(const struct timespec* timeout) {
+    int ret = 0;
+    if (!mPending) {
+        mWaiting = true;
+        if (timeout) {
+            ret = pthread_cond_timedwait(&threadTriggeredCondition, &timesLock,
+                                         timeout);
+        } else {
+            ret = pthread_cond_wait(&threadTriggeredCondition, &timesLock);
+        }
+        mWaiting = false;
+    }
+    mPending = false;
+    return ret;
+}
+
 bool LogTimeEntry::startReader_Locked() {
     pthread_attr_t attr;
 
@@ -72,7 +95,7 @@ void* LogTimeEntry::threadStart(void* obj) {
 
     SocketClient* client = me->mClient;
 
-    LogBuffer& logbuf = me->mReader.logbuf();
+    LogBufferInterface& logbuf = me->mReader.logbuf();
 
     bool privileged = FlushCommand::hasReadLogs(client);
     bool security = FlushCommand::hasSecurityLogs(client);
@@ -81,12 +104,13 @@ void* LogTimeEntry::threadStart(void* obj) {
 
     wrlock();
 
-    log_time start = me->mStart;
+    uint64_t start = me->mStartSequence;
+    std::unique_ptr<LogBufferInterface::FlushToState> state =
+        logbuf.createFlushToState();
 
     while (!me->mRelease) {
         if (me->mTimeout.tv_sec || me->mTimeout.tv_nsec) {
-            if (pthread_cond_timedwait(&me->threadTriggeredCondition,
-                                       &timesLock, &me->mTimeout) == ETIMEDOUT) {
+            if (me->waitForTrigger_Locked(&me->mTimeout) == ETIMEDOUT) {
                 me->mTimeout.tv_sec = 0;
                 me->mTimeout.tv_nsec = 0;
             }
@@ -103,7 +127,7 @@ void* LogTimeEntry::threadStart(void* obj) {
             me->leadingDropped = true;
         }
         start = logbuf.flushTo(client, start, me->mLastTid, privileged,
-                               security, FilterSecondPass, me);
+                               security, FilterSecondPass, me, state.get());
 
         wrlock();
 
@@ -111,7 +135,7 @@ void* LogTimeEntry::threadStart(void* obj) {
             break;
         }
 
-        me->mStart = start + log_time(0, 1);
+        me->mStartSequence = start;
 
         if (me->mNonBlock || me->mRelease) {
             break;
@@ -120,7 +144,7 @@ void* LogTimeEntry::threadStart(void* obj) {
         me->cleanSkip_Locked();
 
         if (!me->mTimeout.tv_sec && !me->mTimeout.tv_nsec) {
-            pthread_cond_wait(&me->threadTriggeredCondition, &timesLock);
+            me->waitForTrigger_Locked(nullptr);
         }
     }
 
@@ -147,18 +171,15 @@ void* LogTimeEntry::threadStart(void* obj) {
 int LogTimeEntry::FilterFirstPass(const LogBufferElement* element, void* obj) {
     LogTimeEntry* me = reinterpret_cast<LogTimeEntry*>(obj);
 
-    LogTimeEntry::wrlock();
-
     if (me->leadingDropped) {
         if (element->getDropped()) {
-            LogTimeEntry::unlock();
             return false;
         }
         me->leadingDropped = false;
     }
 
     if (me->mCount == 0) {
-        me->mStart = element->getRealTime();
+        me->setStart(element->getRealTime());
     }
 
     if ((!me->mPid || (me->mPid == element->getPid())) &&
@@ -166,21 +187,20 @@ int LogTimeEntry::FilterFirstPass(const LogBufferElement* element, void* obj) {
         ++me->mCount;
     }
 
-    LogTimeEntry::unlock();
-
     return false;
 }
 
 // A second pass to send the selected elements
 int LogTimeEntry::FilterSecondPass(const LogBufferElement* element, void* obj) {
     LogTimeEntry* me = reinterpret_cast<LogTimeEntry*>(obj);
+    std::atomic<unsigned int>& skipAhead = me->skipAhead[element->getLogId()];
 
-    LogTimeEntry::wrlock();
+    me->setStart(element->getRealTime());
 
-    me->mStart = element->getRealTime();
-
-    if (me->skipAhead[element->getLogId()]) {
-        me->skipAhead[element->getLogId()]--;
+    if (unsigned int skip = skipAhead.load(std::memory_order_relaxed)) {
+        // Lost if the pruner resets it meanwhile, theirs is more recent.
+        skipAhead.compare_exchange_strong(skip, skip - 1,
+                                          std::memory_order_relaxed);
         goto skip;
     }
 
@@ -223,21 +243,20 @@ int LogTimeEntry::FilterSecondPass(const LogBufferElement* element, void* obj) {
     }
 
 ok:
-    if (!me->skipAhead[element->getLogId()]) {
-        LogTimeEntry::unlock();
+    if (!skipAhead.load(std::memory_order_relaxed)) {
         return true;
     }
 // FALLTHRU
 
 skip:
-    LogTimeEntry::unlock();
     return false;
 
 stop:
-    LogTimeEntry::unlock();
     return -1;
 }
 
 void LogTimeEntry::cleanSkip_Locked(void) {
-    memset(skipAhead, 0, sizeof(skipAhead));
+    for (auto& skip : skipAhead) {
+        skip.store(0, std::memory_order_relaxed);
+    }
 }
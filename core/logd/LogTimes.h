@@ -22,6 +22,7 @@
 #include <sys/types.h>
 #include <time.h>
 
+#include <atomic>
 #include <list>
 #include <memory>
 
@@ -33,9 +34,14 @@ typedef unsigned int log_mask_t;
 class LogReader;
 class LogBufferElement;
 
+// The flushTo filter callbacks run on the reader thread for every entry
+// without timesLock held; state they share with the writer and pruner is
+// either atomic or only touched under timesLock from threadStart().
 class LogTimeEntry {
     static pthread_mutex_t timesLock;
-    bool mRelease = false;
+    std::atomic<bool> mRelease{false};
+    bool mPending;  // triggered since the reader last went to sleep
+    bool mWaiting;  // reader asleep on threadTriggeredCondition
     bool leadingDropped;
     pthread_cond_t threadTriggeredCondition;
     pthread_t mThread;
@@ -43,19 +49,24 @@ class LogTimeEntry {
     static void* threadStart(void* me);
     const log_mask_t mLogMask;
     const pid_t mPid;
-    unsigned int skipAhead[LOG_ID_MAX];
+    std::atomic<unsigned int> skipAhead[LOG_ID_MAX];
     pid_t mLastTid[LOG_ID_MAX];
     unsigned long mCount;
     unsigned long mTail;
     unsigned long mIndex;
+    uint64_t mStartSequence;  // next sequence number to flush
+    // log_time of the last entry looked at, the prune watermark; packed as
+    // tv_sec << 32 | tv_nsec which orders the same as log_time.
+    std::atomic<uint64_t> mStart;
+
+    int waitForTrigger_Locked(const struct timespec* timeout);
 
    public:
     LogTimeEntry(LogReader& reader, SocketClient* client, bool nonBlock,
                  unsigned long tail, log_mask_t logMask, pid_t pid,
-                 log_time start, uint64_t timeout);
+                 log_time start, uint64_t startSequence, uint64_t timeout);
 
     SocketClient* mClient;
-    log_time mStart;
     struct timespec mTimeout;
     const bool mNonBlock;
     const log_time mEnd;  // only relevant if mNonBlock
@@ -73,12 +84,24 @@ class LogTimeEntry {
 
     bool startReader_Locked();
 
+    log_time start() const {
+        uint64_t packed = mStart.load(std::memory_order_relaxed);
+        return log_time(packed >> 32, packed & 0xFFFFFFFF);
+    }
+    void setStart(log_time start) {
+        mStart.store((static_cast<uint64_t>(start.tv_sec) << 32) | start.tv_nsec,
+                     std::memory_order_relaxed);
+    }
+
     void triggerReader_Locked(void) {
-        pthread_cond_signal(&threadTriggeredCondition);
+        mPending = true;
+        if (mWaiting) {
+            pthread_cond_signal(&threadTriggeredCondition);
+        }
     }
 
     void triggerSkip_Locked(log_id_t id, unsigned int skip) {
-        skipAhead[id] = skip;
+        skipAhead[id].store(skip, std::memory_order_relaxed);
     }
     void cleanSkip_Locked(void);
 
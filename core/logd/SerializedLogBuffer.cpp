@@ -0,0 +1,455 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <optional>
+
+#include <android-base/stringprintf.h>
+#include <log/log_properties.h>
+#include <private/android_logger.h>
+
+#include "LogBufferElement.h"
+#include "LogUtils.h"
+#include "SerializedLogBuffer.h"
+
+SerializedLogBuffer::SerializedLogBuffer(LastLogTimes* times)
+    : LogBufferInterface(times),
+      mSequence(1),
+      monotonic(android_log_clockid() == CLOCK_MONOTONIC) {
+    pthread_rwlock_init(&mLogsLock, nullptr);
+
+    // Only debuggable builds let logd write to /data/misc/logd.
+    if (__android_log_is_debuggable() &&
+        __android_logger_property_get_bool("logd.buffer.persist",
+                                           BOOL_DEFAULT_FALSE | BOOL_DEFAULT_FLAG_PERSIST)) {
+        mPersist.reset(new SerializedLogPersist(ANDROID_LOG_PERSIST_DIR));
+    }
+
+    log_id_for_each(i) {
+        mMaxSize[i] = LOG_BUFFER_MIN_SIZE;
+        mSizes[i] = 0;
+        mGenerations[i] = 0;
+    }
+
+    init();
+}
+
+SerializedLogBuffer::~SerializedLogBuffer() {
+}
+
+void SerializedLogBuffer::init() {
+    log_id_for_each(i) {
+        if (setSize(i, __android_logger_get_buffer_size(i))) {
+            setSize(i, LOG_BUFFER_MIN_SIZE);
+        }
+    }
+
+    // Unlike LogBuffer, entries already serialized keep the timestamps they
+    // were logged with across a change of clock source, sealed chunks are
+    // not rewritten.
+    monotonic = android_log_clockid() == CLOCK_MONOTONIC;
+
+    // We may have been triggered by a SIGHUP. Release any sleeping reader
+    // threads to dump their current content.
+    LogTimeEntry::wrlock();
+
+    LastLogTimes::iterator times = mTimes.begin();
+    while (times != mTimes.end()) {
+        LogTimeEntry* entry = times->get();
+        entry->triggerReader_Locked();
+        times++;
+    }
+
+    LogTimeEntry::unlock();
+}
+
+// A quarter of the buffer, so that at most a quarter of the configured
+// size is held uncompressed, but always large enough for one entry.
+size_t SerializedLogBuffer::chunkSize(log_id_t id) const {
+    return std::max<size_t>(mMaxSize[id] / 4, sizeof(SerializedLogEntry) +
+                                                  LOGGER_ENTRY_MAX_PAYLOAD);
+}
+
+int SerializedLogBuffer::log(log_id_t log_id, log_time realtime, uid_t uid,
+                             pid_t pid, pid_t tid, const char* msg,
+                             uint16_t len) {
+    if (log_id >= LOG_ID_MAX) {
+        return -EINVAL;
+    }
+
+    // Slip the time by 1 nsec if the incoming lands on xxxxxx000 ns.
+    // This prevents any chance that an outside source can request an
+    // exact entry with time specified in ms or us precision.
+    if ((realtime.tv_nsec % 1000) == 0) ++realtime.tv_nsec;
+
+    // Only used to feed LogStatistics, the entry itself lands in a chunk.
+    EntryElement elem(log_id, realtime, uid, pid, tid, msg, len);
+    if (log_id != LOG_ID_SECURITY) {
+        int prio = ANDROID_LOG_INFO;
+        const char* tag = nullptr;
+        size_t tag_len = 0;
+        if (log_id == LOG_ID_EVENTS || log_id == LOG_ID_STATS) {
+            tag = tagToName(elem.get()->getTag());
+            if (tag) {
+                tag_len = strlen(tag);
+            }
+        } else {
+            prio = *msg;
+            tag = msg + 1;
+            tag_len = strnlen(tag, len - 1);
+        }
+        if (!__android_log_is_loggable_len(prio, tag, tag_len,
+                                           ANDROID_LOG_VERBOSE)) {
+            // Log traffic received to total
+            wrlock();
+            stats.addTotal(elem.get());
+            unlock();
+            return -EACCES;
+        }
+    }
+
+    wrlock();
+    SerializedLogChunkCollection& chunks = mLogs[log_id];
+    if (chunks.empty() || !chunks.back().canLog(len)) {
+        if (!chunks.empty()) {
+            SerializedLogChunk& full = chunks.back();
+            mSizes[log_id] -= full.pruneSize();
+            full.seal();
+            mSizes[log_id] += full.pruneSize();
+            if (mPersist) {
+                mPersist->queue(log_id, full);
+            }
+        }
+        chunks.emplace_back(chunkSize(log_id));
+    }
+    const SerializedLogEntry* entry = chunks.back().log(
+        mSequence++, realtime, uid, pid, tid, msg, len);
+    mSizes[log_id] += entry->total_len();
+    stats.add(elem.get());
+    maybePrune(log_id);
+    unlock();
+
+    return len;
+}
+
+// assumes wrlock() held
+void SerializedLogBuffer::maybePrune(log_id_t id) {
+    SerializedLogChunkCollection& chunks = mLogs[id];
+    // The chunk being written to is never pruned.
+    while ((mSizes[id] > mMaxSize[id]) && (chunks.size() > 1)) {
+        SerializedLogChunk& oldest = chunks.front();
+        mSizes[id] -= oldest.pruneSize();
+        removeFromStats(id, oldest);
+        chunks.pop_front();
+    }
+}
+
+// assumes wrlock() held
+void SerializedLogBuffer::removeFromStats(log_id_t id,
+                                          const SerializedLogChunk& chunk) {
+    std::vector<uint8_t> contents;
+    chunk.read(&contents);
+    ChunkCursor cursor;
+    cursor.contents.swap(contents);
+    for (const SerializedLogEntry* entry; (entry = cursor.entry());
+         cursor.offset += entry->total_len()) {
+        EntryElement elem(id, *entry);
+        stats.subtract(elem.get());
+    }
+}
+
+// assumes rdlock() held. Positions the cursor on the first entry at or after
+// cursor->nextSequence, returns false once the reader has caught up. The copy
+// is carried on from where it was left: the chunk it came from is only looked
+// for again to top up the copy if that chunk was still being written to, and
+// the next chunk is looked for from the newest one back.
+bool SerializedLogBuffer::fillCursor(log_id_t id, ChunkCursor* cursor) {
+    const SerializedLogChunkCollection& chunks = mLogs[id];
+
+    if (cursor->generation != mGenerations[id]) {
+        cursor->contents.clear();
+        cursor->offset = 0;
+        cursor->chunkSequence = 0;
+        cursor->generation = mGenerations[id];
+    }
+
+    for (;;) {
+        for (const SerializedLogEntry* entry; (entry = cursor->entry());
+             cursor->offset += entry->total_len()) {
+            if (entry->sequence >= cursor->nextSequence) {
+                return true;
+            }
+        }
+
+        if (cursor->chunkSequence && !cursor->sealed) {
+            auto it = std::find_if(
+                chunks.rbegin(), chunks.rend(),
+                [cursor](const SerializedLogChunk& chunk) {
+                    return chunk.entries() &&
+                           (chunk.lowestSequence() == cursor->chunkSequence);
+                });
+            if (it == chunks.rend()) {
+                cursor->sealed = true;  // sealed and pruned since
+            } else {
+                size_t copied = cursor->contents.size();
+                it->readFrom(copied, &cursor->contents);
+                cursor->sealed = it->sealed();
+                if (cursor->contents.size() > copied) {
+                    continue;
+                }
+                if (!cursor->sealed) {
+                    return false;
+                }
+            }
+        }
+
+        auto next = chunks.rend();
+        for (auto it = chunks.rbegin(); it != chunks.rend(); ++it) {
+            if (!it->entries()) {
+                continue;
+            }
+            if ((it->lowestSequence() <= cursor->chunkSequence) ||
+                (it->highestSequence() < cursor->nextSequence)) {
+                break;
+            }
+            next = it;
+        }
+        if (next == chunks.rend()) {
+            return false;
+        }
+        cursor->contents.clear();
+        next->readFrom(0, &cursor->contents);
+        cursor->offset = 0;
+        cursor->chunkSequence = next->lowestSequence();
+        cursor->sealed = next->sealed();
+    }
+}
+
+std::unique_ptr<LogBufferInterface::FlushToState>
+SerializedLogBuffer::createFlushToState() {
+    return std::make_unique<ReaderState>();
+}
+
+uint64_t SerializedLogBuffer::flushTo(
+    SocketClient* reader, uint64_t start, pid_t* lastTid, bool privileged,
+    bool security, int (*filter)(const LogBufferElement* element, void* arg),
+    void* arg, FlushToState* state) {
+    uid_t uid = reader->getUid();
+    ReaderState local;
+    ReaderState* readerState =
+        state ? static_cast<ReaderState*>(state) : &local;
+    ChunkCursor* cursors = readerState->cursors;
+
+    if (readerState->resume != start) {
+        // Not where this reader's last flush stopped, start afresh.
+        log_id_for_each(i) {
+            cursors[i] = ChunkCursor();
+        }
+    }
+
+    rdlock();
+    log_id_for_each(i) {
+        cursors[i].nextSequence = std::max(cursors[i].nextSequence, start);
+        fillCursor(i, &cursors[i]);
+    }
+    unlock();
+
+    uint64_t curr = start;
+
+    // Readers walk their private copies without any lock held, and only
+    // come back for the lock to copy out the next chunk of a log id.
+    for (;;) {
+        // Merge the log ids in the order they were logged.
+        log_id_t id = LOG_ID_MAX;
+        const SerializedLogEntry* entry = nullptr;
+        log_id_for_each(i) {
+            const SerializedLogEntry* candidate = cursors[i].entry();
+            if (candidate &&
+                (!entry || (candidate->sequence < entry->sequence))) {
+                entry = candidate;
+                id = i;
+            }
+        }
+        if (!entry) {
+            break;
+        }
+
+        std::optional<EntryElement> element;
+        if ((privileged || (entry->uid == uid)) &&
+            (security || (id != LOG_ID_SECURITY))) {
+            element.emplace(id, *entry);
+        }
+        uint64_t sequence = entry->sequence;
+
+        ChunkCursor& cursor = cursors[id];
+        if (filter && element) {
+            int ret = (*filter)(element->get(), arg);
+            if ((ret != false) && (ret != true)) {
+                break;  // entry stays unread, we resume from it next time
+            }
+            if (ret == false) {
+                element.reset();
+            }
+        }
+
+        curr = sequence + 1;
+        cursor.nextSequence = curr;
+        cursor.offset += entry->total_len();
+
+        // Send before the cursor moves on, the element points into its copy.
+        if (element) {
+            LogBufferElement* elem = element->get();
+            bool sameTid = false;
+            if (lastTid) {
+                sameTid = lastTid[id] == elem->getTid();
+                lastTid[id] = elem->getTid();
+            }
+
+            if (elem->flushTo(reader, this, privileged, sameTid) ==
+                LogBufferElement::FLUSH_ERROR) {
+                return LogBufferElement::FLUSH_ERROR;
+            }
+            element.reset();
+        }
+
+        if (!cursor.entry()) {
+            rdlock();
+            fillCursor(id, &cursor);
+            unlock();
+        }
+    }
+
+    readerState->resume = curr;
+    return curr;
+}
+
+// clear all rows of type "id" from the buffer.
+bool SerializedLogBuffer::clear(log_id_t id, uid_t uid) {
+    wrlock();
+    SerializedLogChunkCollection& chunks = mLogs[id];
+    if (uid == AID_ROOT) {
+        for (const auto& chunk : chunks) {
+            removeFromStats(id, chunk);
+        }
+        chunks.clear();
+        mSizes[id] = 0;
+        ++mGenerations[id];
+        if (mPersist) {
+            mPersist->clear(id);
+        }
+        unlock();
+        return false;
+    }
+
+    // Clearing on behalf of a single uid rewrites each chunk without the
+    // entries belonging to that uid, keeping their sequence numbers.
+    SerializedLogChunkCollection kept;
+    ChunkCursor cursor;
+    mSizes[id] = 0;
+    for (const auto& chunk : chunks) {
+        chunk.read(&cursor.contents);
+        cursor.offset = 0;
+        SerializedLogChunk copy(chunk.sealed() ? cursor.contents.size()
+                                               : chunkSize(id));
+        for (const SerializedLogEntry* entry; (entry = cursor.entry());
+             cursor.offset += entry->total_len()) {
+            if (entry->uid == uid) {
+                EntryElement elem(id, *entry);
+                stats.subtract(elem.get());
+                continue;
+            }
+            copy.log(entry->sequence, entry->realtime, entry->uid, entry->pid,
+                     entry->tid, entry->msg(), entry->msg_len);
+        }
+        if (chunk.sealed()) {
+            if (!copy.entries()) {
+                continue;
+            }
+            copy.seal();
+        }
+        mSizes[id] += copy.pruneSize();
+        kept.push_back(std::move(copy));
+    }
+    chunks.swap(kept);
+    ++mGenerations[id];
+    unlock();
+
+    return false;
+}
+
+// Chunks are pruned whole, oldest first, there is no uid or pid to favour
+// or to single out. Only going back to the default of no list is accepted.
+int SerializedLogBuffer::initPrune(const char* cp) {
+    if (!cp || !*cp || !strcmp(cp, "default") || !strcmp(cp, "disable")) {
+        return 0;
+    }
+    return -EINVAL;
+}
+
+// get the used space associated with "id".
+unsigned long SerializedLogBuffer::getSizeUsed(log_id_t id) {
+    rdlock();
+    size_t retval = mSizes[id];
+    unlock();
+    return retval;
+}
+
+// set the total space allocated to "id"
+int SerializedLogBuffer::setSize(log_id_t id, unsigned long size) {
+    // Reasonable limits ...
+    if (!__android_logger_valid_buffer_size(size)) {
+        return -1;
+    }
+    wrlock();
+    mMaxSize[id] = size;
+    maybePrune(id);
+    unlock();
+    return 0;
+}
+
+// get the total space allocated to "id"
+unsigned long SerializedLogBuffer::getSize(log_id_t id) {
+    rdlock();
+    size_t retval = mMaxSize[id];
+    unlock();
+    return retval;
+}
+
+std::string SerializedLogBuffer::formatStatistics(uid_t uid, pid_t pid,
+                                                  unsigned int logMask) {
+    wrlock();
+
+    std::string ret = stats.format(uid, pid, logMask);
+
+    ret += "\n\nChunks (compressed/uncompressed bytes):";
+    log_id_for_each(id) {
+        if (!(logMask & (1 << id)) || mLogs[id].empty()) continue;
+        size_t uncompressed = 0;
+        for (const auto& chunk : mLogs[id]) {
+            uncompressed += chunk.uncompressedSize();
+        }
+        ret += android::base::StringPrintf(
+            "\n%s: %zu chunks %zu/%zu", android_log_id_to_name(id),
+            mLogs[id].size(), mSizes[id], uncompressed);
+    }
+
+    unlock();
+
+    return ret;
+}
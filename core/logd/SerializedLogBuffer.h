@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_SERIALIZED_LOG_BUFFER_H__
+#define _LOGD_SERIALIZED_LOG_BUFFER_H__
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <android/log.h>
+#include <private/android_filesystem_config.h>
+#include <sysutils/SocketClient.h>
+
+#include "LogBufferElement.h"
+#include "LogBufferInterface.h"
+#include "LogStatistics.h"
+#include "LogTags.h"
+#include "LogTimes.h"
+#include "SerializedLogChunk.h"
+#include "SerializedLogPersist.h"
+
+typedef std::list<SerializedLogChunk> SerializedLogChunkCollection;
+
+// Log store that keeps each log id in its own list of contiguous chunks
+// instead of one heap allocated LogBufferElement per entry. Only the newest
+// chunk of each log id is uncompressed, pruning drops whole chunks from the
+// front of the list. There is no chatty de-duplication, repeats are left to
+// the compressor, and no prune list: a chunk mixes every uid and pid, so
+// setting one is rejected.
+//
+// Selected at startup with logd.buffer.serialized, see README.property.
+class SerializedLogBuffer : public LogBufferInterface {
+    SerializedLogChunkCollection mLogs[LOG_ID_MAX];
+    pthread_rwlock_t mLogsLock;
+
+    LogStatistics stats;
+
+    unsigned long mMaxSize[LOG_ID_MAX];
+    size_t mSizes[LOG_ID_MAX];  // sum of pruneSize() of each chunk
+    // Bumped by clear(), which rewrites chunks under the readers' copies.
+    uint64_t mGenerations[LOG_ID_MAX];
+
+    uint64_t mSequence;
+
+    bool monotonic;
+
+    LogTags tags;
+
+    // Sealed chunks are also written to disk if logd.buffer.persist is set.
+    std::unique_ptr<SerializedLogPersist> mPersist;
+
+   public:
+    explicit SerializedLogBuffer(LastLogTimes* times);
+    ~SerializedLogBuffer() override;
+    void init() override;
+    bool isMonotonic() override {
+        return monotonic;
+    }
+
+    int log(log_id_t log_id, log_time realtime, uid_t uid, pid_t pid, pid_t tid,
+            const char* msg, uint16_t len) override;
+    uint64_t flushTo(SocketClient* writer, uint64_t start, pid_t* lastTid,
+                     bool privileged, bool security,
+                     int (*filter)(const LogBufferElement* element,
+                                   void* arg) = nullptr,
+                     void* arg = nullptr,
+                     FlushToState* state = nullptr) override;
+    std::unique_ptr<FlushToState> createFlushToState() override;
+
+    bool clear(log_id_t id, uid_t uid = AID_ROOT) override;
+    unsigned long getSize(log_id_t id) override;
+    int setSize(log_id_t id, unsigned long size) override;
+    unsigned long getSizeUsed(log_id_t id) override;
+
+    std::string formatStatistics(uid_t uid, pid_t pid,
+                                 unsigned int logMask) override;
+
+    void enableStatistics() override {
+        stats.enableStatistics();
+    }
+
+    int initPrune(const char* cp) override;
+    std::string formatPrune() override {
+        return "";
+    }
+
+    std::string formatGetEventTag(uid_t uid, const char* name,
+                                  const char* format) override {
+        return tags.formatGetEventTag(uid, name, format);
+    }
+    std::string formatEntry(uint32_t tag, uid_t uid) override {
+        return tags.formatEntry(tag, uid);
+    }
+    const char* tagToName(uint32_t tag) override {
+        return tags.tagToName(tag);
+    }
+
+    // helper must be protected directly or implicitly by wrlock()/unlock()
+    const char* pidToName(pid_t pid) override {
+        return stats.pidToName(pid);
+    }
+    uid_t pidToUid(pid_t pid) override {
+        return stats.pidToUid(pid);
+    }
+    pid_t tidToPid(pid_t tid) override {
+        return stats.tidToPid(tid);
+    }
+    const char* uidToName(uid_t uid) override {
+        return stats.uidToName(uid);
+    }
+    void wrlock() override {
+        pthread_rwlock_wrlock(&mLogsLock);
+    }
+    void rdlock() override {
+        pthread_rwlock_rdlock(&mLogsLock);
+    }
+    void unlock() override {
+        pthread_rwlock_unlock(&mLogsLock);
+    }
+
+   private:
+    // A reader's private copy of the chunk it is currently walking.
+    struct ChunkCursor {
+        std::vector<uint8_t> contents;
+        size_t offset = 0;
+        uint64_t nextSequence = 0;
+        uint64_t chunkSequence = 0;  // lowestSequence() of the chunk, 0 if none
+        bool sealed = false;         // contents is all the chunk will hold
+        uint64_t generation = 0;
+
+        const SerializedLogEntry* entry() const {
+            if ((offset + sizeof(SerializedLogEntry)) > contents.size()) {
+                return nullptr;
+            }
+            return reinterpret_cast<const SerializedLogEntry*>(
+                &contents[offset]);
+        }
+    };
+
+    // Kept by a reader thread between flushes, so that a reader woken for
+    // new entries carries on from its copy instead of finding and copying
+    // out its chunk again.
+    struct ReaderState : public FlushToState {
+        ChunkCursor cursors[LOG_ID_MAX];
+        uint64_t resume = 0;  // what the last flushTo() returned
+    };
+
+    // Hands a serialized entry to LogStatistics or a reader as a
+    // LogBufferElement that refers to the message rather than copying it.
+    class EntryElement {
+        LogBufferElement mElement;
+
+       public:
+        EntryElement(log_id_t id, log_time realtime, uid_t uid, pid_t pid,
+                     pid_t tid, const char* msg, uint16_t len)
+            : mElement(LogBufferElement::Borrowed(), id, realtime, uid, pid,
+                       tid, msg, len) {
+        }
+        EntryElement(log_id_t id, const SerializedLogEntry& entry)
+            : EntryElement(id, entry.realtime, entry.uid, entry.pid,
+                           entry.tid, entry.msg(), entry.msg_len) {
+            mElement.mSequence = entry.sequence;
+        }
+        ~EntryElement() {
+            mElement.mMsg = nullptr;
+        }
+        LogBufferElement* get() {
+            return &mElement;
+        }
+    };
+
+    size_t chunkSize(log_id_t id) const;
+    void maybePrune(log_id_t id);
+    void removeFromStats(log_id_t id, const SerializedLogChunk& chunk);
+    bool fillCursor(log_id_t id, ChunkCursor* cursor);
+};
+
+#endif  // _LOGD_SERIALIZED_LOG_BUFFER_H__
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <zstd.h>
+
+#include "LogUtils.h"
+#include "SerializedLogChunk.h"
+
+// Favour speed, seal() runs with the buffer write lock held.
+static const int kCompressionLevel = 1;
+
+SerializedLogChunk::SerializedLogChunk(size_t size)
+    : mContents(size),
+      mWriteOffset(0),
+      mEntries(0),
+      mLowestSequence(0),
+      mHighestSequence(0),
+      mNewest(log_time::EPOCH),
+      mSealed(false) {
+}
+
+const SerializedLogEntry* SerializedLogChunk::log(uint64_t sequence,
+                                                  log_time realtime, uid_t uid,
+                                                  pid_t pid, pid_t tid,
+                                                  const char* msg,
+                                                  uint16_t len) {
+    if (!canLog(len)) {
+        return nullptr;
+    }
+
+    SerializedLogEntry* entry =
+        reinterpret_cast<SerializedLogEntry*>(&mContents[mWriteOffset]);
+    entry->uid = uid;
+    entry->pid = pid;
+    entry->tid = tid;
+    entry->sequence = sequence;
+    entry->realtime = realtime;
+    entry->msg_len = len;
+    memcpy(&mContents[mWriteOffset + sizeof(*entry)], msg, len);
+    mWriteOffset += entry->total_len();
+
+    if (!mEntries++) {
+        mLowestSequence = sequence;
+    }
+    mHighestSequence = sequence;
+    if (mNewest < realtime) {
+        mNewest = realtime;
+    }
+    return entry;
+}
+
+void SerializedLogChunk::seal() {
+    if (mSealed) {
+        return;
+    }
+    mSealed = true;
+
+    mCompressed.resize(ZSTD_compressBound(mWriteOffset));
+    size_t ret = ZSTD_compress(mCompressed.data(), mCompressed.size(),
+                               mContents.data(), mWriteOffset,
+                               kCompressionLevel);
+    if (ZSTD_isError(ret) || (ret >= mWriteOffset)) {
+        // Incompressible or failure, keep it raw but give back the slack.
+        if (ZSTD_isError(ret)) {
+            android::prdebug("logd.chunk: compression failed: %s",
+                             ZSTD_getErrorName(ret));
+        }
+        std::vector<uint8_t>().swap(mCompressed);
+        mContents.resize(mWriteOffset);
+        mContents.shrink_to_fit();
+        return;
+    }
+    mCompressed.resize(ret);
+    mCompressed.shrink_to_fit();
+    std::vector<uint8_t>().swap(mContents);
+}
+
+void SerializedLogChunk::read(std::vector<uint8_t>* out) const {
+    if (mCompressed.empty()) {
+        out->assign(mContents.begin(), mContents.begin() + mWriteOffset);
+        return;
+    }
+
+    out->resize(mWriteOffset);
+    size_t ret = ZSTD_decompress(out->data(), out->size(), mCompressed.data(),
+                                 mCompressed.size());
+    if (ZSTD_isError(ret) || (ret != mWriteOffset)) {
+        android::prdebug("logd.chunk: decompression failed");
+        out->clear();
+    }
+}
+
+void SerializedLogChunk::readFrom(size_t offset,
+                                  std::vector<uint8_t>* out) const {
+    if (offset >= mWriteOffset) {
+        return;
+    }
+    if (mCompressed.empty()) {
+        out->insert(out->end(), mContents.begin() + offset,
+                    mContents.begin() + mWriteOffset);
+        return;
+    }
+
+    std::vector<uint8_t> contents;
+    read(&contents);
+    if (contents.size() == mWriteOffset) {
+        out->insert(out->end(), contents.begin() + offset, contents.end());
+    }
+}
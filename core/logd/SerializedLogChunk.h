@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_SERIALIZED_LOG_CHUNK_H__
+#define _LOGD_SERIALIZED_LOG_CHUNK_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <vector>
+
+#include <log/log_time.h>
+
+// On-chunk representation of a log entry, the payload of msg_len bytes
+// immediately follows the header. Entries are packed back to back.
+struct __attribute__((packed)) SerializedLogEntry {
+    uint32_t uid;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t sequence;
+    log_time realtime;
+    uint16_t msg_len;
+
+    const char* msg() const {
+        return reinterpret_cast<const char*>(this) + sizeof(*this);
+    }
+    size_t total_len() const {
+        return sizeof(*this) + msg_len;
+    }
+};
+
+// A contiguous, append only run of SerializedLogEntry for a single log id.
+// The newest chunk of each log id is the only one written to; once it is
+// full it is sealed, which compresses the contents with zstd and releases
+// the uncompressed copy. Readers never hold references into a chunk, they
+// take a private (decompressed) copy with readFrom() while holding the buffer
+// lock and walk that, so sealed or pruned chunks need no reader tracking. A
+// reader's copy of the newest chunk is topped up with what was appended
+// since, only sealed chunks are ever decompressed.
+class SerializedLogChunk {
+    std::vector<uint8_t> mContents;    // uncompressed, empty once sealed
+    std::vector<uint8_t> mCompressed;  // empty until sealed
+    size_t mWriteOffset;
+    size_t mEntries;
+    uint64_t mLowestSequence;
+    uint64_t mHighestSequence;
+    log_time mNewest;
+    bool mSealed;
+
+   public:
+    explicit SerializedLogChunk(size_t size);
+
+    bool canLog(size_t len) const {
+        return !mSealed &&
+               ((mWriteOffset + sizeof(SerializedLogEntry) + len) <=
+                mContents.size());
+    }
+    const SerializedLogEntry* log(uint64_t sequence, log_time realtime,
+                                  uid_t uid, pid_t pid, pid_t tid,
+                                  const char* msg, uint16_t len);
+
+    // Compress the contents, no more entries may be added afterwards.
+    void seal();
+    // Replace |out| with the uncompressed contents of this chunk.
+    void read(std::vector<uint8_t>* out) const;
+    // Append the uncompressed contents from |offset| on to |out|, which
+    // already holds the contents up to |offset|.
+    void readFrom(size_t offset, std::vector<uint8_t>* out) const;
+
+    // Memory held on behalf of this chunk, used for pruning decisions.
+    size_t pruneSize() const {
+        return mSealed ? (mCompressed.empty() ? mContents.size()
+                                              : mCompressed.size())
+                       : mWriteOffset;
+    }
+    // Size of the entries as they were written.
+    size_t uncompressedSize() const {
+        return mWriteOffset;
+    }
+    size_t entries() const {
+        return mEntries;
+    }
+    bool sealed() const {
+        return mSealed;
+    }
+    uint64_t lowestSequence() const {
+        return mLowestSequence;
+    }
+    uint64_t highestSequence() const {
+        return mHighestSequence;
+    }
+    log_time newest() const {
+        return mNewest;
+    }
+    // The bytes backing a sealed chunk, zstd compressed if compressed().
+    const std::vector<uint8_t>& stored() const {
+        return mCompressed.empty() ? mContents : mCompressed;
+    }
+    bool compressed() const {
+        return !mCompressed.empty();
+    }
+};
+
+#endif  // _LOGD_SERIALIZED_LOG_CHUNK_H__
@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
+#include <private/android_logger.h>
+
+#include "LogUtils.h"
+#include "SerializedLogPersist.h"
+
+static_assert(sizeof(SerializedLogEntry) == sizeof(android_log_persist_entry_t),
+              "SerializedLogEntry is persisted as android_log_persist_entry_t");
+
+const size_t SerializedLogPersist::kMaxBytes = 16 * 1024 * 1024;
+
+// Bounds what we are willing to hold in memory if the disk falls behind.
+static const size_t kMaxPending = 8;
+// Beyond this many distinct tags in a chunk an index no longer pays off.
+static const size_t kMaxTags = 256;
+
+SerializedLogPersist::SerializedLogPersist(const char* dir)
+    : mDir(dir),
+      mThreadStarted(false),
+      mStop(false),
+      mScanned(false),
+      mBytes(0),
+      mNextFile(0),
+      mClearMask(0) {
+    pthread_mutex_init(&mLock, nullptr);
+    pthread_cond_init(&mCond, nullptr);
+
+    pthread_attr_t attr;
+    if (!pthread_attr_init(&attr)) {
+        mThreadStarted =
+            !pthread_create(&mThread, &attr, SerializedLogPersist::threadStart,
+                            this);
+        pthread_attr_destroy(&attr);
+    }
+}
+
+SerializedLogPersist::~SerializedLogPersist() {
+    pthread_mutex_lock(&mLock);
+    mStop = true;
+    pthread_cond_signal(&mCond);
+    pthread_mutex_unlock(&mLock);
+    if (mThreadStarted) {
+        pthread_join(mThread, nullptr);
+    }
+    pthread_cond_destroy(&mCond);
+    pthread_mutex_destroy(&mLock);
+}
+
+void SerializedLogPersist::queue(log_id_t id, const SerializedLogChunk& chunk) {
+    pthread_mutex_lock(&mLock);
+    if (mPending.size() >= kMaxPending) {
+        android::prdebug("logd.persist: falling behind, dropping a chunk");
+        mPending.pop_front();
+    }
+    mPending.emplace_back(id, chunk);
+    pthread_cond_signal(&mCond);
+    pthread_mutex_unlock(&mLock);
+}
+
+void SerializedLogPersist::clear(log_id_t id) {
+    pthread_mutex_lock(&mLock);
+    mPending.erase(std::remove_if(mPending.begin(), mPending.end(),
+                                  [id](const auto& pending) {
+                                      return pending.first == id;
+                                  }),
+                   mPending.end());
+    mClearMask |= 1 << id;
+    pthread_cond_signal(&mCond);
+    pthread_mutex_unlock(&mLock);
+}
+
+// assumes mLock held. Forgets the files of the log ids in mask and returns
+// their names, for the caller to unlink once mLock is dropped.
+std::vector<std::string> SerializedLogPersist::takeFiles_Locked(uint32_t mask) {
+    std::vector<std::string> taken;
+    if (!mScanned) {
+        scan_Locked();
+    }
+    for (auto it = mFiles.begin(); it != mFiles.end();) {
+        const std::string& name = it->first;
+        bool match = false;
+        for (int id = LOG_ID_MIN; id < LOG_ID_MAX; ++id) {
+            if (!(mask & (1 << id))) continue;
+            std::string suffix = android::base::StringPrintf(
+                "-%s%s", android_log_id_to_name(static_cast<log_id_t>(id)),
+                ANDROID_LOG_PERSIST_SUFFIX);
+            if ((name.size() > suffix.size()) &&
+                !name.compare(name.size() - suffix.size(), std::string::npos,
+                              suffix)) {
+                match = true;
+                break;
+            }
+        }
+        if (match) {
+            taken.push_back(name);
+            mBytes -= it->second;
+            it = mFiles.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    return taken;
+}
+
+// assumes mLock held
+void SerializedLogPersist::scan_Locked() {
+    // logd starts before /data is mounted, so this is retried until it works.
+    if (mkdir(mDir.c_str(), 0700) && (errno != EEXIST)) {
+        return;
+    }
+
+    // Pick up where the previous boot left off.
+    std::vector<std::pair<uint32_t, std::string>> found;
+    std::unique_ptr<DIR, int (*)(DIR*)> d(opendir(mDir.c_str()), closedir);
+    if (!d) {
+        return;
+    }
+    struct dirent* dp;
+    while ((dp = readdir(d.get())) != nullptr) {
+        std::string name(dp->d_name);
+        if ((name == ".") || (name == "..")) {
+            continue;
+        }
+        if (name[0] == '.') {
+            unlinkat(dirfd(d.get()), dp->d_name, 0);  // interrupted write
+            continue;
+        }
+        if ((name.size() <= strlen(ANDROID_LOG_PERSIST_SUFFIX)) ||
+            (name.compare(name.size() - strlen(ANDROID_LOG_PERSIST_SUFFIX),
+                          std::string::npos, ANDROID_LOG_PERSIST_SUFFIX) != 0)) {
+            continue;
+        }
+        uint32_t number;
+        if (sscanf(dp->d_name, "%u-", &number) == 1) {
+            found.emplace_back(number, name);
+        }
+    }
+    std::sort(found.begin(), found.end());
+    for (const auto& file : found) {
+        struct stat st;
+        if (stat((mDir + "/" + file.second).c_str(), &st)) {
+            continue;
+        }
+        mFiles.emplace_back(file.second, st.st_size);
+        mBytes += st.st_size;
+        mNextFile = file.first + 1;
+    }
+    mScanned = true;
+    trim_Locked();
+}
+
+// assumes mLock held
+void SerializedLogPersist::trim_Locked() {
+    while ((mBytes > kMaxBytes) && !mFiles.empty()) {
+        unlink((mDir + "/" + mFiles.front().first).c_str());
+        mBytes -= mFiles.front().second;
+        mFiles.pop_front();
+    }
+}
+
+void* SerializedLogPersist::threadStart(void* obj) {
+    prctl(PR_SET_NAME, "logd.persist");
+
+    SerializedLogPersist* me = reinterpret_cast<SerializedLogPersist*>(obj);
+
+    pthread_mutex_lock(&me->mLock);
+    while (!me->mStop) {
+        // Ahead of the pending chunks, which were all queued after the clear.
+        if (me->mClearMask) {
+            std::vector<std::string> names =
+                me->takeFiles_Locked(me->mClearMask);
+            me->mClearMask = 0;
+            pthread_mutex_unlock(&me->mLock);
+
+            for (const auto& name : names) {
+                unlink((me->mDir + "/" + name).c_str());
+            }
+
+            pthread_mutex_lock(&me->mLock);
+            continue;
+        }
+        if (me->mPending.empty()) {
+            pthread_cond_wait(&me->mCond, &me->mLock);
+            continue;
+        }
+        auto pending = std::move(me->mPending.front());
+        me->mPending.pop_front();
+        pthread_mutex_unlock(&me->mLock);
+
+        me->write(pending.first, pending.second);
+
+        pthread_mutex_lock(&me->mLock);
+    }
+    pthread_mutex_unlock(&me->mLock);
+
+    return nullptr;
+}
+
+void SerializedLogPersist::write(log_id_t id, const SerializedLogChunk& chunk) {
+    std::vector<uint8_t> contents;
+    chunk.read(&contents);
+    if (contents.empty()) {
+        return;
+    }
+
+    android_log_persist_header_t header = {};
+    header.magic = ANDROID_LOG_PERSIST_MAGIC;
+    header.version = ANDROID_LOG_PERSIST_VERSION;
+    header.log_id = id;
+    header.flags = chunk.compressed() ? ANDROID_LOG_PERSIST_ZSTD : 0;
+    header.data_len = chunk.stored().size();
+    header.uncompressed_len = contents.size();
+    header.oldest = log_time(log_time::tv_sec_max, log_time::tv_nsec_max);
+    header.newest = log_time(log_time::EPOCH);
+
+    std::set<uint32_t> pids;
+    std::set<std::string> tags;
+    bool indexTags = (id != LOG_ID_EVENTS) && (id != LOG_ID_STATS) &&
+                     (id != LOG_ID_SECURITY);
+    for (size_t offset = 0;
+         (offset + sizeof(SerializedLogEntry)) <= contents.size();) {
+        const SerializedLogEntry* entry =
+            reinterpret_cast<const SerializedLogEntry*>(&contents[offset]);
+        offset += entry->total_len();
+
+        ++header.entry_count;
+        if (entry->realtime < header.oldest) header.oldest = entry->realtime;
+        if (header.newest < entry->realtime) header.newest = entry->realtime;
+        pids.insert(entry->pid);
+
+        if (!indexTags || (entry->msg_len < 2)) continue;
+        const char* tag = entry->msg() + 1;  // after the priority
+        size_t len = strnlen(tag, entry->msg_len - 1);
+        tags.emplace(tag, std::min<size_t>(len, UINT8_MAX));
+        if (tags.size() > kMaxTags) {
+            indexTags = false;
+            tags.clear();
+        }
+    }
+
+    std::string out(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (uint32_t pid : pids) {
+        out.append(reinterpret_cast<const char*>(&pid), sizeof(pid));
+    }
+    for (const auto& tag : tags) {
+        out += static_cast<char>(tag.size());
+        out += tag;
+    }
+    auto* out_header = reinterpret_cast<android_log_persist_header_t*>(&out[0]);
+    out_header->pid_count = pids.size();
+    out_header->tag_count = tags.size();
+    out_header->tag_len = out.size() - sizeof(header) - pids.size() * 4;
+    const std::vector<uint8_t>& stored = chunk.stored();
+    out.append(reinterpret_cast<const char*>(stored.data()), stored.size());
+
+    pthread_mutex_lock(&mLock);
+    if (!mScanned) {
+        scan_Locked();
+        if (!mScanned) {
+            pthread_mutex_unlock(&mLock);
+            return;
+        }
+    }
+    // Cleared since we took it off mPending. Only our thread resets the mask,
+    // so this holds until write() returns.
+    if (mClearMask & (1 << id)) {
+        pthread_mutex_unlock(&mLock);
+        return;
+    }
+    std::string name = android::base::StringPrintf(
+        "%010u-%s%s", mNextFile++, android_log_id_to_name(id),
+        ANDROID_LOG_PERSIST_SUFFIX);
+    pthread_mutex_unlock(&mLock);
+
+    // Written aside and renamed, so a reader never sees a partial file.
+    std::string tmp = mDir + "/." + name;
+    android::base::unique_fd fd(TEMP_FAILURE_RETRY(
+        open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW,
+             0600)));
+    if ((fd == -1) || !android::base::WriteFully(fd, out.data(), out.size()) ||
+        rename(tmp.c_str(), (mDir + "/" + name).c_str())) {
+        android::prdebug("logd.persist: write %s: %s", name.c_str(),
+                         strerror(errno));
+        unlink(tmp.c_str());
+        return;
+    }
+
+    pthread_mutex_lock(&mLock);
+    if (mClearMask & (1 << id)) {  // cleared while we were writing it
+        pthread_mutex_unlock(&mLock);
+        unlink((mDir + "/" + name).c_str());
+        return;
+    }
+    mFiles.emplace_back(name, out.size());
+    mBytes += out.size();
+    trim_Locked();
+    pthread_mutex_unlock(&mLock);
+}
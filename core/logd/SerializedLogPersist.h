@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_SERIALIZED_LOG_PERSIST_H__
+#define _LOGD_SERIALIZED_LOG_PERSIST_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <android/log.h>
+
+#include "SerializedLogChunk.h"
+
+// Writes sealed SerializedLogChunks to disk in the format described by
+// android_log_persist_header_t, so that they survive a reboot. Files are
+// written by a thread of our own, and the oldest are removed to stay under
+// kMaxBytes.
+class SerializedLogPersist {
+    const std::string mDir;
+
+    pthread_mutex_t mLock;
+    pthread_cond_t mCond;
+    pthread_t mThread;
+    bool mThreadStarted;
+    bool mStop;
+
+    // All of the following protected by mLock
+    bool mScanned;  // mDir exists and mFiles reflects it
+    std::deque<std::pair<log_id_t, SerializedLogChunk>> mPending;
+    std::deque<std::pair<std::string, size_t>> mFiles;  // oldest first
+    size_t mBytes;
+    uint32_t mNextFile;
+    uint32_t mClearMask;  // 1 << log id, files still to be removed
+
+    static void* threadStart(void* me);
+    void write(log_id_t id, const SerializedLogChunk& chunk);
+    void scan_Locked();
+    void trim_Locked();
+    std::vector<std::string> takeFiles_Locked(uint32_t mask);
+
+   public:
+    static const size_t kMaxBytes;
+
+    explicit SerializedLogPersist(const char* dir);
+    ~SerializedLogPersist();
+
+    // Queue a sealed chunk, a copy is taken. Called with the buffer lock held
+    // so this only ever copies the compressed contents.
+    void queue(log_id_t id, const SerializedLogChunk& chunk);
+    // Remove everything persisted, or queued, for this log id. Also called
+    // with the buffer lock held, the files are removed by our thread.
+    void clear(log_id_t id);
+};
+
+#endif  // _LOGD_SERIALIZED_LOG_PERSIST_H__
@@ -52,6 +52,7 @@
 #include "LogKlog.h"
 #include "LogListener.h"
 #include "LogUtils.h"
+#include "SerializedLogBuffer.h"
 
 #define KMSG_PRIORITY(PRI)                                 \
     '<', '0' + LOG_MAKEPRI(LOG_DAEMON, LOG_PRI(PRI)) / 10, \
@@ -211,7 +212,7 @@ static char* name;
 
 static sem_t reinit;
 static bool reinit_running = false;
-static LogBuffer* logBuf = nullptr;
+static LogBufferInterface* logBuf = nullptr;
 
 static bool package_list_parser_cb(pkg_info* info, void* /* userdata */) {
     bool rc = true;
@@ -474,9 +475,16 @@ int main(int argc, char* argv[]) {
     LastLogTimes* times = new LastLogTimes();
 
     // LogBuffer is the object which is responsible for holding all
-    // log entries.
+    // log entries. SerializedLogBuffer trades chatty de-duplication for
+    // compressed per log id chunks, so the same memory holds more history.
 
-    logBuf = new LogBuffer(times);
+    if (__android_logger_property_get_bool(
+            "logd.buffer.serialized",
+            BOOL_DEFAULT_FALSE | BOOL_DEFAULT_FLAG_PERSIST)) {
+        logBuf = new SerializedLogBuffer(times);
+    } else {
+        logBuf = new LogBuffer(times);
+    }
 
     signal(SIGHUP, reinit_signal_handler);
 
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sched.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <log/log_time.h>
+#include <private/android_logger.h>
+
+#include "LogBuffer.h"
+#include "LogReader.h"
+#include "LogTimes.h"
+#include "SerializedLogBuffer.h"
+
+// Furnished by main.cpp in logd proper.
+void android::prdebug(const char* /*fmt*/, ...) {
+}
+
+char* android::uidToName(uid_t /*uid*/) {
+    return nullptr;
+}
+
+BENCHMARK_MAIN();
+
+namespace {
+
+// A blocking reader attached to the buffer the way LogReader would attach a
+// "logcat" client, with the far end of its socket drained by a thread.
+class BlockingReader {
+    int mFds[2];
+    std::thread mDrain;
+
+   public:
+    explicit BlockingReader(LogReader& reader) {
+        socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, mFds);
+        mDrain = std::thread([fd = mFds[1]] {
+            char buf[LOGGER_ENTRY_MAX_LEN];
+            while (read(fd, buf, sizeof(buf)) > 0) {
+            }
+        });
+
+        // Owned by the LogTimeEntry, which drops the last reference on exit.
+        SocketClient* client = new SocketClient(mFds[0], true);
+        LogTimeEntry::wrlock();
+        auto entry = std::make_unique<LogTimeEntry>(
+            reader, client, false, 0, static_cast<log_mask_t>(-1), 0,
+            log_time(log_time::EPOCH), 0, 0);
+        if (entry->startReader_Locked()) {
+            reader.logbuf().mTimes.emplace_front(std::move(entry));
+        }
+        LogTimeEntry::unlock();
+    }
+
+    ~BlockingReader() {
+        mDrain.join();
+        close(mFds[1]);
+    }
+};
+
+void releaseReaders(LastLogTimes& times) {
+    LogTimeEntry::wrlock();
+    for (const auto& entry : times) {
+        entry->release_Locked();
+    }
+    LogTimeEntry::unlock();
+
+    // Each reader thread removes itself from the list on the way out.
+    for (;;) {
+        LogTimeEntry::rdlock();
+        bool empty = times.empty();
+        LogTimeEntry::unlock();
+        if (empty) break;
+        sched_yield();
+    }
+}
+
+}  // namespace
+
+// Measures what LogListener pays for each entry it receives, log() into the
+// buffer followed by notifyNewLog(), with range(0) blocking readers tailing
+// the buffer. Reports the median and 99th percentile latency of a write.
+template <typename Buffer>
+static void BM_log_latency_readers(benchmark::State& state) {
+    LastLogTimes times;
+    Buffer logbuf(&times);
+    LogReader reader(&logbuf, -1);
+
+    std::vector<std::unique_ptr<BlockingReader>> readers;
+    for (int i = 0; i < state.range(0); ++i) {
+        readers.emplace_back(new BlockingReader(reader));
+    }
+
+    static const char msg[] = "\4logd_benchmark\0A message of moderate length";
+    std::vector<uint64_t> latencies;
+    for (auto _ : state) {
+        log_time start(CLOCK_MONOTONIC);
+        log_time realtime(CLOCK_REALTIME);
+        int ret = logbuf.log(LOG_ID_MAIN, realtime, AID_ROOT, getpid(),
+                             gettid(), msg, sizeof(msg));
+        if (ret > 0) {
+            reader.notifyNewLog(1 << LOG_ID_MAIN);
+        }
+        latencies.push_back((log_time(CLOCK_MONOTONIC) - start).nsec());
+    }
+
+    releaseReaders(times);
+    readers.clear();
+
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        state.counters["p50_ns"] = latencies[latencies.size() / 2];
+        state.counters["p99_ns"] = latencies[latencies.size() * 99 / 100];
+    }
+}
+
+static void ReaderCounts(benchmark::internal::Benchmark* b) {
+    for (int readers : {0, 1, 2, 4, 8, 16}) {
+        b->Arg(readers);
+    }
+}
+BENCHMARK_TEMPLATE(BM_log_latency_readers, LogBuffer)
+    ->Apply(ReaderCounts)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_log_latency_readers, SerializedLogBuffer)
+    ->Apply(ReaderCounts)
+    ->UseRealTime();
+
+// What the writer path costs with statistics off (range(0) == 0) and on.
+// The buffer is kept small and the senders varied, so that pruning, and
+// with it the search for the worst uid, runs throughout.
+template <typename Buffer>
+static void BM_log_statistics(benchmark::State& state) {
+    LastLogTimes times;
+    Buffer logbuf(&times);
+    if (state.range(0)) {
+        logbuf.enableStatistics();
+    }
+    logbuf.setSize(LOG_ID_MAIN, 256 * 1024);
+
+    static const char msg[] = "\4logd_benchmark\0A message of moderate length";
+    size_t i = 0;
+    for (auto _ : state) {
+        uid_t uid = AID_APP_START + (i % 64);
+        pid_t pid = 1000 + (i % 256);
+        pid_t tid = pid + (i % 4);
+        logbuf.log(LOG_ID_MAIN, log_time(CLOCK_REALTIME), uid, pid, tid, msg,
+                   sizeof(msg));
+        ++i;
+    }
+}
+BENCHMARK_TEMPLATE(BM_log_statistics, LogBuffer)->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_log_statistics, SerializedLogBuffer)->Arg(0)->Arg(1);
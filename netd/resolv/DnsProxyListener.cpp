@@ -42,7 +42,6 @@
 #include <netdutils/ResponseCode.h>
 #include <netdutils/Slice.h>
 #include <netdutils/Stopwatch.h>
-#include <netdutils/ThreadUtil.h>
 #include <private/android_filesystem_config.h>  // AID_SYSTEM
 #include <statslog_resolv.h>
 #include <sysutils/SocketClient.h>
@@ -52,6 +51,7 @@
 #include "NetdPermissions.h"
 #include "PrivateDnsConfiguration.h"
 #include "ResolverEventReporter.h"
+#include "ThreadPool.h"
 #include "getaddrinfo.h"
 #include "gethnamaddr.h"
 #include "netd_resolv/stats.h"  // RCODE_TIMEOUT
@@ -86,11 +86,24 @@ void logArguments(int argc, char** argv) {
     }
 }
 
+// Handlers spend most of their time blocked on the network, so the pool is sized for
+// concurrency rather than for the number of cores.
+constexpr size_t MAX_HANDLER_THREADS = 256;
+constexpr std::chrono::seconds HANDLER_THREAD_IDLE_TIMEOUT = std::chrono::seconds(30);
+
+ThreadPool& handlerThreadPool() {
+    static ThreadPool* pool = new ThreadPool(MAX_HANDLER_THREADS, HANDLER_THREAD_IDLE_TIMEOUT);
+    return *pool;
+}
+
 template<typename T>
 void tryThreadOrError(SocketClient* cli, T* handler) {
     cli->incRef();
 
-    const int rval = netdutils::threadLaunch(handler);
+    const int rval = handlerThreadPool().enqueue([handler] {
+        std::unique_ptr<T> h(handler);
+        h->run();
+    });
     if (rval == 0) {
         // SocketClient decRef() happens in the handler's run() method.
         return;
@@ -18,7 +18,10 @@
 //#define LOG_NDEBUG 0
 
 #include "DnsTlsDispatcher.h"
+#include <algorithm>
+#include <android-base/parseint.h>
 #include <netdutils/Stopwatch.h>
+#include <server_configurable_flags/get_flags.h>
 #include "DnsTlsSocketFactory.h"
 #include "resolv_private.h"
 #include "stats.pb.h"
@@ -38,6 +41,14 @@ DnsTlsDispatcher::DnsTlsDispatcher() {
     mFactory.reset(new DnsTlsSocketFactory());
 }
 
+static bool resumeAcrossNetworks() {
+    int enabled = 0;
+    android::base::ParseInt(server_configurable_flags::GetServerConfigurableFlag(
+                                    "netd_native", "dot_resume_across_networks", ""),
+                            &enabled);
+    return enabled != 0;
+}
+
 std::list<DnsTlsServer> DnsTlsDispatcher::getOrderedServerList(
         const std::list<DnsTlsServer> &tlsServers, unsigned mark) const {
     // Our preferred DnsTlsServer order is:
@@ -136,12 +147,19 @@ DnsTlsTransport::Response DnsTlsDispatcher::query(const DnsTlsServer& server, un
                                                   const Slice query,
                                                   const Slice ans, int *resplen) {
     const Key key = std::make_pair(mark, server);
+    const bool shareSessions = resumeAcrossNetworks();
     Transport* xport;
     {
         std::lock_guard guard(sLock);
         auto it = mStore.find(key);
         if (it == mStore.end()) {
-            xport = new Transport(server, mark, mFactory.get());
+            DnsTlsSessionCache* cache = nullptr;
+            if (shareSessions) {
+                auto& shared = mSessionCaches[server];
+                if (!shared) shared = std::make_unique<DnsTlsSessionCache>();
+                cache = shared.get();
+            }
+            xport = new Transport(server, mark, mFactory.get(), cache);
             mStore[key].reset(xport);
         } else {
             xport = it->second.get();
@@ -193,6 +211,16 @@ void DnsTlsDispatcher::cleanup(std::chrono::time_point<std::chrono::steady_clock
             ++it;
         }
     }
+    for (auto it = mSessionCaches.begin(); it != mSessionCaches.end();) {
+        const bool inUse = std::any_of(mStore.begin(), mStore.end(), [&it](const auto& entry) {
+            return entry.first.second == it->first;
+        });
+        if (inUse) {
+            ++it;
+        } else {
+            it = mSessionCaches.erase(it);
+        }
+    }
     mLastCleanup = now;
 }
 
@@ -72,8 +72,9 @@ class DnsTlsDispatcher {
     // Transport is a thin wrapper around DnsTlsTransport, adding reference counting and
     // usage monitoring so we can expire idle sessions from the cache.
     struct Transport {
-        Transport(const DnsTlsServer& server, unsigned mark, IDnsTlsSocketFactory* _Nonnull factory)
-            : transport(server, mark, factory) {}
+        Transport(const DnsTlsServer& server, unsigned mark, IDnsTlsSocketFactory* _Nonnull factory,
+                  DnsTlsSessionCache* _Nullable cache)
+            : transport(server, mark, factory, cache) {}
         // DnsTlsTransport is thread-safe, so it doesn't need to be guarded.
         DnsTlsTransport transport;
         // This use counter and timestamp are used to ensure that only idle sessions are
@@ -83,6 +84,13 @@ class DnsTlsDispatcher {
         std::chrono::time_point<std::chrono::steady_clock> lastUsed GUARDED_BY(sLock);
     };
 
+    // TLS session caches shared by the transports to the same server on different networks,
+    // so that a connection on a new network can resume a session instead of doing a full
+    // handshake.  Only used if the netd_native flag "dot_resume_across_networks" is set, since
+    // resuming a session lets the server link the device's connections across networks.
+    // Declared before mStore so that the caches outlive the transports that use them.
+    std::map<DnsTlsServer, std::unique_ptr<DnsTlsSessionCache>> mSessionCaches GUARDED_BY(sLock);
+
     // Cache of reusable DnsTlsTransports.  Transports stay in cache as long as
     // they are in use and for a few minutes after.
     // The key is a (netid, server) pair.  The netid is first for lexicographic comparison speed.
@@ -92,7 +100,8 @@ class DnsTlsDispatcher {
     // few minutes.
     std::chrono::time_point<std::chrono::steady_clock> mLastCleanup GUARDED_BY(sLock);
 
-    // Drop any cache entries whose useCount is zero and which have not been used recently.
+    // Drop any cache entries whose useCount is zero and which have not been used recently,
+    // and the shared session caches of servers that no longer have a transport.
     // This function performs a linear scan of mStore.
     void cleanup(std::chrono::time_point<std::chrono::steady_clock> now) REQUIRES(sLock);
 
@@ -393,13 +393,10 @@ void DnsTlsSocket::loop() {
         } else if (fds[SSLFD].revents & POLLOUT) {
             // q cannot be empty here.
             // Sending the entire queue here would risk a TCP flow control deadlock, so
-            // we only send a single query on each cycle of this loop.
-            // TODO: Coalesce multiple pending queries if there is enough space in the
-            // write buffer.
-            if (!sendQuery(q.front())) {
+            // we only send as many queries as fit in one TLS record on each cycle of this loop.
+            if (!sendQueries(&q)) {
                 break;
             }
-            q.pop_front();
         }
     }
     ALOGV("Disconnecting");
@@ -507,6 +504,25 @@ bool DnsTlsSocket::sendQuery(const std::vector<uint8_t>& buf) {
     return true;
 }
 
+std::vector<uint8_t> DnsTlsSocket::coalesceQueries(std::deque<std::vector<uint8_t>>* q) {
+    std::vector<uint8_t> buf = std::move(q->front());
+    q->pop_front();
+    // Coalesce the following queries into the same write, so that a burst of queries is
+    // pipelined in a single TLS record instead of one record and poll() cycle per query.
+    while (!q->empty() && buf.size() + q->front().size() <= SSL3_RT_MAX_PLAIN_LENGTH) {
+        buf.insert(buf.end(), q->front().begin(), q->front().end());
+        q->pop_front();
+    }
+    return buf;
+}
+
+bool DnsTlsSocket::sendQueries(std::deque<std::vector<uint8_t>>* q) {
+    const size_t queued = q->size();
+    const std::vector<uint8_t> buf = coalesceQueries(q);
+    ALOGV("%u Sending %zu queries", mMark, queued - q->size());
+    return sendQuery(buf);
+}
+
 bool DnsTlsSocket::readResponse() {
     ALOGV("reading response");
     uint8_t responseHeader[2];
@@ -18,6 +18,7 @@
 #define _DNS_DNSTLSSOCKET_H
 
 #include <openssl/ssl.h>
+#include <deque>
 #include <future>
 #include <mutex>
 
@@ -64,6 +65,11 @@ class DnsTlsSocket : public IDnsTlsSocket {
     // Thread-safe.
     bool query(uint16_t id, const netdutils::Slice query) override EXCLUDES(mLock);
 
+    // Removes the query at the front of |q|, together with as many of the following queries as
+    // fit in the same TLS record, from |q|, and returns them concatenated for a single write.
+    // |q| must not be empty.  Public for testing.
+    static std::vector<uint8_t> coalesceQueries(std::deque<std::vector<uint8_t>>* _Nonnull q);
+
   private:
     // Lock to be held by the SSL event loop thread.  This is not normally in contention.
     std::mutex mLock;
@@ -94,6 +100,8 @@ class DnsTlsSocket : public IDnsTlsSocket {
     int sslRead(const netdutils::Slice buffer, bool wait) REQUIRES(mLock);
 
     bool sendQuery(const std::vector<uint8_t>& buf) REQUIRES(mLock);
+    // Sends the queries that coalesceQueries() takes from |q|.
+    bool sendQueries(std::deque<std::vector<uint8_t>>* _Nonnull q) REQUIRES(mLock);
     bool readResponse() REQUIRES(mLock);
 
     // Similar to query(), this function uses incrementEventFd to send a message to the
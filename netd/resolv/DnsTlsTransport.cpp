@@ -61,7 +61,7 @@ bool DnsTlsTransport::sendQuery(const DnsTlsQueryMap::Query q) {
 
 void DnsTlsTransport::doConnect() {
     ALOGV("Constructing new socket");
-    mSocket = mFactory->createDnsTlsSocket(mServer, mMark, this, &mCache);
+    mSocket = mFactory->createDnsTlsSocket(mServer, mMark, this, mCache);
 
     if (mSocket) {
         auto queries = mQueries.getAll();
@@ -41,9 +41,12 @@ class IDnsTlsSocketFactory;
 // such as reopening the socket and reissuing pending queries.
 class DnsTlsTransport : public IDnsTlsSocketObserver {
   public:
+    // If |cache| is null, the transport keeps its own session cache.  Otherwise, TLS sessions
+    // are resumed from, and recorded to, |cache|, which must outlive the transport.
     DnsTlsTransport(const DnsTlsServer& server, unsigned mark,
-                    IDnsTlsSocketFactory* _Nonnull factory)
-        : mMark(mark), mServer(server), mFactory(factory) {}
+                    IDnsTlsSocketFactory* _Nonnull factory,
+                    DnsTlsSessionCache* _Nullable cache = nullptr)
+        : mCache(cache ? cache : &mOwnCache), mMark(mark), mServer(server), mFactory(factory) {}
     ~DnsTlsTransport();
 
     typedef DnsTlsServer::Response Response;
@@ -64,7 +67,8 @@ class DnsTlsTransport : public IDnsTlsSocketObserver {
   private:
     std::mutex mLock;
 
-    DnsTlsSessionCache mCache;
+    DnsTlsSessionCache mOwnCache;
+    DnsTlsSessionCache* _Nonnull const mCache;
     DnsTlsQueryMap mQueries;
 
     const unsigned mMark;  // Socket mark
@@ -26,7 +26,9 @@
 
 #include <aidl/android/net/IDnsResolver.h>
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/strings.h>
+#include <server_configurable_flags/get_flags.h>
 
 #include "Dns64Configuration.h"
 #include "DnsResolver.h"
@@ -190,9 +192,17 @@ void ResolverController::destroyNetworkCache(unsigned netId) {
 }
 
 int ResolverController::createNetworkCache(unsigned netId) {
+    using android::base::ParseInt;
+    using server_configurable_flags::GetServerConfigurableFlag;
+
     LOG(VERBOSE) << __func__ << ": netId = " << netId;
 
-    return resolv_create_cache_for_net(netId);
+    ResolvCacheParams params;
+    ParseInt(GetServerConfigurableFlag("netd_native", "cache_max_entries", ""),
+             &params.max_entries, 0);
+    ParseInt(GetServerConfigurableFlag("netd_native", "cache_serve_stale_seconds", ""),
+             &params.serve_stale_seconds, 0);
+    return resolv_create_cache_for_net(netId, params);
 }
 
 int ResolverController::setResolverConfiguration(
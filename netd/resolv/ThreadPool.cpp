@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "resolv"
+
+#include "ThreadPool.h"
+
+#include <errno.h>
+#include <pthread.h>
+
+#include <android-base/logging.h>
+#include <netdutils/ThreadUtil.h>
+
+namespace android {
+namespace net {
+
+ThreadPool::ThreadPool(size_t maxThreads, std::chrono::milliseconds idleTimeout)
+    : mMaxThreads(maxThreads), mIdleTimeout(idleTimeout) {}
+
+ThreadPool::~ThreadPool() {
+    std::unique_lock lock(mLock);
+    mStopping = true;
+    mTaskCv.notify_all();
+    mExitCv.wait(lock, [this]() REQUIRES(mLock) { return mThreads == 0; });
+}
+
+int ThreadPool::enqueue(Task task) {
+    std::lock_guard guard(mLock);
+    mTasks.push_back(std::move(task));
+    if (mIdleThreads >= mTasks.size() || mThreads >= mMaxThreads) {
+        mTaskCv.notify_one();
+        return 0;
+    }
+
+    netdutils::scoped_pthread_attr scoped_attr;
+    int rval = scoped_attr.detach();
+    if (rval == 0) {
+        pthread_t thread;
+        rval = -pthread_create(&thread, &scoped_attr.attr, &ThreadPool::workerMain, this);
+    }
+    if (rval == 0) {
+        mThreads++;
+        return 0;
+    }
+
+    LOG(WARNING) << __func__ << ": pthread_create failed: " << -rval;
+    if (mThreads > 0) {
+        // An existing worker will get to the task eventually.
+        mTaskCv.notify_one();
+        return 0;
+    }
+    mTasks.pop_back();
+    return rval;
+}
+
+size_t ThreadPool::threadCount() {
+    std::lock_guard guard(mLock);
+    return mThreads;
+}
+
+void* ThreadPool::workerMain(void* arg) {
+    static_cast<ThreadPool*>(arg)->runWorker();
+    return nullptr;
+}
+
+void ThreadPool::runWorker() {
+    std::unique_lock lock(mLock);
+    while (true) {
+        if (mTasks.empty()) {
+            if (mStopping) break;
+            mIdleThreads++;
+            const bool woken = mTaskCv.wait_for(lock, mIdleTimeout, [this]() REQUIRES(mLock) {
+                return mStopping || !mTasks.empty();
+            });
+            mIdleThreads--;
+            if (!woken) break;
+            continue;
+        }
+        Task task = std::move(mTasks.front());
+        mTasks.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+    if (--mThreads == 0) mExitCv.notify_all();
+}
+
+}  // end of namespace net
+}  // end of namespace android
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DNS_THREAD_POOL_H
+#define _DNS_THREAD_POOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+#include <android-base/thread_annotations.h>
+
+namespace android {
+namespace net {
+
+// A pool of detached worker threads that run tasks in FIFO order.
+//
+// Most tasks block on the network for much of their lifetime, so a task is never left queued
+// behind a busy worker while the pool has room to grow: a new worker is started whenever none is
+// idle and the pool is below maxThreads. Workers that stay idle for idleTimeout exit, so the pool
+// shrinks back once a burst of lookups is over.
+class ThreadPool {
+  public:
+    using Task = std::function<void()>;
+
+    ThreadPool(size_t maxThreads, std::chrono::milliseconds idleTimeout);
+    // Waits for all queued tasks to complete and all workers to exit.
+    ~ThreadPool();
+
+    // Queues a task. Returns 0 on success, or a negative errno if no worker could be started to
+    // run it.
+    int enqueue(Task task);
+
+    size_t threadCount();
+
+  private:
+    static void* workerMain(void* arg);
+    void runWorker();
+
+    const size_t mMaxThreads;
+    const std::chrono::milliseconds mIdleTimeout;
+
+    std::mutex mLock;
+    std::condition_variable mTaskCv;
+    std::condition_variable mExitCv;
+    std::deque<Task> mTasks GUARDED_BY(mLock);
+    size_t mThreads GUARDED_BY(mLock) = 0;
+    size_t mIdleThreads GUARDED_BY(mLock) = 0;
+    bool mStopping GUARDED_BY(mLock) = false;
+};
+
+}  // end of namespace net
+}  // end of namespace android
+
+#endif  // _DNS_THREAD_POOL_H
@@ -578,6 +578,10 @@ void DNSResponder::setEdns(Edns edns) {
     edns_ = edns;
 }
 
+void DNSResponder::setDroppedType(ns_type type) {
+    dropped_type_ = type;
+}
+
 bool DNSResponder::running() const {
     return socket_.get() != -1;
 }
@@ -769,6 +773,13 @@ bool DNSResponder::handleDNSRequest(const char* buffer, ssize_t len,
         }
     }
 
+    for (const DNSQuestion& question : header.questions) {
+        if (ns_type(question.qtype) == dropped_type_) {
+            ALOGI("dropping request for type %s", dnstype2str(question.qtype));
+            return false;
+        }
+    }
+
     // Ignore requests with the preset probability.
     auto constexpr bound = std::numeric_limits<unsigned>::max();
     if (arc4random_uniform(bound) > bound * response_probability_) {
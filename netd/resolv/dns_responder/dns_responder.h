@@ -65,6 +65,8 @@ class DNSResponder {
     void removeMapping(const std::string& name, ns_type type);
     void setResponseProbability(double response_probability);
     void setEdns(Edns edns);
+    // Ignore the requests for |type|, as if their answers were lost, or none if ns_t_invalid.
+    void setDroppedType(ns_type type);
     bool running() const;
     bool startServer();
     bool stopServer();
@@ -155,6 +157,9 @@ class DNSResponder {
     // ignoring the requests.
     std::atomic<Edns> edns_ = Edns::ON;
 
+    // Type of the requests to ignore whatever response_probability_ is, or ns_t_invalid.
+    std::atomic<ns_type> dropped_type_ = ns_type::ns_t_invalid;
+
     // Mappings from (name, type) to registered response and the
     // mutex protecting them.
     std::unordered_map<QueryKey, std::string, QueryKeyHash> mappings_
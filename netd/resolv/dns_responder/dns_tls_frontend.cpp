@@ -315,6 +315,12 @@ void DnsTlsFrontend::requestHandler() {
                 // client, including cleanup actions.
                 ++queries_;
             }
+            while (success && pipelining_ && waitForNextRequest(ssl.get(), client.get())) {
+                success = handleOneRequest(ssl.get());
+                if (success) {
+                    ++queries_;
+                }
+            }
         }
     }
     ALOGD("Ending loop");
@@ -363,6 +369,24 @@ bool DnsTlsFrontend::handleOneRequest(SSL* ssl) {
     return true;
 }
 
+bool DnsTlsFrontend::waitForNextRequest(SSL* ssl, int fd) {
+    // Queries pipelined in the same TLS record as the previous one are already decrypted.
+    if (SSL_pending(ssl) > 0) {
+        return true;
+    }
+    enum { EVENT_FD = 0, CLIENT_FD = 1 };
+    pollfd fds[2] = {{.fd = event_fd_.get(), .events = POLLIN}, {.fd = fd, .events = POLLIN}};
+    if (poll(fds, std::size(fds), -1) <= 0) {
+        return false;
+    }
+    // Leave the termination signal for requestHandler() to handle.
+    if (fds[EVENT_FD].revents & (POLLIN | POLLERR)) {
+        return false;
+    }
+    // If the client closed the connection, handleOneRequest() fails to read the header.
+    return fds[CLIENT_FD].revents != 0;
+}
+
 bool DnsTlsFrontend::stopServer() {
     std::lock_guard lock(update_mutex_);
     if (!running()) {
@@ -63,12 +63,18 @@ class DnsTlsFrontend {
     void clearQueries() { queries_ = 0; }
     bool waitForQueries(int number, int timeoutMs) const;
     void set_chain_length(int length) { chain_length_ = length; }
+    // If set, each connection is kept open and every query sent on it is answered, instead of
+    // closing it after the first query.  Connections are still served one at a time.
+    void set_pipelining(bool pipelining) { pipelining_ = pipelining; }
     // Represents a fingerprint from the middle of the certificate chain.
     const std::vector<uint8_t>& fingerprint() const { return fingerprint_; }
 
   private:
     void requestHandler();
     bool handleOneRequest(SSL* ssl);
+    // Waits for the next query on a connection.  Returns false if the client closed the
+    // connection or the server is being stopped.
+    bool waitForNextRequest(SSL* ssl, int fd);
 
     // Trigger the handler thread to terminate.
     bool sendToEventFd();
@@ -91,6 +97,7 @@ class DnsTlsFrontend {
     std::thread handler_thread_ GUARDED_BY(update_mutex_);
     std::mutex update_mutex_;
     int chain_length_ = 1;
+    bool pipelining_ = false;
     std::vector<uint8_t> fingerprint_;
 };
 
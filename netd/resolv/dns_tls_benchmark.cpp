@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures DNS-over-TLS queries sent through DnsTlsDispatcher to a local DnsTlsFrontend, which
+ * forwards them to a local DNSResponder. Must be run as root, since DnsTlsSocket marks its
+ * sockets.
+ *
+ * By default the frontend answers a single query per connection, so every query is sent on a
+ * new TLS connection, and the benchmarks measure the cost of connection setup.  The pipelined
+ * benchmark keeps one connection open instead.
+ *
+ * Useful measurements
+ * ===================
+ *
+ *  - query_resumed: the average time taken by a query whose connection resumes the TLS session
+ *                   of the previous connection.
+ *  - query_full_handshake: the same, with a new dispatcher for every query, so that there is no
+ *                          session to resume and every connection does a full handshake.
+ *                          The difference from query_resumed is the saving from resumption.
+ *  - query_pipelined/threads:N: the average time taken by a query when N threads send queries
+ *                               concurrently over a single connection.  Queries that are queued
+ *                               together are sent in the same TLS record, so this shows how
+ *                               throughput scales with the number of queries in flight.
+ */
+
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+
+#include <memory>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <netdutils/Slice.h>
+
+#include "DnsTlsDispatcher.h"
+#include "DnsTlsServer.h"
+#include "dns_responder/dns_responder.h"
+#include "dns_responder/dns_tls_frontend.h"
+
+using android::net::DnsTlsDispatcher;
+using android::net::DnsTlsServer;
+using android::net::DnsTlsTransport;
+using android::netdutils::makeSlice;
+
+constexpr char kListenAddr[] = "127.0.0.3";
+constexpr char kBackendService[] = "5353";
+constexpr char kTlsService[] = "8531";
+constexpr in_port_t kTlsPort = 8531;
+constexpr unsigned kMark = 0;
+
+class DnsTlsFixture : public ::benchmark::Fixture {
+  protected:
+    std::unique_ptr<test::DNSResponder> dns;
+    std::unique_ptr<test::DnsTlsFrontend> tls;
+    DnsTlsServer server;
+    std::vector<uint8_t> query;
+    // Whether the frontend keeps connections open to answer more than one query.
+    bool pipelining = false;
+
+  public:
+    void SetUp(const ::benchmark::State& state) override {
+        if (state.thread_index != 0) return;
+
+        dns = std::make_unique<test::DNSResponder>(kListenAddr, kBackendService);
+        dns->addMapping("host.example.com.", ns_type::ns_t_a, "192.0.2.1");
+        dns->startServer();
+        tls = std::make_unique<test::DnsTlsFrontend>(kListenAddr, kTlsService, kListenAddr,
+                                                     kBackendService);
+        tls->set_pipelining(pipelining);
+        tls->startServer();
+
+        sockaddr_in* sin = reinterpret_cast<sockaddr_in*>(&server.ss);
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(kTlsPort);
+        inet_pton(AF_INET, kListenAddr, &sin->sin_addr);
+
+        // A query for host.example.com of type A.
+        query = {0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                 4,    'h',  'o',  's',  't',  7,    'e',  'x',  'a',  'm',  'p',  'l',
+                 'e',  3,    'c',  'o',  'm',  0x00, 0x00, ns_t_a, 0x00, ns_c_in};
+    }
+
+    void TearDown(const ::benchmark::State& state) override {
+        if (state.thread_index != 0) return;
+
+        tls.reset();
+        dns.reset();
+    }
+
+    bool sendQuery(DnsTlsDispatcher* dispatcher) {
+        std::vector<uint8_t> ans(4096);
+        int resplen = 0;
+        return dispatcher->query(server, kMark, makeSlice(query), makeSlice(ans), &resplen) ==
+               DnsTlsTransport::Response::success;
+    }
+};
+
+BENCHMARK_DEFINE_F(DnsTlsFixture, query_resumed)(benchmark::State& state) {
+    DnsTlsDispatcher dispatcher;
+    // Get a session to resume.
+    if (!sendQuery(&dispatcher)) {
+        state.SkipWithError("query failed");
+        return;
+    }
+    while (state.KeepRunning()) {
+        if (!sendQuery(&dispatcher)) {
+            state.SkipWithError("query failed");
+            break;
+        }
+    }
+}
+BENCHMARK_REGISTER_F(DnsTlsFixture, query_resumed)->UseRealTime();
+
+BENCHMARK_DEFINE_F(DnsTlsFixture, query_full_handshake)(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        DnsTlsDispatcher dispatcher;
+        if (!sendQuery(&dispatcher)) {
+            state.SkipWithError("query failed");
+            break;
+        }
+    }
+}
+BENCHMARK_REGISTER_F(DnsTlsFixture, query_full_handshake)->UseRealTime();
+
+class DnsTlsPipelinedFixture : public DnsTlsFixture {
+  protected:
+    // Shared by all the threads, so that their queries go out on the same connection.
+    std::unique_ptr<DnsTlsDispatcher> dispatcher;
+
+  public:
+    DnsTlsPipelinedFixture() { pipelining = true; }
+
+    void SetUp(const ::benchmark::State& state) override {
+        DnsTlsFixture::SetUp(state);
+        if (state.thread_index != 0) return;
+
+        dispatcher = std::make_unique<DnsTlsDispatcher>();
+    }
+
+    void TearDown(const ::benchmark::State& state) override {
+        if (state.thread_index == 0) {
+            dispatcher.reset();
+        }
+        DnsTlsFixture::TearDown(state);
+    }
+};
+
+BENCHMARK_DEFINE_F(DnsTlsPipelinedFixture, query_pipelined)(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        if (!sendQuery(dispatcher.get())) {
+            state.SkipWithError("query failed");
+            break;
+        }
+    }
+}
+BENCHMARK_REGISTER_F(DnsTlsPipelinedFixture, query_pipelined)->ThreadRange(1, 32)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -34,6 +34,7 @@
 #include <chrono>
 #include <arpa/inet.h>
 #include <android-base/macros.h>
+#include <android-base/properties.h>
 #include <netdutils/Slice.h>
 
 #include "log/log.h"
@@ -650,12 +651,14 @@ class TrackingFakeSocketFactory : public IDnsTlsSocketFactory {
             const DnsTlsServer& server,
             unsigned mark,
             IDnsTlsSocketObserver* observer,
-            DnsTlsSessionCache* cache ATTRIBUTE_UNUSED) override {
+            DnsTlsSessionCache* cache) override {
         std::lock_guard guard(mLock);
         keys.emplace(mark, server);
+        caches.insert(cache);
         return std::make_unique<T>(observer);
     }
     std::multiset<std::pair<unsigned, DnsTlsServer>> keys;
+    std::set<DnsTlsSessionCache*> caches;
 
   private:
     std::mutex mLock;
@@ -704,6 +707,53 @@ TEST_F(DispatcherTest, Dispatching) {
     }
 }
 
+TEST_F(DispatcherTest, SessionCachePerNetwork) {
+    auto factory = std::make_unique<TrackingFakeSocketFactory<FakeSocketEcho>>();
+    auto* weak_factory = factory.get();  // Valid as long as dispatcher is in scope.
+    DnsTlsDispatcher dispatcher(std::move(factory));
+
+    // Query the same server on two networks.
+    for (unsigned mark : {MARK, MARK + 1}) {
+        bytevec ans(4096);
+        int resplen = 0;
+        auto r = dispatcher.query(SERVER1, mark, makeSlice(QUERY), makeSlice(ans), &resplen);
+        EXPECT_EQ(DnsTlsTransport::Response::success, r);
+    }
+
+    // Unless dot_resume_across_networks is set, TLS sessions are not shared across networks.
+    EXPECT_EQ(2U, weak_factory->keys.size());
+    EXPECT_EQ(2U, weak_factory->caches.size());
+}
+
+TEST_F(DispatcherTest, SessionCacheSharedAcrossNetworks) {
+    const std::string flag = "persist.device_config.netd_native.dot_resume_across_networks";
+    const std::string storedValue = android::base::GetProperty(flag, "");
+    android::base::SetProperty(flag, "1");
+
+    auto factory = std::make_unique<TrackingFakeSocketFactory<FakeSocketEcho>>();
+    auto* weak_factory = factory.get();  // Valid as long as dispatcher is in scope.
+    DnsTlsDispatcher dispatcher(std::move(factory));
+
+    // Query the same server on two networks, and another server on the first network.
+    std::vector<std::pair<unsigned, DnsTlsServer>> keys;
+    keys.emplace_back(MARK, SERVER1);
+    keys.emplace_back(MARK + 1, SERVER1);
+    keys.emplace_back(MARK, V4ADDR2);
+    for (const auto& [mark, server] : keys) {
+        bytevec ans(4096);
+        int resplen = 0;
+        auto r = dispatcher.query(server, mark, makeSlice(QUERY), makeSlice(ans), &resplen);
+        EXPECT_EQ(DnsTlsTransport::Response::success, r);
+    }
+
+    // Each network still gets its own socket, but the two sockets to SERVER1 share one
+    // session cache, separate from the cache of V4ADDR2.
+    EXPECT_EQ(3U, weak_factory->keys.size());
+    EXPECT_EQ(2U, weak_factory->caches.size());
+
+    android::base::SetProperty(flag, storedValue);
+}
+
 // Check DnsTlsServer's comparison logic.
 AddressComparator ADDRESS_COMPARATOR;
 bool isAddressEqual(const DnsTlsServer& s1, const DnsTlsServer& s2) {
@@ -928,6 +978,30 @@ class StubObserver : public IDnsTlsSocketObserver {
     void onClosed() override { closed = true; }
 };
 
+TEST(DnsTlsSocketTest, CoalesceQueries) {
+    // Queue several queries, in the [length][value] format that query() puts in the queue.
+    std::deque<bytevec> q;
+    bytevec expected;
+    for (size_t i = 0; i < 10; ++i) {
+        bytevec query = make_query(i, SIZE);
+        q.push_back({uint8_t(query.size() >> 8), uint8_t(query.size())});
+        q.back().insert(q.back().end(), query.begin(), query.end());
+        expected.insert(expected.end(), q.back().begin(), q.back().end());
+    }
+
+    // They all fit in one TLS record, so they all go out in one write, in order.
+    EXPECT_EQ(expected, DnsTlsSocket::coalesceQueries(&q));
+    EXPECT_TRUE(q.empty());
+
+    // Queries that don't fit in the same record are left for the next write.
+    constexpr size_t maxRecord = SSL3_RT_MAX_PLAIN_LENGTH;
+    q.assign(3, bytevec(maxRecord / 2));
+    EXPECT_EQ(maxRecord, DnsTlsSocket::coalesceQueries(&q).size());
+    EXPECT_EQ(1U, q.size());
+    EXPECT_EQ(maxRecord / 2, DnsTlsSocket::coalesceQueries(&q).size());
+    EXPECT_TRUE(q.empty());
+}
+
 TEST(DnsTlsSocketTest, SlowDestructor) {
     constexpr char tls_addr[] = "127.0.0.3";
     constexpr char tls_port[] = "8530";  // High-numbered port so root isn't required.
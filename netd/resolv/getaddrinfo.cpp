@@ -55,8 +55,18 @@
 #include <sys/un.h>
 #include <unistd.h>
 
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <server_configurable_flags/get_flags.h>
 
+#include "ThreadPool.h"
 #include "netd_resolv/resolv.h"
 #include "resolv_cache.h"
 #include "resolv_private.h"
@@ -1567,6 +1577,108 @@ static bool files_getaddrinfo(const char* name, const addrinfo* pai, addrinfo**
 
 /* resolver logic */
 
+// Whether the queries for the different types of a lookup (e.g. A and AAAA) are sent in parallel.
+static bool parallel_lookup_enabled() {
+    int enabled = 1;
+    android::base::ParseInt(server_configurable_flags::GetServerConfigurableFlag(
+                                    "netd_native", "parallel_lookup", ""),
+                            &enabled);
+    return enabled != 0;
+}
+
+// The queries sent alongside the first one of a lookup spend nearly all their time waiting on the
+// network, so the pool is sized for concurrency, like the DnsProxyListener handler pool.
+constexpr size_t MAX_QUERY_THREADS = 64;
+constexpr std::chrono::seconds QUERY_THREAD_IDLE_TIMEOUT = std::chrono::seconds(30);
+
+static android::net::ThreadPool& queryThreadPool() {
+    static android::net::ThreadPool* pool =
+            new android::net::ThreadPool(MAX_QUERY_THREADS, QUERY_THREAD_IDLE_TIMEOUT);
+    return *pool;
+}
+
+// A query handed to queryThreadPool(). It is run by whichever of the pool and the lookup claims
+// it first. The lookup claims whatever the pool has not started once its own query is answered,
+// and otherwise waits for the pool to finish, so it never returns while the query can still touch
+// its stack. A lookup also never waits on a pool that is busy with other lookups.
+struct QueryTask {
+    std::function<void()> query;
+    std::mutex lock;
+    std::condition_variable cv;
+    bool claimed = false;
+    bool done = false;
+
+    // Runs the query unless it was claimed already. Returns false if it was.
+    bool claimAndRun() {
+        {
+            std::lock_guard guard(lock);
+            if (claimed) return false;
+            claimed = true;
+        }
+        query();
+        std::lock_guard guard(lock);
+        done = true;
+        cv.notify_all();
+        return true;
+    }
+
+    void waitForDone() {
+        std::unique_lock ul(lock);
+        cv.wait(ul, [this] { return done; });
+    }
+};
+
+/*
+ * Send the query for a single target and await the answer.
+ * Return the number of answer records, 0 if there are none (in which case
+ * *rcode is the error, unless it already is RCODE_TIMEOUT), or -1 if the
+ * query could not be built.
+ */
+static int res_queryN_target(const char* name, res_target* t, res_state res, int* rcode) {
+    HEADER* hp = (HEADER*) (void*) t->answer;
+    u_char buf[MAXPACKET];
+    int n;
+
+    bool retried = false;
+again:
+    hp->rcode = NOERROR; /* default */
+
+    /* make it easier... */
+    int cl = t->qclass;
+    int type = t->qtype;
+    u_char* answer = t->answer;
+    int anslen = t->anslen;
+
+    LOG(DEBUG) << __func__ << ": (" << cl << ", " << type << ")";
+
+    n = res_nmkquery(res, QUERY, name, cl, type, NULL, 0, NULL, buf, sizeof(buf));
+    if (n > 0 && (res->options & (RES_USE_EDNS0 | RES_USE_DNSSEC)) != 0 && !retried)
+        n = res_nopt(res, n, buf, sizeof(buf), anslen);
+    if (n <= 0) {
+        LOG(ERROR) << __func__ << ": res_nmkquery failed";
+        return -1;
+    }
+
+    n = res_nsend(res, buf, n, answer, anslen, rcode, 0);
+    if (n < 0 || hp->rcode != NOERROR || ntohs(hp->ancount) == 0) {
+        // Record rcode from DNS response header only if no timeout.
+        // Keep rcode timeout for reporting later if any.
+        if (*rcode != RCODE_TIMEOUT) *rcode = hp->rcode; /* record most recent error */
+        /* if the query choked with EDNS0, retry without EDNS0 */
+        if ((res->options & (RES_USE_EDNS0 | RES_USE_DNSSEC)) != 0 &&
+            (res->_flags & RES_F_EDNS0ERR) && !retried) {
+            LOG(DEBUG) << __func__ << ": retry without EDNS0";
+            retried = true;
+            goto again;
+        }
+        LOG(DEBUG) << __func__ << ": rcode=" << hp->rcode << ", ancount=" << ntohs(hp->ancount);
+        return 0;
+    }
+
+    t->n = n;
+    return ntohs(hp->ancount);
+}
+
 /*
  * Formulate a normal query, send, and await answer.
  * Returned answer is placed in supplied buffer "answer".
@@ -1575,68 +1687,74 @@ static bool files_getaddrinfo(const char* name, const addrinfo* pai, addrinfo**
  * Return the size of the response on success, -1 on error.
  * Error number is left in *herrno.
  *
+ * If there are several targets, their queries are sent at the same time,
+ * the others from queryThreadPool() each with its own resolver state and
+ * sockets, so that a lost packet only delays the query it belongs to.
+ *
  * Caller must parse answer and determine whether it answers the question.
  */
 static int res_queryN(const char* name, res_target* target, res_state res, int* herrno) {
-    u_char buf[MAXPACKET];
-    HEADER* hp;
-    int n;
-    struct res_target* t;
-    int rcode;
-    int ancount;
-
     assert(name != NULL);
     /* XXX: target may be NULL??? */
 
-    rcode = NOERROR;
-    ancount = 0;
-
-    for (t = target; t; t = t->next) {
-        u_char* answer;
-        int anslen;
-
-        hp = (HEADER*) (void*) t->answer;
-        bool retried = false;
-    again:
-        hp->rcode = NOERROR; /* default */
-
-        /* make it easier... */
-        int cl = t->qclass;
-        int type = t->qtype;
-        answer = t->answer;
-        anslen = t->anslen;
-
-        LOG(DEBUG) << __func__ << ": (" << cl << ", " << type << ")";
-
-        n = res_nmkquery(res, QUERY, name, cl, type, NULL, 0, NULL, buf, sizeof(buf));
-        if (n > 0 && (res->options & (RES_USE_EDNS0 | RES_USE_DNSSEC)) != 0 && !retried)
-            n = res_nopt(res, n, buf, sizeof(buf), anslen);
-        if (n <= 0) {
-            LOG(ERROR) << __func__ << ": res_nmkquery failed";
-            *herrno = NO_RECOVERY;
-            return n;
+    std::vector<res_target*> targets;
+    for (res_target* t = target; t; t = t->next) {
+        targets.push_back(t);
+    }
+    std::vector<int> results(targets.size(), 0);
+    std::vector<int> rcodes(targets.size(), NOERROR);
+
+    if (targets.size() > 1 && parallel_lookup_enabled()) {
+        std::vector<NetworkDnsEventReported> events(targets.size());
+        std::vector<std::shared_ptr<QueryTask>> tasks;
+        for (size_t i = 1; i < targets.size(); i++) {
+            auto task = std::make_shared<QueryTask>();
+            task->query = [&, i] {
+                res_state query_res = res_get_state();
+                if (query_res == NULL) {
+                    rcodes[i] = RCODE_INTERNAL_ERROR;
+                    return;
+                }
+                // A pool thread's state is reused from lookup to lookup, so set all of what
+                // this one needs. Run by the lookup itself, this is |res| and already is.
+                if (query_res != res) {
+                    query_res->netid = res->netid;
+                    query_res->_mark = res->_mark;
+                    query_res->options = (query_res->options & ~(RES_USE_EDNS0 | RES_USE_DNSSEC)) |
+                                         (res->options & (RES_USE_EDNS0 | RES_USE_DNSSEC));
+                    query_res->use_local_nameserver = res->use_local_nameserver;
+                    query_res->event = &events[i];
+                }
+                results[i] = res_queryN_target(name, targets[i], query_res, &rcodes[i]);
+            };
+            // If the pool can't take it, it's run below once the first query is answered.
+            queryThreadPool().enqueue([task] { task->claimAndRun(); });
+            tasks.push_back(std::move(task));
         }
-
-        n = res_nsend(res, buf, n, answer, anslen, &rcode, 0);
-        if (n < 0 || hp->rcode != NOERROR || ntohs(hp->ancount) == 0) {
-            // Record rcode from DNS response header only if no timeout.
-            // Keep rcode timeout for reporting later if any.
-            if (rcode != RCODE_TIMEOUT) rcode = hp->rcode; /* record most recent error */
-            /* if the query choked with EDNS0, retry without EDNS0 */
-            if ((res->options & (RES_USE_EDNS0 | RES_USE_DNSSEC)) != 0 &&
-                (res->_flags & RES_F_EDNS0ERR) && !retried) {
-                LOG(DEBUG) << __func__ << ": retry without EDNS0";
-                retried = true;
-                goto again;
-            }
-            LOG(DEBUG) << __func__ << ": rcode=" << hp->rcode << ", ancount=" << ntohs(hp->ancount);
-            continue;
+        results[0] = res_queryN_target(name, targets[0], res, &rcodes[0]);
+        for (const auto& task : tasks) {
+            if (!task->claimAndRun()) task->waitForDone();
         }
+        for (size_t i = 1; i < targets.size(); i++) {
+            res->event->mutable_dns_query_events()->MergeFrom(events[i].dns_query_events());
+        }
+    } else {
+        for (size_t i = 0; i < targets.size(); i++) {
+            results[i] = res_queryN_target(name, targets[i], res, &rcodes[i]);
+            if (results[i] < 0) break;
+        }
+    }
 
-        ancount += ntohs(hp->ancount);
-
-        t->n = n;
+    int ancount = 0;
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (results[i] < 0) {
+            *herrno = NO_RECOVERY;
+            return -1;
+        }
+        ancount += results[i];
     }
+    // As when the queries are sent one after the other, the error of the last one is reported.
+    const int rcode = targets.empty() ? NOERROR : rcodes.back();
 
     if (ancount == 0) {
         switch (rcode) {
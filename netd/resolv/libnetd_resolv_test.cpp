@@ -16,12 +16,18 @@
 
 #define LOG_TAG "libnetd_resolv_test"
 
+#include <chrono>
+#include <thread>
+
 #include <gtest/gtest.h>
 
 #include <android-base/stringprintf.h>
 #include <arpa/inet.h>
+#include <cutils/properties.h>
 #include <netdb.h>
+#include <openssl/sha.h>
 
+#include "PrivateDnsConfiguration.h"
 #include "dns_responder.h"
 #include "getaddrinfo.h"
 #include "gethnamaddr.h"
@@ -42,6 +48,21 @@ namespace net {
 
 using android::net::NetworkDnsEventReported;
 
+// Sets a netd_native server configurable flag, and restores it when going out of scope.
+class ScopedServerFlag {
+  public:
+    ScopedServerFlag(const std::string& flag, const std::string& value)
+        : mProperty("persist.device_config.netd_native." + flag) {
+        property_get(mProperty.c_str(), mStoredValue, "");
+        property_set(mProperty.c_str(), value.c_str());
+    }
+    ~ScopedServerFlag() { property_set(mProperty.c_str(), mStoredValue); }
+
+  private:
+    const std::string mProperty;
+    char mStoredValue[PROPERTY_VALUE_MAX]{};
+};
+
 // Minimize class ResolverTest to be class TestBase because class TestBase doesn't need all member
 // functions of class ResolverTest and class DnsResponderClient.
 class TestBase : public ::testing::Test {
@@ -87,6 +108,18 @@ class TestBase : public ::testing::Test {
         return found;
     }
 
+    size_t GetNumQueriesForType(const test::DNSResponder& dns, ns_type type,
+                                const char* name) const {
+        auto queries = dns.queries();
+        size_t found = 0;
+        for (const auto& p : queries) {
+            if (p.second == type && p.first == name) {
+                ++found;
+            }
+        }
+        return found;
+    }
+
     const char* mDefaultSearchDomains = "example.com";
     const res_params mDefaultParams_Binder = {
             .sample_validity = 300,
@@ -473,6 +506,169 @@ TEST_F(GetAddrInfoForNetContextTest, ServerTimeout) {
     if (result) freeaddrinfo(result);
 }
 
+// Lookups share the resolver state of the thread they run on, so a lookup that bypasses private
+// DNS must not make the next one on the same thread bypass it too.
+TEST_F(GetAddrInfoForNetContextTest, LocalNameserverLookupThenStrictModeLookup) {
+    constexpr char listen_addr[] = "127.0.0.3";
+    constexpr char listen_srv[] = "53";
+    constexpr char local_host_name[] = "local.example.com.";
+    constexpr char host_name[] = "hello.example.com.";
+    test::DNSResponder dns(listen_addr, listen_srv, 250, ns_rcode::ns_r_servfail);
+    dns.addMapping(local_host_name, ns_type::ns_t_a, "1.2.3.4");
+    dns.addMapping(host_name, ns_type::ns_t_a, "1.2.3.5");
+    ASSERT_TRUE(dns.startServer());
+    const char* servers[] = {listen_addr};
+    ASSERT_EQ(0, resolv_set_nameservers_for_net(TEST_NETID, servers,
+                                                sizeof(servers) / sizeof(servers[0]),
+                                                mDefaultSearchDomains, &mDefaultParams_Binder));
+    // Strict mode, with a TLS server that never validates since nothing listens on it.
+    const std::set<std::vector<uint8_t>> fingerprints = {
+            std::vector<uint8_t>(SHA256_DIGEST_LENGTH, 0)};
+    ASSERT_EQ(0, gPrivateDnsConfiguration.set(TEST_NETID, MARK_UNSET, {listen_addr}, "",
+                                              fingerprints));
+
+    android_net_context local_netcontext = mNetcontext;
+    local_netcontext.flags = NET_CONTEXT_FLAG_USE_LOCAL_NAMESERVERS | NET_CONTEXT_FLAG_USE_EDNS;
+    struct addrinfo* result = nullptr;
+    const struct addrinfo hints = {.ai_family = AF_INET};
+    NetworkDnsEventReported event;
+    int rv = android_getaddrinfofornetcontext(local_host_name, nullptr, &hints, &local_netcontext,
+                                              &result, &event);
+    EXPECT_EQ(0, rv);
+    EXPECT_EQ("1.2.3.4", ToString(result));
+    EXPECT_EQ(1U, GetNumQueries(dns, local_host_name));
+    if (result) freeaddrinfo(result);
+
+    result = nullptr;
+    NetworkDnsEventReported event2;
+    rv = android_getaddrinfofornetcontext(host_name, nullptr, &hints, &mNetcontext, &result,
+                                          &event2);
+    EXPECT_NE(0, rv);
+    EXPECT_TRUE(result == nullptr);
+    EXPECT_EQ(0U, GetNumQueries(dns, host_name));
+    if (result) freeaddrinfo(result);
+
+    gPrivateDnsConfiguration.clear(TEST_NETID);
+}
+
+TEST_F(GetAddrInfoForNetContextTest, ParallelLookup_ADropped) {
+    constexpr char listen_addr[] = "127.0.0.3";
+    constexpr char listen_srv[] = "53";
+    constexpr char host_name[] = "hello.example.com.";
+    constexpr char v6addr[] = "::1.2.3.4";
+    ScopedServerFlag parallel("parallel_lookup", "1");
+    test::DNSResponder dns(listen_addr, listen_srv, 250, ns_rcode::ns_r_servfail);
+    dns.addMapping(host_name, ns_type::ns_t_a, "1.2.3.4");
+    dns.addMapping(host_name, ns_type::ns_t_aaaa, v6addr);
+    dns.setDroppedType(ns_type::ns_t_a);
+    ASSERT_TRUE(dns.startServer());
+    const char* servers[] = {listen_addr};
+    ASSERT_EQ(0, resolv_set_nameservers_for_net(TEST_NETID, servers,
+                                                sizeof(servers) / sizeof(servers[0]),
+                                                mDefaultSearchDomains, &mDefaultParams_Binder));
+
+    struct addrinfo* result = nullptr;
+    int rv = -1;
+    const auto start = std::chrono::steady_clock::now();
+    std::thread lookup([&] {
+        const struct addrinfo hints = {.ai_family = AF_UNSPEC};
+        NetworkDnsEventReported event;
+        rv = android_getaddrinfofornetcontext(host_name, nullptr, &hints, &mNetcontext, &result,
+                                              &event);
+    });
+    // The AAAA query doesn't wait for the A query to time out.
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    EXPECT_EQ(1U, GetNumQueriesForType(dns, ns_type::ns_t_aaaa, host_name));
+    lookup.join();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    // The AAAA answer is returned once the A query has used up its timeout, and no later.
+    EXPECT_EQ(0, rv);
+    EXPECT_EQ(v6addr, ToString(result));
+    const int timeout_ms =
+            mDefaultParams_Binder.base_timeout_msec * mDefaultParams_Binder.retry_count;
+    EXPECT_GE(elapsed, std::chrono::milliseconds(timeout_ms));
+    EXPECT_LT(elapsed, std::chrono::milliseconds(timeout_ms + 500));
+
+    if (result) freeaddrinfo(result);
+}
+
+TEST_F(GetAddrInfoForNetContextTest, ParallelLookupDisabled) {
+    constexpr char listen_addr[] = "127.0.0.3";
+    constexpr char listen_srv[] = "53";
+    constexpr char host_name[] = "hello.example.com.";
+    constexpr char v6addr[] = "::1.2.3.4";
+    ScopedServerFlag parallel("parallel_lookup", "0");
+    test::DNSResponder dns(listen_addr, listen_srv, 250, ns_rcode::ns_r_servfail);
+    dns.addMapping(host_name, ns_type::ns_t_a, "1.2.3.4");
+    dns.addMapping(host_name, ns_type::ns_t_aaaa, v6addr);
+    dns.setDroppedType(ns_type::ns_t_a);
+    ASSERT_TRUE(dns.startServer());
+    const char* servers[] = {listen_addr};
+    ASSERT_EQ(0, resolv_set_nameservers_for_net(TEST_NETID, servers,
+                                                sizeof(servers) / sizeof(servers[0]),
+                                                mDefaultSearchDomains, &mDefaultParams_Binder));
+
+    struct addrinfo* result = nullptr;
+    int rv = -1;
+    std::thread lookup([&] {
+        const struct addrinfo hints = {.ai_family = AF_UNSPEC};
+        NetworkDnsEventReported event;
+        rv = android_getaddrinfofornetcontext(host_name, nullptr, &hints, &mNetcontext, &result,
+                                              &event);
+    });
+    // The AAAA query is only sent once the A query has timed out.
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    EXPECT_EQ(1U, GetNumQueriesForType(dns, ns_type::ns_t_a, host_name));
+    EXPECT_EQ(0U, GetNumQueriesForType(dns, ns_type::ns_t_aaaa, host_name));
+    lookup.join();
+
+    EXPECT_EQ(0, rv);
+    EXPECT_EQ(v6addr, ToString(result));
+    EXPECT_EQ(1U, GetNumQueriesForType(dns, ns_type::ns_t_aaaa, host_name));
+
+    if (result) freeaddrinfo(result);
+}
+
+TEST_F(GetAddrInfoForNetContextTest, UdpRace_DeadFirstServer) {
+    constexpr char listen_addr1[] = "127.0.0.3";
+    constexpr char listen_addr2[] = "127.0.0.4";
+    constexpr char listen_srv[] = "53";
+    constexpr char host_name[] = "hello.example.com.";
+    constexpr char v4addr[] = "1.2.3.4";
+    constexpr int stagger_ms = 100;
+    ScopedServerFlag race("udp_race_stagger_ms", std::to_string(stagger_ms));
+    test::DNSResponder dns1(listen_addr1, listen_srv, 250, static_cast<ns_rcode>(-1));
+    dns1.addMapping(host_name, ns_type::ns_t_a, v4addr);
+    dns1.setResponseProbability(0.0);  // never answers
+    test::DNSResponder dns2(listen_addr2, listen_srv, 250, ns_rcode::ns_r_servfail);
+    dns2.addMapping(host_name, ns_type::ns_t_a, v4addr);
+    ASSERT_TRUE(dns1.startServer());
+    ASSERT_TRUE(dns2.startServer());
+    const char* servers[] = {listen_addr1, listen_addr2};
+    ASSERT_EQ(0, resolv_set_nameservers_for_net(TEST_NETID, servers,
+                                                sizeof(servers) / sizeof(servers[0]),
+                                                mDefaultSearchDomains, &mDefaultParams_Binder));
+
+    struct addrinfo* result = nullptr;
+    const struct addrinfo hints = {.ai_family = AF_INET};
+    NetworkDnsEventReported event;
+    const auto start = std::chrono::steady_clock::now();
+    int rv = android_getaddrinfofornetcontext(host_name, nullptr, &hints, &mNetcontext, &result,
+                                              &event);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    // The second server is queried after the stagger, well before the first one times out.
+    EXPECT_EQ(0, rv);
+    EXPECT_EQ(v4addr, ToString(result));
+    EXPECT_EQ(1U, GetNumQueries(dns1, host_name));
+    EXPECT_EQ(1U, GetNumQueries(dns2, host_name));
+    EXPECT_GE(elapsed, std::chrono::milliseconds(stagger_ms));
+    EXPECT_LT(elapsed, std::chrono::milliseconds(mDefaultParams_Binder.base_timeout_msec));
+
+    if (result) freeaddrinfo(result);
+}
+
 TEST_F(GetHostByNameForNetContextTest, AlphabeticalHostname) {
     constexpr char listen_addr[] = "127.0.0.3";
     constexpr char listen_srv[] = "53";
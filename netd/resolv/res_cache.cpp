@@ -36,7 +36,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
@@ -87,7 +92,8 @@ constexpr bool kDumpData = false;
  *    (and should be solved by the later full DNS cache process).
  *
  *  - the implementation is just a (query-data) => (answer-data) hash table
- *    with a trivial least-recently-used expiration policy.
+ *    with a trivial least-recently-used expiration policy, split into a few
+ *    independently locked shards.
  *
  * Doing this keeps the code simple and avoids to deal with a lot of things
  * that a full DNS cache is expected to do.
@@ -941,9 +947,15 @@ typedef struct Entry {
     const uint8_t* answer;
     int answerlen;
     time_t expires; /* time_t when the entry isn't valid any more */
+    time_t evicts;  /* time_t when the entry is removed, after serving stale */
+    struct Entry* wheel_next;   /* next in expiry wheel slot */
+    struct Entry** wheel_prev;  /* link pointing to this entry in expiry wheel slot */
     int id;         /* for debugging purpose */
 } Entry;
 
+// RFC 2308 recommends not caching negative answers for more than a few hours.
+constexpr u_long MAX_NEGATIVE_TTL = 3 * 60 * 60;
+
 /*
  * Find the TTL for a negative DNS result.  This is defined as the minimum
  * of the SOA records TTL and the MINIMUM-TTL field (RFC-2308).
@@ -1016,7 +1028,7 @@ static u_long answer_getTTL(const void* answer, int answerlen) {
 
         if (ancount == 0) {
             // a response with no answers?  Cache this negative result.
-            result = answer_getNegativeTTL(handle);
+            result = std::min(answer_getNegativeTTL(handle), MAX_NEGATIVE_TTL);
         } else {
             for (n = 0; n < ancount; n++) {
                 if (ns_parserr(&handle, ns_s_an, n, &rr) == 0) {
@@ -1037,6 +1049,36 @@ static u_long answer_getTTL(const void* answer, int answerlen) {
     return result;
 }
 
+// RFC 8767 recommends a TTL of 30 seconds for stale answers, so that clients ask again soon
+// instead of holding on to an answer that is already out of date.
+constexpr uint32_t STALE_ANSWER_TTL = 30;
+
+// Sets the TTL of every record in |answer|, except for the OPT pseudo-record, whose TTL field
+// holds EDNS flags, to STALE_ANSWER_TTL.
+static void answer_setStaleTTL(uint8_t* answer, int answerlen) {
+    ns_msg handle;
+    if (ns_initparse(answer, answerlen, &handle) < 0) {
+        PLOG(INFO) << __func__ << ": ns_initparse failed";
+        return;
+    }
+    for (ns_sect section : {ns_s_an, ns_s_ns, ns_s_ar}) {
+        const int count = ns_msg_count(handle, section);
+        for (int n = 0; n < count; n++) {
+            ns_rr rr;
+            if (ns_parserr(&handle, section, n, &rr) != 0) {
+                PLOG(INFO) << __func__ << ": ns_parserr failed section " << section << " no = " << n;
+                return;
+            }
+            if (ns_rr_type(rr) == ns_t_opt) {
+                continue;
+            }
+            // The TTL is followed by the RDLENGTH, and then the RDATA.
+            const ptrdiff_t offset = ns_rr_rdata(rr) - answer - NS_INT16SZ - NS_INT32SZ;
+            ns_put32(STALE_ANSWER_TTL, answer + offset);
+        }
+    }
+}
+
 static void entry_free(Entry* e) {
     /* everything is allocated in a single memory block */
     if (e) {
@@ -1127,16 +1169,50 @@ static int entry_equals(const Entry* e1, const Entry* e2) {
 /* Maximum time for a thread to wait for an pending request */
 constexpr int PENDING_REQUEST_TIMEOUT = 20;
 
+// The cache of each network is split by query hash into shards, each with its own lock, hash
+// table, MRU list and expiry wheel, so that lookups of different names don't contend.  Eviction
+// of the least recently used entry is per shard.
+constexpr int CACHE_SHARDS = 8;
+
+// Entries are filed in the expiry wheel of their shard by the second at which they are evicted,
+// modulo the number of slots.  Each time the clock moves on, only the slots of the elapsed
+// seconds are visited, rather than every entry of the cache.
+constexpr int EXPIRY_WHEEL_SLOTS = 64;
+
+// A query that one thread is currently sending upstream.  Other threads asking exactly the same
+// question on the same network wait for its answer to be added to the cache instead of sending
+// their own query.
+struct pending_req_info {
+    unsigned int hash;
+    std::vector<uint8_t> query;
+    pid_t owner;      // the thread that is sending the query
+    int waiters = 0;  // threads waiting for the answer
+    bool done = false;
+    std::condition_variable cv;
+    struct pending_req_info* next = nullptr;
+};
+
+struct CacheShard {
+    std::mutex lock;
+    int max_entries = 0;
+    int num_entries = 0;
+    int last_id = 0;
+    std::vector<Entry*> buckets;
+    Entry mru_list = {};
+    Entry* expiry_wheel[EXPIRY_WHEEL_SLOTS] = {};
+    time_t wheel_time = 0;  // the last second swept from the wheel
+    struct pending_req_info* pending_requests = nullptr;
+};
+
+// A network's cache.  It is reference counted so that lookups don't need to hold cache_mutex
+// while they use it; the resolv_cache_info holds one reference until the network is deleted.
 typedef struct resolv_cache {
     int max_entries;
-    int num_entries;
-    Entry mru_list;
-    int last_id;
-    Entry* entries;
-    struct pending_req_info {
-        unsigned int hash;
-        struct pending_req_info* next;
-    } pending_requests;
+    int serve_stale_seconds;  // how long expired answers are kept in case upstream fails
+    std::atomic<int> refs;
+    std::atomic<bool> deleted;
+    std::atomic<int> wait_for_pending_req_timeout_count;
+    CacheShard shards[CACHE_SHARDS];
 } Cache;
 
 struct resolv_cache_info {
@@ -1151,86 +1227,94 @@ struct resolv_cache_info {
     struct res_stats nsstats[MAXNS];
     char defdname[MAXDNSRCHPATH];
     int dnsrch_offset[MAXDNSRCH + 1];  // offsets into defdname
-    int wait_for_pending_req_timeout_count;
     // Map format: ReturnCode:rate_denom
     std::unordered_map<int, uint32_t> dns_event_subsampling_map;
 };
 
-// A helper class for the Clang Thread Safety Analysis to deal with
-// std::unique_lock.
-class SCOPED_CAPABILITY ScopedAssumeLocked {
-  public:
-    ScopedAssumeLocked(std::mutex& mutex) ACQUIRE(mutex) {}
-    ~ScopedAssumeLocked() RELEASE() {}
-};
-
 // lock protecting everything in the resolve_cache_info structs (next ptr, etc)
 static std::mutex cache_mutex;
-static std::condition_variable cv;
 
 /* gets cache associated with a network, or NULL if none exists */
 static resolv_cache* find_named_cache_locked(unsigned netid) REQUIRES(cache_mutex);
-static int resolv_create_cache_for_net_locked(unsigned netid) REQUIRES(cache_mutex);
+// gets a resolv_cache_info associated with a network, or NULL if not found
+static resolv_cache_info* find_cache_info_locked(unsigned netid) REQUIRES(cache_mutex);
+static int resolv_create_cache_for_net_locked(unsigned netid, const ResolvCacheParams& params)
+        REQUIRES(cache_mutex);
 
-static void cache_flush_pending_requests_locked(struct resolv_cache* cache) {
-    resolv_cache::pending_req_info *ri, *tmp;
-    if (!cache) return;
+static void cache_unref(Cache* cache);
 
-    ri = cache->pending_requests.next;
+struct CacheUnref {
+    void operator()(Cache* cache) const { cache_unref(cache); }
+};
+using ScopedCacheRef = std::unique_ptr<Cache, CacheUnref>;
 
-    while (ri) {
-        tmp = ri;
-        ri = ri->next;
-        free(tmp);
+// Returns the cache of |netid| with a reference held, or NULL if there is none.
+static ScopedCacheRef cache_ref(unsigned netid) {
+    std::lock_guard guard(cache_mutex);
+    Cache* cache = find_named_cache_locked(netid);
+    if (cache != NULL) {
+        cache->refs++;
     }
+    return ScopedCacheRef(cache);
+}
 
-    cache->pending_requests.next = NULL;
-    cv.notify_all();
+static CacheShard* cache_shard(Cache* cache, const Entry* key) {
+    return &cache->shards[key->hash % CACHE_SHARDS];
 }
 
-// Return true - if there is a pending request in |cache| matching |key|.
-// Return false - if no pending request is found matching the key. Optionally
-//                link a new one if parameter append_if_not_found is true.
-static bool cache_has_pending_request_locked(resolv_cache* cache, const Entry* key,
-                                             bool append_if_not_found) {
-    if (!cache || !key) return false;
+// Unlinks |ri| from |shard| and wakes up the threads waiting for it.  The last waiter to leave
+// frees it.
+static void cache_finish_pending_request_locked(CacheShard* shard, pending_req_info* ri) {
+    pending_req_info** prev = &shard->pending_requests;
+    while (*prev != ri) {
+        prev = &(*prev)->next;
+    }
+    *prev = ri->next;
 
-    resolv_cache::pending_req_info* ri = cache->pending_requests.next;
-    resolv_cache::pending_req_info* prev = &cache->pending_requests;
-    while (ri) {
-        if (ri->hash == key->hash) {
-            return true;
-        }
-        prev = ri;
-        ri = ri->next;
+    ri->done = true;
+    if (ri->waiters == 0) {
+        delete ri;
+    } else {
+        ri->cv.notify_all();
+    }
+}
+
+static void cache_flush_pending_requests_locked(CacheShard* shard) {
+    while (shard->pending_requests) {
+        cache_finish_pending_request_locked(shard, shard->pending_requests);
     }
+}
 
-    if (append_if_not_found) {
-        ri = (resolv_cache::pending_req_info*)calloc(1, sizeof(resolv_cache::pending_req_info));
-        if (ri) {
-            ri->hash = key->hash;
-            prev->next = ri;
+// Returns the pending request in |shard| for the same question as |key|, or NULL.
+static pending_req_info* cache_find_pending_request_locked(CacheShard* shard, const Entry* key) {
+    for (pending_req_info* ri = shard->pending_requests; ri; ri = ri->next) {
+        if (ri->hash != key->hash || ri->query.size() != static_cast<size_t>(key->querylen)) {
+            continue;
+        }
+        Entry pending_key = {};
+        pending_key.query = ri->query.data();
+        pending_key.querylen = ri->query.size();
+        if (entry_equals(&pending_key, key)) {
+            return ri;
         }
     }
-    return false;
+    return NULL;
+}
+
+static void cache_add_pending_request_locked(CacheShard* shard, const Entry* key) {
+    pending_req_info* ri = new pending_req_info;
+    ri->hash = key->hash;
+    ri->query.assign(key->query, key->query + key->querylen);
+    ri->owner = gettid();
+    ri->next = shard->pending_requests;
+    shard->pending_requests = ri;
 }
 
 // Notify all threads that the cache entry |key| has become available
-static void _cache_notify_waiting_tid_locked(struct resolv_cache* cache, const Entry* key) {
-    if (!cache || !key) return;
-
-    resolv_cache::pending_req_info* ri = cache->pending_requests.next;
-    resolv_cache::pending_req_info* prev = &cache->pending_requests;
-    while (ri) {
-        if (ri->hash == key->hash) {
-            // remove item from list and destroy
-            prev->next = ri->next;
-            free(ri);
-            cv.notify_all();
-            return;
-        }
-        prev = ri;
-        ri = ri->next;
+static void _cache_notify_waiting_tid_locked(CacheShard* shard, const Entry* key) {
+    pending_req_info* ri = cache_find_pending_request_locked(shard, key);
+    if (ri) {
+        cache_finish_pending_request_locked(shard, ri);
     }
 }
 
@@ -1240,60 +1324,83 @@ void _resolv_cache_query_failed(unsigned netid, const void* query, int querylen,
         return;
     }
     Entry key[1];
-    Cache* cache;
 
     if (!entry_init_key(key, query, querylen)) return;
 
-    std::lock_guard guard(cache_mutex);
+    ScopedCacheRef cache = cache_ref(netid);
+    if (!cache) return;
 
-    cache = find_named_cache_locked(netid);
+    CacheShard* shard = cache_shard(cache.get(), key);
+    std::lock_guard guard(shard->lock);
 
-    if (cache) {
-        _cache_notify_waiting_tid_locked(cache, key);
+    // Only the thread that sent the query can say that it failed.  Threads that gave up waiting
+    // for it and sent their own query don't own the pending request.
+    pending_req_info* ri = cache_find_pending_request_locked(shard, key);
+    if (ri && ri->owner == gettid()) {
+        cache_finish_pending_request_locked(shard, ri);
     }
 }
 
-static void cache_flush_locked(Cache* cache) {
-    int nn;
-
-    for (nn = 0; nn < cache->max_entries; nn++) {
-        Entry** pnode = (Entry**) &cache->entries[nn];
-
-        while (*pnode != NULL) {
-            Entry* node = *pnode;
-            *pnode = node->hlink;
+static void cache_flush_shard_locked(CacheShard* shard) {
+    for (Entry*& bucket : shard->buckets) {
+        while (bucket != NULL) {
+            Entry* node = bucket;
+            bucket = node->hlink;
             entry_free(node);
         }
     }
+    std::fill(std::begin(shard->expiry_wheel), std::end(shard->expiry_wheel), nullptr);
 
     // flush pending request
-    cache_flush_pending_requests_locked(cache);
+    cache_flush_pending_requests_locked(shard);
+
+    shard->mru_list.mru_next = shard->mru_list.mru_prev = &shard->mru_list;
+    shard->num_entries = 0;
+    shard->last_id = 0;
+}
 
-    cache->mru_list.mru_next = cache->mru_list.mru_prev = &cache->mru_list;
-    cache->num_entries = 0;
-    cache->last_id = 0;
+static void cache_flush(Cache* cache) {
+    for (CacheShard& shard : cache->shards) {
+        std::lock_guard guard(shard.lock);
+        cache_flush_shard_locked(&shard);
+    }
 
     LOG(INFO) << __func__ << ": *** DNS CACHE FLUSHED ***";
 }
 
-static resolv_cache* resolv_cache_create() {
-    struct resolv_cache* cache;
+static resolv_cache* resolv_cache_create(const ResolvCacheParams& params) {
+    struct resolv_cache* cache = new resolv_cache;
 
-    cache = (struct resolv_cache*) calloc(sizeof(*cache), 1);
-    if (cache) {
-        cache->max_entries = CONFIG_MAX_ENTRIES;
-        cache->entries = (Entry*) calloc(sizeof(*cache->entries), cache->max_entries);
-        if (cache->entries) {
-            cache->mru_list.mru_prev = cache->mru_list.mru_next = &cache->mru_list;
-            LOG(INFO) << __func__ << ": cache created";
-        } else {
-            free(cache);
-            cache = NULL;
-        }
+    // Each shard holds an equal part of the entries, and at least one, so the capacity is
+    // rounded down to a multiple of CACHE_SHARDS, and up to CACHE_SHARDS if it is smaller.
+    const int max_entries = params.max_entries > 0 ? params.max_entries : CONFIG_MAX_ENTRIES;
+    const int shard_entries = std::max(max_entries / CACHE_SHARDS, 1);
+    cache->max_entries = shard_entries * CACHE_SHARDS;
+    cache->serve_stale_seconds = std::max(params.serve_stale_seconds, 0);
+    cache->refs = 1;
+    cache->deleted = false;
+    cache->wait_for_pending_req_timeout_count = 0;
+
+    for (CacheShard& shard : cache->shards) {
+        shard.max_entries = shard_entries;
+        shard.buckets.resize(shard_entries);
+        shard.mru_list.mru_prev = shard.mru_list.mru_next = &shard.mru_list;
+        shard.wheel_time = _time_now();
     }
+    LOG(INFO) << __func__ << ": cache created, max_entries=" << cache->max_entries;
     return cache;
 }
 
+static void cache_unref(Cache* cache) {
+    if (--cache->refs == 0) {
+        for (CacheShard& shard : cache->shards) {
+            std::lock_guard guard(shard.lock);
+            cache_flush_shard_locked(&shard);
+        }
+        delete cache;
+    }
+}
+
 static void dump_query(const uint8_t* query, int querylen) {
     if (!WOULD_LOG(VERBOSE)) return;
 
@@ -1305,12 +1412,12 @@ static void dump_query(const uint8_t* query, int querylen) {
     LOG(VERBOSE) << __func__ << ": " << temp;
 }
 
-static void cache_dump_mru(Cache* cache) {
+static void cache_dump_mru(CacheShard* shard) {
     char temp[512], *p = temp, *end = p + sizeof(temp);
     Entry* e;
 
-    p = bprint(temp, end, "MRU LIST (%2d): ", cache->num_entries);
-    for (e = cache->mru_list.mru_next; e != &cache->mru_list; e = e->mru_next)
+    p = bprint(temp, end, "MRU LIST (%2d): ", shard->num_entries);
+    for (e = shard->mru_list.mru_next; e != &shard->mru_list; e = e->mru_next)
         p = bprint(p, end, " %d", e->id);
 
     LOG(INFO) << __func__ << ": " << temp;
@@ -1330,9 +1437,10 @@ static void cache_dump_mru(Cache* cache) {
  * The result of a lookup_p is only valid until you alter the hash
  * table.
  */
-static Entry** _cache_lookup_p(Cache* cache, Entry* key) {
-    int index = key->hash % cache->max_entries;
-    Entry** pnode = (Entry**) &cache->entries[index];
+static Entry** _cache_lookup_p(CacheShard* shard, Entry* key) {
+    // The low bits of the hash picked the shard, so use the others to pick the bucket.
+    int index = (key->hash / CACHE_SHARDS) % shard->buckets.size();
+    Entry** pnode = &shard->buckets[index];
 
     while (*pnode != NULL) {
         Entry* node = *pnode;
@@ -1346,41 +1454,57 @@ static Entry** _cache_lookup_p(Cache* cache, Entry* key) {
     return pnode;
 }
 
+static void entry_wheel_add(CacheShard* shard, Entry* e) {
+    Entry** slot = &shard->expiry_wheel[e->evicts % EXPIRY_WHEEL_SLOTS];
+
+    e->wheel_next = *slot;
+    e->wheel_prev = slot;
+    if (*slot != NULL) (*slot)->wheel_prev = &e->wheel_next;
+    *slot = e;
+}
+
+static void entry_wheel_remove(Entry* e) {
+    *e->wheel_prev = e->wheel_next;
+    if (e->wheel_next != NULL) e->wheel_next->wheel_prev = e->wheel_prev;
+}
+
 /* Add a new entry to the hash table. 'lookup' must be the
  * result of an immediate previous failed _lookup_p() call
  * (i.e. with *lookup == NULL), and 'e' is the pointer to the
  * newly created entry
  */
-static void _cache_add_p(Cache* cache, Entry** lookup, Entry* e) {
+static void _cache_add_p(CacheShard* shard, Entry** lookup, Entry* e) {
     *lookup = e;
-    e->id = ++cache->last_id;
-    entry_mru_add(e, &cache->mru_list);
-    cache->num_entries += 1;
+    e->id = ++shard->last_id;
+    entry_mru_add(e, &shard->mru_list);
+    entry_wheel_add(shard, e);
+    shard->num_entries += 1;
 
-    LOG(INFO) << __func__ << ": entry " << e->id << " added (count=" << cache->num_entries << ")";
+    LOG(INFO) << __func__ << ": entry " << e->id << " added (count=" << shard->num_entries << ")";
 }
 
 /* Remove an existing entry from the hash table,
  * 'lookup' must be the result of an immediate previous
  * and succesful _lookup_p() call.
  */
-static void _cache_remove_p(Cache* cache, Entry** lookup) {
+static void _cache_remove_p(CacheShard* shard, Entry** lookup) {
     Entry* e = *lookup;
 
-    LOG(INFO) << __func__ << ": entry " << e->id << " removed (count=" << cache->num_entries - 1
+    LOG(INFO) << __func__ << ": entry " << e->id << " removed (count=" << shard->num_entries - 1
               << ")";
 
     entry_mru_remove(e);
+    entry_wheel_remove(e);
     *lookup = e->hlink;
     entry_free(e);
-    cache->num_entries -= 1;
+    shard->num_entries -= 1;
 }
 
 /* Remove the oldest entry from the hash table.
  */
-static void _cache_remove_oldest(Cache* cache) {
-    Entry* oldest = cache->mru_list.mru_prev;
-    Entry** lookup = _cache_lookup_p(cache, oldest);
+static void _cache_remove_oldest(CacheShard* shard) {
+    Entry* oldest = shard->mru_list.mru_prev;
+    Entry** lookup = _cache_lookup_p(shard, oldest);
 
     if (*lookup == NULL) { /* should not happen */
         LOG(INFO) << __func__ << ": OLDEST NOT IN HTABLE ?";
@@ -1388,34 +1512,35 @@ static void _cache_remove_oldest(Cache* cache) {
     }
     LOG(INFO) << __func__ << ": Cache full - removing oldest";
     dump_query(oldest->query, oldest->querylen);
-    _cache_remove_p(cache, lookup);
+    _cache_remove_p(shard, lookup);
 }
 
-/* Remove all expired entries from the hash table.
+/* Remove the entries that are due for eviction by |now|.  Only the wheel
+ * slots of the seconds that have passed since the last call are visited.
  */
-static void _cache_remove_expired(Cache* cache) {
-    Entry* e;
-    time_t now = _time_now();
-
-    for (e = cache->mru_list.mru_next; e != &cache->mru_list;) {
-        // Entry is old, remove
-        if (now >= e->expires) {
-            Entry** lookup = _cache_lookup_p(cache, e);
-            if (*lookup == NULL) { /* should not happen */
-                LOG(INFO) << __func__ << ": ENTRY NOT IN HTABLE ?";
-                return;
+static void _cache_remove_expired(CacheShard* shard, time_t now) {
+    if (now <= shard->wheel_time) return;
+
+    time_t first = std::max(shard->wheel_time + 1, now - EXPIRY_WHEEL_SLOTS + 1);
+    for (time_t t = first; t <= now; t++) {
+        Entry* e = shard->expiry_wheel[t % EXPIRY_WHEEL_SLOTS];
+        while (e != NULL) {
+            Entry* next = e->wheel_next;
+            // Entry is old, remove
+            if (now >= e->evicts) {
+                Entry** lookup = _cache_lookup_p(shard, e);
+                if (*lookup == NULL) { /* should not happen */
+                    LOG(INFO) << __func__ << ": ENTRY NOT IN HTABLE ?";
+                    return;
+                }
+                _cache_remove_p(shard, lookup);
             }
-            e = e->mru_next;
-            _cache_remove_p(cache, lookup);
-        } else {
-            e = e->mru_next;
+            e = next;
         }
     }
+    shard->wheel_time = now;
 }
 
-// gets a resolv_cache_info associated with a network, or NULL if not found
-static resolv_cache_info* find_cache_info_locked(unsigned netid) REQUIRES(cache_mutex);
-
 ResolvCacheStatus _resolv_cache_lookup(unsigned netid, const void* query, int querylen,
                                        void* answer, int answersize, int* answerlen,
                                        uint32_t flags) {
@@ -1430,7 +1555,6 @@ ResolvCacheStatus _resolv_cache_lookup(unsigned netid, const void* query, int qu
     Entry** lookup;
     Entry* e;
     time_t now;
-    Cache* cache;
 
     LOG(INFO) << __func__ << ": lookup";
     dump_query((u_char*) query, querylen);
@@ -1441,18 +1565,33 @@ ResolvCacheStatus _resolv_cache_lookup(unsigned netid, const void* query, int qu
         return RESOLV_CACHE_UNSUPPORTED;
     }
     /* lookup cache */
-    std::unique_lock lock(cache_mutex);
-    ScopedAssumeLocked assume_lock(cache_mutex);
-    cache = find_named_cache_locked(netid);
-    if (cache == NULL) {
+    ScopedCacheRef cache = cache_ref(netid);
+    if (!cache) {
+        return RESOLV_CACHE_UNSUPPORTED;
+    }
+    CacheShard* shard = cache_shard(cache.get(), &key);
+    std::unique_lock lock(shard->lock);
+    if (cache->deleted) {
         return RESOLV_CACHE_UNSUPPORTED;
     }
 
     /* see the description of _lookup_p to understand this.
      * the function always return a non-NULL pointer.
      */
-    lookup = _cache_lookup_p(cache, &key);
+    lookup = _cache_lookup_p(shard, &key);
     e = *lookup;
+    now = _time_now();
+
+    /* remove stale entries here, unless they are kept to be served if
+     * the query fails */
+    if (e != NULL && now >= e->expires) {
+        LOG(INFO) << __func__ << ": NOT IN CACHE (STALE ENTRY " << *lookup << ")";
+        dump_query(e->query, e->querylen);
+        if (now >= e->evicts) {
+            _cache_remove_p(shard, lookup);
+        }
+        e = NULL;
+    }
 
     if (e == NULL) {
         LOG(INFO) << __func__ << ": NOT IN CACHE";
@@ -1461,45 +1600,35 @@ ResolvCacheStatus _resolv_cache_lookup(unsigned netid, const void* query, int qu
             return RESOLV_CACHE_SKIP;
         }
 
-        if (!cache_has_pending_request_locked(cache, &key, true)) {
+        pending_req_info* ri = cache_find_pending_request_locked(shard, &key);
+        if (ri == NULL) {
+            cache_add_pending_request_locked(shard, &key);
             return RESOLV_CACHE_NOTFOUND;
-
-        } else {
-            LOG(INFO) << __func__ << ": Waiting for previous request";
-            // wait until (1) timeout OR
-            //            (2) cv is notified AND no pending request matching the |key|
-            // (cv notifier should delete pending request before sending notification.)
-            bool ret = cv.wait_for(lock, std::chrono::seconds(PENDING_REQUEST_TIMEOUT),
-                                   [netid, &cache, &key]() REQUIRES(cache_mutex) {
-                                       // Must update cache as it could have been deleted
-                                       cache = find_named_cache_locked(netid);
-                                       return !cache_has_pending_request_locked(cache, &key, false);
-                                   });
-            if (!cache) {
-                return RESOLV_CACHE_NOTFOUND;
-            }
-            if (ret == false) {
-                resolv_cache_info* info = find_cache_info_locked(netid);
-                if (info != NULL) {
-                    info->wait_for_pending_req_timeout_count++;
-                }
-            }
-            lookup = _cache_lookup_p(cache, &key);
-            e = *lookup;
-            if (e == NULL) {
-                return RESOLV_CACHE_NOTFOUND;
-            }
         }
-    }
 
-    now = _time_now();
+        LOG(INFO) << __func__ << ": Waiting for previous request";
+        // Wait until the owner of the request adds the answer to the cache, gives up, or the
+        // cache is flushed.  Only the threads waiting for this question are woken.
+        ri->waiters++;
+        bool ret = ri->cv.wait_for(lock, std::chrono::seconds(PENDING_REQUEST_TIMEOUT),
+                                   [ri] { return ri->done; });
+        if (--ri->waiters == 0 && ri->done) {
+            delete ri;
+        }
 
-    /* remove stale entries here */
-    if (now >= e->expires) {
-        LOG(INFO) << __func__ << ": NOT IN CACHE (STALE ENTRY " << *lookup << "DISCARDED)";
-        dump_query(e->query, e->querylen);
-        _cache_remove_p(cache, lookup);
-        return RESOLV_CACHE_NOTFOUND;
+        // The network could have been deleted while we were waiting.
+        if (cache->deleted) {
+            return RESOLV_CACHE_NOTFOUND;
+        }
+        if (ret == false) {
+            cache->wait_for_pending_req_timeout_count++;
+        }
+        lookup = _cache_lookup_p(shard, &key);
+        e = *lookup;
+        now = _time_now();
+        if (e == NULL || now >= e->expires) {
+            return RESOLV_CACHE_NOTFOUND;
+        }
     }
 
     *answerlen = e->answerlen;
@@ -1512,22 +1641,50 @@ ResolvCacheStatus _resolv_cache_lookup(unsigned netid, const void* query, int qu
     memcpy(answer, e->answer, e->answerlen);
 
     /* bump up this entry to the top of the MRU list */
-    if (e != cache->mru_list.mru_next) {
+    if (e != shard->mru_list.mru_next) {
         entry_mru_remove(e);
-        entry_mru_add(e, &cache->mru_list);
+        entry_mru_add(e, &shard->mru_list);
     }
 
     LOG(INFO) << __func__ << ": FOUND IN CACHE entry=" << e;
     return RESOLV_CACHE_FOUND;
 }
 
+ResolvCacheStatus _resolv_cache_lookup_stale(unsigned netid, const void* query, int querylen,
+                                             void* answer, int answersize, int* answerlen) {
+    Entry key;
+
+    if (!entry_init_key(&key, query, querylen)) {
+        return RESOLV_CACHE_UNSUPPORTED;
+    }
+    ScopedCacheRef cache = cache_ref(netid);
+    if (!cache || cache->serve_stale_seconds == 0) {
+        return RESOLV_CACHE_UNSUPPORTED;
+    }
+    CacheShard* shard = cache_shard(cache.get(), &key);
+    std::lock_guard guard(shard->lock);
+
+    Entry* e = *_cache_lookup_p(shard, &key);
+    if (e == NULL || _time_now() >= e->evicts) {
+        return RESOLV_CACHE_NOTFOUND;
+    }
+    *answerlen = e->answerlen;
+    if (e->answerlen > answersize) {
+        return RESOLV_CACHE_UNSUPPORTED;
+    }
+    memcpy(answer, e->answer, e->answerlen);
+    answer_setStaleTTL(static_cast<uint8_t*>(answer), e->answerlen);
+
+    LOG(INFO) << __func__ << ": SERVING STALE entry=" << e;
+    return RESOLV_CACHE_FOUND;
+}
+
 void _resolv_cache_add(unsigned netid, const void* query, int querylen, const void* answer,
                        int answerlen) {
     Entry key[1];
     Entry* e;
     Entry** lookup;
     u_long ttl;
-    Cache* cache = NULL;
 
     /* don't assume that the query has already been cached
      */
@@ -1536,10 +1693,13 @@ void _resolv_cache_add(unsigned netid, const void* query, int querylen, const vo
         return;
     }
 
-    std::lock_guard guard(cache_mutex);
-
-    cache = find_named_cache_locked(netid);
-    if (cache == NULL) {
+    ScopedCacheRef cache = cache_ref(netid);
+    if (!cache) {
+        return;
+    }
+    CacheShard* shard = cache_shard(cache.get(), key);
+    std::lock_guard guard(shard->lock);
+    if (cache->deleted) {
         return;
     }
 
@@ -1551,42 +1711,43 @@ void _resolv_cache_add(unsigned netid, const void* query, int querylen, const vo
         dump_bytes((u_char*)answer, answerlen);
     }
 
-    lookup = _cache_lookup_p(cache, key);
+    const time_t now = _time_now();
+    _cache_remove_expired(shard, now);
+
+    lookup = _cache_lookup_p(shard, key);
     e = *lookup;
 
+    // A stale entry kept for serve-stale is replaced by the fresh answer.
+    if (e != NULL && now >= e->expires) {
+        _cache_remove_p(shard, lookup);
+        lookup = _cache_lookup_p(shard, key);
+        e = *lookup;
+    }
+
     // Should only happen on ANDROID_RESOLV_NO_CACHE_LOOKUP
     if (e != NULL) {
         LOG(INFO) << __func__ << ": ALREADY IN CACHE (" << e << ") ? IGNORING ADD";
-        _cache_notify_waiting_tid_locked(cache, key);
+        _cache_notify_waiting_tid_locked(shard, key);
         return;
     }
 
-    if (cache->num_entries >= cache->max_entries) {
-        _cache_remove_expired(cache);
-        if (cache->num_entries >= cache->max_entries) {
-            _cache_remove_oldest(cache);
-        }
-        // TODO: It looks useless, remove below code after having test to prove it.
-        lookup = _cache_lookup_p(cache, key);
-        e = *lookup;
-        if (e != NULL) {
-            LOG(INFO) << __func__ << ": ALREADY IN CACHE (" << e << ") ? IGNORING ADD";
-            _cache_notify_waiting_tid_locked(cache, key);
-            return;
-        }
+    if (shard->num_entries >= shard->max_entries) {
+        _cache_remove_oldest(shard);
+        lookup = _cache_lookup_p(shard, key);
     }
 
     ttl = answer_getTTL(answer, answerlen);
     if (ttl > 0) {
         e = entry_alloc(key, answer, answerlen);
         if (e != NULL) {
-            e->expires = ttl + _time_now();
-            _cache_add_p(cache, lookup, e);
+            e->expires = ttl + now;
+            e->evicts = e->expires + cache->serve_stale_seconds;
+            _cache_add_p(shard, lookup, e);
         }
     }
 
-    cache_dump_mru(cache);
-    _cache_notify_waiting_tid_locked(cache, key);
+    cache_dump_mru(shard);
+    _cache_notify_waiting_tid_locked(shard, key);
 }
 
 // Head of the list of caches.
@@ -1655,7 +1816,7 @@ std::unordered_map<int, uint32_t> resolv_get_dns_event_subsampling_map() {
 
 }  // namespace
 
-static int resolv_create_cache_for_net_locked(unsigned netid) {
+static int resolv_create_cache_for_net_locked(unsigned netid, const ResolvCacheParams& params) {
     resolv_cache* cache = find_named_cache_locked(netid);
     // Should not happen
     if (cache) {
@@ -1665,11 +1826,7 @@ static int resolv_create_cache_for_net_locked(unsigned netid) {
 
     resolv_cache_info* cache_info = create_cache_info();
     if (!cache_info) return -ENOMEM;
-    cache = resolv_cache_create();
-    if (!cache) {
-        free(cache_info);
-        return -ENOMEM;
-    }
+    cache = resolv_cache_create(params);
     cache_info->cache = cache;
     cache_info->netid = netid;
     cache_info->dns_event_subsampling_map = resolv_get_dns_event_subsampling_map();
@@ -1678,30 +1835,39 @@ static int resolv_create_cache_for_net_locked(unsigned netid) {
     return 0;
 }
 
-int resolv_create_cache_for_net(unsigned netid) {
+int resolv_create_cache_for_net(unsigned netid, const ResolvCacheParams& params) {
     std::lock_guard guard(cache_mutex);
-    return resolv_create_cache_for_net_locked(netid);
+    return resolv_create_cache_for_net_locked(netid, params);
 }
 
 void resolv_delete_cache_for_net(unsigned netid) {
-    std::lock_guard guard(cache_mutex);
+    Cache* cache = NULL;
+    {
+        std::lock_guard guard(cache_mutex);
 
-    struct resolv_cache_info* prev_cache_info = &res_cache_list;
+        struct resolv_cache_info* prev_cache_info = &res_cache_list;
 
-    while (prev_cache_info->next) {
-        struct resolv_cache_info* cache_info = prev_cache_info->next;
+        while (prev_cache_info->next) {
+            struct resolv_cache_info* cache_info = prev_cache_info->next;
 
-        if (cache_info->netid == netid) {
-            prev_cache_info->next = cache_info->next;
-            cache_flush_locked(cache_info->cache);
-            free(cache_info->cache->entries);
-            free(cache_info->cache);
-            free_nameservers_locked(cache_info);
-            free(cache_info);
-            break;
+            if (cache_info->netid == netid) {
+                prev_cache_info->next = cache_info->next;
+                cache = cache_info->cache;
+                free_nameservers_locked(cache_info);
+                free(cache_info);
+                break;
+            }
+
+            prev_cache_info = prev_cache_info->next;
         }
+    }
 
-        prev_cache_info = prev_cache_info->next;
+    // Lookups that are still using the cache see that it's gone, and any threads waiting for
+    // pending requests are woken up.  The last of them to drop its reference frees it.
+    if (cache) {
+        cache->deleted = true;
+        cache_flush(cache);
+        cache_unref(cache);
     }
 }
 
@@ -2046,7 +2212,7 @@ int android_net_res_stats_get_info_for_net(unsigned netid, int* nscount,
         *dcount = i;
         *params = info->params;
         revision_id = info->revision_id;
-        *wait_for_pending_req_timeout_count = info->wait_for_pending_req_timeout_count;
+        *wait_for_pending_req_timeout_count = info->cache->wait_for_pending_req_timeout_count;
     }
 
     return revision_id;
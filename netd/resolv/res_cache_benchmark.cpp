@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measures the latency of cache hits in the resolver's DNS cache, with between 8 and 32 threads
+ * looking up names at the same time.
+ *
+ * Useful measurements
+ * ===================
+ *
+ *  - real_time: the average time taken by a single _resolv_cache_lookup() of a cached name.
+ *               Lookups of different names should scale with the number of threads instead of
+ *               queueing up behind one another.
+ */
+
+#include <arpa/nameser.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+
+#include "resolv_cache.h"
+
+using android::base::StringPrintf;
+
+constexpr unsigned TEST_NETID = 30;
+constexpr int MIN_THREADS = 8;
+constexpr int MAX_THREADS = 32;
+
+class ResCacheFixture : public ::benchmark::Fixture {
+  protected:
+    static constexpr int num_hosts = 1000;
+    std::vector<std::vector<uint8_t>> queries;
+
+  public:
+    void SetUp(const ::benchmark::State& state) override {
+        if (state.thread_index != 0) return;
+
+        resolv_create_cache_for_net(TEST_NETID, {.max_entries = 4 * num_hosts});
+        queries.clear();
+        for (int i = 0; i < num_hosts; i++) {
+            queries.push_back(makeQuery(StringPrintf("host%d", i)));
+            const std::vector<uint8_t>& query = queries.back();
+            const std::vector<uint8_t> answer = makeAnswer(query);
+            uint8_t buf[512];
+            int buflen = 0;
+            _resolv_cache_lookup(TEST_NETID, query.data(), query.size(), buf, sizeof(buf), &buflen,
+                                 0);
+            _resolv_cache_add(TEST_NETID, query.data(), query.size(), answer.data(),
+                              answer.size());
+        }
+    }
+
+    void TearDown(const ::benchmark::State& state) override {
+        if (state.thread_index != 0) return;
+
+        resolv_delete_cache_for_net(TEST_NETID);
+    }
+
+    // A query for <label>.example.com of type A.
+    static std::vector<uint8_t> makeQuery(const std::string& label) {
+        std::vector<uint8_t> query = {0x12, 0x34, 0x01, 0x00, 0x00, 0x01,
+                                      0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+        query.push_back(label.size());
+        query.insert(query.end(), label.begin(), label.end());
+        const uint8_t question[] = {7,    'e',  'x',  'a',  'm',  'p', 'l', 'e', 3, 'c',
+                                    'o',  'm',  0x00, 0x00, ns_t_a, 0x00, ns_c_in};
+        query.insert(query.end(), std::begin(question), std::end(question));
+        return query;
+    }
+
+    // An answer to |query| with a single A record and a one hour TTL.
+    static std::vector<uint8_t> makeAnswer(const std::vector<uint8_t>& query) {
+        std::vector<uint8_t> answer = query;
+        answer[2] = 0x81;
+        answer[3] = 0x80;
+        answer[7] = 0x01;
+        const uint8_t rr[] = {0xc0, 0x0c, 0x00, ns_t_a, 0x00, ns_c_in, 0x00, 0x00,
+                              0x0e, 0x10, 0x00, 0x04, 192,  0,        2,    1};
+        answer.insert(answer.end(), std::begin(rr), std::end(rr));
+        return answer;
+    }
+};
+
+BENCHMARK_DEFINE_F(ResCacheFixture, lookup_hit)(benchmark::State& state) {
+    uint8_t answer[512];
+    int answerlen = 0;
+    unsigned seed = state.thread_index;
+    while (state.KeepRunning()) {
+        const auto& query = queries[rand_r(&seed) % queries.size()];
+        if (_resolv_cache_lookup(TEST_NETID, query.data(), query.size(), answer, sizeof(answer),
+                                 &answerlen, 0) != RESOLV_CACHE_FOUND) {
+            state.SkipWithError("cache miss");
+            break;
+        }
+    }
+}
+BENCHMARK_REGISTER_F(ResCacheFixture, lookup_hit)
+    ->ThreadRange(MIN_THREADS, MAX_THREADS)
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
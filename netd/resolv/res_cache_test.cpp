@@ -14,8 +14,15 @@
  * limitations under the License.
  */
 
+#include <arpa/nameser.h>
 #include <netdb.h>
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <android-base/stringprintf.h>
 #include <cutils/properties.h>
 #include <gmock/gmock-matchers.h>
 #include <gtest/gtest.h>
@@ -51,8 +58,154 @@ class ScopedCacheCreate {
     char mStoredMap[PROPERTY_VALUE_MAX]{};
 };
 
+// A query for <label>.com with the given type, and an answer to it with the given TTL.
+std::vector<uint8_t> makeQuery(uint8_t qtype, const std::string& label = "example") {
+    std::vector<uint8_t> query = {0x12, 0x34, 0x01, 0x00, 0x00, 0x01,
+                                  0x00, 0x00, 0x00, 0x00, 0x00, 0x00};  // header
+    query.push_back(label.size());
+    query.insert(query.end(), label.begin(), label.end());
+    const uint8_t question[] = {0x03, 'c', 'o', 'm', 0x00, 0x00, qtype, 0x00, 0x01};
+    query.insert(query.end(), std::begin(question), std::end(question));
+    return query;
+}
+
+std::vector<uint8_t> makeAnswer(const std::vector<uint8_t>& query, uint32_t ttl = 300) {
+    std::vector<uint8_t> answer = query;
+    answer[2] = 0x81;  // QR, RD
+    answer[3] = 0x80;  // RA
+    answer[7] = 0x01;  // ANCOUNT
+    const uint8_t rr[] = {0xc0,
+                          0x0c,
+                          0x00,
+                          0x01,
+                          0x00,
+                          0x01,
+                          static_cast<uint8_t>(ttl >> 24),
+                          static_cast<uint8_t>(ttl >> 16),
+                          static_cast<uint8_t>(ttl >> 8),
+                          static_cast<uint8_t>(ttl),
+                          0x00,
+                          0x04,
+                          192,
+                          0,
+                          2,
+                          1};
+    answer.insert(answer.end(), std::begin(rr), std::end(rr));
+    return answer;
+}
+
+void cacheAdd(const std::vector<uint8_t>& query, const std::vector<uint8_t>& answer) {
+    _resolv_cache_add(TEST_NETID, query.data(), query.size(), answer.data(), answer.size());
+}
+
+ResolvCacheStatus cacheLookup(const std::vector<uint8_t>& query) {
+    uint8_t answer[512];
+    int answerlen = 0;
+    return _resolv_cache_lookup(TEST_NETID, query.data(), query.size(), answer, sizeof(answer),
+                                &answerlen, 0);
+}
+
 }  // namespace
 
+TEST(ResolvCacheTest, PendingRequests) {
+    ScopedCacheCreate scopedCacheCreate(TEST_NETID, "");
+    const std::vector<uint8_t> queryA = makeQuery(ns_t_a);
+    const std::vector<uint8_t> queryAAAA = makeQuery(ns_t_aaaa);
+
+    // The first lookup misses and owns the request; an identical one waits for its answer.
+    EXPECT_EQ(RESOLV_CACHE_NOTFOUND, cacheLookup(queryA));
+    std::atomic<ResolvCacheStatus> waiterStatus(RESOLV_CACHE_UNSUPPORTED);
+    std::thread waiter([&] { waiterStatus = cacheLookup(queryA); });
+
+    // A different question for the same name doesn't wait.
+    EXPECT_EQ(RESOLV_CACHE_NOTFOUND, cacheLookup(queryAAAA));
+    _resolv_cache_query_failed(TEST_NETID, queryAAAA.data(), queryAAAA.size(), 0);
+
+    // A thread that doesn't own the request can't fail it on the owner's behalf.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::thread([&] {
+        _resolv_cache_query_failed(TEST_NETID, queryA.data(), queryA.size(), 0);
+    }).join();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(RESOLV_CACHE_UNSUPPORTED, waiterStatus);
+
+    cacheAdd(queryA, makeAnswer(queryA));
+    waiter.join();
+    EXPECT_EQ(RESOLV_CACHE_FOUND, waiterStatus);
+
+    // When the owner gives up, waiters are released to try for themselves.
+    EXPECT_EQ(RESOLV_CACHE_NOTFOUND, cacheLookup(queryAAAA));
+    waiter = std::thread([&] { waiterStatus = cacheLookup(queryAAAA); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    _resolv_cache_query_failed(TEST_NETID, queryAAAA.data(), queryAAAA.size(), 0);
+    waiter.join();
+    EXPECT_EQ(RESOLV_CACHE_NOTFOUND, waiterStatus);
+}
+
+TEST(ResolvCacheTest, MaxEntries) {
+    constexpr int kMaxEntries = 16;
+    ASSERT_EQ(0, resolv_create_cache_for_net(TEST_NETID, {.max_entries = kMaxEntries}));
+
+    std::vector<std::vector<uint8_t>> queries;
+    for (int i = 0; i < 10 * kMaxEntries; i++) {
+        queries.push_back(makeQuery(ns_t_a, android::base::StringPrintf("host%d", i)));
+        EXPECT_EQ(RESOLV_CACHE_NOTFOUND, cacheLookup(queries.back()));
+        cacheAdd(queries.back(), makeAnswer(queries.back()));
+    }
+
+    // The least recently used entries are evicted, so the last answer is always still there.
+    int found = 0;
+    for (const auto& query : queries) {
+        if (cacheLookup(query) == RESOLV_CACHE_FOUND) {
+            found++;
+        } else {
+            _resolv_cache_query_failed(TEST_NETID, query.data(), query.size(), 0);
+        }
+    }
+    EXPECT_LE(found, kMaxEntries);
+    EXPECT_EQ(RESOLV_CACHE_FOUND, cacheLookup(queries.back()));
+
+    resolv_delete_cache_for_net(TEST_NETID);
+}
+
+TEST(ResolvCacheTest, ServeStale) {
+    const std::vector<uint8_t> query = makeQuery(ns_t_a);
+    uint8_t answer[512];
+    int answerlen = 0;
+
+    // Stale answers are only served if the network is configured to.
+    ASSERT_EQ(0, resolv_create_cache_for_net(TEST_NETID));
+    EXPECT_EQ(RESOLV_CACHE_UNSUPPORTED,
+              _resolv_cache_lookup_stale(TEST_NETID, query.data(), query.size(), answer,
+                                         sizeof(answer), &answerlen));
+    resolv_delete_cache_for_net(TEST_NETID);
+
+    ASSERT_EQ(0, resolv_create_cache_for_net(TEST_NETID, {.serve_stale_seconds = 60}));
+    EXPECT_EQ(RESOLV_CACHE_NOTFOUND,
+              _resolv_cache_lookup_stale(TEST_NETID, query.data(), query.size(), answer,
+                                         sizeof(answer), &answerlen));
+    EXPECT_EQ(RESOLV_CACHE_NOTFOUND, cacheLookup(query));
+    cacheAdd(query, makeAnswer(query, 1));
+    EXPECT_EQ(RESOLV_CACHE_FOUND, cacheLookup(query));
+
+    // Once the TTL has passed, a lookup misses but the answer can still be served if the query
+    // fails, with a TTL of 30 seconds.
+    std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+    EXPECT_EQ(RESOLV_CACHE_NOTFOUND, cacheLookup(query));
+    _resolv_cache_query_failed(TEST_NETID, query.data(), query.size(), 0);
+    ASSERT_EQ(RESOLV_CACHE_FOUND,
+              _resolv_cache_lookup_stale(TEST_NETID, query.data(), query.size(), answer,
+                                         sizeof(answer), &answerlen));
+    EXPECT_EQ(makeAnswer(query, 30), std::vector<uint8_t>(answer, answer + answerlen));
+
+    // A fresh answer replaces the stale one.
+    EXPECT_EQ(RESOLV_CACHE_NOTFOUND, cacheLookup(query));
+    cacheAdd(query, makeAnswer(query));
+    EXPECT_EQ(RESOLV_CACHE_FOUND, cacheLookup(query));
+
+    resolv_delete_cache_for_net(TEST_NETID);
+}
+
 TEST(ResolvCacheTest, DnsEventSubsampling) {
     // Test defaults, default flag is "default:1 0:100 7:10" if no experiment flag is set
     {
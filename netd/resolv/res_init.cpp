@@ -386,14 +386,20 @@ int res_getservers(res_state statp, sockaddr_union* set, int cnt) {
 void res_setnetcontext(res_state statp, const struct android_net_context* netcontext,
                        android::net::NetworkDnsEventReported* _Nonnull event) {
     if (statp != NULL) {
+        // The state is per thread and outlives the request, so set everything that depends on it
+        // rather than only turning on what this request asks for.
         statp->netid = netcontext->dns_netid;
         statp->_mark = netcontext->dns_mark;
         if (netcontext->flags & NET_CONTEXT_FLAG_USE_EDNS) {
             statp->options |= RES_USE_EDNS0 | RES_USE_DNSSEC;
+        } else {
+            statp->options &= ~(RES_USE_EDNS0 | RES_USE_DNSSEC);
         }
-        if (netcontext->flags & NET_CONTEXT_FLAG_USE_LOCAL_NAMESERVERS) {
-            statp->use_local_nameserver = true;
-        }
+        statp->use_local_nameserver =
+                (netcontext->flags & NET_CONTEXT_FLAG_USE_LOCAL_NAMESERVERS) != 0;
+        // The EDNS0 error belongs to the previous request. If a TCP socket was kept open, clearing
+        // RES_F_VC only makes send_vc() reconnect, with this request's mark.
+        statp->_flags = 0;
         statp->event = event;
     }
 }
@@ -88,6 +88,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <netdb.h>
 #include <poll.h>
 #include <signal.h>
@@ -97,11 +98,15 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android/multinetwork.h>  // ResNsendFlags
 
 #include <netdutils/Slice.h>
 #include <netdutils/Stopwatch.h>
+#include <server_configurable_flags/get_flags.h>
 #include "DnsTlsDispatcher.h"
 #include "DnsTlsTransport.h"
 #include "PrivateDnsConfiguration.h"
@@ -125,8 +130,19 @@ static int get_salen(const struct sockaddr*);
 static struct sockaddr* get_nsaddr(res_state, size_t);
 static int send_vc(res_state, res_params* params, const u_char*, int, u_char*, int, int*, int,
                    time_t*, int*, int*);
+
+// A UDP query raced against several nameservers: if a server has not answered within the stagger,
+// the query is sent to the next one while still listening for the servers it was already sent to.
+struct UdpRace {
+    int stagger_ms;  // how long to wait before moving on, or 0 to wait for the full timeout
+    bool sent[MAXNS];
+    struct timespec sent_at[MAXNS];
+    int answered_ns;  // the server whose reply send_dg() last read
+    bool staggered;   // whether send_dg() gave up on the stagger rather than the timeout
+};
+
 static int send_dg(res_state, res_params* params, const u_char*, int, u_char*, int, int*, int, int*,
-                   int*, time_t*, int*, int*);
+                   int*, time_t*, int*, int*, UdpRace*);
 static void Aerror(const res_state, const char*, int, const struct sockaddr*, int);
 static void Perror(const res_state, const char*, int);
 
@@ -134,6 +150,7 @@ static int sock_eq(struct sockaddr*, struct sockaddr*);
 static int connect_with_timeout(int sock, const struct sockaddr* nsap, socklen_t salen,
                                 const struct timespec timeout);
 static int retrying_poll(const int sock, short events, const struct timespec* finish);
+static int race_poll(res_state statp, UdpRace* race, const struct timespec* finish, int* ns);
 static int res_tls_send(res_state, const Slice query, const Slice answer, int* rcode,
                         bool* fallback);
 
@@ -396,6 +413,45 @@ int res_queriesmatch(const u_char* buf1, const u_char* eom1, const u_char* buf2,
     return (1);
 }
 
+// If the network serves stale answers, answers a failed query from an expired cache entry.
+// Returns the answer length, or 0 if there is no such entry.
+static int serve_stale_answer(res_state statp, const u_char* buf, int buflen, u_char* ans,
+                              int anssiz, int* rcode) {
+    int anslen = 0;
+    if (_resolv_cache_lookup_stale(statp->netid, buf, buflen, ans, anssiz, &anslen) !=
+        RESOLV_CACHE_FOUND) {
+        return 0;
+    }
+    HEADER* hp = (HEADER*)(void*)ans;
+    *rcode = hp->rcode;
+    return anslen;
+}
+
+// The delay after which a UDP query is also sent to the next nameserver, or 0 to query the
+// nameservers one at a time.
+static int udp_race_stagger_ms() {
+    int stagger_ms = 0;
+    android::base::ParseInt(server_configurable_flags::GetServerConfigurableFlag(
+                                    "netd_native", "udp_race_stagger_ms", ""),
+                            &stagger_ms, 0);
+    return stagger_ms;
+}
+
+// Orders the nameservers by their average round trip time, fastest first. Servers without a
+// successful sample keep their configured order after the ones that have one.
+static void sort_servers_by_rtt(res_stats stats[], int nscount, int order[]) {
+    int rtt[MAXNS];
+    for (int ns = 0; ns < nscount; ns++) {
+        int successes, errors, timeouts, internal_errors;
+        time_t last_sample_time;
+        android_net_res_stats_aggregate(&stats[ns], &successes, &errors, &timeouts,
+                                        &internal_errors, &rtt[ns], &last_sample_time);
+        if (rtt[ns] < 0) rtt[ns] = INT_MAX;
+        order[ns] = ns;
+    }
+    std::stable_sort(order, order + nscount, [&rtt](int a, int b) { return rtt[a] < rtt[b]; });
+}
+
 static DnsQueryEvent* addDnsQueryEvent(NetworkDnsEventReported* event) {
     return event->mutable_dns_query_events()->add_dns_query_event();
 }
@@ -549,9 +605,21 @@ int res_nsend(res_state statp, const u_char* buf, int buflen, u_char* ans, int a
      */
     int retryTimes = (flags & ANDROID_RESOLV_NO_RETRY) ? 1 : params.retry_count;
 
+    /*
+     * If racing is enabled, try the servers fastest first and keep listening to the servers
+     * that have not answered within the stagger while querying the next one.
+     */
+    const int race_stagger_ms = usableServersCount > 1 ? udp_race_stagger_ms() : 0;
+    UdpRace race = {};
+    UdpRace* udp_race = race_stagger_ms > 0 ? &race : NULL;
+    int server_order[MAXNS];
+    for (int ns = 0; ns < statp->nscount; ns++) server_order[ns] = ns;
+    if (udp_race != NULL) sort_servers_by_rtt(stats, statp->nscount, server_order);
+
     for (int attempt = 0; attempt < retryTimes; ++attempt) {
 
-        for (int ns = 0; ns < statp->nscount; ns++) {
+        for (int i = 0; i < statp->nscount; i++) {
+            const int ns = server_order[i];
             if (!usable_servers[ns]) continue;
             int nsaplen;
             time_t now = 0;
@@ -577,6 +645,10 @@ int res_nsend(res_state statp, const u_char* buf, int buflen, u_char* ans, int a
                 if (!fallback) {
                     _resolv_cache_query_failed(statp->netid, buf, buflen, flags);
                     res_nclose(statp);
+                    if (cache_status == RESOLV_CACHE_NOTFOUND) {
+                        resplen = serve_stale_answer(statp, buf, buflen, ans, anssiz, rcode);
+                        if (resplen > 0) return resplen;
+                    }
                     return -terrno;
                 }
             }
@@ -633,24 +705,40 @@ int res_nsend(res_state statp, const u_char* buf, int buflen, u_char* ans, int a
                 /* Use datagrams. */
                 LOG(INFO) << __func__ << ": using send_dg";
 
+                if (udp_race != NULL) {
+                    // Only stagger the first attempt, and only if there is another server to try.
+                    race.stagger_ms = 0;
+                    for (int j = i + 1; attempt == 0 && j < statp->nscount; j++) {
+                        if (usable_servers[server_order[j]]) {
+                            race.stagger_ms = race_stagger_ms;
+                            break;
+                        }
+                    }
+                }
                 n = send_dg(statp, &params, buf, buflen, ans, anssiz, &terrno, ns, &v_circuit,
-                            &gotsomewhere, &now, rcode, &delay);
+                            &gotsomewhere, &now, rcode, &delay, udp_race);
+                // When racing, the reply may have come from a server queried earlier.
+                const int answered_ns = udp_race != NULL ? race.answered_ns : ns;
 
                 dnsQueryEvent->set_latency_micros(
                         saturate_cast<int32_t>(query_stopwatch.timeTakenUs()));
-                dnsQueryEvent->set_dns_server_index(ns);
-                dnsQueryEvent->set_ip_version(ipFamilyToIPVersion(nsap->sa_family));
+                dnsQueryEvent->set_dns_server_index(answered_ns);
+                dnsQueryEvent->set_ip_version(
+                        ipFamilyToIPVersion(get_nsaddr(statp, answered_ns)->sa_family));
                 dnsQueryEvent->set_retry_times(attempt);
                 dnsQueryEvent->set_rcode(static_cast<NsRcode>(*rcode));
                 dnsQueryEvent->set_protocol(PROTO_UDP);
                 dnsQueryEvent->set_type(getQueryType(buf, buflen));
 
-                /* Only record stats the first time we try a query. See above. */
-                if (attempt == 0) {
+                /*
+                 * Only record stats the first time we try a query. See above. A server that
+                 * was only given the stagger has not timed out yet, so record nothing for it.
+                 */
+                if (attempt == 0 && !(udp_race != NULL && race.staggered)) {
                     res_sample sample;
                     _res_stats_set_sample(&sample, now, *rcode, delay);
-                    _resolv_cache_add_resolver_stats_sample(statp->netid, revision_id, ns, &sample,
-                                                            params.max_samples);
+                    _resolv_cache_add_resolver_stats_sample(statp->netid, revision_id, answered_ns,
+                                                            &sample, params.max_samples);
                 }
 
                 LOG(INFO) << __func__ << ": used send_dg " << n;
@@ -699,6 +787,10 @@ int res_nsend(res_state statp, const u_char* buf, int buflen, u_char* ans, int a
         errno = terrno;
     }
     _resolv_cache_query_failed(statp->netid, buf, buflen, flags);
+    if (cache_status == RESOLV_CACHE_NOTFOUND) {
+        const int stale_len = serve_stale_answer(statp, buf, buflen, ans, anssiz, rcode);
+        if (stale_len > 0) return stale_len;
+    }
     return -terrno;
 }
 
@@ -1021,9 +1113,55 @@ retry:
     return n;
 }
 
+// Waits until the reply to a raced query can be read from one of the servers it was sent to.
+// Returns 1 and sets |*ns| to that server, 0 on timeout, or -1 if all the sockets have failed.
+static int race_poll(res_state statp, UdpRace* race, const struct timespec* finish, int* ns) {
+    for (;;) {
+        struct pollfd fds[MAXNS];
+        int servers[MAXNS];
+        nfds_t nfds = 0;
+        for (int i = 0; i < statp->nscount; i++) {
+            if (!race->sent[i] || statp->_u._ext.nssocks[i] < 0) continue;
+            fds[nfds] = {.fd = statp->_u._ext.nssocks[i], .events = POLLIN};
+            servers[nfds++] = i;
+        }
+        if (nfds == 0) {
+            errno = ECONNREFUSED;
+            return -1;
+        }
+
+        struct timespec now = evNowTime();
+        struct timespec timeout =
+                evCmpTime(*finish, now) > 0 ? evSubTime(*finish, now) : evConsTime(0L, 0L);
+        int n = ppoll(fds, nfds, &timeout, /*sigmask=*/NULL);
+        if (n == 0) {
+            errno = ETIMEDOUT;
+            return 0;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            PLOG(INFO) << __func__ << ": race_poll failed";
+            return n;
+        }
+        for (nfds_t i = 0; i < nfds; i++) {
+            if (fds[i].revents & (POLLIN | POLLERR)) {
+                int error;
+                socklen_t len = sizeof(error);
+                if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error) {
+                    // e.g. ICMP port unreachable; stop listening to this server.
+                    race->sent[servers[i]] = false;
+                    continue;
+                }
+                *ns = servers[i];
+                return 1;
+            }
+        }
+    }
+}
+
 static int send_dg(res_state statp, res_params* params, const u_char* buf, int buflen, u_char* ans,
                    int anssiz, int* terrno, int ns, int* v_circuit, int* gotsomewhere, time_t* at,
-                   int* rcode, int* delay) {
+                   int* rcode, int* delay, UdpRace* race) {
     *at = time(NULL);
     *delay = 0;
     const HEADER* hp = (const HEADER*) (const void*) buf;
@@ -1103,15 +1241,41 @@ static int send_dg(res_state statp, res_params* params, const u_char* buf, int b
 
     // Wait for reply.
     timeout = get_timeout(statp, params, ns);
+    bool staggered = false;
+    if (race != NULL && race->stagger_ms > 0) {
+        const struct timespec stagger =
+                evConsTime(race->stagger_ms / 1000, (race->stagger_ms % 1000) * 1000000L);
+        if (evCmpTime(stagger, timeout) < 0) {
+            timeout = stagger;
+            staggered = true;
+        }
+    }
     now = evNowTime();
     finish = evAddTime(now, timeout);
+    if (race != NULL) {
+        race->sent[ns] = true;
+        race->sent_at[ns] = now;
+        race->answered_ns = ns;
+        race->staggered = false;
+    }
 retry:
-    n = retrying_poll(s, POLLIN, &finish);
+    if (race != NULL) {
+        int answered_ns = ns;
+        n = race_poll(statp, race, &finish, &answered_ns);
+        if (n > 0) {
+            s = statp->_u._ext.nssocks[answered_ns];
+            now = race->sent_at[answered_ns];
+            race->answered_ns = answered_ns;
+        }
+    } else {
+        n = retrying_poll(s, POLLIN, &finish);
+    }
 
     if (n == 0) {
         *rcode = RCODE_TIMEOUT;
         LOG(DEBUG) << __func__ << ": timeout";
         *gotsomewhere = 1;
+        if (race != NULL) race->staggered = staggered;
         return 0;
     }
     if (n < 0) {
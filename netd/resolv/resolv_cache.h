@@ -70,12 +70,27 @@ void _resolv_cache_add(unsigned netid, const void* query, int querylen, const vo
 /* Notify the cache a request failed */
 void _resolv_cache_query_failed(unsigned netid, const void* query, int querylen, uint32_t flags);
 
+/* look up an answer that has expired but is still within the network's
+ * serve-stale window (RFC 8767), for use when the query itself failed.
+ * the TTLs of the returned answer are set to 30 seconds.
+ * returns RESOLV_CACHE_UNSUPPORTED if the network doesn't serve stale answers
+ */
+ResolvCacheStatus _resolv_cache_lookup_stale(unsigned netid, const void* query, int querylen,
+                                             void* answer, int answersize, int* answerlen);
+
 // Sets name servers for a given network.
 int resolv_set_nameservers_for_net(unsigned netid, const char** servers, int numservers,
                                    const char* domains, const res_params* params);
 
+// Size and expiry policy of a network's cache.
+struct ResolvCacheParams {
+    int max_entries = 0;          // 0: use the default size; else rounded down to a
+                                  // multiple of 8, and at least 8
+    int serve_stale_seconds = 0;  // how long expired answers may be served; 0: never
+};
+
 // Creates the cache associated with the given network.
-int resolv_create_cache_for_net(unsigned netid);
+int resolv_create_cache_for_net(unsigned netid, const ResolvCacheParams& params = {});
 
 // Deletes the cache associated with the given network.
 void resolv_delete_cache_for_net(unsigned netid);
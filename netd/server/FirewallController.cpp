@@ -263,6 +263,22 @@ int FirewallController::setUidRule(ChildChain chain, int uid, FirewallRule rule)
         return gCtls->trafficCtrl.changeUidOwnerRule(chain, uid, rule, firewallType);
     }
 
+    // If we know the contents of the chain, skip changes that would leave it as it is. As in
+    // setInterfaceRule, this avoids the latency of deleting rules that do not exist.
+    const bool add = strcmp(op, "-D") != 0;
+    auto known = mUidChains.end();
+    if (chain != NONE) {
+        known = mUidChains.find(chainNames[0]);
+        if (known != mUidChains.end() &&
+            known->second.isWhitelist != (firewallType == WHITELIST)) {
+            mUidChains.erase(known);
+            known = mUidChains.end();
+        }
+        if (known != mUidChains.end() && (known->second.uids.count(uid) > 0) == add) {
+            return 0;
+        }
+    }
+
     std::string command = "*filter\n";
     for (const std::string& chainName : chainNames) {
         StringAppendF(&command, "%s %s -m owner --uid-owner %d -j %s\n",
@@ -270,7 +286,17 @@ int FirewallController::setUidRule(ChildChain chain, int uid, FirewallRule rule)
     }
     StringAppendF(&command, "COMMIT\n");
 
-    return (execIptablesRestore(V4V6, command) == 0) ? 0 : -EREMOTEIO;
+    const int ret = execIptablesRestore(V4V6, command);
+    if (known != mUidChains.end()) {
+        if (ret != 0) {
+            mUidChains.erase(known);
+        } else if (add) {
+            known->second.uids.insert(uid);
+        } else {
+            known->second.uids.erase(uid);
+        }
+    }
+    return (ret == 0) ? 0 : -EREMOTEIO;
 }
 
 int FirewallController::createChain(const char* chain, FirewallType type) {
@@ -345,14 +371,67 @@ std::string FirewallController::makeUidRules(IptablesTarget target, const char *
     return commands;
 }
 
+std::string FirewallController::makeUidRuleChanges(const char* name, bool isWhitelist,
+                                                   const std::set<int32_t>& oldUids,
+                                                   const std::set<int32_t>& newUids) {
+    // Add UIDs where makeUidRules() puts them: at the beginning of whitelist chains, and at
+    // the end of blacklist chains.
+    const char* op = isWhitelist ? "-I" : "-A";
+    const char* target = isWhitelist ? "RETURN" : "DROP";
+    std::string commands;
+    for (auto uid : oldUids) {
+        if (newUids.find(uid) == newUids.end()) {
+            StringAppendF(&commands, "-D %s -m owner --uid-owner %d -j %s\n", name, uid, target);
+        }
+    }
+    for (auto uid : newUids) {
+        if (oldUids.find(uid) == oldUids.end()) {
+            StringAppendF(&commands, "%s %s -m owner --uid-owner %d -j %s\n", op, name, uid,
+                          target);
+        }
+    }
+    if (commands.empty()) {
+        return commands;
+    }
+    return "*filter\n" + commands + "COMMIT\n";
+}
+
 int FirewallController::replaceUidChain(
         const std::string &name, bool isWhitelist, const std::vector<int32_t>& uids) {
     if (mUseBpfOwnerMatch != BpfLevel::NONE) {
         return gCtls->trafficCtrl.replaceUidOwnerMap(name, isWhitelist, uids);
-   }
-   std::string commands4 = makeUidRules(V4, name.c_str(), isWhitelist, uids);
-   std::string commands6 = makeUidRules(V6, name.c_str(), isWhitelist, uids);
-   return execIptablesRestore(V4, commands4.c_str()) | execIptablesRestore(V6, commands6.c_str());
+    }
+    const std::set<int32_t> uidSet(uids.begin(), uids.end());
+
+    // If we know the contents of the chain, only add and delete the rules of the UIDs that
+    // changed, in a single transaction, instead of rebuilding the whole chain.
+    auto known = mUidChains.find(name);
+    if (known != mUidChains.end() && known->second.isWhitelist == isWhitelist) {
+        const std::string commands =
+                makeUidRuleChanges(name.c_str(), isWhitelist, known->second.uids, uidSet);
+        if (commands.empty()) {
+            return 0;
+        }
+        const int ret = execIptablesRestore(V4V6, commands);
+        if (ret == 0) {
+            known->second.uids = uidSet;
+        } else {
+            mUidChains.erase(known);
+        }
+        return ret;
+    }
+
+    std::string commands4 = makeUidRules(V4, name.c_str(), isWhitelist, uids);
+    std::string commands6 = makeUidRules(V6, name.c_str(), isWhitelist, uids);
+    const int ret =
+            execIptablesRestore(V4, commands4.c_str()) | execIptablesRestore(V6, commands6.c_str());
+    // A list with duplicate UIDs creates duplicate rules, which the set can't describe.
+    if (ret == 0 && uidSet.size() == uids.size()) {
+        mUidChains[name] = {isWhitelist, uidSet};
+    } else {
+        mUidChains.erase(name);
+    }
+    return ret;
 }
 
 /* static */
@@ -18,6 +18,7 @@
 #define _FIREWALL_CONTROLLER_H
 
 #include <sys/types.h>
+#include <map>
 #include <mutex>
 #include <set>
 #include <string>
@@ -94,6 +95,11 @@ protected:
     friend class FirewallControllerTest;
     std::string makeUidRules(IptablesTarget target, const char *name, bool isWhitelist,
                              const std::vector<int32_t>& uids);
+    // Returns the commands that change the UID rules of chain |name| from |oldUids| to
+    // |newUids|, or an empty string if there is nothing to change.
+    static std::string makeUidRuleChanges(const char* name, bool isWhitelist,
+                                          const std::set<int32_t>& oldUids,
+                                          const std::set<int32_t>& newUids);
     static int (*execIptablesRestore)(IptablesTarget target, const std::string& commands);
 
 private:
@@ -106,6 +112,13 @@ private:
   FirewallType mFirewallType;
   android::bpf::BpfLevel mUseBpfOwnerMatch;
   std::set<std::string> mIfaceRules;
+  // The UID rules of the chains built by replaceUidChain, as long as all the changes made to
+  // them since have succeeded. Used to only send the changes to iptables.
+  struct UidChain {
+      bool isWhitelist;
+      std::set<int32_t> uids;
+  };
+  std::map<std::string, UidChain> mUidChains;
   int attachChain(const char*, const char*);
   int detachChain(const char*, const char*);
   int createChain(const char*, FirewallType);
@@ -208,6 +208,70 @@ TEST_F(FirewallControllerTest, TestReplaceBlacklistUidRule) {
     EXPECT_EQ(expected, makeUidRules(V4 ,"FW_blackchain", false, uids));
 }
 
+TEST_F(FirewallControllerTest, TestReplaceUidChainChanges) {
+    std::vector<int32_t> uids = { 10023, 10059 };
+    ExpectedIptablesCommands expected = {
+        { V4, makeUidRules(V4, "fw_whitelist", true, uids) },
+        { V6, makeUidRules(V6, "fw_whitelist", true, uids) },
+    };
+    EXPECT_EQ(0, mFw.replaceUidChain("fw_whitelist", true, uids));
+    expectIptablesRestoreCommands(expected);
+
+    // Replacing the chain with the same UIDs changes nothing.
+    std::vector<std::string> noCommands = {};
+    EXPECT_EQ(0, mFw.replaceUidChain("fw_whitelist", true, { 10059, 10023 }));
+    expectIptablesRestoreCommands(noCommands);
+
+    // Only the UIDs that changed are sent, in one transaction.
+    expected = {
+        { V4V6, "*filter\n"
+                "-D fw_whitelist -m owner --uid-owner 10023 -j RETURN\n"
+                "-I fw_whitelist -m owner --uid-owner 10124 -j RETURN\n"
+                "COMMIT\n" }
+    };
+    EXPECT_EQ(0, mFw.replaceUidChain("fw_whitelist", true, { 10059, 10124 }));
+    expectIptablesRestoreCommands(expected);
+
+    // Changing the type of the chain rebuilds it.
+    uids = { 10124 };
+    expected = {
+        { V4, makeUidRules(V4, "fw_whitelist", false, uids) },
+        { V6, makeUidRules(V6, "fw_whitelist", false, uids) },
+    };
+    EXPECT_EQ(0, mFw.replaceUidChain("fw_whitelist", false, uids));
+    expectIptablesRestoreCommands(expected);
+}
+
+TEST_F(FirewallControllerTest, TestSetUidRuleOnKnownChain) {
+    ExpectedIptablesCommands expected = {
+        { V4, makeUidRules(V4, "fw_standby", false, {}) },
+        { V6, makeUidRules(V6, "fw_standby", false, {}) },
+    };
+    EXPECT_EQ(0, createChain("fw_standby", BLACKLIST));
+    expectIptablesRestoreCommands(expected);
+
+    // The UID has no rule yet, so there is nothing to delete.
+    std::vector<std::string> noCommands = {};
+    EXPECT_EQ(0, mFw.setUidRule(STANDBY, 12345, ALLOW));
+    expectIptablesRestoreCommands(noCommands);
+
+    expected = {
+        { V4V6, "*filter\n-A fw_standby -m owner --uid-owner 12345 -j DROP\nCOMMIT\n" }
+    };
+    EXPECT_EQ(0, mFw.setUidRule(STANDBY, 12345, DENY));
+    expectIptablesRestoreCommands(expected);
+
+    // Adding the rule again would add a duplicate rule.
+    EXPECT_EQ(0, mFw.setUidRule(STANDBY, 12345, DENY));
+    expectIptablesRestoreCommands(noCommands);
+
+    expected = {
+        { V4V6, "*filter\n-D fw_standby -m owner --uid-owner 12345 -j DROP\nCOMMIT\n" }
+    };
+    EXPECT_EQ(0, mFw.setUidRule(STANDBY, 12345, ALLOW));
+    expectIptablesRestoreCommands(expected);
+}
+
 TEST_F(FirewallControllerTest, TestEnableChildChains) {
     std::vector<std::string> expected = {
         "*filter\n"